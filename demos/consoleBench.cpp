@@ -0,0 +1,566 @@
+// Benchmarks of the console hot paths.
+//
+// Usage: consoleBench [--headless] [--filter=<substring>] [--samples=<n>]
+//                     [--min-time-ms=<ms>] [--font=<path>] [--out=<file>]
+//
+// Results are written as JSON to standard output, or to the `--out` file, and
+// a human readable summary goes to standard error. `--headless` skips the
+// benchmarks that need a graphics context; they are also skipped, and reported
+// as such, if the context or the font can't be created.
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../include/ConsoleBuffer.hpp"
+#include "../include/ConsoleFormatting.h"
+#include "../include/ConsoleView.hpp"
+#include "../include/FontMetricsCache.hpp"
+#include "../include/QuakeStyleConsole.h"
+#include "../include/RichText.hpp"
+
+namespace {
+
+struct Options {
+  bool headless = false;
+  std::string filter;
+  int samples = 5;
+  std::chrono::milliseconds min_time{100};
+  std::string font_path = "FreeMono.ttf";
+  std::string out_path;
+};
+
+// Result of a single benchmark.
+struct Result {
+  std::string name;
+  // Number of operations in every sample.
+  std::uint64_t iterations = 0;
+  // Median and fastest time of one operation over the samples.
+  double ns_per_op = 0.;
+  double ns_per_op_min = 0.;
+  // Bytes processed by one operation, 0 if not meaningful.
+  std::uint64_t bytes_per_op = 0;
+  // Set if the benchmark didn't run.
+  std::string skipped;
+};
+
+// Keeps results of benchmarked code observable so it isn't optimized out.
+volatile std::size_t g_sink = 0;
+
+// Stream buffer that discards everything written into it.
+class NullBuffer : public std::streambuf {
+ protected:
+  int overflow(int c) override { return traits_type::not_eof(c); }
+  std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+// Console exposing the variable expansion for benchmarking.
+class BenchConsole : public Virtuoso::QuakeStyleConsole {
+ public:
+  using QuakeStyleConsole::dereferenceVariables;
+  using QuakeStyleConsole::ExpansionErrors;
+};
+
+class Bench {
+ public:
+  explicit Bench(const Options& options) : options_(options) {}
+
+  // Checks if a benchmark is selected by the filter.
+  bool Selected(std::string_view name) const {
+    return name.find(options_.filter) != std::string_view::npos;
+  }
+
+  // Measures `op`, calling it as many times as fit into the minimal sample
+  // time, for every sample.
+  void Run(const std::string& name, std::uint64_t bytes_per_op,
+           const std::function<void()>& op) {
+    if (!Selected(name)) {
+      return;
+    }
+    using Clock = std::chrono::steady_clock;
+    const auto run_batch = [&op](std::uint64_t iterations) {
+      const auto start = Clock::now();
+      for (std::uint64_t i = 0; i < iterations; ++i) {
+        op();
+      }
+      return std::chrono::duration<double, std::nano>(Clock::now() - start);
+    };
+
+    // Grows the batch until it takes long enough to be measured reliably.
+    std::uint64_t iterations = 1;
+    for (;;) {
+      const auto elapsed = run_batch(iterations);
+      if (elapsed >= options_.min_time || iterations >= (1ull << 40)) {
+        break;
+      }
+      const double scale =
+          elapsed.count() > 0.
+              ? std::chrono::duration<double, std::nano>(options_.min_time) /
+                    elapsed * 1.2
+              : 100.;
+      iterations = std::max<std::uint64_t>(
+          iterations + 1, static_cast<std::uint64_t>(iterations *
+                                                     std::min(scale, 100.)));
+    }
+
+    std::vector<double> samples;
+    for (int i = 0; i < std::max(options_.samples, 1); ++i) {
+      samples.push_back(run_batch(iterations).count() / iterations);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    Result result;
+    result.name = name;
+    result.iterations = iterations;
+    result.ns_per_op = samples[samples.size() / 2];
+    result.ns_per_op_min = samples.front();
+    result.bytes_per_op = bytes_per_op;
+    Report(result);
+    results_.push_back(std::move(result));
+  }
+
+  // Records a benchmark that can't run.
+  void Skip(const std::string& name, const std::string& reason) {
+    if (!Selected(name)) {
+      return;
+    }
+    Result result;
+    result.name = name;
+    result.skipped = reason;
+    Report(result);
+    results_.push_back(std::move(result));
+  }
+
+  void WriteJson(std::ostream& os) const {
+    os << "{\n  \"context\": {\"headless\": "
+       << (options_.headless ? "true" : "false")
+       << ", \"samples\": " << options_.samples
+       << ", \"min_time_ms\": " << options_.min_time.count()
+       << "},\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results_.size(); ++i) {
+      const Result& r = results_[i];
+      os << (i ? ",\n" : "\n") << "    {\"name\": " << Quoted(r.name);
+      if (!r.skipped.empty()) {
+        os << ", \"skipped\": " << Quoted(r.skipped) << "}";
+        continue;
+      }
+      os << ", \"iterations\": " << r.iterations << std::fixed
+         << std::setprecision(3) << ", \"ns_per_op\": " << r.ns_per_op
+         << ", \"ns_per_op_min\": " << r.ns_per_op_min;
+      if (r.bytes_per_op) {
+        os << ", \"bytes_per_op\": " << r.bytes_per_op
+           << ", \"bytes_per_second\": "
+           << r.bytes_per_op * 1e9 / r.ns_per_op;
+      }
+      os << "}";
+      os.unsetf(std::ios::floatfield);
+    }
+    os << "\n  ]\n}\n";
+  }
+
+ private:
+  static void Report(const Result& r) {
+    std::cerr << std::left << std::setw(44) << r.name << std::right;
+    if (!r.skipped.empty()) {
+      std::cerr << "skipped: " << r.skipped << '\n';
+      return;
+    }
+    std::cerr << std::fixed << std::setprecision(1) << std::setw(14)
+              << r.ns_per_op << " ns/op";
+    if (r.bytes_per_op) {
+      std::cerr << std::setw(12) << r.bytes_per_op * 1e3 / r.ns_per_op
+                << " MB/s";
+    }
+    std::cerr << '\n';
+  }
+
+  static std::string Quoted(std::string_view text) {
+    std::string result = "\"";
+    for (const char c : text) {
+      if (c == '"' || c == '\\') {
+        result += '\\';
+      }
+      result += c;
+    }
+    return result + '"';
+  }
+
+  const Options& options_;
+  std::vector<Result> results_;
+};
+
+// Formatting of the benchmark console output.
+enum class OutputStyle { kPlain, kAnsi, kTrueColor };
+
+// Lines of console output, plain, with ANSI color codes or with 24-bit colors.
+std::string MakeOutput(OutputStyle style) {
+  static constexpr const char* kColors[] = {"\u001b[31m", "\u001b[32m",
+                                            "\u001b[33m", "\u001b[36m"};
+  std::string text;
+  for (int i = 0; i < 64; ++i) {
+    if (style == OutputStyle::kAnsi) {
+      text += kColors[i % 4];
+    } else if (style == OutputStyle::kTrueColor) {
+      text += "\u001b[1;38;2;255;" + std::to_string(i * 4) + ";0;48;5;" +
+              std::to_string(232 + i % 24) + "m";
+    }
+    text += "player ";
+    text += std::to_string(i);
+    if (style != OutputStyle::kPlain) {
+      text += "\u001b[0m";
+    }
+    text += " took 25 damage from the environment at x=" +
+            std::to_string(i * 3) + " y=17\n";
+  }
+  return text;
+}
+
+void BenchConsoleBuffer(Bench& bench) {
+  const std::pair<OutputStyle, const char*> kStyles[] = {
+      {OutputStyle::kPlain, "ConsoleBuffer.append.plain"},
+      {OutputStyle::kAnsi, "ConsoleBuffer.append.ansi"},
+      {OutputStyle::kTrueColor, "ConsoleBuffer.append.truecolor"}};
+  for (const auto& [style, name] : kStyles) {
+    const std::string text = MakeOutput(style);
+    sfe::ConsoleBuffer buffer;
+    buffer.SetMaxLines(10000);
+    std::ostream os(&buffer);
+    bench.Run(name, text.size(), [&] {
+      os.write(text.data(), static_cast<std::streamsize>(text.size()));
+      g_sink = buffer.GetBytesCount();
+    });
+  }
+}
+
+void BenchCommandExecute(Bench& bench, std::ostream& null_stream) {
+  Virtuoso::QuakeStyleConsole console;
+  int total = 0;
+  console.bindCommand("noArgs", [&total]() { ++total; });
+  console.bindCommand("oneArg", [&total](int a) { total += a; });
+  console.bindCommand("manyArgs", [&total](int a, float b, std::string c,
+                                           int d, double e) {
+    total += a + static_cast<int>(b + e) + d + static_cast<int>(c.size());
+  });
+
+  bench.Run("commandExecute.args0", 0,
+            [&] { console.commandExecute("noArgs", null_stream); });
+  bench.Run("commandExecute.args1", 0,
+            [&] { console.commandExecute("oneArg 42", null_stream); });
+  bench.Run("commandExecute.args5", 0, [&] {
+    console.commandExecute("manyArgs 1 2.5 word 4 5.25", null_stream);
+  });
+  bench.Run("commandExecute.unknown", 0,
+            [&] { console.commandExecute("noSuchCommand 1 2", null_stream); });
+  g_sink = total;
+}
+
+int g_startup_value = 0;
+void StartupCommand(int a) { g_startup_value += a; }
+
+// Startup registration of many commands and cvars, one at a time and as a
+// static table.
+void BenchRegistration(Bench& bench) {
+  constexpr int kCount = 2000;
+  std::vector<std::string> names;
+  std::vector<int> values(kCount);
+  for (int i = 0; i < kCount; ++i) {
+    names.push_back("cmd" + std::to_string(i));
+  }
+  // Static tables normally come from compile time, built at run time here
+  // only to get distinct names.
+  std::vector<Virtuoso::QuakeStyleConsole::CommandSpec> commands;
+  std::vector<Virtuoso::QuakeStyleConsole::CVarSpec> cvars;
+  for (int i = 0; i < kCount; ++i) {
+    commands.push_back(
+        Virtuoso::QuakeStyleConsole::staticCommand<&StartupCommand>(
+            names[i], "adds a number"));
+    cvars.push_back(Virtuoso::QuakeStyleConsole::staticCVar<g_startup_value>(
+        names[i], "a number"));
+  }
+
+  bench.Run("registration.bind2k", 0, [&] {
+    Virtuoso::QuakeStyleConsole console(0, false);
+    for (int i = 0; i < kCount; ++i) {
+      console.bindCommand(names[i], &StartupCommand, "adds a number");
+      console.bindCVar(names[i], values[i], "a number");
+    }
+    g_sink = console.getCommandTable().size();
+  });
+  bench.Run("registration.static2k", 0, [&] {
+    Virtuoso::QuakeStyleConsole console(0, false);
+    console.registerStatic(commands, cvars);
+    g_sink = console.getCommandTable().size();
+  });
+}
+
+void BenchDereference(Bench& bench) {
+  BenchConsole console;
+  int health = 100;
+  float speed = 3.5F;
+  std::string name = "player";
+  console.bindCVar("health", health);
+  console.bindCVar("speed", speed);
+  console.bindCVar("name", name);
+
+  const std::string line =
+      "echo $name has $health health and $speed speed, $name at $health";
+  std::string out;
+  BenchConsole::ExpansionErrors errors;
+  bench.Run("dereferenceVariables.refs5", line.size(), [&] {
+    console.dereferenceVariables(line, out, errors);
+    g_sink = out.size();
+  });
+}
+
+void BenchAutocomplete(Bench& bench) {
+  constexpr int kCVarCount = 10000;
+  std::vector<int> values(kCVarCount);
+  std::vector<std::string> names;
+  static constexpr const char* kPrefixes[] = {"r_", "sv_", "cl_", "snd_",
+                                              "net_"};
+  for (int i = 0; i < kCVarCount; ++i) {
+    names.push_back(std::string(kPrefixes[i % 5]) + "var" + std::to_string(i));
+  }
+
+  bench.Run("autocomplete.bind10k", 0, [&] {
+    Virtuoso::QuakeStyleConsole console(0, false);
+    for (int i = 0; i < kCVarCount; ++i) {
+      console.bindCVar(names[i], values[i]);
+    }
+    g_sink = console.getCVarIndex().size();
+  });
+
+  Virtuoso::QuakeStyleConsole console;
+  for (int i = 0; i < kCVarCount; ++i) {
+    console.bindCVar(names[i], values[i]);
+  }
+  std::vector<std::string> candidates;
+  // Collects candidates the way a frontend completes a partial word.
+  const auto complete = [&](std::string_view prefix) {
+    candidates.clear();
+    for (const auto* index :
+         {&console.getCommandIndex(), &console.getCVarIndex()}) {
+      const auto range = index->findPrefix(prefix);
+      candidates.insert(candidates.end(), range.first, range.second);
+    }
+    g_sink = candidates.size();
+  };
+  bench.Run("autocomplete.10k.wide", 0, [&] { complete("r_var1"); });
+  bench.Run("autocomplete.10k.narrow", 0, [&] { complete("sv_var123"); });
+  bench.Run("autocomplete.10k.none", 0, [&] { complete("zzz"); });
+}
+
+void BenchRegexFormatter(Bench& bench) {
+  namespace io = Virtuoso::io;
+  static const std::string kTypes[] = {"float", "vec2", "vec3", "vec4",
+                                       "mat4",  "int",  "bool", "sampler2D"};
+  static const std::string kKeywords[] = {"if",     "else",  "for",
+                                          "return", "while", "uniform",
+                                          "in",     "out"};
+  io::RegexFormatter formatter;
+  formatter.rules.push_back(
+      io::makeKeywordsRule(kTypes, std::size(kTypes),
+                           io::ANSI_TEXT_COLOR_CYAN));
+  formatter.rules.push_back(
+      io::makeKeywordsRule(kKeywords, std::size(kKeywords),
+                           io::ANSI_TEXT_COLOR_BLUE));
+  {
+    io::RegexFormatter::Rule comment;
+    comment.rule = std::regex("//.*");
+    comment.before = io::ANSI_TEXT_COLOR_RED;
+    comment.after = io::ANSI_TEXT_COLOR_RESET;
+    formatter.rules.push_back(comment);
+  }
+
+  std::string source;
+  for (int i = 0; i < 32; ++i) {
+    source +=
+        "uniform mat4 transform; // model to clip space\n"
+        "in vec3 position;\n"
+        "out vec4 color;\n"
+        "float shade(vec3 n) { if (n.z > 0.0) return n.z; else return 0.0; }"
+        "\n";
+  }
+
+  std::string out;
+  bench.Run("RegexFormatter.format", source.size(), [&] {
+    out.clear();
+    formatter.format(source, out);
+    g_sink = out.size();
+  });
+}
+
+void BenchRendering(Bench& bench, const Options& options) {
+  static constexpr const char* kNames[] = {
+      "textWidth.sfText",    "textWidth.metrics",
+      "textWidth.monospace", "RichText.rebuild",
+      "RichText.rebuild.metrics", "RichText.draw",
+      "ConsoleView.rebuild", "ConsoleView.rebuild.monospace",
+      "ConsoleView.rebuild.wrap", "ConsoleView.draw"};
+  const auto skip_all = [&bench](const std::string& reason) {
+    for (const char* name : kNames) {
+      bench.Skip(name, reason);
+    }
+  };
+
+  if (options.headless) {
+    skip_all("headless");
+    return;
+  }
+  sf::Font font;
+  if (!font.loadFromFile(options.font_path)) {
+    skip_all("unable to load font " + options.font_path);
+    return;
+  }
+  sf::RenderTexture target;
+  if (!target.create({1280u, 720u})) {
+    skip_all("unable to create render texture");
+    return;
+  }
+
+  // Measuring autocomplete options, as PrintOptions does.
+  const std::string word = "sv_max_players_per_team  ";
+  bench.Run("textWidth.sfText", word.size(), [&] {
+    const sf::Text text(font, word, 30);
+    g_sink = static_cast<std::uint64_t>(text.getGlobalBounds().width);
+  });
+  sfe::FontMetricsCache metrics;
+  metrics.SetFont(font);
+  bench.Run("textWidth.metrics", word.size(), [&] {
+    g_sink = static_cast<std::uint64_t>(metrics.GetTextWidth(word, 30));
+  });
+  sfe::FontMetricsCache mono_metrics;
+  mono_metrics.SetFont(font);
+  mono_metrics.SetMonospace(true);
+  bench.Run("textWidth.monospace", word.size(), [&] {
+    g_sink = static_cast<std::uint64_t>(mono_metrics.GetTextWidth(word, 30));
+  });
+
+  constexpr int kVisibleLines = 40;
+  const auto rebuild = [&font](sfe::RichText& text) {
+    text.clear();
+    text.setFont(font);
+    for (int i = 0; i < kVisibleLines; ++i) {
+      text << sf::Color::Green << "> " << sf::Color::White << "player "
+           << std::to_string(i) << sf::Color::Red << " took 25 damage\n";
+    }
+  };
+  // Finishes rendering, so the GPU work is part of the measurement.
+  const auto present = [&target] {
+    target.display();
+    g_sink = target.getSize().x;
+  };
+
+  sfe::RichText text(font);
+  bench.Run("RichText.rebuild", 0, [&] { rebuild(text); });
+  sfe::RichText metrics_text(font);
+  metrics_text.setFontMetrics(&metrics);
+  bench.Run("RichText.rebuild.metrics", 0, [&] { rebuild(metrics_text); });
+  rebuild(text);
+  bench.Run("RichText.draw", 0, [&] {
+    target.clear();
+    target.draw(text);
+    present();
+  });
+
+  sfe::ConsoleBuffer buffer;
+  {
+    std::ostream os(&buffer);
+    os << MakeOutput(OutputStyle::kAnsi);
+  }
+  sfe::ConsoleView view;
+  view.SetFontMetrics(metrics);
+  bench.Run("ConsoleView.rebuild", 0, [&] {
+    view.clear();
+    view.Update(buffer, 0, kVisibleLines);
+  });
+  sfe::ConsoleView mono_view;
+  mono_view.SetFontMetrics(mono_metrics);
+  bench.Run("ConsoleView.rebuild.monospace", 0, [&] {
+    mono_view.clear();
+    mono_view.Update(buffer, 0, kVisibleLines);
+  });
+  // Narrow enough for every line to take a few rows; rewrapping is part of
+  // the measurement, as after a resize.
+  sfe::ConsoleView wrap_view;
+  wrap_view.SetFontMetrics(metrics);
+  bench.Run("ConsoleView.rebuild.wrap", 0, [&] {
+    wrap_view.SetWrapWidth(0.F);
+    wrap_view.SetWrapWidth(200.F);
+    wrap_view.Update(buffer, 0, kVisibleLines, 0, kVisibleLines);
+  });
+  view.Update(buffer, 0, kVisibleLines);
+  bench.Run("ConsoleView.draw", 0, [&] {
+    target.clear();
+    target.draw(view);
+    present();
+  });
+}
+
+// Parses the command line, returns false on unknown arguments.
+bool ParseOptions(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    const auto value = [&arg](std::string_view flag) {
+      return arg.substr(flag.size());
+    };
+    if (arg == "--headless") {
+      options.headless = true;
+    } else if (arg.starts_with("--filter=")) {
+      options.filter = value("--filter=");
+    } else if (arg.starts_with("--samples=")) {
+      options.samples = std::stoi(std::string(value("--samples=")));
+    } else if (arg.starts_with("--min-time-ms=")) {
+      options.min_time = std::chrono::milliseconds(
+          std::stoi(std::string(value("--min-time-ms="))));
+    } else if (arg.starts_with("--font=")) {
+      options.font_path = value("--font=");
+    } else if (arg.starts_with("--out=")) {
+      options.out_path = value("--out=");
+    } else {
+      std::cerr << "unknown argument " << arg << "\nusage: " << argv[0]
+                << " [--headless] [--filter=<substring>] [--samples=<n>]"
+                   " [--min-time-ms=<ms>] [--font=<path>] [--out=<file>]\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, options)) {
+    return 1;
+  }
+
+  NullBuffer null_buffer;
+  std::ostream null_stream(&null_buffer);
+
+  Bench bench(options);
+  BenchConsoleBuffer(bench);
+  BenchCommandExecute(bench, null_stream);
+  BenchRegistration(bench);
+  BenchDereference(bench);
+  BenchAutocomplete(bench);
+  BenchRegexFormatter(bench);
+  BenchRendering(bench, options);
+
+  if (options.out_path.empty()) {
+    bench.WriteJson(std::cout);
+  } else {
+    std::ofstream out(options.out_path);
+    bench.WriteJson(out);
+  }
+  return 0;
+}
@@ -0,0 +1,469 @@
+// Self checks of console code paths that are hard to reach interactively,
+// such as crash recovery of the history journal, and of fast paths against
+// the straightforward code they replace.
+//
+// Usage: consoleCheck [--filter=<substring>]
+//
+// Every check prints one line to standard output; the exit code is 1 if any
+// of them failed.
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../include/ConsoleFormatting.h"
+#include "../include/QuakeStyleConsole.h"
+
+namespace {
+
+namespace fs = std::filesystem;
+
+// Runs the checks and collects their failures.
+class Checker {
+ public:
+  explicit Checker(std::string filter) : filter_(std::move(filter)) {}
+
+  // Runs check unless it's filtered out. The check reports problems through
+  // Expect().
+  void Run(std::string_view name, const std::function<void()>& check) {
+    if (name.find(filter_) == std::string_view::npos) {
+      return;
+    }
+    failures_.clear();
+    check();
+    std::cout << (failures_.empty() ? "ok      " : "FAILED  ") << name << '\n';
+    for (const std::string& failure : failures_) {
+      std::cout << "    " << failure << '\n';
+    }
+    failed_ += !failures_.empty();
+  }
+
+  void Expect(bool condition, std::string_view what) {
+    if (!condition) {
+      failures_.emplace_back(what);
+    }
+  }
+
+  int failed() const { return failed_; }
+
+ private:
+  std::string filter_;
+  std::vector<std::string> failures_;
+  int failed_ = 0;
+};
+
+// Empty directory that is removed with everything in it.
+class ScratchDir {
+ public:
+  explicit ScratchDir(std::string_view name)
+      : path_(fs::temp_directory_path() / ("consoleCheck-" + std::string(name))) {
+    fs::remove_all(path_);
+    fs::create_directories(path_);
+  }
+  ~ScratchDir() {
+    std::error_code ignored;
+    fs::remove_all(path_, ignored);
+  }
+
+  ScratchDir(const ScratchDir&) = delete;
+  ScratchDir& operator=(const ScratchDir&) = delete;
+
+  std::string File(std::string_view name) const {
+    return (path_ / name).string();
+  }
+  std::size_t EntryCount() const {
+    return static_cast<std::size_t>(std::distance(
+        fs::directory_iterator(path_), fs::directory_iterator()));
+  }
+
+ private:
+  fs::path path_;
+};
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+void WriteFile(const std::string& path, std::string_view data) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+std::vector<std::string> Lines(const Virtuoso::HistoryBuffer& history) {
+  std::vector<std::string> lines;
+  for (std::size_t i = 0; i < history.size(); ++i) {
+    lines.push_back(history[i]);
+  }
+  return lines;
+}
+
+// The journal holding exactly the lines of history.
+std::string JournalOf(const Virtuoso::HistoryBuffer& history) {
+  std::ostringstream out;
+  Virtuoso::HistoryJournal::write(out, history);
+  return out.str();
+}
+
+std::size_t RecordSize(std::string_view line) {
+  return Virtuoso::HistoryJournal::recordOverhead + line.size();
+}
+
+// Records lines the way QuakeStyleConsole does: into history, then the
+// journal.
+bool Record(Virtuoso::HistoryJournal& journal,
+            Virtuoso::HistoryBuffer& history,
+            const std::vector<std::string>& lines) {
+  bool ok = true;
+  for (const std::string& line : lines) {
+    history.push(line);
+    ok &= journal.append(line, history);
+  }
+  return ok;
+}
+
+Virtuoso::HistoryJournalOptions NoCompaction() {
+  Virtuoso::HistoryJournalOptions options;
+  options.sync = Virtuoso::HistorySyncPolicy::Never;
+  options.compactionRatio = 0;
+  return options;
+}
+
+const std::vector<std::string> kCommands = {
+    "map e1m1", "set r_gamma 2.2", "echo hello", "map e1m2", "stats",
+    "set r_gamma 1.8", "echo hello", "help set", "map e1m3", "stats reset"};
+
+// Distinct commands, newest occurrence last: what the window should hold.
+const std::vector<std::string> kWindow = {
+    "map e1m1", "set r_gamma 2.2", "map e1m2",  "stats",      "set r_gamma 1.8",
+    "echo hello", "help set",      "map e1m3",  "stats reset"};
+
+void CheckJournalRoundTrip(Checker& check) {
+  ScratchDir dir("roundtrip");
+  const std::string path = dir.File("history.bin");
+  {
+    Virtuoso::HistoryBuffer history(16);
+    Virtuoso::HistoryJournal journal;
+    check.Expect(journal.open(path, history, NoCompaction()), "open new");
+    check.Expect(Record(journal, history, kCommands), "append");
+  }
+  Virtuoso::HistoryBuffer history(16);
+  Virtuoso::HistoryJournal journal;
+  check.Expect(journal.open(path, history, NoCompaction()), "reopen");
+  check.Expect(Lines(history) == kWindow, "window after reopen");
+
+  // only the newest lines that fit are loaded, without older repeats
+  Virtuoso::HistoryBuffer small(3);
+  check.Expect(Virtuoso::HistoryJournal::load(ReadFile(path), small),
+               "load into a small window");
+  check.Expect(Lines(small) == std::vector<std::string>(kWindow.end() - 3,
+                                                        kWindow.end()),
+               "small window holds the newest lines");
+}
+
+// A crash in the middle of an append leaves part of the last record; it has
+// to be cut off, and records appended later have to follow the intact ones.
+void CheckJournalTornTail(Checker& check) {
+  ScratchDir dir("torn");
+  const std::string path = dir.File("history.bin");
+  std::size_t intact_size = 0;
+  {
+    Virtuoso::HistoryBuffer history(16);
+    Virtuoso::HistoryJournal journal;
+    check.Expect(journal.open(path, history, NoCompaction()), "open new");
+    check.Expect(Record(journal, history, kCommands), "append");
+    intact_size = journal.size();
+  }
+  check.Expect(fs::file_size(path) == intact_size, "size before the crash");
+
+  const std::string torn = "set sv_cheats 1";
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    std::string record;
+    Virtuoso::HistoryBuffer one(1);
+    one.push(torn);
+    record = JournalOf(one).substr(Virtuoso::HistoryJournal::magic.size());
+    out.write(record.data(), static_cast<std::streamsize>(record.size() / 2));
+  }
+
+  Virtuoso::HistoryBuffer history(16);
+  Virtuoso::HistoryJournal journal;
+  check.Expect(journal.open(path, history, NoCompaction()), "reopen torn");
+  check.Expect(Lines(history) == kWindow, "torn record dropped");
+  check.Expect(journal.size() == intact_size, "journal size after recovery");
+  check.Expect(fs::file_size(path) == intact_size, "file truncated");
+
+  check.Expect(Record(journal, history, {"quit"}), "append after recovery");
+  journal.close();
+  const std::string data = ReadFile(path);
+  check.Expect(data.size() == intact_size + RecordSize("quit"),
+               "record appended after the intact ones");
+
+  Virtuoso::HistoryBuffer reloaded(16);
+  std::size_t valid_size = 0;
+  check.Expect(Virtuoso::HistoryJournal::load(data, reloaded, &valid_size),
+               "reload");
+  check.Expect(valid_size == data.size(), "every record intact");
+  std::vector<std::string> expected = kWindow;
+  expected.push_back("quit");
+  check.Expect(Lines(reloaded) == expected, "window after reload");
+}
+
+// A record with the right length but damaged contents fails its checksum and
+// is dropped like a torn one.
+void CheckJournalChecksum(Checker& check) {
+  ScratchDir dir("checksum");
+  const std::string path = dir.File("history.bin");
+  {
+    Virtuoso::HistoryBuffer history(16);
+    Virtuoso::HistoryJournal journal;
+    check.Expect(journal.open(path, history, NoCompaction()), "open new");
+    check.Expect(Record(journal, history, kCommands), "append");
+  }
+
+  std::string data = ReadFile(path);
+  const std::size_t last_size = RecordSize(kCommands.back());
+  data[data.size() - last_size + 8] ^= 0x20;
+  WriteFile(path, data);
+
+  Virtuoso::HistoryBuffer history(16);
+  Virtuoso::HistoryJournal journal;
+  check.Expect(journal.open(path, history, NoCompaction()), "reopen");
+  std::vector<std::string> expected(kWindow.begin(), kWindow.end() - 1);
+  check.Expect(Lines(history) == expected, "damaged record dropped");
+  check.Expect(journal.size() == data.size() - last_size,
+               "journal cut before the damaged record");
+  check.Expect(fs::file_size(path) == data.size() - last_size,
+               "file truncated");
+}
+
+// Appending grows the journal until it's compactionRatio times the size of
+// the window, then it's rewritten with only the window through a temporary
+// file.
+void CheckJournalCompaction(Checker& check) {
+  ScratchDir dir("compaction");
+  const std::string path = dir.File("history.bin");
+
+  Virtuoso::HistoryJournalOptions options = NoCompaction();
+  options.compactionRatio = 2;
+  Virtuoso::HistoryBuffer history(4);
+  Virtuoso::HistoryJournal journal;
+  check.Expect(journal.open(path, history, options), "open new");
+
+  // the window is tiny, so compaction starts at the minimum size of 4 KiB
+  std::size_t compactions = 0;
+  for (int i = 0; i < 400; ++i) {
+    const std::string line = "echo " + std::to_string(i % 6) +
+                             std::string(40, 'x');
+    const std::size_t before = journal.size();
+    history.push(line);
+    check.Expect(journal.append(line, history), "append");
+    if (journal.size() < before + RecordSize(line)) {
+      ++compactions;
+      check.Expect(ReadFile(path) == JournalOf(history),
+                   "compacted journal holds exactly the window");
+    }
+    check.Expect(journal.size() <= 2 * 4096 + RecordSize(line),
+                 "journal stays within the compaction ratio");
+  }
+  check.Expect(compactions > 0, "journal was compacted");
+  check.Expect(fs::file_size(path) == journal.size(), "size matches the file");
+  check.Expect(dir.EntryCount() == 1, "no temporary file left behind");
+
+  journal.close();
+  Virtuoso::HistoryBuffer reloaded(4);
+  check.Expect(journal.open(path, reloaded, options), "reopen");
+  check.Expect(Lines(reloaded) == Lines(history), "window after reopen");
+
+  // a journal that grew too large while compaction was off is compacted
+  // when it's opened
+  journal.close();
+  {
+    Virtuoso::HistoryBuffer grown(4);
+    Virtuoso::HistoryJournal uncompacted;
+    check.Expect(uncompacted.open(path, grown, NoCompaction()), "open");
+    for (int i = 0; i < 400; ++i) {
+      grown.push("echo " + std::to_string(i % 6) + std::string(40, 'x'));
+      uncompacted.append(grown.back(), grown);
+    }
+  }
+  Virtuoso::HistoryBuffer opened(4);
+  check.Expect(journal.open(path, opened, options), "reopen large");
+  check.Expect(ReadFile(path) == JournalOf(opened), "compacted when opened");
+}
+
+// Text history files of older versions are imported and rewritten as a
+// journal.
+void CheckJournalTextMigration(Checker& check) {
+  ScratchDir dir("migration");
+  const std::string path = dir.File("history.txt");
+  WriteFile(path, "map e1m1\r\nstats\n\nmap e1m1\nhelp set");
+
+  Virtuoso::HistoryBuffer history(16);
+  Virtuoso::HistoryJournal journal;
+  check.Expect(journal.open(path, history, NoCompaction()), "open text");
+  check.Expect(Lines(history) ==
+                   std::vector<std::string>{"stats", "map e1m1", "help set"},
+               "text lines imported");
+  check.Expect(ReadFile(path) == JournalOf(history), "rewritten as a journal");
+  check.Expect(dir.EntryCount() == 1, "no temporary file left behind");
+}
+
+// Escapes text so it can be shown in a failure message.
+std::string Printable(std::string_view text) {
+  std::string out;
+  for (const char c : text) {
+    const unsigned char byte = static_cast<unsigned char>(c);
+    if (byte < 0x20 || byte >= 0x7f) {
+      const char* digits = "0123456789abcdef";
+      out += "\\x";
+      out += digits[byte >> 4];
+      out += digits[byte & 15];
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+// Keyword rules go through KeywordMatcher instead of std::regex; formatting
+// has to match the \bkeyword\b regex rules they replace exactly. Random rule
+// sets mix keyword rules, with and without filters, and a plain regex rule;
+// keywords overlap and prefix each other and contain the characters around
+// word boundaries.
+void CheckKeywordsMatchRegex(Checker& check) {
+  // no regex syntax, so makeKeywordsRegexStr needs no escaping
+  constexpr std::string_view kKeywordChars = "ab_1-= ";
+  constexpr std::string_view kTextChars = "ab_1-= .\t\xc3";
+
+  std::mt19937 random(20241026);
+  const auto pick = [&random](std::size_t n) {
+    return std::uniform_int_distribution<std::size_t>(0, n - 1)(random);
+  };
+  const auto make_string = [&](std::string_view chars, std::size_t max_length) {
+    std::string text(pick(max_length + 1), ' ');
+    for (char& c : text) {
+      c = chars[pick(chars.size())];
+    }
+    return text;
+  };
+
+  int mismatches = 0;
+  for (int round = 0; round < 4000 && mismatches < 5; ++round) {
+    Virtuoso::io::RegexFormatter keywords;
+    Virtuoso::io::RegexFormatter regexes;
+    std::string rule_set;  // readable description for failure messages
+
+    const std::size_t rule_count = 1 + pick(4);
+    for (std::size_t r = 0; r < rule_count; ++r) {
+      const std::string format = "<" + std::to_string(r) + ">";
+      if (pick(5) == 0) {
+        Virtuoso::io::RegexFormatter::Rule rule;
+        rule.rule = std::regex("[1=]+");
+        rule.before = format;
+        rule.after = "</>";
+        keywords.rules.push_back(rule);
+        regexes.rules.push_back(rule);
+        rule_set += " [1=]+";
+        continue;
+      }
+
+      // an occasional empty keyword has to be ignored by both
+      std::vector<std::string> words(1 + pick(5));
+      for (std::string& word : words) {
+        word = make_string(kKeywordChars, 4);
+      }
+      if (pick(4) == 0) {
+        words.push_back(words[pick(words.size())] + "b");
+      }
+
+      Virtuoso::io::RegexFormatter::Rule keyword_rule =
+          Virtuoso::io::makeKeywordsRule(words.data(), words.size(), format);
+      Virtuoso::io::RegexFormatter::Rule regex_rule = keyword_rule;
+      regex_rule.keywords.clear();
+      regex_rule.rule = std::regex(
+          Virtuoso::io::makeKeywordsRegexStr(words.data(), words.size()));
+
+      switch (pick(3)) {
+        case 0:
+          break;
+        case 1:
+          keyword_rule.filter = regex_rule.filter =
+              [format](const std::string& s) { return format + s + "|"; };
+          break;
+        case 2:
+          // a filter may remove the match altogether
+          keyword_rule.filter = regex_rule.filter = [](const std::string&) {
+            return std::string();
+          };
+          break;
+      }
+      rule_set += " {";
+      for (const std::string& word : words) {
+        rule_set += " \"" + Printable(word) + "\"";
+      }
+      rule_set += regex_rule.filter ? " filtered }" : " }";
+      keywords.rules.push_back(std::move(keyword_rule));
+      regexes.rules.push_back(std::move(regex_rule));
+    }
+
+    for (int t = 0; t < 8; ++t) {
+      const std::string text = make_string(kTextChars, 24);
+      const std::string expected = regexes.format(text);
+      const std::string actual = keywords.format(text);
+      if (actual != expected) {
+        ++mismatches;
+        check.Expect(false, "\"" + Printable(text) + "\": keywords give \"" +
+                                Printable(actual) + "\", regex gives \"" +
+                                Printable(expected) + "\" with rules" +
+                                rule_set);
+      }
+    }
+  }
+}
+
+// Parses the command line, returns false on unknown arguments.
+bool ParseOptions(int argc, char** argv, std::string& filter) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg.starts_with("--filter=")) {
+      filter = arg.substr(std::string_view("--filter=").size());
+    } else {
+      std::cerr << "unknown argument " << arg << "\nusage: " << argv[0]
+                << " [--filter=<substring>]\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string filter;
+  if (!ParseOptions(argc, argv, filter)) {
+    return 1;
+  }
+
+  Checker check(filter);
+  check.Run("HistoryJournal.roundTrip", [&] { CheckJournalRoundTrip(check); });
+  check.Run("HistoryJournal.tornTail", [&] { CheckJournalTornTail(check); });
+  check.Run("HistoryJournal.checksum", [&] { CheckJournalChecksum(check); });
+  check.Run("HistoryJournal.compaction",
+            [&] { CheckJournalCompaction(check); });
+  check.Run("HistoryJournal.textMigration",
+            [&] { CheckJournalTextMigration(check); });
+  check.Run("RegexFormatter.keywordsMatchRegex",
+            [&] { CheckKeywordsMatchRegex(check); });
+
+  return check.failed() ? 1 : 0;
+}
@@ -49,54 +49,40 @@ extern const std::size_t glsl_functions_length;
 
 void makeGLSLRules(Virtuoso::io::RegexFormatter::RuleSet& rules)
 {
+    rules.push_back(Virtuoso::io::makeKeywordsRule(glsl_types, glsl_types_length, TEXT_COLOR_CYAN));
+
     {
         Virtuoso::io::RegexFormatter::Rule r;
-        r.rule = std::regex(Virtuoso::io::makeKeywordsRegexStr(glsl_types, glsl_types_length));
-        r.filter = std::bind(Virtuoso::io::highlightKeyword,  std::string(TEXT_COLOR_CYAN), std::placeholders::_1);
+        r.rule = std::regex("\\/\\/.*");
+        r.before = TEXT_COLOR_RED;
+        r.after = TEXT_COLOR_RESET;
         rules.push_back(r);
     }
 
-    {
-           Virtuoso::io::RegexFormatter::Rule r;
-           r.rule = std::regex("\\/\\/.*");
-        r.filter = std::bind(Virtuoso::io::highlightKeyword,   std::string(TEXT_COLOR_RED), std::placeholders::_1);
-           rules.push_back(r);
-    }
-
     {// c-style comment
         Virtuoso::io::RegexFormatter::Rule r;
         r.rule = std::regex("(/\\*([^*]|(\\*+[^*/]))*\\*+/)|(//.*)");
-        r.filter = std::bind(Virtuoso::io::highlightKeyword,   std::string(TEXT_COLOR_RED), std::placeholders::_1);
+        r.before = TEXT_COLOR_RED;
+        r.after = TEXT_COLOR_RESET;
         rules.push_back(r);
     }
 
-    {
-        Virtuoso::io::RegexFormatter::Rule r;
-        r.rule = std::regex(Virtuoso::io::makeKeywordsRegexStr(glsl_keywords, glsl_keywords_length));
-        r.filter = std::bind(Virtuoso::io::highlightKeyword,   std::string(TEXT_COLOR_BLUE), std::placeholders::_1);
-        rules.push_back(r);
-    }
+    rules.push_back(Virtuoso::io::makeKeywordsRule(glsl_keywords, glsl_keywords_length, TEXT_COLOR_BLUE));
 
-    {
-        Virtuoso::io::RegexFormatter::Rule r;
-        r.rule = std::regex(Virtuoso::io::makeKeywordsRegexStr(glsl_functions, glsl_functions_length));
-        r.filter = std::bind(Virtuoso::io::highlightKeyword,   std::string(TEXT_COLOR_MAGENTA), std::placeholders::_1);
-        rules.push_back(r);
-    }
+    rules.push_back(Virtuoso::io::makeKeywordsRule(glsl_functions, glsl_functions_length, TEXT_COLOR_MAGENTA));
 
-    {
-        Virtuoso::io::RegexFormatter::Rule r;
-        r.rule = std::regex(Virtuoso::io::makeKeywordsRegexStr(glsl_qualifiers, glsl_qualifiers_length));
-        r.filter = std::bind(Virtuoso::io::highlightKeyword,   std::string(TEXT_COLOR_YELLOW), std::placeholders::_1);
-        rules.push_back(r);
-    }
+    rules.push_back(Virtuoso::io::makeKeywordsRule(glsl_qualifiers, glsl_qualifiers_length, TEXT_COLOR_YELLOW));
 }
 
 
 std::string formatGLSL(const std::string& glsl)
 {
-    Virtuoso::io::RegexFormatter rx;
-    makeGLSLRules(rx.rules);
+    // the rules are compiled once and reused for every call
+    static Virtuoso::io::RegexFormatter rx = [] {
+        Virtuoso::io::RegexFormatter formatter;
+        makeGLSLRules(formatter.rules);
+        return formatter;
+    }();
     return rx.format(glsl);
 }
 
@@ -136,7 +122,7 @@ struct ConsoleApplication : public GLFWApplication
         ms << TEXT_COLOR_RED << "\nRED TEXT\n";
         ms << TEXT_COLOR_RED_BRIGHT << "BRIGHT RED TEXT " << std::endl;
         
-        ms << TEXT_COLOR_GREEN_BRIGHT;
+        ms << TEXT_COLOR_GREEN_BRIGHT << std::flush;
         
         ImGuiContext* ctx = ImGui::CreateContext();
         ImGui::SetCurrentContext(ctx);
@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "../include/ConsoleServer.hpp"
+
+// Headless console: connect with `nc 127.0.0.1 27960` or
+// `nc -U console.sock` and type commands.
+
+namespace {
+
+std::atomic<bool> running = true;
+
+void Stop(int) { running = false; }
+
+}  // namespace
+
+int main() {
+  std::signal(SIGINT, Stop);
+  std::signal(SIGTERM, Stop);
+
+  Virtuoso::QuakeStyleConsole console;
+
+  int tick = 0;
+  int tickRate = 20;
+  std::string mapName = "e1m1";
+  console.bindCVar("tickRate", tickRate, "Simulation ticks per second");
+  console.bindCVar("mapName", mapName, "Name of the running map");
+
+  console.bindCommand(
+      "status",
+      [&](std::istream&, std::ostream& os) {
+        os << "\u001b[32m" << "map " << mapName << ", tick " << tick
+           << "\u001b[0m" << std::endl;
+      },
+      "Print the server state");
+  console.bindCommand(
+      "quit", [] { running = false; }, "Stop the server");
+
+  sfe::ConsoleServerOptions options;
+  options.greeting = "Connected to the server console, try 'help'.\n";
+  sfe::ConsoleServer server(console, options);
+
+  std::string error;
+  if (!server.ListenTcp("127.0.0.1", 27960, &error)) {
+    std::cerr << "TCP: " << error << std::endl;
+  }
+  if (!server.ListenUnix("console.sock", &error)) {
+    std::cerr << "Unix socket: " << error << std::endl;
+  }
+  std::cout << "Listening on 127.0.0.1:" << server.GetTcpPort()
+            << " and console.sock" << std::endl;
+
+  auto next_tick = std::chrono::steady_clock::now();
+  while (running) {
+    ++tick;
+    console.runTasks();
+    server.Pump();
+
+    next_tick += std::chrono::milliseconds(1000 / std::max(tickRate, 1));
+    std::this_thread::sleep_until(next_tick);
+  }
+
+  console.cancelTasks();
+  server.Close();
+}
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <string>
 
+#include "../include/AsyncFileSink.hpp"
 #include "../include/SFMLInGameConsole.hpp"
 
 struct MyStruct {
@@ -28,11 +29,19 @@ int main() {
   const bool loaded = font.loadFromFile("FreeMono.ttf");
   assert(loaded && "Unable to load font FreeMono.ttf");
 
+  // Plain text copy of the console output, written on a background thread.
+  sfe::AsyncFileSink console_log("console.log");
+
   sfe::SFMLInGameConsole console(font, 100, true);
+  console.AddStream(console_log);
+  // Commands typed in earlier runs, saved as they are executed.
+  console.openHistoryJournal("console_history.bin");
   console.show(true);
   console.SetTextLeftOffset(0.F);
   console.SetMaxInputLineSymbols(30);
   console.SetConsoleHeightPart(0.7);
+  // FreeMono is monospace, so text is laid out without per glyph widths.
+  console.SetMonospace(true);
 
   int varInt = 1;
   std::string varStr = "string";
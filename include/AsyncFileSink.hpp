@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+namespace sfe {
+
+// Options of an `AsyncFileSink`.
+struct AsyncFileSinkOptions {
+  // Longest time written text waits before it goes to the file.
+  std::chrono::milliseconds flush_interval{250};
+  // Size of pending text in bytes that wakes the writer before the interval
+  // ends.
+  size_t flush_size = 64u * 1024u;
+  // Size of pending text in bytes at which new text is dropped instead of
+  // growing the buffer further. 0 means no limit.
+  size_t max_pending_size = 16u * 1024u * 1024u;
+  // Removes ANSI escape sequences, for plain text logs.
+  bool strip_ansi = true;
+  // Appends to an existing file instead of truncating it.
+  bool append = false;
+};
+
+// Output stream that writes to a file on a background thread.
+//
+// Meant to be mirrored from the console with `MultiStream::AddStream()`, e.g.
+// as a log file. Writing into the stream only copies the text into a memory
+// buffer; a writer thread swaps it with a second buffer and writes that one to
+// the file every `flush_interval` or as soon as `flush_size` bytes are pending.
+// The writing thread never waits for the disk: if the writer falls behind by
+// more than `max_pending_size` bytes, new text is dropped and counted.
+//
+// Flushing the stream (e.g. `std::endl`) hands the text to the writer without
+// waiting for it. Everything written is in the file once the sink is
+// destroyed.
+class AsyncFileSink : public std::ostream {
+ public:
+  explicit AsyncFileSink(const std::string& path,
+                         AsyncFileSinkOptions options = AsyncFileSinkOptions());
+  ~AsyncFileSink() override;
+
+  AsyncFileSink(const AsyncFileSink&) = delete;
+  AsyncFileSink& operator=(const AsyncFileSink&) = delete;
+
+  // Returns true if the file was opened.
+  bool IsOpen() const;
+
+  // Returns number of bytes dropped because the writer fell behind.
+  size_t GetDroppedBytes() const;
+
+ private:
+  // Collects small writes before they are handed to the sink.
+  class Buffer : public std::streambuf {
+   public:
+    explicit Buffer(AsyncFileSink& sink);
+
+   protected:
+    int overflow(int c) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+    int sync() override;
+
+   private:
+    static constexpr size_t kSize = 4096u;
+
+    // Hands the content of the put area to the sink.
+    void Commit();
+
+    AsyncFileSink& sink_;
+    char data_[kSize];
+  };
+
+  // State of the ANSI escape sequence parser of the writer thread.
+  enum class AnsiState { kText, kEscape, kSequence };
+
+  // Appends text to the pending buffer. Called by the writing thread.
+  void Enqueue(const char* data, size_t size);
+
+  // Body of the writer thread.
+  void WriterLoop();
+  // Writes text to the file, stripping ANSI codes if needed.
+  void WriteToFile(const std::string& text);
+
+  const AsyncFileSinkOptions options_;
+  std::ofstream file_;
+  Buffer buf_;
+
+  // Protects `front_` and `stop_`.
+  std::mutex mutex_;
+  std::condition_variable wake_writer_;
+  // Text waiting for the writer.
+  std::string front_;
+  // Text being written, owned by the writer thread.
+  std::string back_;
+  bool stop_ = false;
+
+  std::atomic<size_t> dropped_bytes_{0};
+  AnsiState ansi_state_ = AnsiState::kText;
+
+  std::thread writer_;
+};
+
+}  // namespace sfe
@@ -1,16 +1,40 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdint>
 #include <cstring>
 #include <iostream>
-#include <sstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "RingBuffer.hpp"
 
 namespace sfe {
 
-// Enumeration of ANSI color codes for console output.
-// These codes are used to format text with specific colors in the terminal.
-enum AnsiColorCode {
+// Enumeration of ANSI SGR codes for console output, the parameters of
+// "\u001b[...m" escape sequences that format text in the terminal.
+enum AnsiColorCode : std::uint8_t {
   ANSI_RESET = 0,
+  // Bold text. Normal colors are shown in their bright variant, as terminals
+  // do, hence the name.
+  ANSI_BRIGHT_TEXT = 1,
+  ANSI_FAINT_TEXT = 2,
+  ANSI_ITALIC_TEXT = 3,
+  ANSI_UNDERLINE_TEXT = 4,
+  ANSI_INVERSE_TEXT = 7,
+  ANSI_STRIKETHROUGH_TEXT = 9,
+  ANSI_DOUBLE_UNDERLINE_TEXT = 21,
+  ANSI_NORMAL_INTENSITY = 22,
+  ANSI_NOT_ITALIC = 23,
+  ANSI_NOT_UNDERLINED = 24,
+  ANSI_NOT_INVERSE = 27,
+  ANSI_NOT_STRIKETHROUGH = 29,
 
   ANSI_BLACK = 30,
   ANSI_RED = 31,
@@ -20,121 +44,1110 @@ enum AnsiColorCode {
   ANSI_MAGENTA = 35,
   ANSI_CYAN = 36,
   ANSI_WHITE = 37,
+  // Followed by "5;n" for a color of the 256 color palette or "2;r;g;b".
+  ANSI_EXTENDED_TEXT = 38,
+  ANSI_DEFAULT_TEXT = 39,
+
+  ANSI_BLACK_BKGRND = 40,
+  ANSI_RED_BKGRND = 41,
+  ANSI_GREEN_BKGRND = 42,
+  ANSI_YELLOW_BKGRND = 43,
+  ANSI_BLUE_BKGRND = 44,
+  ANSI_MAGENTA_BKGRND = 45,
+  ANSI_CYAN_BKGRND = 46,
+  ANSI_WHITE_BKGRND = 47,
+  ANSI_EXTENDED_BKGRND = 48,
+  ANSI_DEFAULT_BKGRND = 49,
+
+  ANSI_BRIGHT_BLACK = 90,
+  ANSI_BRIGHT_WHITE = 97,
+  ANSI_BRIGHT_BLACK_BKGRND = 100,
+  ANSI_BRIGHT_WHITE_BKGRND = 107,
+};
+
+// Kind of a `TextColor`.
+enum TextColorKind : std::uint8_t {
+  // Default color of the front end.
+  COLOR_DEFAULT,
+  // Color of the 256 color palette, see `GetPaletteColor()`.
+  COLOR_PALETTE,
+  // 24-bit color.
+  COLOR_RGB,
+};
+
+// Text or background color of a `TextStyle`.
+struct TextColor {
+  TextColorKind kind = COLOR_DEFAULT;
+  // Palette index of a `COLOR_PALETTE` color.
+  std::uint8_t index = 0;
+  // Channels of a `COLOR_RGB` color.
+  std::uint8_t r = 0;
+  std::uint8_t g = 0;
+  std::uint8_t b = 0;
+
+  bool operator==(const TextColor&) const = default;
+};
+
+// Attributes of a `TextStyle`, combined as bits.
+enum TextStyleFlag : std::uint8_t {
+  STYLE_BOLD = 1u << 0,
+  STYLE_FAINT = 1u << 1,
+  STYLE_ITALIC = 1u << 2,
+  STYLE_UNDERLINE = 1u << 3,
+  STYLE_INVERSE = 1u << 4,
+  STYLE_STRIKETHROUGH = 1u << 5,
+};
+
+// Formatting of a run of text, as set by ANSI SGR codes. Front ends draw what
+// they support and ignore the rest of the attributes.
+struct TextStyle {
+  TextColor foreground;
+  TextColor background;
+  // `TextStyleFlag` bits.
+  std::uint8_t flags = 0;
+
+  inline bool Has(TextStyleFlag flag) const { return (flags & flag) != 0; }
+
+  bool operator==(const TextStyle&) const = default;
+};
+
+// Returns a color of the 256 color palette as 0xRRGGBB: 0-7 are the normal
+// colors, 8-15 their bright variants, 16-231 a 6x6x6 color cube and 232-255
+// shades of gray, as in xterm.
+inline std::uint32_t GetPaletteColor(std::uint8_t index) {
+  static constexpr std::array<std::uint32_t, 16> kBaseColors = {
+      0x000000, 0xC00000, 0x00C000, 0xC0C000, 0x0000C0, 0xC000C0,
+      0x00C0C0, 0xC0C0C0, 0x808080, 0xFF0000, 0x00FF00, 0xFFFF00,
+      0x0000FF, 0xFF00FF, 0x00FFFF, 0xFFFFFF};
+  if (index < kBaseColors.size()) {
+    return kBaseColors[index];
+  }
+  if (index < 232) {
+    const auto level = [](unsigned v) -> std::uint32_t {
+      return v == 0 ? 0 : 55 + 40 * v;
+    };
+    const unsigned cube = index - 16u;
+    return level(cube / 36) << 16 | level(cube / 6 % 6) << 8 | level(cube % 6);
+  }
+  const std::uint32_t gray = 8 + 10 * (index - 232u);
+  return gray << 16 | gray << 8 | gray;
+}
+
+// Returns a color as 0xRRGGBB, `fallback` for `COLOR_DEFAULT`. `bold` shows
+// the normal palette colors in their bright variant.
+inline std::uint32_t ResolveColor(const TextColor& color,
+                                  std::uint32_t fallback, bool bold = false) {
+  switch (color.kind) {
+    case COLOR_PALETTE:
+      return GetPaletteColor(bold && color.index < 8 ? color.index + 8
+                                                     : color.index);
+    case COLOR_RGB:
+      return static_cast<std::uint32_t>(color.r) << 16 |
+             static_cast<std::uint32_t>(color.g) << 8 | color.b;
+    default:
+      return fallback;
+  }
+}
+
+// Colors a front end draws a style with, as 0xRRGGBB.
+struct ResolvedColors {
+  std::uint32_t text = 0;
+  std::uint32_t background = 0;
+  // False if the text is drawn over the front end's own background.
+  bool has_background = false;
+};
+
+// Returns the colors of a style, with bold and inverse applied, given the
+// default colors of the front end.
+inline ResolvedColors ResolveColors(const TextStyle& style,
+                                    std::uint32_t default_text,
+                                    std::uint32_t default_background) {
+  ResolvedColors colors;
+  colors.text = ResolveColor(style.foreground, default_text,
+                             style.Has(STYLE_BOLD));
+  colors.background = ResolveColor(style.background, default_background);
+  colors.has_background = style.background.kind != COLOR_DEFAULT;
+  if (style.Has(STYLE_INVERSE)) {
+    std::swap(colors.text, colors.background);
+    colors.has_background = true;
+  }
+  return colors;
+}
+
+// Category of a line of output, taken from the prefix the console styles its
+// messages with, see `ConsoleBuffer::SetCategoryPrefix()`.
+enum LineCategory : std::uint8_t {
+  LINE_PLAIN = 0,
+  LINE_ERROR = 1,
+  LINE_WARNING = 2,
+  LINE_ECHO = 3,
+
+  LINE_CATEGORIES_COUNT = 4,
+};
+
+// Bit of a category in a mask of categories, see `LineFilter`.
+inline constexpr unsigned LineCategoryBit(LineCategory category) {
+  return 1u << category;
+}
+inline constexpr unsigned kAllLineCategories =
+    (1u << LINE_CATEGORIES_COUNT) - 1;
+
+// Filter of the lines of a `ConsoleBuffer`, see `ConsoleBuffer::FindLines()`.
+struct LineFilter {
+  // Mask of the `LineCategoryBit()` of the categories to keep.
+  unsigned categories = kAllLineCategories;
+  // Text the lines have to contain, ignoring case. Empty keeps every line.
+  std::string text;
+
+  // Checks if the filter keeps every line.
+  inline bool IsEmpty() const {
+    return categories == kAllLineCategories && text.empty();
+  }
+};
+
+// Trigram index over the text of lines, so the lines containing a string are
+// found without scanning the whole scrollback. Lines are added once, by their
+// id, when they are complete. Ids of dropped lines stay in the posting lists
+// and are skipped by the users; `ConsoleBuffer` rebuilds the index once they
+// outnumber the live lines.
+class LineTextIndex {
+ public:
+  // Shortest text `GetCandidates()` can look up.
+  static constexpr size_t kMinQueryLength = 3;
+
+  // Ids of lines, increasing.
+  typedef std::vector<size_t> Ids;
+
+  // Indexes a line. Ids have to be increasing.
+  inline void Add(size_t id, std::string_view text);
+
+  // Returns ids of the lines that may contain the text, ignoring case: the
+  // shortest posting list of its trigrams. The text has at least
+  // `kMinQueryLength` characters. The reference is valid until the index
+  // changes.
+  inline const Ids& GetCandidates(std::string_view text) const;
+
+  // Returns number of lines added since the last `clear()`.
+  inline size_t size() const { return lines_; }
+
+  // Returns approximate size in bytes of the posting lists.
+  inline size_t GetMemoryUsage() const;
+
+  inline void clear();
+
+  // Checks if the text contains the query, ignoring case.
+  static inline bool ContainsNoCase(std::string_view text,
+                                    std::string_view query);
+
+ private:
+  // Key of the trigram at `p`, ignoring case.
+  static inline std::uint32_t Trigram(const char* p);
+
+  std::unordered_map<std::uint32_t, Ids> postings_;
+  // Distinct trigrams of the line being added.
+  std::vector<std::uint32_t> line_grams_;
+  size_t lines_ = 0;
 };
 
 // Console buffer for the UI widget. This buffer splits a stream of text
 // into lines (`Line`), each of which contains one or more formatted sequences
-// (`TextSequence`). Formatting is currently achieved via ANSI color codes.
+// (`TextSequence`). Formatting is achieved via ANSI SGR codes.
 // Additional input transformations (e.g., syntax highlighting) can be applied
 // to the input before passing it to this stream.
+//
+// The buffer doesn't depend on any rendering library, both the SFML and the
+// ImGui front ends draw from it. Sequences carry the parsed `TextStyle`, front
+// ends map it to their own colors, e.g. with `ResolveColors()`.
+//
+// Text is stored in blocks of `kLinesPerBlock` lines. Each block keeps the
+// characters of all its lines in one contiguous arena and the formatting as a
+// flat array of (offset, length, style) spans, so appending text costs no
+// allocations once the arena has grown to its working size. Styles are
+// interned in a table of the buffer and spans keep a 16-bit index into it, so
+// 24-bit colors cost spans no memory. Escape sequences the buffer doesn't
+// support are skipped and counted, see `GetUnknownAnsiCodesCount()`.
+//
+// Every line gets a category (see `LineCategory`) when it's complete, from the
+// prefix it starts with, and the ids of the lines of each category except
+// `LINE_PLAIN` are kept in order. `FindLines()` uses them, and the optional
+// `LineTextIndex` (see `SetTextIndex()`), to filter the scrollback in time
+// proportional to the matches rather than to the number of lines.
+//
+// Blocks are kept in a ring buffer. By default the buffer grows without limit;
+// `SetMaxLines()` and `SetMaxBytes()` turn it into a fixed-capacity scrollback
+// that drops the oldest lines once a limit is exceeded. Blocks whose lines have
+// all been dropped are recycled together with their memory.
 class ConsoleBuffer : public std::streambuf {
  public:
+  // Number of lines stored in a single block.
+  static constexpr size_t kLinesPerBlock = 256;
+
   ConsoleBuffer();
 
-  // Represents a sequence of text with an associated ANSI color code.
+  // Formatted run of text inside the character arena of a block.
+  struct Span {
+    // Offset of the first character in the arena.
+    std::uint32_t offset = 0;
+    // Number of characters.
+    std::uint32_t length = 0;
+    // Index of the style of the run in the style table, 0 is the default
+    // style.
+    std::uint16_t style = 0;
+  };
+
+  // Represents a sequence of text with its formatting.
+  // It is a view into the buffer and is invalidated when the buffer changes.
   struct TextSequence {
-    // Color code for this text sequence.
-    AnsiColorCode color_code = AnsiColorCode::ANSI_WHITE;
+    // Formatting of this text sequence.
+    TextStyle style;
     // Text content of the sequence.
-    std::string text = "";
+    std::string_view text;
   };
 
   // Represents a line of text, potentially containing multiple `TextSequence`
-  // objects, each with separate color formatting.
-  struct Line {
-    std::vector<TextSequence> sequences;
+  // objects, each with separate color formatting. Iterating a line yields its
+  // sequences. It is a view into the buffer and is invalidated when the buffer
+  // changes.
+  class Line {
+   public:
+    class Iterator {
+     public:
+      inline TextSequence operator*() const {
+        return {styles[span->style],
+                std::string_view(chars + span->offset, span->length)};
+      }
+      inline Iterator& operator++() {
+        ++span;
+        return *this;
+      }
+      inline bool operator==(const Iterator& other) const {
+        return span == other.span;
+      }
+
+     private:
+      friend class Line;
+      Iterator(const char* chars, const TextStyle* styles, const Span* span)
+          : chars(chars), styles(styles), span(span) {}
+
+      const char* chars;
+      const TextStyle* styles;
+      const Span* span;
+    };
+
+    inline Iterator begin() const { return {chars, styles, first}; }
+    inline Iterator end() const { return {chars, styles, last}; }
 
-    inline TextSequence& CurSequence() {
-      return sequences[sequences.size() - 1];
+    // Returns number of text sequences in the line.
+    inline size_t size() const { return last - first; }
+    // Returns text sequence by its index.
+    inline TextSequence operator[](size_t i) const {
+      return *Iterator(chars, styles, first + i);
     }
-    inline const TextSequence& CurSequence() const {
-      return sequences[sequences.size() - 1];
+
+    // Returns total number of characters in the line.
+    inline size_t GetBytesCount() const {
+      return first == last
+                 ? 0
+                 : last[-1].offset + last[-1].length - first->offset;
     }
 
     // Checks if the line contains only empty text sequences.
-    inline bool IsEmpty() const {
-      return std::all_of(sequences.begin(), sequences.end(),
-                         [](const auto& seq) { return seq.text.empty(); });
+    inline bool IsEmpty() const { return GetBytesCount() == 0; }
+
+    // Returns text of the whole line without formatting. Sequences of a line
+    // are stored back to back, so this is a view, not a copy.
+    inline std::string_view GetText() const {
+      return first == last
+                 ? std::string_view()
+                 : std::string_view(chars + first->offset, GetBytesCount());
     }
+
+   private:
+    friend class ConsoleBuffer;
+    Line(const char* chars, const TextStyle* styles, const Span* first,
+         const Span* last)
+        : chars(chars), styles(styles), first(first), last(last) {}
+
+    // Character arena of the block the line belongs to.
+    const char* chars;
+    // Style table of the buffer.
+    const TextStyle* styles;
+    // Range of spans of the line.
+    const Span* first;
+    const Span* last;
+  };
+
+  // Random access view of all lines in the buffer, index 0 is the oldest one.
+  class Lines {
+   public:
+    inline size_t size() const { return buffer->lines_count; }
+    inline Line operator[](size_t i) const { return buffer->GetLine(i); }
+
+   private:
+    friend class ConsoleBuffer;
+    explicit Lines(const ConsoleBuffer* buffer) : buffer(buffer) {}
+
+    const ConsoleBuffer* buffer;
   };
 
   // Clears the entire console buffer, resetting it to an initial empty state.
   void clear();
 
   // Returns all lines in the buffer.
-  inline const std::vector<Line>& GetLines() const { return lines; }
+  inline Lines GetLines() const { return Lines(this); }
+
+  // Returns a line by its index, 0 is the oldest line.
+  inline Line GetLine(size_t i) const;
+
+  // Returns id of the oldest line. Every line gets a unique id that does not
+  // change while lines are dropped, the line with index `i` has id
+  // `GetFirstLineId() + i`. Only the last line can change its content.
+  inline size_t GetFirstLineId() const { return total_lines - lines_count; }
 
   // Returns number of lines.
   // Excludes the last one if it's empty.
   inline int size() const;
 
+  // Returns a counter that changes every time the buffer content changes.
+  // Widgets compare it against the value they last rendered to skip
+  // rebuilding unchanged text.
+  inline std::uint64_t GetRevision() const { return revision; }
+
+  // Limits the number of stored lines. 0 means no limit.
+  inline void SetMaxLines(size_t count);
+  // Limits the total size of stored text in bytes. 0 means no limit.
+  // The line currently being written is never dropped, even if it alone
+  // exceeds the limit.
+  inline void SetMaxBytes(size_t bytes);
+
+  inline size_t GetMaxLines() const { return max_lines; }
+  inline size_t GetMaxBytes() const { return max_bytes; }
+
+  // Returns total size of the stored text in bytes.
+  inline size_t GetBytesCount() const { return bytes_count; }
+  // Returns number of lines dropped due to the limits since construction.
+  inline size_t GetDroppedLinesCount() const { return dropped_lines; }
+
+  // Returns number of bytes of text appended since construction, including
+  // dropped and cleared text.
+  inline std::uint64_t GetAppendedBytesCount() const { return total_bytes; }
+  // Returns number of lines started since construction, including dropped
+  // and cleared ones.
+  inline size_t GetAppendedLinesCount() const { return total_lines; }
+
+  // Returns approximate size in bytes of the memory held by the blocks of the
+  // stored lines, the line indices and the style table.
+  inline size_t GetMemoryUsage() const;
+
+  // Returns number of distinct styles of the text written since the last
+  // `clear()`. Once `kMaxStyles` styles are used, text in new ones gets the
+  // default style.
+  inline size_t GetStylesCount() const { return styles.size(); }
+  static constexpr size_t kMaxStyles = 1u << 16;
+
+  // Returns number of ANSI codes skipped since construction: unknown SGR
+  // codes, malformed escape sequences and escape sequences other than SGR.
+  inline std::uint64_t GetUnknownAnsiCodesCount() const {
+    return unknown_ansi_codes;
+  }
+
+  // Sets the prefix of the plain text of the lines of a category, e.g.
+  // "[error]" for `LINE_ERROR`. Applies to the lines completed afterwards.
+  // The defaults match the tags of `Virtuoso::QuakeStyleConsole::style`.
+  inline void SetCategoryPrefix(LineCategory category, std::string prefix);
+
+  // Returns category of the line with the given index. The last line is
+  // classified each time, since it may still change.
+  inline LineCategory GetLineCategory(size_t i) const;
+
+  // Enables the text index, so `FindLines()` finds text without scanning
+  // every line. Costs a few bytes per character of output. The lines in the
+  // buffer are indexed right away.
+  inline void SetTextIndex(bool enabled);
+  inline bool HasTextIndex() const { return text_index_enabled; }
+
+  // Appends to `ids` the ids of the lines with ids from `from_id` on that
+  // pass the filter, oldest first. The last line is included if it passes
+  // and isn't empty; since it may still change, callers that keep the result
+  // look it up again starting from its id. Only the lines of the filtered
+  // categories, or the candidates of the text index, are checked, unless the
+  // filter keeps plain lines and has no indexed text.
+  inline void FindLines(const LineFilter& filter, size_t from_id,
+                        std::vector<size_t>& ids) const;
+
  protected:
+  // Block of consecutive lines sharing one character arena.
+  struct Block {
+    // Characters of all lines of the block.
+    std::string chars;
+    // Formatting spans of all lines of the block.
+    std::vector<Span> spans;
+    // Index of the first span of every line.
+    std::vector<std::uint32_t> line_spans;
+    // Category of every complete line.
+    std::vector<LineCategory> line_categories;
+
+    // Returns view of the line at the given position in the block, styled
+    // from the given style table.
+    inline Line GetLine(size_t i, const TextStyle* styles) const {
+      const Span* first = spans.data() + line_spans[i];
+      const Span* last = i + 1 < line_spans.size()
+                             ? spans.data() + line_spans[i + 1]
+                             : spans.data() + spans.size();
+      return Line(chars.data(), styles, first, last);
+    }
+  };
+
   // Streambuf override method for handling overflow.
   // This method is responsible for processing each character added to the
   // stream, handling both regular text and ANSI color codes.
   int overflow(int c) override;
 
-  // Processes an ANSI code from the input stream, updating the current
+  // Streambuf override method for writing a block of characters.
+  // Runs of plain text between line breaks and ANSI escapes are copied into
+  // the current text sequence at once.
+  std::streamsize xsputn(const char* s, std::streamsize n) override;
+
+  // Feeds a single character of an ANSI escape sequence to the parser.
+  inline void ParseANSIChar(char c);
+
+  // Processes the parameters of an SGR escape sequence, updating the current
   // formatting state.
-  /// @param code The ANSI code to process.
-  inline void ProcessANSICode(int code);
+  /// @param codes The parameters of the sequence, in order.
+  /// @param count Number of parameters.
+  inline void ProcessANSICode(const int* codes, size_t count);
+
+  // Returns index of a style in the style table, adding it if needed.
+  inline std::uint16_t InternStyle(const TextStyle& style);
+
+  // Appends plain text to the current text sequence.
+  inline void AppendText(const char* text, size_t count);
+
+  // Starts a new text sequence in the current line with the current style.
+  inline void NewSequence();
 
-  // Returns the current line being processed.
-  inline Line& CurrentLine() { return lines[lines.size() - 1]; }
-  // Returns the current word (text) sequence in the current line.
-  inline std::string& CurrentWord() { return CurrentLine().CurSequence().text; }
+  // Starts a new line with the current formatting, dropping the oldest lines
+  // if the buffer is over its limits.
+  inline void NewLine();
 
-  // Last used ANSI color code.
-  AnsiColorCode cur_color_code = AnsiColorCode::ANSI_WHITE;
+  // Classifies and indexes the last line, which is complete.
+  inline void FinishLine();
 
+  // Returns category of a line from its text.
+  inline LineCategory Classify(const Line& line) const;
+
+  // Drops the ids of dropped lines from the category lists, and rebuilds the
+  // text index if it's mostly made of dropped lines.
+  inline void ShrinkIndices();
+
+  // Indexes the text of all complete lines.
+  inline void RebuildTextIndex();
+
+  // Drops the oldest lines until the buffer fits into its limits.
+  inline void Shrink();
+
+  // Returns the block holding the current line.
+  inline Block& CurrentBlock() { return *blocks.back(); }
+
+  // Style set by the last ANSI codes and its index in the style table.
+  TextStyle cur_style;
+  std::uint16_t cur_style_id = 0;
+  // Distinct styles used by spans, the first one is the default style.
+  std::vector<TextStyle> styles{TextStyle()};
+  // Indices of the styles by their packed value.
+  std::unordered_map<std::uint64_t, std::uint16_t> style_ids;
+
+  // Most parameters an SGR sequence can have, e.g. "38;2;r;g;b;48;2;r;g;b".
+  static constexpr size_t kMaxAnsiParams = 16;
   // Tracks if currently parsing an ANSI color code.
   bool parsing_ansi_code = false;
   // Tracks if waiting for a digit in an ANSI sequence.
   bool listening_digits = false;
-  // Accumulates digits for ANSI code parsing.
-  std::stringstream num_parse_stream;
-  // All lines in the console buffer.
-  std::vector<Line> lines;
+  // Value of the ANSI code parameter being parsed.
+  int ansi_param = 0;
+  // Tracks if any digit of the current ANSI code parameter was seen.
+  bool has_ansi_param = false;
+  // Parameters of the sequence before the one being parsed.
+  std::array<int, kMaxAnsiParams> ansi_params{};
+  size_t ansi_params_count = 0;
+  // Number of ANSI codes skipped, see `GetUnknownAnsiCodesCount()`.
+  std::uint64_t unknown_ansi_codes = 0;
+  // Blocks of lines, the last one holds the current line. Every block except
+  // the last one is full.
+  RingBuffer<std::unique_ptr<Block>> blocks;
+  // Number of dropped lines at the beginning of the first block.
+  size_t first_line = 0;
+  // Number of live lines in the buffer.
+  size_t lines_count = 0;
+  // Number of lines started since construction, including dropped ones.
+  size_t total_lines = 0;
+  // Max number of stored lines, 0 if unlimited.
+  size_t max_lines = 0;
+  // Max total size of stored text, 0 if unlimited.
+  size_t max_bytes = 0;
+  // Total size of stored text.
+  size_t bytes_count = 0;
+  // Number of lines dropped since construction.
+  size_t dropped_lines = 0;
+  // Number of bytes of text appended since construction.
+  std::uint64_t total_bytes = 0;
+  // Incremented on every content change, see `GetRevision()`.
+  std::uint64_t revision = 0;
+
+  // Prefixes of the categories, see `SetCategoryPrefix()`.
+  std::array<std::string, LINE_CATEGORIES_COUNT> category_prefixes = {
+      "", "[error]", "[warning]", "> "};
+  // Ids of the complete lines of every category but `LINE_PLAIN`, increasing.
+  std::array<RingBuffer<size_t>, LINE_CATEGORIES_COUNT> category_lines;
+  // Index of the text of the complete lines, if enabled.
+  LineTextIndex text_index;
+  bool text_index_enabled = false;
 };
 
+// --------------------------------------
+// ---- LineTextIndex implementation -----
+// --------------------------------------
+
+inline std::uint32_t LineTextIndex::Trigram(const char* p) {
+  std::uint32_t key = 0;
+  for (size_t i = 0; i < 3; ++i) {
+    key |= static_cast<std::uint32_t>(
+               std::tolower(static_cast<unsigned char>(p[i])))
+           << (8 * i);
+  }
+  return key;
+}
+
+inline bool LineTextIndex::ContainsNoCase(std::string_view text,
+                                          std::string_view query) {
+  const auto equal = [](char a, char b) {
+    return std::tolower(static_cast<unsigned char>(a)) ==
+           std::tolower(static_cast<unsigned char>(b));
+  };
+  return std::search(text.begin(), text.end(), query.begin(), query.end(),
+                     equal) != text.end();
+}
+
+inline void LineTextIndex::Add(size_t id, std::string_view text) {
+  line_grams_.clear();
+  for (size_t i = 0; i + 3 <= text.size(); ++i) {
+    line_grams_.push_back(Trigram(text.data() + i));
+  }
+  std::sort(line_grams_.begin(), line_grams_.end());
+  line_grams_.erase(std::unique(line_grams_.begin(), line_grams_.end()),
+                    line_grams_.end());
+
+  for (const std::uint32_t gram : line_grams_) {
+    postings_[gram].push_back(id);
+  }
+  ++lines_;
+}
+
+inline const LineTextIndex::Ids& LineTextIndex::GetCandidates(
+    std::string_view text) const {
+  static const Ids kNone;
+  // Every match is in the posting list of each trigram of the text.
+  const Ids* shortest = nullptr;
+  for (size_t i = 0; i + 3 <= text.size(); ++i) {
+    const auto found = postings_.find(Trigram(text.data() + i));
+    if (found == postings_.end()) {
+      return kNone;
+    }
+    if (!shortest || found->second.size() < shortest->size()) {
+      shortest = &found->second;
+    }
+  }
+  return shortest ? *shortest : kNone;
+}
+
+inline size_t LineTextIndex::GetMemoryUsage() const {
+  size_t usage = 0;
+  for (const auto& [gram, ids] : postings_) {
+    usage += sizeof(gram) + sizeof(ids) + ids.capacity() * sizeof(size_t);
+  }
+  return usage;
+}
+
+inline void LineTextIndex::clear() {
+  postings_.clear();
+  lines_ = 0;
+}
+
 // --------------------------------------
 // ---- ConsoleBuffer implementation -------
 // --------------------------------------
 
+inline ConsoleBuffer::Line ConsoleBuffer::GetLine(size_t i) const {
+  // Every block but the last one is full, so the block is found directly.
+  const size_t pos = first_line + i;
+  return blocks[pos / kLinesPerBlock]->GetLine(pos % kLinesPerBlock,
+                                               styles.data());
+}
+
 inline int ConsoleBuffer::size() const {
-  int lines_count = static_cast<int>(lines.size());
-  if (lines.back().IsEmpty()) {
-    --lines_count;
+  int count = static_cast<int>(lines_count);
+  if (GetLine(lines_count - 1).IsEmpty()) {
+    --count;
   }
-  return lines_count;
+  return count;
 }
 
 inline void ConsoleBuffer::clear() {
-  lines.clear();
-  lines.emplace_back();
-  CurrentLine().sequences.emplace_back(AnsiColorCode::ANSI_WHITE, "");
-}
-
-// Processes a given ANSI code, updating the current color code based on the
-// input.
-/// @param code The ANSI color code to interpret and apply.
-inline void ConsoleBuffer::ProcessANSICode(int code) {
-  switch (code) {
-    case ANSI_RESET:
-    case ANSI_BLACK:
-    case ANSI_RED:
-    case ANSI_GREEN:
-    case ANSI_YELLOW:
-    case ANSI_BLUE:
-    case ANSI_MAGENTA:
-    case ANSI_CYAN:
-    case ANSI_WHITE:
-      cur_color_code = static_cast<AnsiColorCode>(code);
-      break;
-    default:
-      std::cerr << "unknown ansi code " << code << " in output\n";
+  ++revision;
+  blocks.clear();
+  first_line = 0;
+  lines_count = 0;
+  bytes_count = 0;
+  // No span uses the styles anymore.
+  cur_style = TextStyle();
+  cur_style_id = 0;
+  styles.resize(1);
+  style_ids.clear();
+  for (RingBuffer<size_t>& ids : category_lines) {
+    ids.clear();
+  }
+  text_index.clear();
+  NewLine();
+}
+
+inline size_t ConsoleBuffer::GetMemoryUsage() const {
+  size_t usage = 0;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    const Block& block = *blocks[i];
+    usage += sizeof(Block) + block.chars.capacity() +
+             block.spans.capacity() * sizeof(Span) +
+             block.line_spans.capacity() * sizeof(std::uint32_t) +
+             block.line_categories.capacity() * sizeof(LineCategory);
+  }
+  for (const RingBuffer<size_t>& ids : category_lines) {
+    usage += ids.capacity() * sizeof(size_t);
+  }
+  usage += styles.capacity() * sizeof(TextStyle) +
+           style_ids.size() * (sizeof(std::uint64_t) + sizeof(std::uint16_t) +
+                               2 * sizeof(void*));
+  return usage + text_index.GetMemoryUsage();
+}
+
+inline void ConsoleBuffer::SetCategoryPrefix(LineCategory category,
+                                             std::string prefix) {
+  category_prefixes[category] = std::move(prefix);
+}
+
+inline LineCategory ConsoleBuffer::Classify(const Line& line) const {
+  const std::string_view text = line.GetText();
+  for (size_t category = LINE_PLAIN + 1; category < LINE_CATEGORIES_COUNT;
+       ++category) {
+    const std::string& prefix = category_prefixes[category];
+    if (!prefix.empty() && text.starts_with(prefix)) {
+      return static_cast<LineCategory>(category);
+    }
+  }
+  return LINE_PLAIN;
+}
+
+inline LineCategory ConsoleBuffer::GetLineCategory(size_t i) const {
+  if (i + 1 == lines_count) {
+    return Classify(GetLine(i));
+  }
+  const size_t pos = first_line + i;
+  return blocks[pos / kLinesPerBlock]
+      ->line_categories[pos % kLinesPerBlock];
+}
+
+inline void ConsoleBuffer::SetTextIndex(bool enabled) {
+  if (text_index_enabled == enabled) {
+    return;
+  }
+  text_index_enabled = enabled;
+  if (enabled) {
+    RebuildTextIndex();
+  } else {
+    text_index.clear();
+  }
+}
+
+inline void ConsoleBuffer::RebuildTextIndex() {
+  text_index.clear();
+  const size_t first_id = GetFirstLineId();
+  for (size_t i = 0; i + 1 < lines_count; ++i) {
+    text_index.Add(first_id + i, GetLine(i).GetText());
+  }
+}
+
+inline void ConsoleBuffer::FindLines(const LineFilter& filter, size_t from_id,
+                                     std::vector<size_t>& ids) const {
+  const size_t first_id = GetFirstLineId();
+  // Id of the last line, the only one not in the indices.
+  const size_t last_id = first_id + lines_count - 1;
+  from_id = std::max(from_id, first_id);
+
+  const auto passes = [&](size_t id) {
+    const size_t i = id - first_id;
+    if (!(filter.categories & LineCategoryBit(GetLineCategory(i)))) {
+      return false;
+    }
+    const Line line = GetLine(i);
+    if (id == last_id && line.IsEmpty()) {
+      return false;
+    }
+    return filter.text.empty() ||
+           LineTextIndex::ContainsNoCase(line.GetText(), filter.text);
+  };
+
+  if (text_index_enabled &&
+      filter.text.size() >= LineTextIndex::kMinQueryLength) {
+    const LineTextIndex::Ids& candidates =
+        text_index.GetCandidates(filter.text);
+    for (auto it = std::lower_bound(candidates.begin(), candidates.end(),
+                                    from_id);
+         it != candidates.end(); ++it) {
+      if (passes(*it)) {
+        ids.push_back(*it);
+      }
+    }
+  } else if (!(filter.categories & LineCategoryBit(LINE_PLAIN))) {
+    // Merge the lists of the filtered categories, starting at `from_id`.
+    std::array<size_t, LINE_CATEGORIES_COUNT> next{};
+    for (size_t category = LINE_PLAIN + 1; category < LINE_CATEGORIES_COUNT;
+         ++category) {
+      const RingBuffer<size_t>& list = category_lines[category];
+      size_t low = 0;
+      size_t high = list.size();
+      while (low < high) {
+        const size_t mid = low + (high - low) / 2;
+        if (list[mid] < from_id) {
+          low = mid + 1;
+        } else {
+          high = mid;
+        }
+      }
+      next[category] = low;
+    }
+    for (;;) {
+      size_t best = LINE_CATEGORIES_COUNT;
+      for (size_t category = LINE_PLAIN + 1; category < LINE_CATEGORIES_COUNT;
+           ++category) {
+        const RingBuffer<size_t>& list = category_lines[category];
+        if ((filter.categories & (1u << category)) &&
+            next[category] < list.size() &&
+            (best == LINE_CATEGORIES_COUNT ||
+             list[next[category]] < category_lines[best][next[best]])) {
+          best = category;
+        }
+      }
+      if (best == LINE_CATEGORIES_COUNT) {
+        break;
+      }
+      const size_t id = category_lines[best][next[best]++];
+      if (filter.text.empty() ||
+          LineTextIndex::ContainsNoCase(GetLine(id - first_id).GetText(),
+                                        filter.text)) {
+        ids.push_back(id);
+      }
+    }
+  } else {
+    for (size_t id = from_id; id < last_id; ++id) {
+      if (passes(id)) {
+        ids.push_back(id);
+      }
+    }
+  }
+
+  if (last_id >= from_id && passes(last_id)) {
+    ids.push_back(last_id);
+  }
+}
+
+inline void ConsoleBuffer::SetMaxLines(size_t count) {
+  max_lines = count;
+  Shrink();
+}
+
+inline void ConsoleBuffer::SetMaxBytes(size_t bytes) {
+  max_bytes = bytes;
+  Shrink();
+}
+
+inline void ConsoleBuffer::AppendText(const char* text, size_t count) {
+  Block& block = CurrentBlock();
+  block.chars.append(text, count);
+  block.spans.back().length += static_cast<std::uint32_t>(count);
+  bytes_count += count;
+  total_bytes += count;
+}
+
+inline void ConsoleBuffer::NewSequence() {
+  Block& block = CurrentBlock();
+  block.spans.push_back(
+      {static_cast<std::uint32_t>(block.chars.size()), 0, cur_style_id});
+}
+
+inline void ConsoleBuffer::FinishLine() {
+  const size_t i = lines_count - 1;
+  const Line line = GetLine(i);
+  const LineCategory category = Classify(line);
+  CurrentBlock().line_categories.push_back(category);
+
+  const size_t id = GetFirstLineId() + i;
+  if (category != LINE_PLAIN) {
+    category_lines[category].push_back(id);
+  }
+  if (text_index_enabled) {
+    text_index.Add(id, line.GetText());
+  }
+}
+
+inline void ConsoleBuffer::NewLine() {
+  if (lines_count > 0) {
+    FinishLine();
+  }
+  if (blocks.empty() || CurrentBlock().line_spans.size() == kLinesPerBlock) {
+    // Reuse a recycled block together with its allocated memory.
+    std::unique_ptr<Block>& block = blocks.recycle_back();
+    if (block) {
+      block->chars.clear();
+      block->spans.clear();
+      block->line_spans.clear();
+      block->line_categories.clear();
+    } else {
+      block = std::make_unique<Block>();
+    }
+  }
+  Block& block = CurrentBlock();
+  block.line_spans.push_back(static_cast<std::uint32_t>(block.spans.size()));
+  ++lines_count;
+  ++total_lines;
+  NewSequence();
+  Shrink();
+}
+
+inline void ConsoleBuffer::Shrink() {
+  const auto over_limits = [this]() {
+    return (max_lines && lines_count > max_lines) ||
+           (max_bytes && bytes_count > max_bytes);
+  };
+  bool dropped = false;
+  while (lines_count > 1 && over_limits()) {
+    bytes_count -= GetLine(0).GetBytesCount();
+    --lines_count;
+    ++dropped_lines;
+    dropped = true;
+    // Recycle the first block once all of its lines are dropped. The current
+    // block is never recycled since it holds the current line.
+    if (++first_line == kLinesPerBlock) {
+      blocks.pop_front();
+      first_line = 0;
+    }
+  }
+  if (dropped) {
+    ++revision;
+    ShrinkIndices();
+  }
+}
+
+inline void ConsoleBuffer::ShrinkIndices() {
+  const size_t first_id = GetFirstLineId();
+  for (RingBuffer<size_t>& ids : category_lines) {
+    while (!ids.empty() && ids.front() < first_id) {
+      ids.pop_front();
+    }
+  }
+  // Dropped lines are only skipped, start over once they are the majority.
+  constexpr size_t kMinRebuildLines = 1024;
+  if (text_index_enabled &&
+      text_index.size() > 2 * std::max(lines_count, kMinRebuildLines)) {
+    RebuildTextIndex();
+  }
+}
+
+// Processes the parameters of an SGR sequence in order, updating the current
+// style. Colors take their extra parameters, e.g. "38;5;208" or "48;2;0;0;64".
+/// @param codes The parameters of the sequence.
+/// @param count Number of parameters.
+inline void ConsoleBuffer::ProcessANSICode(const int* codes, size_t count) {
+  // Parses the parameters of an extended color starting at `i`, advancing it
+  // past them.
+  const auto extended_color = [&](size_t& i, TextColor& color) {
+    const auto channel = [&](size_t at) {
+      return at < count && codes[at] >= 0 && codes[at] <= 255;
+    };
+    if (i >= count) {
+      return false;
+    }
+    if (codes[i] == 5 && channel(i + 1)) {
+      color = {COLOR_PALETTE, static_cast<std::uint8_t>(codes[i + 1])};
+      i += 2;
+      return true;
+    }
+    if (codes[i] == 2 && channel(i + 1) && channel(i + 2) && channel(i + 3)) {
+      color = {COLOR_RGB, 0, static_cast<std::uint8_t>(codes[i + 1]),
+               static_cast<std::uint8_t>(codes[i + 2]),
+               static_cast<std::uint8_t>(codes[i + 3])};
+      i += 4;
+      return true;
+    }
+    return false;
+  };
+  const auto palette = [](int index) {
+    return TextColor{COLOR_PALETTE, static_cast<std::uint8_t>(index)};
+  };
+
+  for (size_t i = 0; i < count;) {
+    const int code = codes[i++];
+    switch (code) {
+      case ANSI_RESET:
+        cur_style = TextStyle();
+        break;
+      case ANSI_BRIGHT_TEXT:
+        cur_style.flags |= STYLE_BOLD;
+        break;
+      case ANSI_FAINT_TEXT:
+        cur_style.flags |= STYLE_FAINT;
+        break;
+      case ANSI_ITALIC_TEXT:
+        cur_style.flags |= STYLE_ITALIC;
+        break;
+      case ANSI_UNDERLINE_TEXT:
+      case ANSI_DOUBLE_UNDERLINE_TEXT:
+        cur_style.flags |= STYLE_UNDERLINE;
+        break;
+      case ANSI_INVERSE_TEXT:
+        cur_style.flags |= STYLE_INVERSE;
+        break;
+      case ANSI_STRIKETHROUGH_TEXT:
+        cur_style.flags |= STYLE_STRIKETHROUGH;
+        break;
+      case ANSI_NORMAL_INTENSITY:
+        cur_style.flags &= ~(STYLE_BOLD | STYLE_FAINT);
+        break;
+      case ANSI_NOT_ITALIC:
+        cur_style.flags &= ~STYLE_ITALIC;
+        break;
+      case ANSI_NOT_UNDERLINED:
+        cur_style.flags &= ~STYLE_UNDERLINE;
+        break;
+      case ANSI_NOT_INVERSE:
+        cur_style.flags &= ~STYLE_INVERSE;
+        break;
+      case ANSI_NOT_STRIKETHROUGH:
+        cur_style.flags &= ~STYLE_STRIKETHROUGH;
+        break;
+      case ANSI_EXTENDED_TEXT:
+      case ANSI_EXTENDED_BKGRND:
+        if (!extended_color(i, code == ANSI_EXTENDED_TEXT
+                                   ? cur_style.foreground
+                                   : cur_style.background)) {
+          // The parameters that follow can't be told apart from codes.
+          ++unknown_ansi_codes;
+          return;
+        }
+        break;
+      case ANSI_DEFAULT_TEXT:
+        cur_style.foreground = TextColor();
+        break;
+      case ANSI_DEFAULT_BKGRND:
+        cur_style.background = TextColor();
+        break;
+      default:
+        if (code >= ANSI_BLACK && code <= ANSI_WHITE) {
+          cur_style.foreground = palette(code - ANSI_BLACK);
+        } else if (code >= ANSI_BLACK_BKGRND && code <= ANSI_WHITE_BKGRND) {
+          cur_style.background = palette(code - ANSI_BLACK_BKGRND);
+        } else if (code >= ANSI_BRIGHT_BLACK && code <= ANSI_BRIGHT_WHITE) {
+          cur_style.foreground = palette(code - ANSI_BRIGHT_BLACK + 8);
+        } else if (code >= ANSI_BRIGHT_BLACK_BKGRND &&
+                   code <= ANSI_BRIGHT_WHITE_BKGRND) {
+          cur_style.background = palette(code - ANSI_BRIGHT_BLACK_BKGRND + 8);
+        } else {
+          ++unknown_ansi_codes;
+        }
+        break;
+    }
+  }
+}
+
+inline std::uint16_t ConsoleBuffer::InternStyle(const TextStyle& style) {
+  if (style == styles.front()) {
+    return 0;
+  }
+  const auto pack = [](const TextColor& color) -> std::uint64_t {
+    const std::uint64_t value =
+        color.kind == COLOR_PALETTE
+            ? color.index
+            : std::uint64_t{color.r} << 16 | std::uint64_t{color.g} << 8 |
+                  color.b;
+    return std::uint64_t{color.kind} << 24 | value;
+  };
+  const std::uint64_t key =
+      pack(style.foreground) << 34 | pack(style.background) << 8 | style.flags;
+  const auto found = style_ids.find(key);
+  if (found != style_ids.end()) {
+    return found->second;
+  }
+  if (styles.size() == kMaxStyles) {
+    return 0;
+  }
+  const auto id = static_cast<std::uint16_t>(styles.size());
+  styles.push_back(style);
+  style_ids.emplace(key, id);
+  return id;
+}
+
+// Feeds a character of an ANSI escape sequence to the parser. Digits are
+// accumulated into integer parameters separated by `;`, `m` applies them.
+// Other sequences are skipped up to their final character.
+/// @param c The character to process.
+inline void ConsoleBuffer::ParseANSIChar(char c) {
+  // Longer parameters are certainly invalid, clamping avoids overflow.
+  constexpr int kMaxAnsiParam = 1 << 16;
+
+  if (c >= '0' && c <= '9' && listening_digits) {
+    ansi_param = std::min(ansi_param * 10 + (c - '0'), kMaxAnsiParam);
+    has_ansi_param = true;
+    return;
+  }
+
+  switch (c) {
+    case 'm':  // End of ANSI code; apply formatting to a new sequence.
+    case ';':  // Multiple ANSI codes; keep current and prepare for next.
+      if (!listening_digits) {
+        break;
+      }
+      // Missing parameter means 0, e.g. "\u001b[m" resets.
+      if (ansi_params_count < kMaxAnsiParams) {
+        ansi_params[ansi_params_count++] = has_ansi_param ? ansi_param : 0;
+      } else {
+        ++unknown_ansi_codes;
+      }
+      ansi_param = 0;
+      has_ansi_param = false;
+      if (c == 'm') {
+        ProcessANSICode(ansi_params.data(), ansi_params_count);
+        ansi_params_count = 0;
+        parsing_ansi_code = false;
+        listening_digits = false;
+        cur_style_id = InternStyle(cur_style);
+        NewSequence();
+      }
+      return;
+    case '[':  // Start of ANSI sequence.
+      if (listening_digits) {
+        break;
+      }
+      listening_digits = true;
       return;
+    default:
+      break;
   }
+
+  // Invalid character in ANSI code, or the end of another escape sequence,
+  // e.g. "\u001b[2K". Dropped along with the sequence.
+  ansi_param = 0;
+  has_ansi_param = false;
+  ansi_params_count = 0;
+  listening_digits = false;
+  parsing_ansi_code = false;
+  ++unknown_ansi_codes;
 }
 
 // Handles characters pushed to the stream, managing text and ANSI sequences.
@@ -142,73 +1155,82 @@ inline void ConsoleBuffer::ProcessANSICode(int code) {
 /// @return The character processed, or `EOF` if at the end of the file.
 inline int ConsoleBuffer::overflow(int c) {
   if (c != EOF) {
+    ++revision;
+    const char ch = static_cast<char>(c);
     if (parsing_ansi_code) {
-      bool error = false;
-
-      if (std::isdigit(static_cast<char>(c)) && listening_digits) {
-        num_parse_stream << static_cast<char>(c);
-      } else {
-        switch (c) {
-          case 'm': {  // End of ANSI code; apply color formatting to new
-                       // sequence.
-            parsing_ansi_code = false;
-            int x;
-            if (num_parse_stream >> x) {
-              ProcessANSICode(x);
-            }
-            num_parse_stream.clear();
-            CurrentLine().sequences.emplace_back(cur_color_code, "");
-            break;
-          }
-          case '[':  // Start of ANSI sequence.
-            listening_digits = true;
-            num_parse_stream.clear();
-            break;
-          case ';': {  // Multiple ANSI codes; process current and prepare for
-                       // next.
-            int x;
-            num_parse_stream >> x;
-            num_parse_stream.clear();
-            ProcessANSICode(x);
-            break;
-          }
-          default:  // Invalid character in ANSI code.
-            error = true;
-            break;
-        }
-
-        if (error) {
-          num_parse_stream.clear();
-          listening_digits = false;
-          parsing_ansi_code = false;
-
-          std::cerr << "Parsing ANSI code failed. Unknown symbol "
-                    << static_cast<char>(c);
-        }
-      }
+      ParseANSIChar(ch);
     } else {
-      switch (c) {
+      switch (ch) {
         case '\u001b':  // Start of an ANSI escape sequence.
           parsing_ansi_code = true;
-          num_parse_stream.clear();
           break;
         case '\n':  // End of line; add a new line.
-          lines.emplace_back();
-          CurrentLine().sequences.emplace_back(cur_color_code, "");
+          NewLine();
           break;
         default:  // Regular character, added to the current text sequence.
-          CurrentWord() += static_cast<char>(c);
+          AppendText(&ch, 1);
       }
     }
   }
   return c;
 }
 
+// Handles a block of characters pushed to the stream. Plain text is located
+// with `memchr` and copied in runs instead of character by character.
+/// @param s Characters to process.
+/// @param n Number of characters.
+/// @return Number of characters processed.
+inline std::streamsize ConsoleBuffer::xsputn(const char* s,
+                                             std::streamsize n) {
+  if (n <= 0) {
+    return 0;
+  }
+  ++revision;
+
+  const char* cur = s;
+  const char* const end = s + n;
+  const auto find = [&end](const char* from, char c) {
+    const void* found = std::memchr(from, c, end - from);
+    return found ? static_cast<const char*>(found) : end;
+  };
+  // Positions of the next line break and escape character, `end` if none.
+  const char* next_line = find(cur, '\n');
+  const char* next_escape = find(cur, '\u001b');
+
+  while (cur < end) {
+    if (parsing_ansi_code) {
+      ParseANSIChar(*cur++);
+      continue;
+    }
+
+    if (next_line < cur) {
+      next_line = find(cur, '\n');
+    }
+    if (next_escape < cur) {
+      next_escape = find(cur, '\u001b');
+    }
+
+    const char* special = std::min(next_line, next_escape);
+    if (special != cur) {
+      AppendText(cur, special - cur);
+    }
+    if (special == end) {
+      break;
+    }
+    if (special == next_line) {
+      NewLine();
+    } else {
+      parsing_ansi_code = true;
+    }
+    cur = special + 1;
+  }
+  return n;
+}
+
 /// Initializes a ConsoleBuffer with an empty line and default color formatting.
 inline ConsoleBuffer::ConsoleBuffer() {
-  lines.emplace_back();
   // Start a new run of characters with default formatting.
-  CurrentLine().sequences.emplace_back(AnsiColorCode::ANSI_WHITE, "");
+  NewLine();
 }
 
 }  // namespace sfe
\ No newline at end of file
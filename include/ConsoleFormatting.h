@@ -17,6 +17,14 @@
 #include <iterator>
 #include <stack>
 #include <regex>
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 namespace Virtuoso
 {
@@ -159,12 +167,245 @@ inline bool terminalSupportsColorCodes()
 #endif
 
 
+// ------------------------------------------------------//
+/* --------- Keyword Matcher --------------------------- */
+// ------------------------------------------------------//
+
+/// Finds literal keywords in text in a single pass, with an Aho-Corasick automaton compiled to a dense transition table.
+/// Occurrences have to start and end at word boundaries, the same as the regex \bkeyword\b.
+/// Bytes that don't appear in any keyword share a single column of the table, so the table stays small for typical keyword sets.
+class KeywordMatcher
+{
+  public:
+    struct Match
+    {
+        std::size_t start = 0;
+        std::size_t length = 0;
+        int id = -1; ///< id the keyword was added with
+    };
+
+    /// adds a keyword.  When several keywords match at the same position, the lowest id wins, then the keyword added first,
+    /// like the alternatives of a regex
+    void add(std::string_view keyword, int id);
+
+    void clear();
+
+    /// builds the automaton from the added keywords.  Has to be called before find()
+    void compile();
+
+    bool empty() const { return keywords.empty(); }
+
+    /// finds the leftmost keyword occurrence in text starting at or after 'from'
+    bool find(std::string_view text, std::size_t from, Match &match) const;
+
+  private:
+    struct Keyword
+    {
+        std::string text; ///< released by compile()
+        std::size_t length = 0;
+        int id = -1;
+    };
+
+    struct Node
+    {
+        int fail = 0;      ///< longest proper suffix of this node that is also in the trie
+        int keyword = -1;  ///< best keyword ending at this node
+        int dictLink = -1; ///< next node on the fail chain with a keyword
+    };
+
+    static bool isWordChar(char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; }
+
+    static bool isBoundary(std::string_view text, std::size_t pos)
+    {
+        const bool before = pos > 0 && isWordChar(text[pos - 1]);
+        const bool after = pos < text.size() && isWordChar(text[pos]);
+        return before != after;
+    }
+
+    /// ordering of matches at the same start position.  Both are elements of keywords, so their addresses follow the order they were added in
+    static bool preferred(const Keyword &a, const Keyword &b) { return a.id != b.id ? a.id < b.id : &a < &b; }
+
+    std::vector<Keyword> keywords;
+    std::vector<Node> nodes;
+    std::vector<int> transitions; ///< nodes.size() x classCount table of next states
+    std::array<std::uint16_t, 256> byteClass{};
+    std::size_t classCount = 1;
+    std::size_t maxLength = 0;
+};
+
+inline void KeywordMatcher::add(std::string_view keyword, int id)
+{
+    if (!keyword.empty())
+    {
+        keywords.push_back({std::string(keyword), keyword.size(), id});
+    }
+}
+
+inline void KeywordMatcher::clear()
+{
+    keywords.clear();
+    nodes.clear();
+    transitions.clear();
+    byteClass.fill(0);
+    classCount = 1;
+    maxLength = 0;
+}
+
+inline void KeywordMatcher::compile()
+{
+    // class 0 is for the bytes not used by any keyword
+    byteClass.fill(0);
+    classCount = 1;
+    maxLength = 0;
+    for (const Keyword &kw : keywords)
+    {
+        for (const char c : kw.text)
+        {
+            std::uint16_t &cls = byteClass[static_cast<unsigned char>(c)];
+            if (!cls)
+            {
+                cls = static_cast<std::uint16_t>(classCount++);
+            }
+        }
+        maxLength = std::max(maxLength, kw.length);
+    }
+
+    // trie
+    nodes.assign(1, Node());
+    transitions.assign(classCount, -1);
+    for (std::size_t i = 0; i < keywords.size(); i++)
+    {
+        int state = 0;
+        for (const char c : keywords[i].text)
+        {
+            const std::size_t edge = state * classCount + byteClass[static_cast<unsigned char>(c)];
+            if (transitions[edge] < 0)
+            {
+                transitions[edge] = static_cast<int>(nodes.size());
+                nodes.emplace_back();
+                transitions.resize(transitions.size() + classCount, -1);
+            }
+            state = transitions[edge];
+        }
+
+        int &best = nodes[state].keyword;
+        if (best < 0 || preferred(keywords[i], keywords[best]))
+        {
+            best = static_cast<int>(i);
+        }
+    }
+
+    // fail links, breadth first so the links of shorter prefixes are ready first.  Missing edges are resolved to full transitions
+    std::vector<int> queue;
+    queue.reserve(nodes.size());
+    for (std::size_t cls = 0; cls < classCount; cls++)
+    {
+        int &next = transitions[cls];
+        if (next < 0)
+        {
+            next = 0;
+        }
+        else
+        {
+            queue.push_back(next);
+        }
+    }
+
+    for (std::size_t head = 0; head < queue.size(); head++)
+    {
+        const int state = queue[head];
+        const int fail = nodes[state].fail;
+
+        for (std::size_t cls = 0; cls < classCount; cls++)
+        {
+            int &next = transitions[state * classCount + cls];
+            const int failNext = transitions[fail * classCount + cls];
+            if (next < 0)
+            {
+                next = failNext;
+            }
+            else
+            {
+                nodes[next].fail = failNext;
+                nodes[next].dictLink = nodes[failNext].keyword >= 0 ? failNext : nodes[failNext].dictLink;
+                queue.push_back(next);
+            }
+        }
+    }
+
+    for (Keyword &kw : keywords)
+    {
+        kw.text = std::string();
+    }
+}
+
+inline bool KeywordMatcher::find(std::string_view text, std::size_t from, Match &match) const
+{
+    if (nodes.empty())
+    {
+        return false;
+    }
+
+    bool found = false;
+    const Keyword *best = nullptr;
+    int state = 0;
+
+    for (std::size_t i = from; i < text.size(); i++)
+    {
+        // keywords ending further than this can't start before the best match
+        if (found && i >= match.start + maxLength)
+        {
+            break;
+        }
+
+        state = transitions[state * classCount + byteClass[static_cast<unsigned char>(text[i])]];
+
+        for (int node = nodes[state].keyword >= 0 ? state : nodes[state].dictLink; node >= 0; node = nodes[node].dictLink)
+        {
+            const Keyword &kw = keywords[nodes[node].keyword];
+            const std::size_t end = i + 1;
+            const std::size_t start = end - kw.length;
+
+            if (!isBoundary(text, start) || !isBoundary(text, end))
+            {
+                continue;
+            }
+
+            if (!found || start < match.start || (start == match.start && preferred(kw, *best)))
+            {
+                found = true;
+                best = &kw;
+                match.start = start;
+                match.length = kw.length;
+                match.id = kw.id;
+            }
+        }
+    }
+
+    return found;
+}
+
+// ------------------------------------------------------//
+/* --------- Regex Formatter --------------------------- */
+// ------------------------------------------------------//
+
+/// Applies formatting rules to text, eg. for syntax highlighting.  At each point the rule with the nearest match wins, ties go to the earlier rule.
+/// Keyword rules are compiled into one KeywordMatcher, so all of them are found in a single pass; std::regex is only run for the other rules.
 struct RegexFormatter
 {
     struct Rule
     {
-        std::regex rule;
-        std::function<std::string (const std::string&)> filter = DO_NOTHING;
+        std::regex rule; ///< pattern of the rule, used when keywords is empty
+
+        /// literal words matched like \bword\b.  Keyword rules don't use the regex
+        std::vector<std::string> keywords;
+
+        /// if set, transforms the matched text
+        std::function<std::string (const std::string&)> filter;
+
+        /// written around the matched text when there's no filter, eg. an ANSI color code and a reset
+        std::string before;
+        std::string after;
 
         inline static std::string DO_NOTHING(const std::string& s){return s;}
     };
@@ -175,7 +416,7 @@ struct RegexFormatter
 
     std::string matched(Rule &tok, const std::string &str)
     {
-        return tok.filter(str);
+        return tok.filter ? tok.filter(str) : tok.before + str + tok.after;
     }
 
     std::string unmatched(const std::string &str)
@@ -183,116 +424,194 @@ struct RegexFormatter
         return str;
     }
 
-    std::string format(const std::string &str)
+    /// prepares the rules for format().  Called automatically when rules are added, call it after changing existing rules
+    void compile()
     {
-        std::stringstream sstr;
-        
-        struct SearchParams
+        keywordMatcher.clear();
+        regexRules.clear();
+
+        for (std::size_t i = 0; i < rules.size(); i++)
         {
-            std::smatch match;
-            std::size_t searchStartedAt = 0;
-            std::string result;
-            std::string prefix;
-            std::string suffix;
-            bool hasResult = true;
-
-            std::size_t offsetOfMatch() const
+            if (rules[i].keywords.empty())
             {
-                return match.prefix().length() + searchStartedAt;
+                regexRules.push_back(static_cast<int>(i));
             }
-        };
+            else
+            {
+                for (const std::string &keyword : rules[i].keywords)
+                {
+                    keywordMatcher.add(keyword, static_cast<int>(i));
+                }
+            }
+        }
+
+        keywordMatcher.compile();
+        compiledRules = rules.size();
+    }
+
+    std::string format(std::string_view str)
+    {
+        std::string out;
+        out.reserve(str.size() + str.size() / 4);
+        format(str, out);
+        return out;
+    }
 
-        std::vector<SearchParams> matches;
+    /// appends the formatted text to out
+    void format(std::string_view str, std::string &out)
+    {
+        if (compiledRules != rules.size())
+        {
+            compile();
+        }
 
-        matches.resize(rules.size());
+        // nearest match of every rule from the current position.  A match is searched again once the output passes its start
+        regexMatches.assign(regexRules.size(), RuleMatch());
+        RuleMatch keywordMatch;
+        keywordMatch.hasResult = !keywordMatcher.empty();
 
-        int segmentStart = 0;
-        int priorityMatch = -1;
+        std::size_t segmentStart = 0;
 
         do
         {
-            int lastPriorityMatch = priorityMatch;
-            priorityMatch = -1;
+            int priorityMatch = -1;
+            std::size_t startLocation = str.npos;
+            std::size_t matchLength = 0;
 
-            unsigned int startLocation = 0xffffffff;
-
-            for (int i = 0; i < rules.size(); i++)
+            for (std::size_t i = 0; i < regexRules.size(); i++)
             {
-                SearchParams &match = matches[i];
-
-                if (!match.hasResult)
-                    continue;
+                RuleMatch &match = regexMatches[i];
 
-                // update the next search result for the regex we chose, or for any regex whose latest result
-                // is now behind the edge of the string we've consumed
-                if ((i == lastPriorityMatch) || (match.offsetOfMatch() < segmentStart) || (!segmentStart))
+                if (match.hasResult && (!match.searched || match.start < segmentStart))
                 {
-                    match.hasResult = std::regex_search((str.begin() + segmentStart), str.end(), match.match, rules[i].rule);
-
-                    match.searchStartedAt = segmentStart;
-
-                    if (match.hasResult)
-                    {
-                        //std::cout << "\tpossible match "<<match.match.str()<<std::endl;
-                        match.prefix = match.match.prefix();
-                        match.suffix = match.match.suffix();
-                        match.result = match.match.str();
-                    }
+                    match.hasResult = searchRegex(rules[regexRules[i]].rule, str, segmentStart, match);
+                    match.searched = true;
                 }
 
-                // get the nearest for any
-                if (match.hasResult && match.offsetOfMatch() < startLocation)
+                if (match.hasResult && match.start < startLocation)
                 {
-                    priorityMatch = i;
-                    std::size_t off = match.offsetOfMatch();
-                    startLocation = off;
+                    priorityMatch = regexRules[i];
+                    startLocation = match.start;
+                    matchLength = match.length;
                 }
             }
 
-            if (priorityMatch == -1)
+            if (keywordMatch.hasResult && (!keywordMatch.searched || keywordMatch.start < segmentStart))
             {
-                sstr << unmatched(str.substr(segmentStart, str.size() - segmentStart));
+                KeywordMatcher::Match found;
+                keywordMatch.hasResult = keywordMatcher.find(str, segmentStart, found);
+                keywordMatch.searched = true;
+                keywordMatch.start = found.start;
+                keywordMatch.length = found.length;
+                keywordMatch.rule = found.id;
+            }
 
-                return sstr.str();
+            if (keywordMatch.hasResult &&
+                (keywordMatch.start < startLocation || (keywordMatch.start == startLocation && keywordMatch.rule < priorityMatch)))
+            {
+                priorityMatch = keywordMatch.rule;
+                startLocation = keywordMatch.start;
+                matchLength = keywordMatch.length;
             }
 
-            // handle first match
+            if (priorityMatch == -1)
+            {
+                out.append(str.substr(segmentStart));
+                return;
+            }
 
-            const std::string prefix = matches[priorityMatch].prefix;
-            const std::string matchStr = matches[priorityMatch].result;
+            out.append(str.substr(segmentStart, startLocation - segmentStart));
 
-            if (prefix.length())
+            const Rule &rule = rules[priorityMatch];
+            const std::string_view matchStr = str.substr(startLocation, matchLength);
+            if (rule.filter)
             {
-                std::size_t offset = segmentStart - matches[priorityMatch].searchStartedAt;
-                if (prefix.length() > offset && prefix.length())
-                {
-                    std::size_t len = prefix.length() - offset;
-                    sstr << unmatched(prefix.substr(offset, len));
-                }
+                out += rule.filter(std::string(matchStr));
+            }
+            else
+            {
+                out += rule.before;
+                out.append(matchStr);
+                out += rule.after;
             }
 
-            sstr << matched(rules[priorityMatch], matchStr);
-
-            segmentStart = matches[priorityMatch].offsetOfMatch() + matchStr.length();
+            segmentStart = startLocation + matchLength;
 
         } while (true);
     }
+
+  private:
+    struct RuleMatch
+    {
+        std::size_t start = 0;
+        std::size_t length = 0;
+        int rule = -1;
+        bool hasResult = true;
+        bool searched = false;
+    };
+
+    /// nearest non-empty match of the regex at or after 'from'.  The text is searched in place, the characters before 'from' are visible to \b and lookbehinds
+    static bool searchRegex(const std::regex &regex, std::string_view str, std::size_t from, RuleMatch &result)
+    {
+        std::cmatch match;
+
+        while (from <= str.size())
+        {
+            const auto flags = from ? std::regex_constants::match_prev_avail : std::regex_constants::match_default;
+            if (!std::regex_search(str.data() + from, str.data() + str.size(), match, regex, flags))
+            {
+                return false;
+            }
+
+            // an empty match would never advance the output, look further
+            if (match.length(0) > 0)
+            {
+                result.start = from + match.position(0);
+                result.length = match.length(0);
+                return true;
+            }
+            from += match.position(0) + 1;
+        }
+
+        return false;
+    }
+
+    KeywordMatcher keywordMatcher;
+    std::vector<int> regexRules; ///< indices of the rules that use a regex
+    std::size_t compiledRules = static_cast<std::size_t>(-1);
+    std::vector<RuleMatch> regexMatches;
 };
 
 
+/// regex alternation of the keywords as whole words.  Empty keywords are left out, the same as in keyword rules:
+/// an empty alternative would match first at every word boundary and hide the keywords starting there
 inline std::string makeKeywordsRegexStr(const std::string keywords[], std::size_t numKeywords)
 {
     std::stringstream sstr;
 
-    sstr << "\\b" << keywords[0] << "\\b";
-    for (int i = 1; i < numKeywords; i++)
+    const char *separator = "";
+    for (std::size_t i = 0; i < numKeywords; i++)
     {
-        sstr << '|' << "\\b" << keywords[i] << "\\b";
+        if (!keywords[i].empty())
+        {
+            sstr << separator << "\\b" << keywords[i] << "\\b";
+            separator = "|";
+        }
     }
 
     return (sstr.str());
 }
 
+/// makes a keyword rule that wraps each of the keywords in the given format, eg. an ANSI color code, and a reset
+inline RegexFormatter::Rule makeKeywordsRule(const std::string keywords[], std::size_t numKeywords, std::string_view format)
+{
+    RegexFormatter::Rule rule;
+    rule.keywords.assign(keywords, keywords + numKeywords);
+    rule.before = format;
+    rule.after = ANSI_TEXT_COLOR_RESET;
+    return rule;
+}
+
 // use std bind to set this as a 'filter' for regex formatter.  see guiTest.cpp example in 'demos' folder for example glsl syntax highlighting
 inline std::string highlightKeyword(const std::string& format, const std::string& str)
 {
@@ -0,0 +1,326 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace sfe {
+
+// Text posted to the console by a producer thread.
+struct ConsoleRecord {
+  // Global ticket taken when the record was posted. `Drain()` merges the
+  // records of all threads it finds in the order of their tickets.
+  std::uint64_t timestamp = 0;
+  // Formatted text of the record, ANSI color codes included.
+  std::string text;
+};
+
+// Bounded lock-free queue with a single producer and a single consumer thread.
+class SpscRecordQueue {
+ public:
+  // Capacity is rounded up to a power of two.
+  explicit SpscRecordQueue(size_t capacity);
+
+  // Producer side. Returns false if the queue is full.
+  inline bool TryPush(ConsoleRecord&& record);
+
+  // Consumer side. Returns the oldest record, nullptr if the queue is empty.
+  inline ConsoleRecord* Front();
+  // Consumer side. Drops the record returned by `Front()`.
+  inline void Pop();
+
+ private:
+  static constexpr size_t kCacheLineSize = 64;
+
+  std::unique_ptr<ConsoleRecord[]> slots_;
+  size_t mask_ = 0;
+
+  // Next slot to read, written by the consumer only.
+  alignas(kCacheLineSize) std::atomic<size_t> head_{0};
+  // Consumer's copy of `tail_`, saves loads of the shared cache line.
+  size_t cached_tail_ = 0;
+
+  // Next slot to write, written by the producer only.
+  alignas(kCacheLineSize) std::atomic<size_t> tail_{0};
+  // Producer's copy of `head_`.
+  size_t cached_head_ = 0;
+};
+
+// Multi-producer / single-consumer queue of console records.
+//
+// Every producer thread gets its own `SpscRecordQueue` on the first `Post()`,
+// so producers never wait on each other or on the consumer. The only lock is
+// taken once per thread to register its queue. The consumer thread (usually
+// the one that renders the console) calls `Drain()` once per frame and writes
+// the records into the console stream. Order is guaranteed per thread only.
+// Records of different threads are merged by their tickets, which is
+// approximate: a thread takes its ticket before it pushes the record, so a
+// record that isn't pushed yet when `Drain()` runs is written by a later drain,
+// after newer records of other threads. Waiting for it instead could stall the
+// consumer on a preempted producer or on a record dropped from a full queue.
+//
+// A producer whose queue is full drops the record instead of blocking, see
+// `GetDroppedCount()`.
+class ConsoleProducerQueue {
+ public:
+  // Default number of records a single thread can have in flight.
+  static constexpr size_t kDefaultThreadCapacity = 4096u;
+
+  explicit ConsoleProducerQueue(
+      size_t thread_capacity = kDefaultThreadCapacity);
+  ~ConsoleProducerQueue();
+
+  ConsoleProducerQueue(const ConsoleProducerQueue&) = delete;
+  ConsoleProducerQueue& operator=(const ConsoleProducerQueue&) = delete;
+
+  // Posts text from the calling thread. Thread-safe and lock-free except for
+  // the first call on each thread.
+  void Post(std::string text);
+
+  // Writes records pushed so far to `os`, merged in ticket order. Must be called
+  // from a single consumer thread. Returns number of written records.
+  size_t Drain(std::ostream& os);
+
+  // Returns number of records dropped because a thread queue was full.
+  inline size_t GetDroppedCount() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Per-thread queue.
+  struct Channel {
+    explicit Channel(size_t capacity) : queue(capacity) {}
+
+    SpscRecordQueue queue;
+    // Set when the producer thread has exited.
+    std::atomic<bool> orphaned{false};
+    // Cleared when the owning `ConsoleProducerQueue` is destroyed.
+    std::atomic<bool> consumer_alive{true};
+  };
+
+  // Thread-local list of channels of the calling thread, one per queue.
+  struct ThreadChannels {
+    ~ThreadChannels();
+
+    std::vector<std::pair<std::uint64_t, std::shared_ptr<Channel>>> channels;
+  };
+
+  // Returns the channel of the calling thread, registering it if needed.
+  Channel& LocalChannel();
+
+  // Unique id of this queue, keys the thread-local channel cache.
+  const std::uint64_t id_;
+  const size_t thread_capacity_;
+
+  // Protects `channels_`, taken on registration of a new thread only.
+  std::mutex registry_mutex_;
+  // Channels of all threads that posted to the queue.
+  std::vector<std::shared_ptr<Channel>> channels_;
+  // Incremented when `channels_` changes.
+  std::atomic<std::uint64_t> channels_version_{0};
+
+  // Consumer's copy of `channels_`, refreshed when the version changes.
+  std::vector<std::shared_ptr<Channel>> drained_channels_;
+  std::uint64_t drained_version_ = 0;
+
+  // Next ticket to hand out.
+  std::atomic<std::uint64_t> next_timestamp_{0};
+  // Number of dropped records.
+  std::atomic<size_t> dropped_{0};
+};
+
+// Output stream that posts its content to a `ConsoleProducerQueue` on flush,
+// e.g. on `std::endl`. Create one per thread; a single stream must not be
+// shared between threads.
+class ProducerStream : public std::ostream {
+ public:
+  explicit ProducerStream(ConsoleProducerQueue& queue)
+      : std::ostream(&buf_), buf_(queue) {}
+  ~ProducerStream() { flush(); }
+
+ private:
+  class Buffer : public std::stringbuf {
+   public:
+    explicit Buffer(ConsoleProducerQueue& queue) : queue_(queue) {}
+
+   protected:
+    int sync() override {
+      std::string text = str();
+      if (!text.empty()) {
+        queue_.Post(std::move(text));
+        str(std::string());
+      }
+      return 0;
+    }
+
+   private:
+    ConsoleProducerQueue& queue_;
+  };
+
+  Buffer buf_;
+};
+
+// --------------------------------------
+// ---- SpscRecordQueue implementation --
+// --------------------------------------
+
+inline SpscRecordQueue::SpscRecordQueue(size_t capacity) {
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  slots_ = std::make_unique<ConsoleRecord[]>(size);
+  mask_ = size - 1;
+}
+
+inline bool SpscRecordQueue::TryPush(ConsoleRecord&& record) {
+  const size_t tail = tail_.load(std::memory_order_relaxed);
+  if (tail - cached_head_ > mask_) {
+    cached_head_ = head_.load(std::memory_order_acquire);
+    if (tail - cached_head_ > mask_) {
+      return false;
+    }
+  }
+  slots_[tail & mask_] = std::move(record);
+  tail_.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+inline ConsoleRecord* SpscRecordQueue::Front() {
+  const size_t head = head_.load(std::memory_order_relaxed);
+  if (head == cached_tail_) {
+    cached_tail_ = tail_.load(std::memory_order_acquire);
+    if (head == cached_tail_) {
+      return nullptr;
+    }
+  }
+  return &slots_[head & mask_];
+}
+
+inline void SpscRecordQueue::Pop() {
+  const size_t head = head_.load(std::memory_order_relaxed);
+  // Release the string memory on the consumer side.
+  slots_[head & mask_].text = std::string();
+  head_.store(head + 1, std::memory_order_release);
+}
+
+// --------------------------------------
+// - ConsoleProducerQueue implementation -
+// --------------------------------------
+
+namespace detail {
+
+inline std::uint64_t NextProducerQueueId() {
+  static std::atomic<std::uint64_t> next_id{1};
+  return next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace detail
+
+inline ConsoleProducerQueue::ConsoleProducerQueue(size_t thread_capacity)
+    : id_(detail::NextProducerQueueId()), thread_capacity_(thread_capacity) {}
+
+inline ConsoleProducerQueue::~ConsoleProducerQueue() {
+  std::lock_guard lock(registry_mutex_);
+  for (const auto& channel : channels_) {
+    channel->consumer_alive.store(false, std::memory_order_release);
+  }
+}
+
+inline ConsoleProducerQueue::ThreadChannels::~ThreadChannels() {
+  for (const auto& [id, channel] : channels) {
+    channel->orphaned.store(true, std::memory_order_release);
+  }
+}
+
+inline ConsoleProducerQueue::Channel& ConsoleProducerQueue::LocalChannel() {
+  thread_local ThreadChannels local;
+
+  for (const auto& [id, channel] : local.channels) {
+    if (id == id_) {
+      return *channel;
+    }
+  }
+
+  // Forget channels of destroyed queues before registering a new one.
+  std::erase_if(local.channels, [](const auto& entry) {
+    return !entry.second->consumer_alive.load(std::memory_order_acquire);
+  });
+
+  auto channel = std::make_shared<Channel>(thread_capacity_);
+  {
+    std::lock_guard lock(registry_mutex_);
+    channels_.push_back(channel);
+    channels_version_.fetch_add(1, std::memory_order_release);
+  }
+  local.channels.emplace_back(id_, channel);
+  return *channel;
+}
+
+inline void ConsoleProducerQueue::Post(std::string text) {
+  Channel& channel = LocalChannel();
+  ConsoleRecord record{next_timestamp_.fetch_add(1, std::memory_order_relaxed),
+                       std::move(text)};
+  if (!channel.queue.TryPush(std::move(record))) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+inline size_t ConsoleProducerQueue::Drain(std::ostream& os) {
+  const std::uint64_t version =
+      channels_version_.load(std::memory_order_acquire);
+  if (version != drained_version_) {
+    std::lock_guard lock(registry_mutex_);
+    // Channels of exited threads are removed once they are drained.
+    std::erase_if(channels_, [](const auto& channel) {
+      return channel->orphaned.load(std::memory_order_acquire) &&
+             !channel->queue.Front();
+    });
+    drained_channels_ = channels_;
+    drained_version_ = channels_version_.load(std::memory_order_relaxed);
+  }
+
+  // Records posted after this point go to the next drain, which keeps a busy
+  // producer from stalling the consumer.
+  const std::uint64_t end = next_timestamp_.load(std::memory_order_acquire);
+
+  size_t count = 0;
+  for (;;) {
+    // Merge the per-thread queues by picking the oldest front record.
+    ConsoleRecord* oldest = nullptr;
+    Channel* oldest_channel = nullptr;
+    for (const auto& channel : drained_channels_) {
+      ConsoleRecord* record = channel->queue.Front();
+      if (record && record->timestamp < end &&
+          (!oldest || record->timestamp < oldest->timestamp)) {
+        oldest = record;
+        oldest_channel = channel.get();
+      }
+    }
+    if (!oldest) {
+      break;
+    }
+    os << oldest->text;
+    oldest_channel->queue.Pop();
+    ++count;
+  }
+
+  // Orphaned channels are pruned on the next registry refresh.
+  const bool has_orphans = std::any_of(
+      drained_channels_.begin(), drained_channels_.end(),
+      [](const auto& channel) {
+        return channel->orphaned.load(std::memory_order_relaxed);
+      });
+  if (has_orphans) {
+    channels_version_.fetch_add(1, std::memory_order_release);
+  }
+  return count;
+}
+
+}  // namespace sfe
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "QuakeStyleConsole.h"
+
+namespace sfe {
+
+// Options of a `ConsoleServer`.
+struct ConsoleServerOptions {
+  // Connections accepted at once, others are closed right away.
+  size_t max_clients = 16;
+  // Longest command line in bytes. A client sending a longer one is
+  // disconnected.
+  size_t max_line_size = 4096;
+  // Size of output in bytes waiting for a client at which it is considered
+  // stuck and disconnected, so a client that doesn't read can't grow the
+  // server's memory.
+  size_t max_pending_output = 4u * 1024u * 1024u;
+  // Sent to every client when it connects.
+  std::string greeting;
+};
+
+// Headless front end of a `Virtuoso::QuakeStyleConsole`: remote clients send
+// command lines over TCP or a Unix domain socket and receive their output.
+//
+// Meant for dedicated servers without a window, but it works next to any
+// other front end, since it drives the same console instance, with the same
+// commands, cvars and history. The protocol is plain text: every line a
+// client sends is executed, a trailing `\r` is ignored, and the output goes
+// back byte for byte, ANSI styling included, so `nc` or `telnet` in a terminal
+// show colors.
+//
+// Sockets are served by a network thread with non-blocking sockets and
+// `poll()`: it reads command lines into a queue and writes queued output,
+// never touching the console. Commands run on the thread calling `Pump()`,
+// e.g. once per simulation tick, so they can use the game state like any
+// other command. `Pump()` executes all lines received since the last call and
+// hands the output of each client to the network thread as one batch.
+//
+// Every client has its own output stream, so the output of commands that run
+// across several ticks (see `Virtuoso::ConsoleTask`) and of worker commands
+// still reaches the client that started them. `GetBroadcastStream()` writes to
+// all clients, e.g. mirrored from the game console with
+// `MultiStream::AddStream()`.
+//
+// Available on POSIX systems; elsewhere `ListenTcp()` and `ListenUnix()` fail.
+class ConsoleServer {
+ public:
+  explicit ConsoleServer(Virtuoso::QuakeStyleConsole& console,
+                         ConsoleServerOptions options = ConsoleServerOptions());
+  // Closes all connections without sending pending output. Tasks started by
+  // clients write to streams of the server, so they have to be finished or
+  // cancelled first.
+  ~ConsoleServer();
+
+  ConsoleServer(const ConsoleServer&) = delete;
+  ConsoleServer& operator=(const ConsoleServer&) = delete;
+
+  // Listens for TCP connections on the given IPv4 address, e.g. "127.0.0.1"
+  // or "0.0.0.0" for every interface. Port 0 picks a free one, see
+  // `GetTcpPort()`. Returns false and sets `error` on failure.
+  bool ListenTcp(const std::string& address, std::uint16_t port,
+                 std::string* error = nullptr);
+  // Listens for connections on a Unix domain socket, replacing a stale socket
+  // file at the path. The file is removed by `Close()`.
+  bool ListenUnix(const std::string& path, std::string* error = nullptr);
+  // Returns the port of the TCP listener, 0 if none.
+  std::uint16_t GetTcpPort() const;
+
+  // Stops listening and closes all connections.
+  void Close();
+
+  // Executes the command lines received since the last call and sends the
+  // output written for each client since then. Call it on the simulation
+  // thread, after `Virtuoso::QuakeStyleConsole::runTasks()`. Never blocks on
+  // the network.
+  void Pump();
+
+  // Returns an output stream writing to every connected client, sent on the
+  // next `Pump()`. Use it from the `Pump()` thread only.
+  std::ostream& GetBroadcastStream();
+
+  // Returns number of connected clients.
+  size_t GetClientsCount() const;
+
+ private:
+  // Output stream of a client, written on the `Pump()` thread.
+  class ClientStream : public std::streambuf {
+   public:
+    // Text written since the last `Pump()`.
+    std::string pending;
+    // Cleared when the client disconnects, later output is dropped.
+    bool connected = true;
+
+   protected:
+    int overflow(int c) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+  };
+
+  // Stream writing into the output of every connected client.
+  class BroadcastBuffer : public std::streambuf {
+   public:
+    explicit BroadcastBuffer(ConsoleServer& server);
+
+   protected:
+    int overflow(int c) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+
+   private:
+    ConsoleServer& server_;
+  };
+
+  // A client as seen by the `Pump()` thread.
+  struct Client {
+    std::unique_ptr<ClientStream> buffer;
+    std::unique_ptr<std::ostream> stream;
+  };
+
+  // A command line received from a client.
+  struct Request {
+    std::uint64_t client = 0;
+    std::string line;
+  };
+
+  // A connection, owned by the network thread.
+  struct Connection {
+    int fd = -1;
+    std::uint64_t id = 0;
+    // Received bytes after the last complete line.
+    std::string input;
+    // Output being sent and how much of it was sent.
+    std::string output;
+    size_t output_sent = 0;
+    // Set once the client closed its side. The connection is closed when the
+    // output is sent and `output_pumps_` reached `close_after_pumps`.
+    bool input_closed = false;
+    std::uint64_t close_after_pumps = 0;
+  };
+
+  // Creates the wakeup pipe and starts the network thread if needed.
+  bool Start(std::string* error);
+  // Wakes the network thread from `poll()`.
+  void Wake();
+  // Body of the network thread.
+  void NetworkLoop();
+  // Accepts the pending connections of a listening socket.
+  void Accept(int listener);
+  // Reads from a connection, returns false if it has to be closed.
+  bool Receive(Connection& connection);
+  // Writes queued output to a connection, returns false if it has to be
+  // closed.
+  bool Send(Connection& connection);
+  // Closes a connection and reports it to the `Pump()` thread.
+  void Disconnect(Connection& connection);
+
+  Virtuoso::QuakeStyleConsole& console_;
+  const ConsoleServerOptions options_;
+
+  // Clients by id, used on the `Pump()` thread.
+  std::unordered_map<std::uint64_t, Client> clients_;
+  // Clients that disconnected while a task may still write to their stream.
+  // Dropped once the console runs no tasks.
+  std::vector<Client> retired_clients_;
+  BroadcastBuffer broadcast_buffer_;
+  std::ostream broadcast_stream_;
+  // Scratch lists of `Pump()`.
+  std::vector<std::uint64_t> accepted_;
+  std::vector<Request> requests_;
+  std::vector<std::uint64_t> closed_;
+
+  // Protects the members below, shared by both threads.
+  mutable std::mutex mutex_;
+  // Clients connected since the last `Pump()`.
+  std::vector<std::uint64_t> connected_;
+  // Lines received and not executed yet.
+  std::vector<Request> inbox_;
+  // Clients disconnected since the last `Pump()`.
+  std::vector<std::uint64_t> disconnected_;
+  // Output waiting to be taken by the network thread, by client id.
+  std::unordered_map<std::uint64_t, std::string> outbox_;
+  // Listening sockets, added while the network thread runs.
+  std::vector<int> listeners_;
+  size_t clients_count_ = 0;
+  // Number of `Pump()` calls that took the inbox, and that queued the output
+  // of the lines they executed.
+  std::uint64_t pumps_ = 0;
+  std::uint64_t output_pumps_ = 0;
+  // Connections waiting for a `Pump()` before they close, see `Connection`.
+  size_t closing_count_ = 0;
+  bool stop_ = false;
+
+  // Owned by the network thread.
+  std::vector<Connection> connections_;
+  std::uint64_t next_client_id_ = 1;
+
+  std::string unix_path_;
+  std::uint16_t tcp_port_ = 0;
+  // Pipe that wakes the network thread: [read end, write end].
+  int wake_fds_[2] = {-1, -1};
+  std::thread network_;
+};
+
+}  // namespace sfe
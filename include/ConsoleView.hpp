@@ -0,0 +1,129 @@
+#pragma once
+
+#include <SFML/Graphics/Drawable.hpp>
+#include <SFML/Graphics/Transformable.hpp>
+#include <SFML/Graphics/Vertex.hpp>
+#include <SFML/Graphics/VertexArray.hpp>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include "ConsoleBuffer.hpp"
+#include "FontMetricsCache.hpp"
+#include "LineWrapCache.hpp"
+
+namespace sf {
+class RenderTarget;
+}  // namespace sf
+
+namespace sfe {
+
+// Drawable that renders a window of consecutive lines of a `ConsoleBuffer`.
+//
+// Geometry of every line in the window is cached by the stable line id (see
+// `ConsoleBuffer::GetFirstLineId()`). Moving the window only builds the lines
+// that scrolled into view, and new output only rebuilds the lines written
+// since the previous update, so the cost never depends on the total number
+// of lines in the buffer.
+//
+// Text is batched: every cached line keeps textured quads built from the
+// font's glyph atlas with per-vertex colors, and the visible lines are joined
+// into a single vertex array that is drawn with one draw call. Glyphs and
+// advances come from a `FontMetricsCache`, so a monospace cache lays out
+// lines without kerning lookups.
+//
+// With a wrap width set, lines longer than it are drawn in several rows (see
+// `LineWrapCache`), and the window can start and end in the middle of a line.
+//
+// The window may also skip lines, e.g. the ones a `LineFilter` drops: the
+// shown lines are then passed by index, and cached lines are still reused by
+// their id.
+class ConsoleView : public sf::Drawable, public sf::Transformable {
+ public:
+  // Default character size of the console text in pixels.
+  static constexpr unsigned int kDefaultCharacterSize = 30u;
+
+  // Sets the metrics of the font used to draw the text. The cache must
+  // outlive the view. Drops cached lines, as does any change of the cache.
+  void SetFontMetrics(FontMetricsCache& metrics);
+  // Sets the character size used to draw the text. Drops cached lines.
+  void SetCharacterSize(unsigned int size);
+  unsigned int GetCharacterSize() const;
+
+  // Sets the width to wrap lines to in local coordinates. 0 disables
+  // wrapping. Drops cached lines.
+  void SetWrapWidth(float width);
+  float GetWrapWidth() const;
+
+  // Returns number of rows the line with the given index is drawn in.
+  size_t GetRowsCount(const ConsoleBuffer& buffer, size_t index);
+
+  // Returns height of a single line in local coordinates.
+  float GetLineHeight() const;
+
+  // Shows lines with indices in range [begin, end) of the buffer, skipping the
+  // first `skip_rows` rows of the first line and at most `max_rows` rows in
+  // total.
+  void Update(const ConsoleBuffer& buffer, size_t begin, size_t end,
+              size_t skip_rows = 0,
+              size_t max_rows = std::numeric_limits<size_t>::max());
+  // Shows the lines with the given indices of the buffer, in increasing
+  // order, one below the other. Rows are skipped and limited the same way.
+  void Update(const ConsoleBuffer& buffer, std::span<const size_t> indices,
+              size_t skip_rows = 0,
+              size_t max_rows = std::numeric_limits<size_t>::max());
+
+  // Drops all cached lines.
+  void clear();
+
+ protected:
+  void draw(sf::RenderTarget& target,
+            const sf::RenderStates& states) const override;
+
+ private:
+  // Geometry of a single line in line-local coordinates.
+  struct CachedLine {
+    // Id of the line in the buffer.
+    size_t id = 0;
+    std::vector<sf::Vertex> vertices;
+    // Index of the first vertex of every row but the first one.
+    std::vector<std::uint32_t> row_vertices;
+  };
+
+  // Builds geometry of the line with the given index.
+  CachedLine BuildLine(const ConsoleBuffer& buffer, size_t index);
+
+  // Joins geometry of the cached lines into `vertices_`.
+  void UpdateVertices();
+
+  // Metrics of the font used to draw the text.
+  FontMetricsCache* metrics_ = nullptr;
+  // Generation of `metrics_` the cached lines were built with.
+  std::uint64_t metrics_generation_ = 0;
+  // Character size used to draw the text.
+  unsigned int character_size_ = kDefaultCharacterSize;
+  // Rows of the wrapped lines.
+  LineWrapCache wrap_;
+
+  // Cached geometry of the visible lines, ordered by id.
+  std::deque<CachedLine> lines_;
+  // Cached lines while the shown ones are picked from them, kept to reuse its
+  // memory.
+  std::deque<CachedLine> spare_lines_;
+  // Indices of the lines of a contiguous window, see `Update()`.
+  std::vector<size_t> indices_;
+  // Geometry of all visible lines, drawn at once.
+  sf::VertexArray vertices_{sf::PrimitiveType::Triangles};
+  // Rows of the cached lines shown, see `Update()`.
+  size_t skip_rows_ = 0;
+  size_t max_rows_ = 0;
+  // Id of the buffer's last line at the last update. Lines starting from this
+  // one may have changed since.
+  size_t mutable_id_ = 0;
+  // Buffer revision at the last update.
+  std::uint64_t revision_ = 0;
+};
+
+}  // namespace sfe
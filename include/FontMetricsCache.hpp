@@ -0,0 +1,88 @@
+#pragma once
+
+#include <SFML/Graphics/Glyph.hpp>
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+
+namespace sf {
+class Font;
+class String;
+}  // namespace sf
+
+namespace sfe {
+
+// Cache of the glyphs, advances and line spacing of a font per character
+// size, for laying out console text without `sf::Text`.
+//
+// Text is measured the same way `sf::Text` lays it out with the regular
+// style: glyph advances plus kerning, tabs as four spaces and `\r` ignored.
+// Glyphs of the 256 byte values, the ones console text is made of, are kept
+// in a flat table per size; other code points in a map.
+//
+// In monospace mode every character advances by the width of a space and
+// kerning is ignored, so measuring text is a single multiplication. The mode
+// is explicit since fonts don't reliably say whether they're monospace.
+class FontMetricsCache {
+ public:
+  // Sets the measured font. Drops the cached metrics.
+  void SetFont(const sf::Font& font);
+  const sf::Font* GetFont() const;
+
+  // Enables the monospace mode. Drops the cached metrics.
+  void SetMonospace(bool monospace);
+  bool IsMonospace() const;
+
+  // Returns a counter that changes every time the cached metrics are dropped.
+  // Users that keep laid out text compare it to the value they used.
+  std::uint64_t GetGeneration() const;
+
+  // Returns the regular style glyph of a code point.
+  const sf::Glyph& GetGlyph(std::uint32_t codepoint, unsigned int size);
+  // Returns how far the pen moves after a code point, see `GetTextWidth()`.
+  float GetAdvance(std::uint32_t codepoint, unsigned int size);
+  // Returns kerning between two code points, 0 in monospace mode.
+  float GetKerning(std::uint32_t first, std::uint32_t second,
+                   unsigned int size);
+  float GetLineSpacing(unsigned int size);
+
+  // Returns width of the text, decoded byte by byte like ANSI strings passed
+  // to `sf::Text`.
+  float GetTextWidth(std::string_view text, unsigned int size);
+  // Returns width of the text. Named apart from `GetTextWidth()`, since
+  // both `std::string_view` and `sf::String` convert from `std::string`.
+  float GetStringWidth(const sf::String& text, unsigned int size);
+
+ private:
+  // Metrics of a single character size.
+  struct SizeMetrics {
+    float line_spacing = 0.F;
+    float whitespace_width = 0.F;
+    // Glyphs of the byte code points, loaded on first use. Glyphs are owned
+    // by the font and keep their address.
+    std::array<const sf::Glyph*, 256> byte_glyphs{};
+    std::unordered_map<std::uint32_t, const sf::Glyph*> other_glyphs;
+  };
+
+  SizeMetrics& GetSizeMetrics(unsigned int size);
+
+  // Drops the cached metrics.
+  void clear();
+
+  // Measures text of any code point sequence.
+  template <class It>
+  float MeasureText(It begin, It end, unsigned int size);
+
+  const sf::Font* font_ = nullptr;
+  bool monospace_ = false;
+  std::uint64_t generation_ = 0;
+
+  // Node based, so `last_metrics_` stays valid when sizes are added.
+  std::unordered_map<unsigned int, SizeMetrics> sizes_;
+  // The console uses a single size, looked up without hashing.
+  unsigned int last_size_ = 0;
+  SizeMetrics* last_metrics_ = nullptr;
+};
+
+}  // namespace sfe
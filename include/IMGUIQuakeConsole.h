@@ -14,15 +14,17 @@
 /// This file contains base classes, out of which the IMGUIQuakeConsole is composed, and you can experiment with as well.
 ///
 /// The text area of the console is an IMGUIOstream, which inherits from std::ostream and you can do all the things that implies.
-/// The IMGUIOstream's streambuf parses ANSI color codes so you can add color formatting that way.
+/// The IMGUIOstream's streambuf is the sfe::ConsoleBuffer shared with the SFML console (ConsoleBuffer.hpp), it parses ANSI color codes so you can add color formatting that way.
+/// The pane only submits the lines that are visible, so a long scrollback doesn't cost frame time.
 ///
 /// IMGUIInputLine handles some IMGUI callbacks, and pushes user input into a stringstream on enter.  You can get the stream directly or get a line.
 ///
 /// Both the Input Line and the Ostream have render methods that draw them in whatever surrounding IMGUI context the caller has,
 /// and also helper methods to draw them in their own windows.
 ///
-/// a MultiStream is an ostream that forwards input to multiple other ostreams.
+/// a MultiStream is an ostream that forwards input to multiple other ostreams, see MultiStream.hpp.
 /// The console widget is a 'multistream' so you can mirror console output to a file or cout or whatever other streams you need.
+/// Output is forwarded on flush; the console flushes itself every render.
 
 /*
  This software is available under 2 licenses -- choose whichever you prefer.
@@ -37,10 +39,16 @@
 
 #include <unordered_set>
 #include <algorithm>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <vector>
 
 //dependencies
 #include <imgui.h>
 #include <misc/cpp/imgui_stdlib.h>
+#include "ConsoleBuffer.hpp"
+#include "MultiStream.hpp"
 #include "QuakeStyleConsole.h"
 
 namespace Virtuoso
@@ -50,14 +58,6 @@ inline const ImVec4 COMMENT_COLOR = ImVec4(1.0f, 0.8f, 0.6f, 1.0f);
 inline const ImVec4 ERROR_COLOR = ImVec4(2.0f, 0.2f, 0.2f, 1.0f);
 inline const ImVec4 WARNING_COLOR = ImVec4(1.0f, 1.0f, 0.0f, 1.0f);
 
-#define RED_BKGRND_COLOR IM_COL32(255, 0, 0, 255);
-#define GREEN_BKGRND_COLOR IM_COL32(0, 255, 0, 255);
-#define YELLOW_BKGRND_COLOR IM_COL32(255, 255, 0, 255);
-#define BLUE_BKGRND_COLOR IM_COL32(0, 0, 255, 255);
-#define MAGENTA_BKGRND_COLOR IM_COL32(255, 0, 255, 255);
-#define CYAN_BKGRND_COLOR IM_COL32(0, 255, 255, 255);
-#define WHITE_BKGRND_COLOR IM_COL32(255, 255, 255, 255);
-
 inline constexpr std::string_view TEXT_COLOR_RESET = "\u001b[0m";
 inline constexpr std::string_view TEXT_COLOR_BLACK = "\u001b[30m";
 inline constexpr std::string_view TEXT_COLOR_RED = "\u001b[31m";
@@ -84,115 +84,17 @@ inline constexpr std::string_view TEXT_COLOR_MAGENTA_BKGRND = "\u001b[45m";
 inline constexpr std::string_view TEXT_COLOR_CYAN_BKGRND = "\u001b[46m";
 inline constexpr std::string_view TEXT_COLOR_WHITE_BKGRND = "\u001b[47m";
 
-enum AnsiColorCode
-{
-    ANSI_RESET = 0,
-    ANSI_BRIGHT_TEXT = 1,
-
-    ANSI_BLACK = 30,
-    ANSI_RED = 31,
-    ANSI_GREEN = 32,
-    ANSI_YELLOW = 33,
-    ANSI_BLUE = 34,
-    ANSI_MAGENTA = 35,
-    ANSI_CYAN = 36,
-    ANSI_WHITE = 37,
-
-    ANSI_BLACK_BKGRND = 40,
-    ANSI_RED_BKGRND = 41,
-    ANSI_GREEN_BKGRND = 42,
-    ANSI_YELLOW_BKGRND = 43,
-    ANSI_BLUE_BKGRND = 44,
-    ANSI_MAGENTA_BKGRND = 45,
-    ANSI_CYAN_BKGRND = 46,
-    ANSI_WHITE_BKGRND = 47,
-};
-
-/// Stream Buffer for the IMGUI Console Terminal.  Breaks text stream into Lines, which are an array of formatted text sequences
-/// Formatting is presently handled via ANSI Color Codes.  Some other input transformation can be applied to the input before it hits this stream
-/// eg. to do syntax highlighting, etc.
-class ConsoleBuf : public std::streambuf
-{
-  public:
-    
-    struct FormattingParams
-    {
-        ImVec4 textColor = ImVec4(1.0, 1.0, 1.0, 1.0);
-        ImU32 backgroundColor = 0;
-        bool hasBackgroundColor = false;
-    };
-    
-    struct TextSequence
-    {
-        FormattingParams style;
-        std::string text = "";
-    };
-
-    struct Line
-    {
-        std::vector<TextSequence> sequences;
-
-        inline TextSequence &curSequence() { return sequences[sequences.size() - 1]; }
-        inline const TextSequence &curSequence() const { return sequences[sequences.size() - 1]; }
-    };
-
-    void clear();
-
-    inline void applyDefaultStyle(){currentStyle = defaultStyle;}
-    inline const Line &currentLine() const { return lines[lines.size() - 1]; }
-    inline const std::string &curStr() const { return currentLine().curSequence().text; }
-
-    ConsoleBuf();
-
-    inline const std::vector<Line>& getLines() const { return lines; }
-    
-    FormattingParams defaultStyle; ///< can change default text color and background
-
-  protected:
-    /// change formatting state based on an integer code in the ansi-code input stream.  called by the streambuf methods
-    void processANSICode(int code);
-
-    // -- streambuf overloads --
-    int overflow(int c);
-
-    FormattingParams currentStyle; ///< // current formatting
-    
-    bool brightText = false;                       ///< saw ansi code for bright-mode text
-    AnsiColorCode textCode = ANSI_RESET;           ///< ANSI color code we last saw for text
-
-    std::vector<Line> lines; ///< All output lines
-
-    bool parsingANSICode = false; ///< ANSI color code parser state variable
-    bool listeningDigits = false; ///< ANSI color code parser state variable - listening for next digit
-
-    std::stringstream numParse; ///< ANSI color code parser state variable - digit accumulator
-
-    inline Line &currentLine() { return lines[lines.size() - 1]; }
-    inline std::string &curStr() { return currentLine().curSequence().text; }
-};
-
-/// streambuffer implementation for MultiStream
-class MultiStreamBuf : public std::streambuf
-{
-  public:
-    std::unordered_set<std::ostream *> streams;
-
-    MultiStreamBuf() {}
-
-    int overflow(int in);
-
-    std::streamsize xsputn(const char *s, std::streamsize n);
-};
+/// ANSI codes understood by the console buffer, shared with the SFML console.
+using AnsiColorCode = sfe::AnsiColorCode;
+using enum sfe::AnsiColorCode;
 
 /// An ostream that is actually a container of ostream pointers, that pipes output to every ostream in the container
-class MultiStream : public std::ostream
+/// Output is buffered and forwarded on flush, eg. std::endl or std::flush.
+class MultiStream : public sfe::MultiStream
 {
-    MultiStreamBuf buf;
-
   public:
-    MultiStream() : std::ostream(&buf) {}
-
-    void addStream(std::ostream &str) { buf.streams.insert(&str); }
+    void addStream(std::ostream &str) { AddStream(str); }
+    void removeStream(std::ostream &str) { RemoveStream(str); }
 };
 
 /// A user input line that supports callbacks and pushes user input to a stream on enter
@@ -228,14 +130,21 @@ struct IMGUIInputLine
 
 /// GUI Ostream pane with ANSI Color Code Support
 /// Supports text filtering as well via 'filter' member.
+/// Lines are drawn through ImGuiListClipper, only the visible ones are submitted each frame.
+/// Widths of the lines and the lines passing the filter are kept across frames, so a frame only measures and filters the lines appended since the previous one.
 class IMGUIOstream : public std::ostream
 {
-    /// checks if an output line passes the filter
-    bool linePassFilter(const ConsoleBuf::Line &l) const;
-
   public:
-    ConsoleBuf strb;        ///< custom streambuf
-    ImGuiTextFilter filter; ///< Text filter.
+    /// Colors used for text without ANSI formatting.
+    struct FormattingParams
+    {
+        ImVec4 textColor = ImVec4(1.0, 1.0, 1.0, 1.0);
+        ImU32 backgroundColor = 0;
+        bool hasBackgroundColor = false;
+    };
+
+    sfe::ConsoleBuffer strb; ///< custom streambuf
+    ImGuiTextFilter filter;  ///< Text filter.
 
     bool autoScrollEnabled = true;
     bool shouldScrollToBottom = false;
@@ -249,9 +158,47 @@ class IMGUIOstream : public std::ostream
 
     /// Renders the control in whatever the surrounding IMGUI context is.
     void render();
-    
-    inline void applyDefaultStyle(){strb.applyDefaultStyle();}
-    inline ConsoleBuf::FormattingParams& defaultStyle(){return strb.defaultStyle;}
+
+    /// Copies the lines passing the filter to the clipboard, without formatting.
+    void copyToClipboard() const;
+
+    /// resets the formatting of the following output to defaultStyle
+    inline void applyDefaultStyle() { (*this) << TEXT_COLOR_RESET; }
+    inline FormattingParams &defaultStyle() { return style; }
+
+  private:
+    /// checks if an output line passes the filter
+    bool linePassFilter(const sfe::ConsoleBuffer::Line &l) const;
+
+    /// submits the text sequences of a single line
+    void renderLine(const sfe::ConsoleBuffer::Line &l) const;
+
+    /// width of a line as renderLine lays it out
+    float lineWidth(const sfe::ConsoleBuffer::Line &l) const;
+
+    /// measures and filters the lines completed since the last frame.  Starts over when the font or the filter changes.
+    void updateLineCache();
+
+    FormattingParams style; ///< can change default text color and background
+
+    /// Layout state of the completed lines, by their sfe::ConsoleBuffer line ids.
+    /// The current line may still grow, it is measured and filtered every frame instead.
+    struct LineCache
+    {
+        std::size_t measuredEndId = 0;    ///< id of the first line not measured yet
+        std::size_t filteredEndId = 0;    ///< id of the first line not filtered yet
+        const ImFont *font = nullptr;     ///< font the widths were measured with
+        float fontSize = 0.0f;            ///< font size the widths were measured with
+        std::string filterText;           ///< filter the filtered ids were collected with
+
+        /// candidates for the widest line : (id, width) pairs with decreasing widths, the front is the widest line.
+        /// A line that is narrower than a later one can never be the widest again, so it isn't kept.
+        std::deque<std::pair<std::size_t, float>> widest;
+
+        std::deque<std::size_t> filteredIds; ///< ids of the completed lines passing the filter
+    };
+
+    LineCache cache;
 };
 
 /// Quake style console : IMGUI Widget
@@ -264,7 +211,7 @@ class IMGUIQuakeConsole : public MultiStream
     Virtuoso::QuakeStyleConsole con; ///< implementation of the quake style console
     IMGUIOstream os;                 ///< IMGUI ostream pane
     IMGUIInputLine is;               ///< IMGUI input line
-    std::size_t prevLineCount = 0;   ///< previous line count for os; used to autoscroll when os gets a new line.
+    std::size_t prevLineCount = 0;   ///< previous count of lines appended to os; used to autoscroll when os gets a new line.
 
     ImFont* font = nullptr;
 
@@ -290,9 +237,9 @@ class IMGUIQuakeConsole : public MultiStream
 // ------------ANSI COLOR HELPERS-------------
 // -------------------------------------------
 
-ImU32 getANSIBackgroundColor(AnsiColorCode code);
-ImVec4 getAnsiTextColor(AnsiColorCode code);
-ImVec4 getAnsiTextColorBright(AnsiColorCode code);
+/// Convert a 0xRRGGBB color resolved by the console buffer (see sfe::ResolveColor) to an opaque ImGui color.
+ImU32 getANSIBackgroundColor(std::uint32_t rgb);
+ImVec4 getAnsiTextColor(std::uint32_t rgb);
 
 // -------------------------------------------
 // --------------Portable String Helpers------
@@ -322,16 +269,11 @@ inline static void Strtrim(char *s)
 // ----- IMGUIOstream Implementation ------ //
 // -------------------------------------------
 
-inline bool IMGUIOstream::linePassFilter(const ConsoleBuf::Line &l) const
+inline bool IMGUIOstream::linePassFilter(const sfe::ConsoleBuffer::Line &l) const
 {
-    for (const ConsoleBuf::TextSequence &s : l.sequences)
-    {
-        const char *item = s.text.c_str();
-        if (filter.PassFilter(item))
-            return true;
-    }
-
-    return false;
+    // the sequences of a line are stored back to back, so the whole line is matched at once
+    const std::string_view text = l.GetText();
+    return filter.PassFilter(text.data(), text.data() + text.size());
 }
 
 inline void IMGUIOstream::renderInWindow(bool &p_open, const char *title)
@@ -349,35 +291,184 @@ inline void IMGUIOstream::renderInWindow(bool &p_open, const char *title)
     ImGui::End();
 }
 
-inline void IMGUIOstream::render()
+inline void IMGUIOstream::renderLine(const sfe::ConsoleBuffer::Line &line) const
 {
-    for (const ConsoleBuf::Line& line : strb.getLines())
+    bool sameLine = false;
+
+    for (const sfe::ConsoleBuffer::TextSequence seq : line)
     {
-        if (!linePassFilter(line))
+        if (seq.text.empty())
             continue;
 
-        for (const ConsoleBuf::TextSequence &seq : line.sequences)
+        // sequences are parts of the same text, no spacing between them
+        if (sameLine)
+            ImGui::SameLine(0.0f, 0.0f);
+        sameLine = true;
+
+        const char *begin = seq.text.data();
+        const char *end = begin + seq.text.size();
+
+        // inverse swaps the colors, the default ones included; bold brightens the normal text colors
+        const sfe::TextStyle &textStyle = seq.style;
+        const bool inverse = textStyle.Has(sfe::STYLE_INVERSE);
+        const bool bold = textStyle.Has(sfe::STYLE_BOLD);
+        const bool hasTextColor = textStyle.foreground.kind != sfe::COLOR_DEFAULT;
+        const bool hasBackgroundColor = textStyle.background.kind != sfe::COLOR_DEFAULT;
+
+        ImVec4 textColor = style.textColor;
+        ImU32 backgroundColor = style.backgroundColor;
+        if (hasTextColor)
+            textColor = getAnsiTextColor(sfe::ResolveColor(textStyle.foreground, 0, bold));
+        if (hasBackgroundColor)
+            backgroundColor = getANSIBackgroundColor(sfe::ResolveColor(textStyle.background, 0));
+        if (inverse)
+        {
+            const ImVec4 newTextColor = hasBackgroundColor || style.hasBackgroundColor ? ImGui::ColorConvertU32ToFloat4(backgroundColor) : ImVec4(0.0, 0.0, 0.0, 1.0);
+            backgroundColor = ImGui::ColorConvertFloat4ToU32(textColor);
+            textColor = newTextColor;
+        }
+
+        const bool hasBackground = hasBackgroundColor || inverse || style.hasBackgroundColor;
+        if (hasBackground)
         {
-            if (seq.style.hasBackgroundColor)
-            {
-                ImVec2 textSize = ImGui::CalcTextSize(seq.text.c_str());
-                ImVec2 cursorScreenPos = ImGui::GetCursorScreenPos();
-                ImVec2 sum = ImVec2(textSize[0] + cursorScreenPos[0], textSize[1] + cursorScreenPos[1]);
-                ImGui::GetWindowDrawList()->AddRectFilled(cursorScreenPos, sum, seq.style.backgroundColor);
-            }
-
-            ImGui::TextColored(seq.style.textColor, "%s", seq.text.c_str());
-            ImGui::SameLine();
+            ImVec2 textSize = ImGui::CalcTextSize(begin, end);
+            ImVec2 cursorScreenPos = ImGui::GetCursorScreenPos();
+            ImVec2 sum = ImVec2(textSize[0] + cursorScreenPos[0], textSize[1] + cursorScreenPos[1]);
+            ImGui::GetWindowDrawList()->AddRectFilled(cursorScreenPos, sum, backgroundColor);
         }
 
+        ImGui::PushStyleColor(ImGuiCol_Text, textColor);
+        ImGui::TextUnformatted(begin, end);
+        ImGui::PopStyleColor();
+    }
+
+    // keep empty lines as tall as the others, the clipper expects equal heights
+    if (!sameLine)
         ImGui::NewLine();
+}
+
+inline float IMGUIOstream::lineWidth(const sfe::ConsoleBuffer::Line &line) const
+{
+    // summed per sequence, as that's how they're submitted
+    float width = 0.0f;
+    for (const sfe::ConsoleBuffer::TextSequence seq : line)
+    {
+        if (!seq.text.empty())
+            width += ImGui::CalcTextSize(seq.text.data(), seq.text.data() + seq.text.size()).x;
+    }
+    return width;
+}
+
+inline void IMGUIOstream::updateLineCache()
+{
+    const std::size_t firstId = strb.GetFirstLineId();
+    const std::size_t lastId = firstId + strb.GetLines().size() - 1;
+
+    const bool filtering = filter.IsActive();
+    const char *filterText = filtering ? filter.InputBuf : "";
+
+    if (cache.font != ImGui::GetFont() || cache.fontSize != ImGui::GetFontSize())
+    {
+        cache.widest.clear();
+        cache.measuredEndId = 0;
+        cache.font = ImGui::GetFont();
+        cache.fontSize = ImGui::GetFontSize();
+    }
+    if (cache.filterText != filterText)
+    {
+        cache.filteredIds.clear();
+        cache.filteredEndId = 0;
+        cache.filterText = filterText;
+    }
+
+    // forget the lines dropped from the buffer
+    while (!cache.widest.empty() && cache.widest.front().first < firstId)
+        cache.widest.pop_front();
+    while (!cache.filteredIds.empty() && cache.filteredIds.front() < firstId)
+        cache.filteredIds.pop_front();
+
+    for (std::size_t id = std::max(std::min(cache.measuredEndId, cache.filteredEndId), firstId); id < lastId; ++id)
+    {
+        const sfe::ConsoleBuffer::Line line = strb.GetLine(id - firstId);
+
+        if (id >= cache.measuredEndId)
+        {
+            const float width = lineWidth(line);
+            while (!cache.widest.empty() && cache.widest.back().second <= width)
+                cache.widest.pop_back();
+            cache.widest.emplace_back(id, width);
+        }
+
+        if (id >= cache.filteredEndId && filtering && linePassFilter(line))
+            cache.filteredIds.push_back(id);
     }
+    cache.measuredEndId = std::max(cache.measuredEndId, lastId);
+    cache.filteredEndId = std::max(cache.filteredEndId, lastId);
+}
+
+inline void IMGUIOstream::render()
+{
+    updateLineCache();
+
+    const sfe::ConsoleBuffer::Lines lines = strb.GetLines();
+    const std::size_t firstId = strb.GetFirstLineId();
+    const sfe::ConsoleBuffer::Line lastLine = lines[lines.size() - 1];
+
+    // the last line is left out while it's empty
+    const bool filtering = filter.IsActive();
+    const bool showLastLine = !lastLine.IsEmpty() && (!filtering || linePassFilter(lastLine));
+
+    int count = filtering ? static_cast<int>(cache.filteredIds.size()) : static_cast<int>(lines.size()) - 1;
+    if (showLastLine)
+        ++count;
+
+    // every line is a single row of text, so the clipper can skip the invisible ones by the line height alone
+    ImGuiListClipper clipper;
+    clipper.Begin(count, ImGui::GetTextLineHeightWithSpacing());
+    while (clipper.Step())
+    {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i)
+        {
+            if (!filtering)
+                renderLine(lines[i]);
+            else if (i < static_cast<int>(cache.filteredIds.size()))
+                renderLine(lines[cache.filteredIds[i] - firstId]);
+            else
+                renderLine(lastLine);
+        }
+    }
+    clipper.End();
+
+    // the clipped lines aren't submitted, so the widest line is reserved explicitly to keep the horizontal scroll range stable
+    float width = showLastLine ? lineWidth(lastLine) : 0.0f;
+    if (!cache.widest.empty())
+        width = std::max(width, cache.widest.front().second);
+    if (width > 0.0f)
+        ImGui::Dummy(ImVec2(width, 0.0f));
 
     if ((autoScrollEnabled && shouldScrollToBottom) || (autoScrollEnabled && ImGui::GetScrollY() >= ImGui::GetScrollMaxY()))
         ImGui::SetScrollHereY(1.0f);
     shouldScrollToBottom = false;
 }
 
+inline void IMGUIOstream::copyToClipboard() const
+{
+    // the clipper skips invisible lines, so logging the rendered items would only copy the visible ones
+    const sfe::ConsoleBuffer::Lines lines = strb.GetLines();
+    const bool filtering = filter.IsActive();
+
+    std::string text;
+    for (int i = 0; i < strb.size(); ++i)
+    {
+        if (filtering && !linePassFilter(lines[i]))
+            continue;
+        text += lines[i].GetText();
+        text += '\n';
+    }
+
+    ImGui::SetClipboardText(text.c_str());
+}
+
 // -------------------------------------------
 // --- IMGUIQuakeConsole Implementation --- //
 // -------------------------------------------
@@ -404,6 +495,10 @@ inline void IMGUIQuakeConsole::render(const char *title, bool& p_open)
 {
     if (!p_open) return;
 
+    // continue the commands running across frames (see ConsoleTask), then forward the output written since the last frame to the panes
+    con.runTasks();
+    flush();
+
     if (font)
     {
         ImGui::PushFont(font);
@@ -469,23 +564,27 @@ inline void IMGUIQuakeConsole::render(const char *title, bool& p_open)
 
     ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(4, 1)); // Tighten spacing
     if (copy_to_clipboard)
-        ImGui::LogToClipboard();
+        os.copyToClipboard();
 
     os.render();
 
-    if (prevLineCount < os.strb.getLines().size())
+    // counted over all appended lines, the pane keeps the same size once it reaches its line limit
+    if (prevLineCount < os.strb.GetAppendedLinesCount())
     {
         os.shouldScrollToBottom = true;
     }
-    prevLineCount = os.strb.getLines().size();
-
-    if (copy_to_clipboard)
-        ImGui::LogFinish();
+    prevLineCount = os.strb.GetAppendedLinesCount();
 
     ImGui::PopStyleVar();
     ImGui::EndChild();
     ImGui::Separator();
 
+    // Ctrl+C stops the running commands
+    if (con.taskCount() && ImGui::GetIO().KeyCtrl && ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_C)))
+    {
+        con.cancelTasks();
+    }
+
     if (is.render())
     {
         HistoryPos = -1;
@@ -544,28 +643,17 @@ inline void IMGUIQuakeConsole::textCompletionCallback(ImGuiInputTextCallbackData
         word_start--;
     }
 
-    // Build a list of candidates
-    ImVector<std::string> candidates;
-
-    // autocomplete commands...
-    for (auto it = con.getCommandTable().begin(); it != con.getCommandTable().end(); it++)
-    {
-        if (Strnicmp(it->first.c_str(), word_start, (int)(word_end - word_start)) == 0)
-        {
-            candidates.push_back(it->first);
-        }
-    }
+    // Build a list of candidates, the console keeps the names sorted
+    const std::string_view prefix(word_start, word_end - word_start);
+    const auto commands = con.getCommandIndex().findPrefix(prefix);
+    const auto cvars = con.getCVarIndex().findPrefix(prefix);
 
-    // ... and autcomplete variables
-    for (auto it = con.getCVarReadTable().begin(); it != con.getCVarReadTable().end(); it++)
-    {
-        if (Strnicmp(it->first.c_str(), word_start, (int)(word_end - word_start)) == 0)
-        {
-            candidates.push_back(it->first);
-        }
-    }
+    // autocomplete commands and variables
+    std::vector<std::string> candidates;
+    candidates.reserve((commands.second - commands.first) + (cvars.second - cvars.first));
+    std::merge(commands.first, commands.second, cvars.first, cvars.second, std::back_inserter(candidates), Virtuoso::CompletionIndex::less);
 
-    if (candidates.Size == 0)
+    if (candidates.empty())
     {
         // No match
         //AddLog("No match for %.*s, , word_start);
@@ -574,7 +662,7 @@ inline void IMGUIQuakeConsole::textCompletionCallback(ImGuiInputTextCallbackData
         (*this) << ' ' << word_start;
         (*this) << "!\n";
     }
-    else if (candidates.Size == 1)
+    else if (candidates.size() == 1)
     {
         // Single match. Delete the beginning of the word and replace it entirely so we've got nice casing.
         data->DeleteChars((int)(word_start - data->Buf), (int)(word_end - word_start));
@@ -590,7 +678,7 @@ inline void IMGUIQuakeConsole::textCompletionCallback(ImGuiInputTextCallbackData
         {
             int c = 0;
             bool all_candidates_matches = true;
-            for (int i = 0; i < candidates.Size && all_candidates_matches; i++)
+            for (size_t i = 0; i < candidates.size() && all_candidates_matches; i++)
                 if (i == 0)
                     c = toupper(candidates[i][match_len]);
                 else if (c == 0 || c != toupper(candidates[i][match_len]))
@@ -608,294 +696,19 @@ inline void IMGUIQuakeConsole::textCompletionCallback(ImGuiInputTextCallbackData
 
         // List matches
         (*this) << "Possible matches:\n";
-        for (int i = 0; i < candidates.Size; i++)
+        for (size_t i = 0; i < candidates.size(); i++)
             (*this) << "- " << candidates[i] << '\n';
     }
 }
 
-inline ImU32 getANSIBackgroundColor(AnsiColorCode code)
-{
-    switch (code)
-    {
-    case ANSI_RESET:
-        return 0;
-    case ANSI_BLACK_BKGRND:
-        return 0;
-    case ANSI_RED_BKGRND:
-        return RED_BKGRND_COLOR;
-    case ANSI_GREEN_BKGRND:
-        return GREEN_BKGRND_COLOR;
-    case ANSI_YELLOW_BKGRND:
-        return YELLOW_BKGRND_COLOR;
-    case ANSI_BLUE_BKGRND:
-        return BLUE_BKGRND_COLOR;
-    case ANSI_MAGENTA_BKGRND:
-        return MAGENTA_BKGRND_COLOR;
-    case ANSI_CYAN_BKGRND:
-        return CYAN_BKGRND_COLOR;
-    case ANSI_WHITE_BKGRND:
-        return WHITE_BKGRND_COLOR;
-    default:
-        return 0;
-    }
-}
-
-inline ImVec4 getAnsiTextColor(AnsiColorCode code)
-{
-    switch (code)
-    {
-    case ANSI_RESET:
-        return ImVec4(1.0, 1.0, 1.0, 1.0);
-    case ANSI_BLACK:
-        return ImVec4(0.0, 0.0, 0.0, 1.0);
-    case ANSI_RED:
-        return ImVec4(0.75, 0.0, 0.0, 1.0);
-    case ANSI_GREEN:
-        return ImVec4(0.0, 0.750, 0.0, 1.0);
-    case ANSI_YELLOW:
-        return ImVec4(0.750, 0.750, 0.0, 1.0);
-    case ANSI_BLUE:
-        return ImVec4(0.0, 0.0, 0.750, 1.0);
-        ;
-    case ANSI_MAGENTA:
-        return ImVec4(0.750, 0.0, 0.750, 1.0);
-        ;
-    case ANSI_CYAN:
-        return ImVec4(0.0, 0.750, 0.750, 1.0);
-        ;
-    case ANSI_WHITE:
-        return ImVec4(0.750, 0.750, 0.750, 1.0);
-        ;
-    default:
-        return ImVec4(0.0, 0.0, 0.0, 1.0);
-    }
-}
-
-inline ImVec4 getAnsiTextColorBright(AnsiColorCode code)
-{
-    switch (code)
-    {
-    case ANSI_RESET:
-        return ImVec4(1.0, 1.0, 1.0, 1.0);
-    case ANSI_BLACK:
-        return ImVec4(0.0, 0.0, 0.0, 1.0);
-    case ANSI_RED:
-        return ImVec4(1.0, 0.0, 0.0, 1.0);
-    case ANSI_GREEN:
-        return ImVec4(0.0, 1.0, 0.0, 1.0);
-    case ANSI_YELLOW:
-        return ImVec4(1.0, 1.0, 0.0, 1.0);
-    case ANSI_BLUE:
-        return ImVec4(0.0, 0.0, 1.0, 1.0);
-        ;
-    case ANSI_MAGENTA:
-        return ImVec4(1.0, 0.0, 1.0, 1.0);
-        ;
-    case ANSI_CYAN:
-        return ImVec4(0.0, 1.0, 1.0, 1.0);
-        ;
-    case ANSI_WHITE:
-        return ImVec4(1.0, 1.0, 1.0, 1.0);
-        ;
-    default:
-        return ImVec4(0.0, 0.0, 0.0, 1.0);
-    }
-}
-
-// --------------------------------------
-// --- MultiStreamBuf implementation ---
-// --------------------------------------
-
-inline int MultiStreamBuf::overflow(int in)
-{
-    char c = in; ///\todo check for eof, etc?
-    for (std::ostream *str : streams)
-    {
-        (*str) << c;
-    }
-    return 1;
-}
-
-inline std::streamsize MultiStreamBuf::xsputn(const char *s, std::streamsize n)
-{
-    std::streamsize ssz = 0;
-
-    for (std::ostream *str : streams)
-    {
-        ssz = str->rdbuf()->sputn(s, n);
-    }
-
-    return ssz;
-}
-
-// --------------------------------------
-// ---- ConsoleBuf implementation -------
-// --------------------------------------
-
-inline void ConsoleBuf::clear()
-{
-    // swap forces reallocation, unlike clear
-    std::vector<Line> x;
-    lines.swap(x);
-    //lines.clear();
-
-    lines.push_back(Line());
-    currentLine().sequences.push_back(TextSequence()); // start a new run of chars with default formatting
-}
-
-inline void ConsoleBuf::processANSICode(int code)
-{
-    switch (code)
-    {
-    case ANSI_RESET:
-        
-        currentStyle = defaultStyle;
-            
-        break;
-    case ANSI_BRIGHT_TEXT:
-        brightText = true;
-        if (textCode)
-        {
-            currentStyle.textColor = getAnsiTextColorBright(textCode);
-        }
-        break;
-    case ANSI_BLACK:
-    case ANSI_RED:
-    case ANSI_GREEN:
-    case ANSI_YELLOW:
-    case ANSI_BLUE:
-    case ANSI_MAGENTA:
-    case ANSI_CYAN:
-    case ANSI_WHITE:
-        textCode = (AnsiColorCode)code;
-
-        if (brightText)
-        {
-            currentStyle.textColor = getAnsiTextColorBright((AnsiColorCode)code);
-        }
-        else
-        {
-            currentStyle.textColor = getAnsiTextColor((AnsiColorCode)code);
-        }
-        break;
-    case ANSI_BLACK_BKGRND:
-    case ANSI_RED_BKGRND:
-    case ANSI_GREEN_BKGRND:
-    case ANSI_YELLOW_BKGRND:
-    case ANSI_BLUE_BKGRND:
-    case ANSI_MAGENTA_BKGRND:
-    case ANSI_CYAN_BKGRND:
-    case ANSI_WHITE_BKGRND:
-        currentStyle.hasBackgroundColor = true;
-        currentStyle.backgroundColor = getANSIBackgroundColor((AnsiColorCode)code);
-        break;
-    default:
-        std::cerr << "unknown ansi code " << code << " in output\n";
-        return;
-    }
-}
-
-inline int ConsoleBuf::overflow(int c)
+inline ImU32 getANSIBackgroundColor(std::uint32_t rgb)
 {
-    if (c != EOF)
-    {
-        if (parsingANSICode)
-        {
-            bool error = false;
-
-            if (std::isdigit((char)c) && listeningDigits)
-            {
-                numParse << (char)c;
-            }
-            else
-            {
-                switch (c)
-                {
-                case 'm': // end of ansi code; apply color formatting to new sequence
-                {
-                    parsingANSICode = false;
-
-                    int x;
-                    if (numParse >> x)
-                    {
-                        processANSICode(x);
-                    }
-
-                    numParse.clear();
-
-                    brightText = false;
-
-                    currentLine().sequences.push_back({currentStyle, "" });
-
-                    break;
-                }
-                case '[':
-                {
-                    listeningDigits = true;
-                    numParse.clear();
-                    break;
-                }
-                case ';':
-                {
-                    int x;
-                    numParse >> x;
-
-                    numParse.clear();
-
-                    processANSICode(x);
-
-                    break;
-                }
-                default:
-                {
-                    error = true;
-                    break;
-                }
-                }
-
-                if (error)
-                {
-                    numParse.clear();
-                    listeningDigits = false;
-                    parsingANSICode = false;
-
-                    std::cerr << c;
-                    //curStr() += (char)c;
-                }
-            }
-        }
-        else
-        {
-            switch (c)
-            {
-            case '\u001b':
-            {
-                parsingANSICode = true;
-                numParse.clear();
-                break;
-            }
-            case '\n':
-            {
-                //currentline add \n
-                lines.push_back(Line());
-                currentLine().sequences.push_back(TextSequence({currentStyle, "",}));
-                break;
-            }
-            default:
-            {
-                //std::cerr <<c;
-                curStr() += (char)c;
-            }
-            }
-        }
-    }
-    return c;
+    return IM_COL32((rgb >> 16) & 0xFF, (rgb >> 8) & 0xFF, rgb & 0xFF, 255);
 }
 
-inline ConsoleBuf::ConsoleBuf()
+inline ImVec4 getAnsiTextColor(std::uint32_t rgb)
 {
-    lines.push_back(Line());
-    currentLine().sequences.push_back(TextSequence()); // start a new run of chars with default formatting
+    return ImVec4(((rgb >> 16) & 0xFF) / 255.0f, ((rgb >> 8) & 0xFF) / 255.0f, (rgb & 0xFF) / 255.0f, 1.0f);
 }
 
 // --------------------------------------
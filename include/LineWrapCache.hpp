@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "ConsoleBuffer.hpp"
+#include "FontMetricsCache.hpp"
+
+namespace sfe {
+
+// Soft wrapping of `ConsoleBuffer` lines into rows that fit a width.
+//
+// Rows of a line are computed when they are first asked for and cached by the
+// stable line id (see `ConsoleBuffer::GetFirstLineId()`) until the width, the
+// character size or the font metrics change. Nothing is wrapped ahead of time,
+// so a resize doesn't re-wrap the scrollback: only the lines asked for after
+// it, typically the visible ones, are wrapped again.
+//
+// Lines break after the last space that fits into the row; words longer than
+// a row break between characters. Spaces at the end of a row may hang past
+// the width, as they are invisible.
+class LineWrapCache {
+ public:
+  // Offsets of the first characters of rows in the text of a line, counted
+  // over all its text sequences.
+  typedef std::vector<std::uint32_t> Breaks;
+
+  // Sets the metrics text is measured with. The cache must outlive this one.
+  // Drops wrapped lines, as does any change of the metrics.
+  void SetFontMetrics(FontMetricsCache& metrics);
+  // Sets the character size text is measured with. Drops wrapped lines.
+  void SetCharacterSize(unsigned int size);
+  // Sets the width of rows in the units of the font metrics. 0 disables
+  // wrapping. Drops wrapped lines.
+  void SetWidth(float width);
+  float GetWidth() const;
+
+  // Returns where the rows of the line with the given index start, except for
+  // the first row. Empty for lines that fit into a single row. The reference
+  // is valid until the buffer or the cache changes.
+  const Breaks& GetBreaks(const ConsoleBuffer& buffer, size_t index);
+  // Returns number of rows of the line with the given index, at least 1.
+  size_t GetRowsCount(const ConsoleBuffer& buffer, size_t index);
+
+  // Returns number of wrapped lines in the cache.
+  size_t size() const;
+
+  // Drops all wrapped lines.
+  void clear();
+
+ private:
+  // Drops the lines that were removed from the buffer or may have changed.
+  void Sync(const ConsoleBuffer& buffer);
+
+  // Computes rows of a single line.
+  Breaks Wrap(const ConsoleBuffer::Line& line) const;
+
+  FontMetricsCache* metrics_ = nullptr;
+  // Generation of `metrics_` the cached lines were wrapped with.
+  std::uint64_t metrics_generation_ = 0;
+  // Same default as `ConsoleView`.
+  unsigned int character_size_ = 30u;
+  float width_ = 0.F;
+
+  // Rows of the wrapped lines by line id. Ordered, so the lines dropped from
+  // the buffer are erased as a single range.
+  std::map<size_t, Breaks> lines_;
+  // Id of the buffer's last line at the last sync. Lines starting from this
+  // one may have changed since.
+  size_t mutable_id_ = 0;
+  // Buffer revision at the last sync.
+  std::uint64_t revision_ = 0;
+};
+
+}  // namespace sfe
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+namespace sfe {
+
+// MultiStreamBuffer class: streambuffer implementation that forwards input to
+// multiple ostreams.
+//
+// Output is collected in the buffer's own put area and forwarded to every
+// stream in whole chunks, when the put area fills up or on `sync()` (e.g.
+// `std::endl` or `std::flush`). Sync also flushes the streams. Output written
+// without a flush reaches the streams on the next one.
+//
+// A stream in a failed state skips the output, it does not fail the others.
+class MultiStreamBuffer : public std::streambuf {
+ public:
+  MultiStreamBuffer() { setp(data_, data_ + kSize); }
+
+  // Adds a stream to forward data to. Adding it again has no effect.
+  void AddStream(std::ostream& str) {
+    if (std::find(streams_.begin(), streams_.end(), &str) == streams_.end()) {
+      streams_.push_back(&str);
+    }
+  }
+
+  // Stops forwarding data to the stream. Pending output is forwarded first.
+  void RemoveStream(std::ostream& str) {
+    Forward();
+    const auto it = std::find(streams_.begin(), streams_.end(), &str);
+    if (it != streams_.end()) {
+      streams_.erase(it);
+    }
+  }
+
+ protected:
+  // Forwards the put area to the streams when it is full.
+  int overflow(int in) override {
+    Forward();
+    if (in != traits_type::eof()) {
+      *pptr() = traits_type::to_char_type(in);
+      pbump(1);
+    }
+    return traits_type::not_eof(in);
+  }
+
+  // Copies the characters into the put area, large writes are forwarded
+  // directly after the pending output.
+  std::streamsize xsputn(const char* s, std::streamsize n) override {
+    if (n <= epptr() - pptr()) {
+      std::memcpy(pptr(), s, static_cast<size_t>(n));
+      pbump(static_cast<int>(n));
+      return n;
+    }
+
+    Forward();
+    if (n >= static_cast<std::streamsize>(kSize)) {
+      ForwardToStreams(s, n);
+    } else {
+      std::memcpy(pptr(), s, static_cast<size_t>(n));
+      pbump(static_cast<int>(n));
+    }
+    return n;
+  }
+
+  // Forwards the pending output and flushes the streams.
+  int sync() override {
+    Forward();
+    for (std::ostream* str : streams_) {
+      str->flush();
+    }
+    return 0;
+  }
+
+ private:
+  static constexpr size_t kSize = 4096u;
+
+  // Forwards and empties the put area.
+  void Forward() {
+    if (pptr() != pbase()) {
+      ForwardToStreams(pbase(), pptr() - pbase());
+      setp(data_, data_ + kSize);
+    }
+  }
+
+  void ForwardToStreams(const char* s, std::streamsize n) {
+    for (std::ostream* str : streams_) {
+      str->write(s, n);
+    }
+  }
+
+  // Output streams to forward data to.
+  std::vector<std::ostream*> streams_;
+  char data_[kSize];
+};
+
+// MultiStream class: ostream that duplicates output to multiple other streams.
+class MultiStream : public std::ostream {
+  // Underlying buffer for managing output duplication.
+  MultiStreamBuffer buf;
+
+ public:
+  MultiStream() : std::ostream(&buf) {}
+
+  // Adds a stream to the buffer, allowing output to be mirrored to it.
+  void AddStream(std::ostream& str) { buf.AddStream(str); }
+  // Stops mirroring output to the stream.
+  void RemoveStream(std::ostream& str) { buf.RemoveStream(str); }
+};
+
+}  // namespace sfe
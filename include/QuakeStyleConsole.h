@@ -23,6 +23,13 @@
  -- echo : eg. echo health - prints the value of the variable to the console
  -- set : eg. set health 25 - sets the value of a variable in the console
  -- runFile <filename> - execute all the commands in a file as if the user typed them in sequence.
+ Files run as a batch (see scriptOptions): lines are not echoed or added to history, and the time taken is reported.
+ The file runs as a task (see ConsoleTask), a time slice per frame, so a long script doesn't stall the game.  Ctrl+C cancels it in the frontends.
+ Variables changed by the file notify their listeners once, after the last line (see CVarTransaction).
+ -- stats : prints call counts and execution times of every command, plus the timers, counters and gauges recorded by the frontend.  stats reset zeroes them.
+ Compile with VIRTUOSO_CONSOLE_STATS=0 to remove the instrumentation.
+
+ Commands bound with ExecutionPolicy::Worker or WorkerParallel run on a thread pool owned by the console.  Their output appears once they are done.
 
  --$: Strings prefixed with $ are interpreted as variable names to dereference, and the identifiers will be replaced in the input with the variable value - eg.
  var x listCmd
@@ -46,6 +53,47 @@
 #include <sstream>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <charconv>
+#include <type_traits>
+#include <cctype>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <iomanip>
+#include <cassert>
+#include <cerrno>
+#include <typeinfo>
+#include <unordered_set>
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <stdexcept>
+#include <condition_variable>
+#include <future>
+#include <span>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace Virtuoso
 {
@@ -67,888 +115,4210 @@ std::istream& operator>>(std::istream& is, std::optional<T>& opt) {
     return is;
 }
 
-class QuakeStyleConsole
+/// Read-only view of a whole file, memory mapped where the platform allows it.
+/// Falls back to reading the file into memory if it can't be mapped.
+class MappedFile
 {
-  public:                                                // the methods in this section are what you should use in your code
-    static const unsigned int defaultHistorySize = 100u; ///size of the history file
+  public:
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
 
-    typedef std::function<void(std::istream &is, std::ostream &os)> ConsoleFunc;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
 
-    typedef std::unordered_map<std::string, ConsoleFunc> CommandTable;
-    typedef std::unordered_map<std::string, ConsoleFunc> CVarReadTable;
-    typedef std::unordered_map<std::string, ConsoleFunc> CVarPrintTable;
-    typedef std::unordered_map<std::string, std::string> HelpTable;
+    bool is_open() const { return opened; }
 
-    /// Constructor binds the default commands to the command table & initializes history buffer
-    QuakeStyleConsole(std::size_t maxHistory = defaultHistorySize, bool enablePrebindedCommands = true);
+    /// contents of the file, valid as long as the MappedFile lives
+    std::string_view view() const { return std::string_view(data, size); }
 
-    // --------------------------------------//
-    /* --------- COMMAND EXECUTION --------- */
-    // --------------------------------------//
-    // call one of these functions to make the console do things - eg. the first one when you press enter
-    // and your GUI console widget gives you a string
-    // You can execute all commands in an input stream until EOF with executeUntilEOF(),
-    // or run every line in a file (eg. a startup or debug playback file) with executeFile()
+  private:
+    const char *data = nullptr;
+    std::size_t size = 0;
+    bool opened = false;
+    bool mapped = false;
+    std::string contents; ///< used when the file is not mapped
+};
 
-    /// Execute command line passed in as string.  Console output goes to "output"
-    void commandExecute(const std::string &str, std::ostream &output);
+/// Window of the most recent distinct command lines, oldest first.
+/// Lines live in slots of strings that are reused once the window is full, so recording a line doesn't allocate after warm up,
+/// and a map from the text to its slot finds a repeated line with one hash lookup.
+/// The age order is a separate log of (sequence number, slot) entries in the order they were added.  Repeating a line moves it to
+/// the newest position by appending an entry and marking its old one dead, without touching the other lines, and a Fenwick tree
+/// over the live entries turns an age index into a log position (and back) in O(log N).  The log is compacted when it fills up,
+/// at most once every capacity() pushes.
+/// Every added or moved line gets the next sequence number, which identifies it while it's in the window, eg. for HistorySearchIndex.
+class HistoryBuffer
+{
+  public:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
 
-    /// Get a command line from the input stream and execute it.   Console output goes to "output"
-    void commandExecute(std::istream &input, std::ostream &output);
+    explicit HistoryBuffer(std::size_t maxCapacity);
 
-    /// execute commands from an istream until EOF
-    void executeUntilEOF(std::istream &f, std::ostream &output);
+    /// adds a line as the newest one, dropping the oldest line if the window is full
+    void push(std::string_view line);
 
-    /// execute commands from a file (named by the input string 'f') until EOF
-    void executeFile(const std::string &f, std::ostream &output);
+    /// removes all lines
+    void clear();
 
-    //------------------------------------//
-    /*----------- ADDING CVARS -----------*/
-    //-------------------------------------//
-    // Call one of these to add variables (eg, Player.health) from your c++ code to the console.
-    // This makes them available to built in commands using the given "varname" - dereference them with $, print them with echo, and set them with "set"
+    /// changes the maximum number of lines, dropping the oldest ones that don't fit
+    void capacity(std::size_t newCapacity);
+    std::size_t capacity() const { return lines.size(); }
 
-    /// function which takes in a string and a variable from client code we want to associate with it in the console.  Takes in an optional help string to describe the variable to the user.
-    template <class T>
-    void bindCVar(const std::string &varname, T &var, const std::string &help = "");
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
 
-    // ------------------------------------//
-    /* --------- ADDING COMMANDS ----------*/
-    // ------------------------------------//
-    // You should call console.bindCommand() with the command name you want and a C++ function from your code with an arbitrary signature.  Optionally provide a help string for the command as a third argument
-    // You shouldn't need to worry about which overload or template arguments to use - it should resolve automatically.
-    // If your function has arguments, so long as there is an istream operator to read them from the input,
-    // the console will automatically parse them with variadic template and lambda magic, so you never have to write a parser
-    // IF YOU ARE USING A MEMBER FUNCTION - we need to wrap the "this" pointer too, so call bindMemberCommand() which takes the object reference as the first argument after the command name
+    /// total length of the lines in the window
+    std::size_t bytes() const { return byteCount; }
 
-    /// add a command to the console using a function pointer that takes no arguments.  set the associated help string to the "help" argument
-    void bindCommand(const std::string &commandName, void (*fptr)(void), const std::string &help = "");
+    /// line by age, 0 is the oldest.  O(log N)
+    const std::string &operator[](std::size_t i) const { return lines[order[position(i)].slot]; }
+    const std::string &back() const { return (*this)[count - 1]; }
 
-    ///add a command to the console using a function pointer that takes arbitrary arguments, then set the associated help string to the "help" argument
-    template <typename... Args>
-    void bindCommand(const std::string &commandName, void (*fptr)(Args...), const std::string &help = "");
+    /// sequence number of the line with index i, increasing with the index
+    std::uint64_t sequence(std::size_t i) const { return order[position(i)].sequence; }
+    /// sequence number of the last added or moved line, 0 before any
+    std::uint64_t lastSequence() const { return nextSequence - 1; }
+    /// index of the line with a sequence number, npos if it left the window or was moved
+    std::size_t find(std::uint64_t seq) const;
 
-    ///add a command to the console using a function object with arbitrary arguments, then set the associated help string to the optional "help" argument
-    template <typename... Args>
-    void bindCommand(const std::string &commandName, std::function<void(Args...)> fun, const std::string &help = "");
+  private:
+    static constexpr std::uint32_t deadSlot = ~std::uint32_t(0);
 
-    ///add a command to the console using universal reference object with arbitrary arguments, then set the associated help string to the optional "help" argument
-    template <typename Func>
-    void bindCommand(const std::string &commandName, Func&& func, const std::string &help = "");
+    struct Entry
+    {
+        std::uint64_t sequence;
+        std::uint32_t slot; ///< deadSlot once the line left the window or moved to a newer entry
+    };
 
-    /// same as bindCommand, but for a member function of an object.  Object instance is first argument after the command name
-    template <typename O, typename... Args>
-    void bindMemberCommand(const std::string &commandName, O &obj, void (O::*fptr)(Args...), const std::string &help = "");
+    /// log position of the line with age index i
+    std::size_t position(std::size_t i) const;
+
+    /// appends a live entry for the slot, compacting the log first if it's full
+    void append(std::uint32_t slot);
+    void kill(std::size_t pos);
+    void popFront();
+
+    /// drops the dead entries from the log and rebuilds the tree
+    void compact();
+    void resetSlots(std::size_t newCapacity);
+
+    /// Fenwick tree over the log positions, 1 for a live entry
+    void addLive(std::size_t pos, int delta);
+    std::size_t liveBefore(std::size_t pos) const;
+
+    std::vector<std::string> lines;                         ///< text by slot
+    std::vector<std::uint32_t> freeSlots;                   ///< slots not holding a line of the window
+    std::vector<std::uint32_t> positions;                   ///< log position of the live entry of each used slot
+    std::unordered_map<std::string_view, std::uint32_t> slotOf; ///< slot of each line of the window, keys point into lines
+    std::vector<Entry> order;                               ///< log of entries, sequence numbers increasing, room for twice the capacity
+    std::vector<std::uint32_t> liveTree;                    ///< Fenwick tree of the live entries, one more element than the room of order
+    std::size_t head = 0;                                   ///< entries before it are dead
+    std::uint64_t nextSequence = 1;
+    std::size_t count = 0;
+    std::size_t byteCount = 0;
+};
 
-    /// the bindCommand that actually does the work of adding commands to the table AFTER they've been coerced to a ConsoleFunc that takes the input/output from executeCommand.  Takes optional help string.
-    void bindCommand(const std::string &commandName, ConsoleFunc f, const std::string &help = "");
+/// N-gram index over the lines of a HistoryBuffer, for incremental reverse search of history.
+/// Lines are indexed once, by the sequence numbers of the buffer, so update() only looks at the lines added since its last call.
+/// Every 1, 2 and 3 character substring of a line is a key, matched ignoring case.  A query only checks the lines in the shortest
+/// posting list of its n-grams (trigrams, or the whole query if shorter), walked from the newest, so a keystroke costs about as much
+/// as the lines it has to skip, not the size of history.
+/// Lines that left the window stay in the posting lists and are skipped, until they outnumber the window and the index is rebuilt
+class HistorySearchIndex
+{
+  public:
+    /// indexes the lines added to history since the last call
+    void update(const HistoryBuffer &history);
 
-    /// unbind a command from the console
-    void unbindCommand(const std::string &commandName);
+    /// index in history of the newest line containing query with a sequence number below before, HistoryBuffer::npos if none.
+    /// Pass the sequence number of the current match to find the next older one
+    std::size_t findBefore(const HistoryBuffer &history, std::string_view query, std::uint64_t before = UINT64_MAX);
 
-    /// unbind all commands from the console
-    void unbindAll();
+    void clear();
 
-    // ------------------------------------//
-    /* --------- HISTORY FILES ----------- */
-    // ------------------------------------//
-    /* Saving and loading the history buffer of previously executed commands to file  */
+    /// true if text contains query, ignoring case
+    static bool containsNoCase(std::string_view text, std::string_view query);
 
-    /// populate the command buffer from an input file named by string inFile
-    bool loadHistoryBuffer(const std::string &inFile);
+  private:
+    /// key of the n-gram at p, n from 1 to 3
+    static std::uint32_t gram(const char *p, std::size_t n);
 
-    /// write the history buffer to file named by string outFile
-    void saveHistoryBuffer(const std::string &outFile);
+    void index(std::string_view line, std::uint64_t seq);
 
-    /// populate the command buffer from an input file named by istream inFile
-    void loadHistoryBuffer(std::istream &inFile);
+    std::unordered_map<std::uint32_t, std::vector<std::uint64_t>> postings; ///< sequence numbers of the lines by n-gram, increasing
+    std::vector<std::uint32_t> lineGrams;                                     ///< distinct n-grams of the line being indexed
+    std::uint64_t indexedSequence = 0;                                        ///< lines up to this sequence number are indexed
+    std::size_t indexedLines = 0;                                             ///< lines indexed since the last rebuild
+};
 
-    /// write the history buffer to file named by ostream outFile
-    void saveHistoryBuffer(std::ofstream &outfile);
+/// When a HistoryJournal makes appended records durable.  Records are handed to the operating system as soon as they are appended,
+/// so a crash of the program never loses them; syncing protects against losing them to a crash of the system
+enum class HistorySyncPolicy
+{
+    Never,    ///< leave it to the operating system
+    Always,   ///< after every record
+    Interval, ///< with the first record appended once syncInterval passed since the last sync, and when the journal is closed
+};
 
-    // ------------------------------------//
-    /* ----------OUTPUT STYLING------------*/
-    // ------------------------------------//
+struct HistoryJournalOptions
+{
+    HistorySyncPolicy sync = HistorySyncPolicy::Interval;
+    std::chrono::milliseconds syncInterval{1000};
+    /// the journal is rewritten with only the history window once it grows this many times larger than the window alone.  0 never compacts
+    std::size_t compactionRatio = 4;
+};
 
-    /// begin / end pairs that wrap output of a certain type
-    struct ConsoleStyling
-    {
-        std::pair<std::string, std::string> error;
-        std::pair<std::string, std::string> warning;
-        std::pair<std::string, std::string> echo;
-    };
+/// Append-only file of the command lines added to history, see QuakeStyleConsole::openHistoryJournal.
+/// The file starts with an 8 byte magic string, followed by one record per line: 32 bit length, 32 bit FNV-1a checksum, the line, and the length again.
+/// Numbers are little endian.  The trailing length lets records be read backwards, so loading the last N lines of a long journal only touches those.
+/// A record torn by a crash fails its checksum; it is cut off when the journal is opened again
+class HistoryJournal
+{
+  public:
+    HistoryJournal() = default;
+    ~HistoryJournal();
+
+    HistoryJournal(const HistoryJournal &) = delete;
+    HistoryJournal &operator=(const HistoryJournal &) = delete;
+
+    /// opens or creates the journal file and loads its newest distinct lines into history.
+    /// A text file with one line per entry is imported and rewritten as a journal
+    bool open(const std::string &path, HistoryBuffer &history, HistoryJournalOptions options = HistoryJournalOptions());
+
+    /// syncs the journal, unless the policy is Never, and closes it
+    void close();
+
+    bool is_open() const { return fileOpen; }
+    const std::string &path() const { return filePath; }
+    std::size_t size() const { return fileSize; }
+
+    /// appends a line, compacting the journal to the lines of history when it grew too large
+    bool append(std::string_view line, const HistoryBuffer &history);
+
+    /// makes the appended records durable
+    bool sync();
+
+    /// rewrites the journal with only the lines of history
+    bool compact(const HistoryBuffer &history);
+
+    /// reads the newest distinct lines of journal data into history, as many as fit.  Returns false if data is not a journal.
+    /// validSize receives the size of the data up to the last intact record
+    static bool load(std::string_view data, HistoryBuffer &history, std::size_t *validSize = nullptr);
+
+    /// writes the lines of history as a complete journal
+    static void write(std::ostream &os, const HistoryBuffer &history);
+
+    static constexpr std::string_view magic = "VQCHIST1";
+    static constexpr std::size_t recordOverhead = 12; ///< bytes of a record besides the line
+
+  private:
+    static std::uint32_t checksum(std::string_view line);
+    static std::uint32_t readU32(const char *p);
+    static void writeU32(char *p, std::uint32_t value);
+    static void appendRecord(std::string &out, std::string_view line);
+
+    /// reads the record at offset pos of data, advancing pos past it
+    static bool readRecord(std::string_view data, std::size_t &pos, std::string_view &line);
+    /// reads the record ending at offset pos of data, moving pos to its start
+    static bool readRecordBefore(std::string_view data, std::size_t &pos, std::string_view &line);
+
+    // thin wrappers of the platform file API
+    bool openFile();
+    bool writeFile(const char *data, std::size_t size);
+    bool syncFile();
+    bool truncateFile(std::size_t size);
+    void closeFile();
+
+    /// replaces the file at path with data through a temporary file, so a crash leaves either the old or the new file
+    static bool replaceFile(const std::string &path, std::string_view data, bool sync);
+
+    /// size of the journal holding only the lines of history
+    static std::size_t compactSize(const HistoryBuffer &history);
+
+    HistoryJournalOptions options;
+    std::string filePath;
+    std::string record; ///< encoding buffer, reused between appends
+    std::size_t fileSize = 0;
+    bool fileOpen = false;
+    bool unsynced = false;
+    std::chrono::steady_clock::time_point lastSync;
+#if defined(_WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+};
 
-    /// ANSI color codes wrap the output in the scope.
-    inline static ConsoleStyling ConsoleStylingColor() { return {{"\u001b[37;41;1m[error]: ", "\u001b[0m"}, {"\u001b[33;1m[warning]: ", "\u001b[0m"}, {"\u001b[32;1m> ", "\u001b[0m"}}; }
+/// Sorted set of words (command names, variable names, keywords) for text completion.
+/// Words are kept in a flat array sorted case-insensitively, so all words starting with a prefix are found with a binary search and come out already sorted.
+/// New words are appended and merged into the sorted part on the next lookup, which keeps binding thousands of names linear enough.
+class CompletionIndex
+{
+  public:
+    typedef std::vector<std::string>::const_iterator const_iterator;
 
-    /// Styling parameters with no colors, just tags
-    inline static ConsoleStyling ConsoleStylingPlain() { return {{"[error]: ", ""}, {"[warning]: ", ""}, {"> ", ""}}; }
+    /// adds a word, duplicates are ignored
+    void insert(std::string word);
 
-    ConsoleStyling style = ConsoleStylingPlain(); ///< public so user can modify.  Initialized using uncolored output
+    /// removes a word if present
+    void erase(std::string_view word);
 
-    // - sugared getters for console implementation -
+    /// replaces all words of the index
+    void assign(std::vector<std::string> newWords);
 
-    const std::pair<std::string, std::string> &error() { return style.error; }
-    const std::pair<std::string, std::string> &warning() { return style.warning; }
-    const std::pair<std::string, std::string> &echo() { return style.echo; }
+    /// makes room for count more words
+    void reserve(std::size_t count);
 
-    // ------------------------------------//
-    /* ----OTHER GETTERS AND SETTERS-------*/
-    // ------------------------------------//
+    void clear();
 
-    /// sets the help string (see built in 'help' command) for a given topic
-    void setHelpTopic(const std::string &topic, const std::string &data);
+    std::size_t size() const;
+    const_iterator begin() const;
+    const_iterator end() const;
 
-    const std::deque<std::string> &historyBuffer() const;
-    inline const CommandTable &getCommandTable() const { return commandTable; }
-    inline const CVarReadTable &getCVarReadTable() const { return cvarReadFTable; }
-    inline const CVarPrintTable &getCVarPrintTable() const { return cvarPrintFTable; }
-    inline const HelpTable &getHelpTable() const { return helpTable; }
+    /// returns the range of words starting with prefix, ignoring case, in sorted order
+    std::pair<const_iterator, const_iterator> findPrefix(std::string_view prefix) const;
 
-    ///prints help on a topic if the user types help < topic >, or a generic help message if the user just types help
-    void commandHelp(std::istream&, std::ostream&);
+    /// order of the words in the index: case-insensitive, ties broken by the case-sensitive order
+    static bool less(std::string_view a, std::string_view b);
 
-  protected:
-    /// WindowedQueue - We implement a ring buffer for the command history as a queue
-    template <class T>
-    class WindowedQueue : public std::deque<T>
-    {
-        void fix_size()
-        {
-            while (std::deque<T>::size() > m_capacity)
-            {
-                std::deque<T>::pop_front();
-            }
-        }
+  private:
+    /// case-insensitive order only, used to search for prefixes
+    static int compareNoCase(std::string_view a, std::string_view b);
 
-        std::size_t m_capacity;
+    /// sorts the words appended since the last lookup into the sorted part
+    void normalize() const;
 
-      public:
-        WindowedQueue(std::size_t maxCapacity) : m_capacity(maxCapacity)
-        {
-        }
+    mutable std::vector<std::string> words;
+    mutable std::size_t sortedCount = 0; ///< words [0, sortedCount) are sorted and unique
+};
 
-        void capacity(std::size_t newCapacity)
-        {
-            m_capacity = newCapacity;
-            fix_size();
-        }
+/// transparent hash so the tables can be searched by std::string_view without building a temporary std::string
+struct StringHash
+{
+    using is_transparent = void;
 
-        std::size_t capacity() const
-        {
-            return m_capacity;
-        }
-        using std::deque<T>::operator[];
+    std::size_t operator()(std::string_view str) const { return std::hash<std::string_view>{}(str); }
+};
 
-        template <class... Args>
-        void emplace(Args &&... args)
-        {
-            std::deque<T>::emplace_back(std::forward<Args>(args)...);
-            fix_size();
-        }
+/// Define VIRTUOSO_CONSOLE_STATS to 0 before including this header to compile the ConsoleStats instrumentation out.
+#ifndef VIRTUOSO_CONSOLE_STATS
+#define VIRTUOSO_CONSOLE_STATS 1
+#endif
 
-        void push(const T &value)
-        {
-            std::deque<T>::push_back(value);
-            fix_size();
-        }
+/// Counters, gauges and timing histograms of the console, see QuakeStyleConsole::getStats() and the built in stats command.
+/// Commands are timed per command name by the console itself; frontends add their own named timers (eg. rendering) and values (eg. scrollback size).
+/// Histograms use power of two buckets of nanoseconds, so adding a sample costs a few integer operations and percentiles are exact within a factor of two.
+/// With VIRTUOSO_CONSOLE_STATS set to 0 the recording functions are empty, the clock is never read and the tables stay empty.
+class ConsoleStats
+{
+  public:
+    /// distribution of durations in nanoseconds
+    struct Histogram
+    {
+        static const std::size_t bucketCount = 65; ///< bucket 0 counts zero durations, bucket i counts durations in [2^(i-1), 2^i)
 
-        void push(T &&value)
-        {
-            std::deque<T>::push_back(value);
-            fix_size();
-        }
-        void pop()
-        {
-            std::deque<T>::pop_front();
-        }
-    };
+        std::uint64_t count = 0;
+        std::uint64_t total = 0;
+        std::uint64_t min = 0;
+        std::uint64_t max = 0;
+        std::array<std::uint64_t, bucketCount> buckets{};
 
-    typedef WindowedQueue<std::string> ConsoleHistoryBuffer;
+        void add(std::uint64_t ns);
 
-    ConsoleHistoryBuffer history_buffer; ///< history buffer of previous commands
+        /// mean duration in nanoseconds, 0 without samples
+        double mean() const;
 
-    /// maps strings naming cVars to functions which read them from a std::istream.
-    /// This allows the console to parse variables of any type representable as text without modifying the console code or adding custom parsing code.
-    CVarReadTable cvarReadFTable;
+        /// upper bound of the bucket holding the given fraction (0..1) of the samples, never above max
+        std::uint64_t percentile(double fraction) const;
+    };
 
-    /// maps strings naming cVars to functions which write the variables of arbitrary type out to a std::ostream
-    CVarPrintTable cvarPrintFTable;
+    typedef std::unordered_map<std::string, Histogram, StringHash, std::equal_to<>> HistogramTable;
+    typedef std::unordered_map<std::string, std::uint64_t, StringHash, std::equal_to<>> ValueTable;
 
-    ///maps strings to std function objects, representing the available commands to the user.  eg, quit, set, etc
-    CommandTable commandTable;
+    /// adds the time from construction to destruction to a histogram
+    class ScopedTimer
+    {
+      public:
+        ScopedTimer() = default;
+        explicit ScopedTimer(Histogram &histogram);
+        ~ScopedTimer();
+
+        ScopedTimer(const ScopedTimer &) = delete;
+        ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+#if VIRTUOSO_CONSOLE_STATS
+      private:
+        Histogram *histogram = nullptr;
+        std::chrono::steady_clock::time_point start;
+#endif
+    };
 
-    /// maps names of functions or cvars to string literals containing helpful information on their use
-    HelpTable helpTable;
+    /// times the rest of the scope as an execution of the named command
+    ScopedTimer timeCommand(std::string_view name);
 
-    ///function which simply sets the value of an arbitrary type based on what's in the input stream
-    ///the arguments are "eaten" by std bind, allowing it to be stored as type void (*x)(void) in the cvarReadFTable
-    template <class T>
-    void setCvar(std::istream &is, std::ostream &os, T *var);
+    /// times the rest of the scope under a named timer, eg. "render"
+    ScopedTimer timeSection(std::string_view name);
 
-    ///function which simply prints the value of a variable to an output stream
-    ///the arguments are "eaten" by std bind, allowing it to be stored as type void (*x)(void) in the cvarPrintFTable
-    template <class T>
-    void printCvar(std::ostream &os, T *var);
+    void recordCommand(std::string_view name, std::uint64_t ns);
+    void recordTimer(std::string_view name, std::uint64_t ns);
 
-    ///dumps a list of available commands to the output stream
-    void listCmd(std::ostream &os) const;
+    /// adds to a counter of events or amounts, eg. bytes written
+    void addCounter(std::string_view name, std::uint64_t delta = 1);
 
-    ///dumps a list of bound cvars to the output stream
-    void listVars(std::ostream &os) const;
+    /// sets a value measured at a point in time, eg. memory in use
+    void setGauge(std::string_view name, std::uint64_t value);
 
-    ///dumps a list of available help topics to the output stream
-    void listHelp(std::ostream &os) const;
+    /// histogram of a command, nullptr if it was never timed
+    const Histogram *findCommand(std::string_view name) const;
+    /// histogram of a named timer, nullptr if it was never recorded
+    const Histogram *findTimer(std::string_view name) const;
+    /// value of a counter, 0 if it was never added to
+    std::uint64_t counter(std::string_view name) const;
+    /// value of a gauge, 0 if it was never set
+    std::uint64_t gauge(std::string_view name) const;
 
-    ///The function associated with the built in command "set" which parses the name of a cvar, and if it is bound, sets the value based on
-    ///the value in the input stream
-    void commandSet(std::istream &is, std::ostream &os);
+    inline const HistogramTable &commands() const { return commandTimes; }
+    inline const HistogramTable &timers() const { return timerTimes; }
+    inline const ValueTable &counters() const { return counterValues; }
+    inline const ValueTable &gauges() const { return gaugeValues; }
 
-    ///the function associated with built in command "echo", which prints the value of a cvar if it is bound. if not, reports an error.
-    void commandEcho(std::istream &is, std::ostream &os);
+    /// zeroes all statistics.  Entries are kept, so timers running during the reset stay valid
+    void reset();
 
-    ///creates a string variable from the console
-    void commandVar();
+    /// prints all statistics as tables sorted by name, durations in microseconds
+    void print(std::ostream &os) const;
 
-    ///wrapper function which parses arguments to a function object of arbitrary type from the console's input stream then executes the function if the parsing was successful
-    template <typename... Args>
-    void parse(std::istream &is, std::ostream &os, std::function<void(Args...)> f);
+  private:
+    /// finds or adds the entry for a name, only allocating the first time a name is seen
+    template <class Table>
+    static typename Table::mapped_type &entry(Table &table, std::string_view name);
 
-    ///This function is called by populateAndExecute, and only executes the bound function if the parsing succeeds
-    ///if parsing failed we do not want to pass in uninitialized garbage to the c++ function we bound
-    template <typename... Args>
-    void conditionalExecute(std::istream &is, std::ostream &os, std::function<void(Args...)> f, const Args &... args);
+    static void printHistograms(std::ostream &os, const char *title, const HistogramTable &table);
+    static void printValues(std::ostream &os, const char *title, const ValueTable &table);
 
-    /// adds the built-in commands to the command table
-    void bindBasicCommands();
+    HistogramTable commandTimes;
+    HistogramTable timerTimes;
+    ValueTable counterValues;
+    ValueTable gaugeValues;
+};
 
-    /// helper function to return a default-constructed temp variable of a particular type.  Used in parsing arguments for C++ functions bound to the console
-    template <class T>
-    T makeTemp();
+/// parses a single value from the stream the same way bound command arguments are parsed.
+/// Arithmetic types other than bool and the character types use std::from_chars on the next whitespace delimited token, which has to be a whole number.
+/// Sets failbit on a syntax error, like operator>>
+template <class T>
+void readValue(std::istream &is, T &value);
 
-    /// for parsing arguments to C++ functions bound to the console.  variadic template that recursively parses our function arguments in order
-    template <typename FirstType, typename... Args>
-    void populateTemps(std::istream &is, FirstType &in, Args &... Temps);
+/// value types the cvar registry stores and formats without streams.  Any other type is Custom and goes through operator>> / operator<<
+enum class CVarType : std::uint8_t
+{
+    Bool,
+    Int32,
+    Int64,
+    UInt32,
+    UInt64,
+    Float,
+    Double,
+    String,
+    Custom
+};
 
-    /// for parsing arguments to C++ functions bound to the console. variadic template that recursively parses our function arguments in order.  base case
-    template <typename FirstType>
-    void populateTemps(std::istream &is, FirstType &in);
+/// registry type tag of T
+template <class T>
+constexpr CVarType cvarTypeOf()
+{
+    if constexpr (std::is_same_v<T, bool>) return CVarType::Bool;
+    else if constexpr (std::is_same_v<T, float>) return CVarType::Float;
+    else if constexpr (std::is_same_v<T, double>) return CVarType::Double;
+    else if constexpr (std::is_same_v<T, std::string>) return CVarType::String;
+    else if constexpr (std::is_integral_v<T> && sizeof(T) >= 4 && std::is_signed_v<T>) return sizeof(T) == 4 ? CVarType::Int32 : CVarType::Int64;
+    else if constexpr (std::is_integral_v<T> && sizeof(T) >= 4) return sizeof(T) == 4 ? CVarType::UInt32 : CVarType::UInt64;
+    else return CVarType::Custom;
+}
 
-    /// for parsing arguments to C++ functions bound to the console. variadic template that recursively parses our function arguments in order.  base case
-    void populateTemps(std::istream &) {}
+/// stable reference to a cvar.  Stays valid for the lifetime of the registry, binding the name again keeps the handle
+struct CVarHandle
+{
+    static const std::uint32_t invalidIndex = ~std::uint32_t(0);
 
-    /// for parsing arguments to C++ functions bound to the console.  call starts populating temp variables
-    template <typename... Args>
-    void goPopulateTemps(std::istream &is, Args &... temps);
+    std::uint32_t index = invalidIndex;
 
-    /// for parsing arguments to C++ functions bound to the console.  Populates the temp variables using the istream, then calls the function with them
-    template <typename... Args>
-    void populateAndExecute(std::istream &is, std::ostream &os, std::function<void(Args...)> f,
-                            typename std::remove_const<typename std::remove_reference<Args>::type>::type... temps);
+    explicit operator bool() const { return index != invalidIndex; }
+    bool operator==(const CVarHandle &other) const { return index == other.index; }
+    bool operator!=(const CVarHandle &other) const { return index != other.index; }
+};
+
+/// Storage of the console variables.
+/// Every cvar is a slot in one contiguous array holding a type tag and a pointer to the value, either a variable of client code (bind) or a value owned by the registry (create).
+/// Values are parsed and formatted with std::from_chars / std::to_chars through plain function pointers, only Custom types use the stream operators.
+/// Names are hashed once in find(); game code keeps the handle and reads the value with get<T>() in O(1)
+///
+/// Every change made through the registry (read(), set(), markChanged()) bumps the version of the cvar, sets its dirty flag and calls its listeners.
+/// Inside a transaction the listeners are called once per changed cvar when the outermost transaction ends, see CVarTransaction
+class CVarRegistry
+{
+  public:
+    /// called with the handle of the changed cvar
+    typedef std::function<void(CVarHandle)> Listener;
+    typedef std::uint32_t ListenerId;
 
-    /// helper function that takes an input line containing commands and dereferences any console variables whose names appear prefixed by the $ symbol
-    void dereferenceVariables(std::istream &is, std::ostream &os, std::string &str);
+    /// binds a variable of client code, which has to outlive the registry or be bound again.
+    /// Binding or creating a name again with the same type keeps its handles; with another type the name moves to a new slot
+    /// and the old one is invalidated: get() throws for the old handles, read() fails and write() writes nothing
+    template <class T>
+    CVarHandle bind(std::string_view name, T &var);
 
-    /// assigns the value of a dynamically created console variable using the console's input stream
+    /// creates a variable owned by the registry.  A string created with readsLine takes the whole rest of the line when set, instead of one token
     template <class T>
-    void assignDynamicVariable(std::istream &is, std::shared_ptr<T> var);
+    CVarHandle create(std::string_view name, const T &value, bool readsLine = false);
+
+    /// returns the handle of a cvar, or an invalid handle if there's no cvar with the name
+    CVarHandle find(std::string_view name) const;
+
+    inline std::size_t size() const { return slots.size(); }
 
-    /// writes a dynamically created console variable to the console output
+    /// makes room for count more cvars, so binding them doesn't rehash or move the slots
+    void reserve(std::size_t count);
+
+    inline std::string_view name(CVarHandle h) const { return slots[h.index].name; }
+    inline CVarType type(CVarHandle h) const { return slots[h.index].type; }
+
+    /// value of a cvar.  T has to be the type it was bound or created with, std::invalid_argument is thrown otherwise
     template <class T>
-    void writeDynamicVariable(std::ostream &os, std::shared_ptr<T> var);
+    T &get(CVarHandle h);
+    template <class T>
+    const T &get(CVarHandle h) const;
 
-    /// bind dynamically created console variable to the variable table and set the associated help string
+    /// value of a cvar, nullptr if the handle is invalid or the cvar has a different type
     template <class T>
-    void bindDynamicCVar(const std::string &var, const T &value, const std::string &help);
+    T *tryGet(CVarHandle h);
+
+    /// parses a new value from the stream.  On a syntax error returns false and keeps the value
+    bool read(CVarHandle h, std::istream &is);
 
-    /// bind dynamically created console variable to the variable table.
+    /// writes the value to the stream, without a line break
+    void write(CVarHandle h, std::ostream &os) const;
+
+    /// assigns a value and reports the change.  Writing through get<T>() does not notify anybody
     template <class T>
-    void bindDynamicCVar(const std::string &var, const T &valueIn);
+    void set(CVarHandle h, T value);
 
-  public:
-    /// Dynamic variables are string-based variables that can be created, assigned, and dereferenced from the console itself rather than C++ code
-    struct DynamicVariable : public std::string
+    /// reports a change made directly to the value, eg. through get<T>() or the bound variable
+    void markChanged(CVarHandle h);
+
+    /// calls the listener after every change of the cvar, or once at the end of a transaction
+    ListenerId addListener(CVarHandle h, Listener listener);
+    void removeListener(CVarHandle h, ListenerId id);
+
+    /// number of changes since the cvar was bound
+    inline std::uint64_t version(CVarHandle h) const { return slots[h.index].version; }
+
+    /// dirty flags are set on every change and only cleared by the client, for systems that poll once per frame
+    inline bool isDirty(CVarHandle h) const { return slots[h.index].dirty; }
+    inline void clearDirty(CVarHandle h) { slots[h.index].dirty = false; }
+
+    /// returns the dirty flag and clears it
+    inline bool consumeDirty(CVarHandle h)
     {
-    };
+        const bool dirty = slots[h.index].dirty;
+        slots[h.index].dirty = false;
+        return dirty;
+    }
 
-    // -----------------------------------------------------------------------------
-    // EndOfLineEscapeStreamScope : by Steve132
-    // For wrapping the output of an ostream push sequence << in a begin / end tag
-    // Used for console output formatting
-    // -----------------------------------------------------------------------------
-    typedef std::pair<std::string, std::string> EndOfLineEscapeTag;
+    /// transactions nest; listeners are called when the outermost one ends
+    void beginTransaction();
+    void endTransaction();
+    inline bool inTransaction() const { return transactionDepth != 0; }
 
-    struct EndOfLineEscapeStreamScope
+  private:
+    struct Slot
     {
-      protected:
-        EndOfLineEscapeTag tag;
-        std::ostream &os;
+        std::string name;
+        CVarType type = CVarType::Custom;
+        bool readsLine = false;
+        bool dirty = false;
+        bool pending = false; ///< changed during the current transaction
+        std::uint64_t version = 0;
+        std::vector<std::pair<ListenerId, Listener>> listeners;
+        void *data = nullptr;                ///< the value, bound or owned
+        std::shared_ptr<void> owned;         ///< keeps a created value alive
+        const std::type_info *valueType = nullptr;
+        bool (*read)(void *data, std::istream &is, bool readsLine) = nullptr;
+        void (*write)(const void *data, std::ostream &os) = nullptr;
+    };
 
-        EndOfLineEscapeStreamScope(const EndOfLineEscapeTag &ttag, std::ostream &tout) : tag(ttag),
-                                                                                         os(tout)
-        {
-            os << tag.first; //you can overload this for custom ostream types with a different color interface
-            //this might also have a stack interface for if you need multiple resets
-        }
+    /// whether the slot holds a T.  Compares the type tags, typeid only for Custom types, integers of the same size and signedness share a tag
+    template <class T>
+    static bool holds(const Slot &slot);
 
-        friend EndOfLineEscapeStreamScope operator<<(std::ostream &out, const EndOfLineEscapeTag &tg);
+    template <class T>
+    static bool readSlot(void *data, std::istream &is, bool readsLine);
 
-      public:
-        template <class T>
-        EndOfLineEscapeStreamScope &operator<<(T &&t)
-        {
-            os << std::forward<T>(t);
-            return *this;
-        }
+    template <class T>
+    static void writeSlot(const void *data, std::ostream &os);
 
-        EndOfLineEscapeStreamScope &operator<<(std::ostream &(&M)(std::ostream &))
-        {
-            M(os);
-            return *this;
-        }
+    /// slot of the name set up for a value of type T at data, added if the name is new or had another type
+    template <class T>
+    CVarHandle assign(std::string_view name, T *data, std::shared_ptr<void> owned, bool readsLine);
 
-        ~EndOfLineEscapeStreamScope()
-        {
-            os << tag.second;
-        }
-    };
+    /// calls the listeners of the cvar
+    void notify(CVarHandle h);
+
+    std::vector<Slot> slots;
+    std::unordered_map<std::string, std::uint32_t, StringHash, std::equal_to<>> indices;
+
+    ListenerId nextListenerId = 0;
+    unsigned int transactionDepth = 0;
+    std::vector<CVarHandle> pendingChanges; ///< cvars changed in the current transaction, notified when it ends
 };
 
-inline Virtuoso::QuakeStyleConsole::EndOfLineEscapeStreamScope operator<<(std::ostream &os, const Virtuoso::QuakeStyleConsole::EndOfLineEscapeTag &tg)
+/// Scope in which changes of cvars are collected and notified once per cvar at the end, eg. while running a script of "set" lines.
+/// The dirty flags and versions still change immediately
+class CVarTransaction
 {
-    return Virtuoso::QuakeStyleConsole::EndOfLineEscapeStreamScope(tg, os);
-}
+  public:
+    explicit CVarTransaction(CVarRegistry &registry) : registry(registry) { registry.beginTransaction(); }
+    ~CVarTransaction() { registry.endTransaction(); }
 
-} // namespace Virtuoso
+    CVarTransaction(const CVarTransaction &) = delete;
+    CVarTransaction &operator=(const CVarTransaction &) = delete;
+
+  private:
+    CVarRegistry &registry;
+};
+
+/// Where a bound command runs, see QuakeStyleConsole::bindCommand
+enum class ExecutionPolicy
+{
+    MainThread,    ///< on the thread executing the command line, to completion
+    Worker,        ///< on a worker thread, one Worker command at a time in the order they were executed
+    WorkerParallel ///< on a worker thread, concurrently with other worker commands
+};
+
+/// Small thread pool running the worker commands of a console.  Threads start with the first job.
+/// Workers hand results and calls meant for the main thread (see QuakeStyleConsole::runOnMainThread) to queues
+/// that drain() empties on the main thread, so output only ever reaches the console's streams from there
+class CommandWorkerPool
+{
+  public:
+    /// a submitted command, reported if it's cancelled before it starts
+    struct Job
+    {
+        std::string name;
+        std::ostream *output = nullptr;
+        bool serial = false;        ///< see ExecutionPolicy::Worker
+        std::function<std::string()> run; ///< runs the command, returns its output
+    };
+
+    CommandWorkerPool() = default;
+    ~CommandWorkerPool();
+
+    CommandWorkerPool(const CommandWorkerPool &) = delete;
+    CommandWorkerPool &operator=(const CommandWorkerPool &) = delete;
+
+    /// number of threads started with the first job, at least 1
+    void threads(std::size_t count);
+    std::size_t threads() const { return threadCount; }
+
+    void submit(Job job);
+
+    /// queues a call for the next drain(), dropping it if the pool is shutting down
+    void postMainThread(std::function<void()> f);
+
+    /// runs the queued main thread calls and writes the output of the finished jobs to their streams
+    void drain();
+
+    /// removes the jobs that haven't started yet and returns them
+    std::vector<Job> cancelQueued();
+
+    /// jobs submitted and not delivered by drain() yet
+    std::size_t pending() const;
+
+  private:
+    void workerLoop();
+
+    mutable std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::vector<std::thread> workers;
+    std::size_t threadCount = std::clamp<std::size_t>(std::thread::hardware_concurrency() / 2, 1, 4);
+    bool stopping = false;
+
+    std::deque<Job> queued;
+    bool serialRunning = false;  ///< a Worker job is running, the next one waits for it
+
+    std::vector<std::pair<std::ostream *, std::string>> finished; ///< output of finished jobs, not delivered yet
+    std::vector<std::function<void()>> mainThreadCalls;
+    std::size_t inFlight = 0; ///< submitted jobs not delivered or cancelled yet
+};
+
+/// Return type of console commands written as C++20 coroutines.  The console resumes such a command a time slice per frame (see QuakeStyleConsole::runTasks),
+/// so a long command streams its output and keeps the game running instead of stalling the frame:
+///
+///     console.bindCommand("dumpEntities", [&](std::istream &is, std::ostream &os) -> Virtuoso::ConsoleTask {
+///         for (const Entity &e : entities)
+///         {
+///             os << e << '\n';
+///             co_await Virtuoso::ConsoleTask::yield(); // continues right away, or next frame once the slice is spent
+///         }
+///     });
+///
+/// The task starts on the next runTasks() call.  Its input stream holds the rest of the command line and lives as long as the task,
+/// the output stream is the one the command line was executed with and has to outlive it.
+/// Cancelling destroys the task where it yielded, so its locals clean up in their destructors.
+class ConsoleTask
+{
+  public:
+    struct promise_type
+    {
+        std::exception_ptr exception; ///< thrown by the command, rethrown by resume()
+
+        ConsoleTask get_return_object() { return ConsoleTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { exception = std::current_exception(); }
+    };
+
+    ConsoleTask() = default;
+    ConsoleTask(ConsoleTask &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    ConsoleTask &operator=(ConsoleTask &&other) noexcept;
+    ~ConsoleTask();
+
+    ConsoleTask(const ConsoleTask &) = delete;
+    ConsoleTask &operator=(const ConsoleTask &) = delete;
+
+    /// suspension point of a task.  resume() continues the task at once while its slice has time left, checking the clock once per yield
+    static std::suspend_always yield() { return {}; }
+
+    /// true once the slice of the task being resumed is spent, eg. to finish a step before yielding
+    static bool sliceExpired();
+
+    /// ends the slice of the task being resumed, and of the tasks running it, at their next yield
+    static void expireSlice() { sliceDeadline = std::chrono::steady_clock::time_point::min(); }
+
+    bool done() const { return !handle || handle.done(); }
+
+    /// runs the task until it's done or it yields after the deadline.  Returns true once it's done, rethrowing what the command threw
+    bool resume(std::chrono::steady_clock::time_point deadline);
+
+  private:
+    explicit ConsoleTask(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+    std::coroutine_handle<promise_type> handle;
+
+    /// end of the slice of the task resumed on this thread
+    inline static thread_local std::chrono::steady_clock::time_point sliceDeadline = std::chrono::steady_clock::time_point::min();
+};
+
+class QuakeStyleConsole
+{
+  public:                                                // the methods in this section are what you should use in your code
+    static const unsigned int defaultHistorySize = 100u; ///size of the history file
+
+    typedef std::function<void(std::istream &is, std::ostream &os)> ConsoleFunc;
+
+    /// command written as a coroutine, see ConsoleTask
+    typedef std::function<ConsoleTask(std::istream &is, std::ostream &os)> AsyncConsoleFunc;
+
+    typedef Virtuoso::StringHash StringHash;
+
+    typedef std::unordered_map<std::string, ConsoleFunc, StringHash, std::equal_to<>> CommandTable;
+    typedef std::unordered_map<std::string, std::string, StringHash, std::equal_to<>> HelpTable;
+
+    /// Constructor binds the default commands to the command table & initializes history buffer
+    QuakeStyleConsole(std::size_t maxHistory = defaultHistorySize, bool enablePrebindedCommands = true);
+
+    // --------------------------------------//
+    /* --------- COMMAND EXECUTION --------- */
+    // --------------------------------------//
+    // call one of these functions to make the console do things - eg. the first one when you press enter
+    // and your GUI console widget gives you a string
+    // You can execute all commands in an input stream until EOF with executeUntilEOF(),
+    // or run every line in a file (eg. a startup or debug playback file) with executeFile()
+
+    /// Execute command line passed in as string.  Console output goes to "output"
+    /// Only the first line of the string is executed.  The line is tokenized in place, without copying it into a stream.
+    void commandExecute(std::string_view str, std::ostream &output);
+
+    /// Get a command line from the input stream and execute it.   Console output goes to "output"
+    void commandExecute(std::istream &input, std::ostream &output);
+
+    /// execute commands from an istream until EOF
+    void executeUntilEOF(std::istream &f, std::ostream &output);
+
+    /// options for running scripts with executeFile() / executeBatch()
+    struct BatchOptions
+    {
+        bool recordHistory = false; ///< add executed lines to the history buffer
+        bool echo = false;          ///< echo executed lines to the output
+        bool deferSet = true;       ///< collect consecutive "set" lines and apply them together, see executeBatch()
+        bool reportTiming = true;   ///< print the number of lines and the time it took when a file is done
+        bool transaction = true;    ///< run the batch as a CVarTransaction, so each changed cvar is notified once when it is done
+    };
+
+    /// options used by executeFile() without explicit options and by the built in runFile command
+    BatchOptions scriptOptions;
+
+    /// execute commands from a file (named by the input string 'f') until EOF.  The file is memory mapped and run as a batch with scriptOptions
+    void executeFile(const std::string &f, std::ostream &output);
+
+    /// execute commands from a file (named by the input string 'f') until EOF, run as a batch with the given options
+    void executeFile(const std::string &f, std::ostream &output, const BatchOptions &options);
+
+    /// execute every line of the script in a single pass.  Returns the number of executed (non blank, non comment) lines.
+    /// With options.deferSet, runs of "set" lines are collected and applied together before the next line that could observe them.
+    /// Only the last value for each variable in a run is applied.
+    /// With options.transaction, cvar listeners are called once per changed cvar after the last line.
+    std::size_t executeBatch(std::string_view script, std::ostream &output, const BatchOptions &options);
+
+    /// same as executeFile(), as a task that runs a time slice per runTasks() call.  Used by the built in runFile command.
+    /// Deferred "set" values are applied before every pause, so commands typed in between see them
+    ConsoleTask executeFileAsync(std::string f, std::ostream &output, BatchOptions options);
+
+    // ------------------------------------//
+    /* ------------ TASKS ---------------- */
+    // ------------------------------------//
+    // Commands bound as coroutines (see ConsoleTask) don't run to completion when their line is executed.  They wait in a queue,
+    // and runTasks() resumes the oldest one for a time slice.  Frontends call runTasks() once per frame.
+    // Inside a batch or another task, a coroutine command runs to completion instead, so the lines after it see everything it did.
+
+    /// time runTasks() without arguments gives the tasks per call
+    std::chrono::microseconds taskBudget = std::chrono::microseconds(4000);
+
+    /// resumes the waiting tasks, oldest first, until they're done or the budget is spent.  Returns true while tasks are left.
+    /// Rethrows what a task threw, after removing it
+    bool runTasks(std::chrono::microseconds budget);
+    inline bool runTasks() { return runTasks(taskBudget); }
+
+    /// number of tasks running or waiting to run, plus worker commands whose output wasn't written yet
+    inline std::size_t taskCount() const { return tasks.size() + worker_pool.pending(); }
+
+    /// destroys all tasks, reporting each one on its output.  From inside a task it takes effect when the task yields.
+    /// Worker commands that haven't started are cancelled too, running ones finish
+    void cancelTasks();
+
+    // ------------------------------------//
+    /* ---------- WORKER COMMANDS -------- */
+    // ------------------------------------//
+    // Commands that only query data can run off the main thread, see ExecutionPolicy.  Their output is collected while they run and written as one block,
+    // headed by an echo of the command line, by the next runTasks() call.  taskCount() includes them until then.
+    // A worker command must not touch the console or game state directly.  Use runOnMainThread() to read or set cvars.
+
+    /// the pool running the worker commands, eg. to set its number of threads before the first one runs
+    inline CommandWorkerPool &workerPool() { return worker_pool; }
+
+    /// runs f on the thread calling runTasks() and returns its result through the future.  For worker commands: waiting for it on the main thread never ends.
+    /// If the console is destroyed first, the future holds a broken_promise error
+    template <class F>
+    std::future<std::invoke_result_t<F>> runOnMainThread(F &&f);
+
+    //------------------------------------//
+    /*----------- ADDING CVARS -----------*/
+    //-------------------------------------//
+    // Call one of these to add variables (eg, Player.health) from your c++ code to the console.
+    // This makes them available to built in commands using the given "varname" - dereference them with $, print them with echo, and set them with "set"
+
+    /// function which takes in a string and a variable from client code we want to associate with it in the console.  Takes in an optional help string to describe the variable to the user.
+    /// Returns a handle for reading the variable through cvar<T>() without looking up the name
+    template <class T>
+    CVarHandle bindCVar(const std::string &varname, T &var, const std::string &help = "");
+
+    /// creates a variable owned by the console, eg. a setting the game reads every frame with cvar<T>()
+    template <class T>
+    CVarHandle createCVar(const std::string &varname, const T &value, const std::string &help = "");
+
+    /// handle of a bound or created cvar, invalid if there's none with the name.  Look it up once and keep it
+    inline CVarHandle findCVar(std::string_view varname) const { return cvars.find(varname); }
+
+    /// value of a cvar, O(1) without hashing or parsing.  T has to be the type the cvar was bound or created with, std::invalid_argument is thrown otherwise
+    template <class T>
+    inline T &cvar(CVarHandle h) { return cvars.get<T>(h); }
+    template <class T>
+    inline const T &cvar(CVarHandle h) const { return cvars.get<T>(h); }
+
+    /// value of a cvar, nullptr if the handle is invalid or the cvar has a different type
+    template <class T>
+    inline T *tryCVar(CVarHandle h) { return cvars.tryGet<T>(h); }
+
+    /// calls the listener whenever the cvar is changed from the console.  During runFile it's called once, after the whole file ran
+    inline CVarRegistry::ListenerId onCVarChange(CVarHandle h, CVarRegistry::Listener listener) { return cvars.addListener(h, std::move(listener)); }
+
+    // ------------------------------------//
+    /* --------- ADDING COMMANDS ----------*/
+    // ------------------------------------//
+    // You should call console.bindCommand() with the command name you want and a C++ function from your code with an arbitrary signature.  Optionally provide a help string for the command as a third argument
+    // You shouldn't need to worry about which overload or template arguments to use - it should resolve automatically.
+    // If your function has arguments, so long as there is an istream operator to read them from the input,
+    // the console will automatically parse them with variadic template and lambda magic, so you never have to write a parser
+    // IF YOU ARE USING A MEMBER FUNCTION - we need to wrap the "this" pointer too, so call bindMemberCommand() which takes the object reference as the first argument after the command name
+
+    /// add a command to the console using a function pointer that takes no arguments.  set the associated help string to the "help" argument
+    void bindCommand(const std::string &commandName, void (*fptr)(void), const std::string &help = "");
+
+    ///add a command to the console using a function pointer that takes arbitrary arguments, then set the associated help string to the "help" argument
+    template <typename... Args>
+    void bindCommand(const std::string &commandName, void (*fptr)(Args...), const std::string &help = "");
+
+    ///add a command to the console using a function object with arbitrary arguments, then set the associated help string to the optional "help" argument
+    template <typename... Args>
+    void bindCommand(const std::string &commandName, std::function<void(Args...)> fun, const std::string &help = "");
+
+    ///add a command to the console using universal reference object with arbitrary arguments, then set the associated help string to the optional "help" argument
+    template <typename Func>
+    void bindCommand(const std::string &commandName, Func&& func, const std::string &help = "");
+
+    /// add a command written as a coroutine, see ConsoleTask.  It runs a time slice per runTasks() call, not to completion
+    void bindCommand(const std::string &commandName, AsyncConsoleFunc f, const std::string &help = "");
+
+    /// add a command with any of the signatures above (except coroutines) that runs as the policy says
+    template <typename Func>
+    void bindCommand(const std::string &commandName, Func &&func, ExecutionPolicy policy, const std::string &help = "");
+
+    /// changes where a bound command runs.  Returns false if there's no such command or it's a coroutine, which always runs on the main thread
+    bool setExecutionPolicy(const std::string &commandName, ExecutionPolicy policy);
+
+    // ------------------------------------//
+    /* -------- STATIC REGISTRATION -------*/
+    // ------------------------------------//
+    // For games that register thousands of commands and cvars at startup.  Entries of a static table are built at compile time;
+    // registerStatic() adds a whole table at once, with the hash tables sized for it, and without allocating a function object per command.
+    //
+    //     void quit();
+    //     void give(std::string item, int count);
+    //     int r_width = 1280;
+    //
+    //     constexpr Virtuoso::QuakeStyleConsole::CommandSpec gameCommands[] = {
+    //         Virtuoso::QuakeStyleConsole::staticCommand<&quit>("quit", "exits the game"),
+    //         Virtuoso::QuakeStyleConsole::staticCommand<&give>("give", "give <item> <count>"),
+    //     };
+    //     constexpr Virtuoso::QuakeStyleConsole::CVarSpec gameCVars[] = {
+    //         Virtuoso::QuakeStyleConsole::staticCVar<r_width>("r_width", "window width"),
+    //     };
+    //
+    //     console.registerStatic(gameCommands, gameCVars);
+    //
+    // Alternatively VIRTUOSO_CONSOLE_COMMAND(name, function, help) and VIRTUOSO_CONSOLE_CVAR(name, variable, help) at namespace scope,
+    // in any translation unit, add an entry to a list that registerStatic() without arguments loads.
+
+    struct ConsoleStyling;
+
+    /// a command of a static table, see staticCommand()
+    struct CommandSpec
+    {
+        std::string_view name;
+        void (*run)(std::istream &is, std::ostream &os, const ConsoleStyling &styling) = nullptr;
+        std::string_view help;
+    };
+
+    /// a cvar of a static table, see staticCVar()
+    struct CVarSpec
+    {
+        std::string_view name;
+        CVarHandle (*bind)(CVarRegistry &cvars, std::string_view name) = nullptr;
+        std::string_view help;
+    };
+
+    /// entry for a function with any of the signatures bindCommand() takes from function pointers, or a ConsoleFunc signature.
+    /// The name and help have to outlive the table, eg. string literals
+    template <auto F>
+    static constexpr CommandSpec staticCommand(std::string_view name, std::string_view help = {});
+
+    /// entry for a variable with static storage duration
+    template <auto &Var>
+    static constexpr CVarSpec staticCVar(std::string_view name, std::string_view help = {});
+
+    /// adds the commands and cvars of static tables, replacing bound ones with the same names
+    void registerStatic(std::span<const CommandSpec> commandSpecs, std::span<const CVarSpec> cvarSpecs = {});
+
+    /// adds the entries of VIRTUOSO_CONSOLE_COMMAND and VIRTUOSO_CONSOLE_CVAR from all translation units
+    void registerStatic();
+
+    /// an entry of the list registerStatic() loads, constructed by VIRTUOSO_CONSOLE_COMMAND.  Nodes link themselves, nothing is allocated
+    struct StaticCommand
+    {
+        explicit StaticCommand(const CommandSpec &spec);
+
+        CommandSpec spec;
+        const StaticCommand *next;
+
+        inline static const StaticCommand *first = nullptr;
+        inline static std::size_t count = 0;
+    };
+
+    /// an entry of the list registerStatic() loads, constructed by VIRTUOSO_CONSOLE_CVAR
+    struct StaticCVar
+    {
+        explicit StaticCVar(const CVarSpec &spec);
+
+        CVarSpec spec;
+        const StaticCVar *next;
+
+        inline static const StaticCVar *first = nullptr;
+        inline static std::size_t count = 0;
+    };
+
+    /// same as bindCommand, but for a member function of an object.  Object instance is first argument after the command name
+    template <typename O, typename... Args>
+    void bindMemberCommand(const std::string &commandName, O &obj, void (O::*fptr)(Args...), const std::string &help = "");
+
+    /// the bindCommand that actually does the work of adding commands to the table AFTER they've been coerced to a ConsoleFunc that takes the input/output from executeCommand.  Takes optional help string.
+    void bindCommand(const std::string &commandName, ConsoleFunc f, const std::string &help = "");
+
+    /// unbind a command from the console
+    void unbindCommand(const std::string &commandName);
+
+    /// unbind all commands from the console
+    void unbindAll();
+
+    // ------------------------------------//
+    /* --------- HISTORY FILES ----------- */
+    // ------------------------------------//
+    /* Saving and loading the history buffer of previously executed commands to file  */
+
+    /// Files named by path are saved in the binary format of HistoryJournal, and files with one line per entry, as saved by older versions, still load.
+    /// The stream overloads keep the text format with one line per entry, so streams opened in text mode work on every platform.
+
+    /// populate the command buffer from an input file named by string inFile
+    bool loadHistoryBuffer(const std::string &inFile);
+
+    /// write the history buffer to file named by string outFile.  Only syncs the journal if it's the open history journal
+    void saveHistoryBuffer(const std::string &outFile);
+
+    /// populate the command buffer from an input stream with one line per entry
+    void loadHistoryBuffer(std::istream &inFile);
+
+    /// write the history buffer to an output stream, one line per entry
+    void saveHistoryBuffer(std::ofstream &outfile);
+
+    /// keeps history in an append-only journal file: loads its newest lines now and appends every line added to history from now on.
+    /// Cheap enough to persist every command, see HistoryJournal and HistoryJournalOptions
+    bool openHistoryJournal(const std::string &path, HistoryJournalOptions options = HistoryJournalOptions());
+
+    /// syncs and closes the history journal
+    void closeHistoryJournal();
+
+    inline HistoryJournal &historyJournal() { return history_journal; }
+
+    // ------------------------------------//
+    /* ----------OUTPUT STYLING------------*/
+    // ------------------------------------//
+
+    /// begin / end pairs that wrap output of a certain type
+    struct ConsoleStyling
+    {
+        std::pair<std::string, std::string> error;
+        std::pair<std::string, std::string> warning;
+        std::pair<std::string, std::string> echo;
+    };
+
+    /// ANSI color codes wrap the output in the scope.
+    inline static ConsoleStyling ConsoleStylingColor() { return {{"\u001b[37;41;1m[error]: ", "\u001b[0m"}, {"\u001b[33;1m[warning]: ", "\u001b[0m"}, {"\u001b[32;1m> ", "\u001b[0m"}}; }
+
+    /// Styling parameters with no colors, just tags
+    inline static ConsoleStyling ConsoleStylingPlain() { return {{"[error]: ", ""}, {"[warning]: ", ""}, {"> ", ""}}; }
+
+    ConsoleStyling style = ConsoleStylingPlain(); ///< public so user can modify.  Initialized using uncolored output
+
+    // - sugared getters for console implementation -
+
+    const std::pair<std::string, std::string> &error() { return style.error; }
+    const std::pair<std::string, std::string> &warning() { return style.warning; }
+    const std::pair<std::string, std::string> &echo() { return style.echo; }
+
+    // ------------------------------------//
+    /* ----OTHER GETTERS AND SETTERS-------*/
+    // ------------------------------------//
+
+    /// sets the help string (see built in 'help' command) for a given topic
+    void setHelpTopic(const std::string &topic, const std::string &data);
+
+    const HistoryBuffer &historyBuffer() const;
+
+    /// index in historyBuffer() of the newest line containing query (ignoring case) with a sequence number below before,
+    /// HistoryBuffer::npos if none.  For incremental reverse search: pass the sequence of the current match to step to older ones
+    std::size_t searchHistory(std::string_view query, std::uint64_t before = UINT64_MAX);
+    inline const CommandTable &getCommandTable() const { return commandTable; }
+    inline CVarRegistry &getCVars() { return cvars; }
+    inline const CVarRegistry &getCVars() const { return cvars; }
+    inline const HelpTable &getHelpTable() const { return helpTable; }
+
+    /// sorted names of the bound commands, for text completion
+    inline const CompletionIndex &getCommandIndex() const { return commandIndex; }
+    /// sorted names of the bound cvars, for text completion
+    inline const CompletionIndex &getCVarIndex() const { return cvarIndex; }
+
+    /// execution times of the commands, plus anything the frontend records.  Printed by the built in stats command
+    inline ConsoleStats &getStats() { return stats; }
+    inline const ConsoleStats &getStats() const { return stats; }
+
+    ///prints help on a topic if the user types help < topic >, or a generic help message if the user just types help
+    void commandHelp(std::istream&, std::ostream&);
+
+  protected:
+    typedef HistoryBuffer ConsoleHistoryBuffer;
+
+    /// Read-only stream buffer over a string_view.  Lets the bound commands read their arguments with an std::istream
+    /// straight from the command line, without copying it into a std::stringstream.
+    class StringViewStreamBuffer : public std::streambuf
+    {
+      public:
+        void reset(std::string_view str)
+        {
+            // the get area is never written to, std::streambuf just has no const interface
+            char *begin = const_cast<char *>(str.data());
+            setg(begin, begin, begin + str.size());
+        }
+    };
+
+    /// streambuf appending everything written to it to a string, so values can be formatted in place
+    class StringAppendBuffer : public std::streambuf
+    {
+      public:
+        explicit StringAppendBuffer(std::string &str) : str(str) {}
+
+      protected:
+        int overflow(int c) override
+        {
+            if (c != traits_type::eof())
+            {
+                str.push_back(traits_type::to_char_type(c));
+            }
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char *s, std::streamsize n) override
+        {
+            str.append(s, static_cast<std::size_t>(n));
+            return n;
+        }
+
+      private:
+        std::string &str;
+    };
+
+    ConsoleHistoryBuffer history_buffer; ///< history buffer of previous commands
+    HistoryJournal history_journal;      ///< file history_buffer is persisted to, if open
+    HistorySearchIndex history_index;    ///< substring index of history_buffer, see searchHistory()
+
+    /// adds a line to the history buffer and the journal, warning on os if the journal can't be written
+    void recordHistory(std::string_view line, std::ostream &os);
+
+    ConsoleStats stats; ///< command timings and frontend statistics, see getStats()
+
+    /// the bound and created cVars.  Types without a built in representation are parsed and printed with the stream operators,
+    /// so the console can handle variables of any type representable as text without modifying the console code or adding custom parsing code.
+    CVarRegistry cvars;
+
+    ///maps strings to std function objects, representing the available commands to the user.  eg, quit, set, etc
+    CommandTable commandTable;
+
+    /// maps names of functions or cvars to string literals containing helpful information on their use
+    HelpTable helpTable;
+
+    /// names of commandTable in sorted order
+    CompletionIndex commandIndex;
+
+    /// names of cvars in sorted order
+    CompletionIndex cvarIndex;
+
+    /// a coroutine command waiting in the task queue
+    struct RunningTask
+    {
+        std::string name;
+        std::unique_ptr<std::istringstream> args; ///< rest of the command line, the task reads it after the line's own stream is gone
+        std::ostream *output = nullptr;
+        ConsoleTask task;
+    };
+
+    /// waiting tasks, the front one runs
+    std::deque<RunningTask> tasks;
+
+    /// number of batches and task slices being executed.  Coroutine commands run to completion while it's above 0
+    int synchronousDepth = 0;
+
+    bool runningTasks = false;   ///< set while runTasks() resumes a task
+    bool cancelRequested = false; ///< cancelTasks() was called from inside a task
+
+    struct SynchronousScope
+    {
+        int &depth;
+        explicit SynchronousScope(int &depth) : depth(depth) { ++depth; }
+        ~SynchronousScope() { --depth; }
+    };
+
+    /// creates the task of a coroutine command and queues it, or runs it to completion inside a batch or another task
+    void startTask(const std::string &commandName, const AsyncConsoleFunc &f, std::istream &is, std::ostream &os);
+
+    /// entry of a coroutine command in the command table.  A named type, so setExecutionPolicy() can tell it apart
+    struct AsyncCommand
+    {
+        QuakeStyleConsole *console;
+        std::string name;
+        AsyncConsoleFunc f;
+
+        void operator()(std::istream &is, std::ostream &os) const { console->startTask(name, f, is, os); }
+    };
+
+    /// a command taking the styling of its error messages, so it can run without reading the console's style
+    typedef std::function<void(std::istream &, std::ostream &, const ConsoleStyling &)> StyledConsoleFunc;
+
+    /// entry of a command whose arguments are parsed by the console, styled by the console's style.  A named type, so setExecutionPolicy() can hand the parsing to a worker
+    struct StyledCommand
+    {
+        QuakeStyleConsole *console;
+        StyledConsoleFunc f;
+
+        void operator()(std::istream &is, std::ostream &os) const { f(is, os, console->style); }
+    };
+
+    /// entry of a worker command in the command table, submits the wrapped command to the worker pool
+    struct WorkerCommand
+    {
+        QuakeStyleConsole *console;
+        std::string name;
+        std::shared_ptr<const StyledConsoleFunc> f; ///< shared with the jobs, which may outlive the binding
+        ConsoleFunc mainThread;                     ///< the entry the command had before, restored by ExecutionPolicy::MainThread
+        ExecutionPolicy policy;
+
+        void operator()(std::istream &is, std::ostream &os) const { console->startWorkerCommand(*this, is, os); }
+    };
+
+    void startWorkerCommand(const WorkerCommand &cmd, std::istream &is, std::ostream &os);
+
+    /// runs the worker commands, declared last so its threads are joined before the rest of the console is destroyed
+    CommandWorkerPool worker_pool;
+
+    /// adds a command to commandTable and commandIndex
+    void addCommand(const std::string &commandName, ConsoleFunc f);
+
+    /// makes room in the tables for the given number of new commands and cvars
+    void reserveTables(std::size_t commandCount, std::size_t cvarCount);
+
+    /// adds an entry of a static table, after reserveTables()
+    void addStatic(const CommandSpec &spec);
+    void addStatic(const CVarSpec &spec);
+
+    /// calls a function pointer of a static table the way bindCommand() calls it
+    template <class R, class... Args>
+    static void runStatic(std::istream &is, std::ostream &os, const ConsoleStyling &styling, R (*f)(Args...));
+
+    ///dumps a list of available commands to the output stream
+    void listCmd(std::ostream &os) const;
+
+    ///dumps a list of bound cvars to the output stream
+    void listVars(std::ostream &os) const;
+
+    ///dumps a list of available help topics to the output stream
+    void listHelp(std::ostream &os) const;
+
+    ///The function associated with the built in command "set" which parses the name of a cvar, and if it is bound, sets the value based on
+    ///the value in the input stream
+    void commandSet(std::istream &is, std::ostream &os);
+
+    ///the function associated with built in command "echo", which prints the value of a cvar if it is bound. if not, reports an error.
+    void commandEcho(std::istream &is, std::ostream &os);
+
+    ///creates a variable from the console.  The value is a bool for true / false, a double for numbers and a string (the rest of the line) otherwise
+    void commandVar(std::istream &is, std::ostream &os);
+
+    ///wrapper function which parses arguments to a function object of arbitrary type from the console's input stream then executes the function if the parsing was successful
+    ///Static and styled by the caller, so worker commands parse their arguments without touching the console
+    template <typename... Args>
+    static void parse(std::istream &is, std::ostream &os, const ConsoleStyling &styling, std::function<void(Args...)> f);
+
+    ///This function is called by populateAndExecute, and only executes the bound function if the parsing succeeds
+    ///if parsing failed we do not want to pass in uninitialized garbage to the c++ function we bound
+    template <typename... Args>
+    static void conditionalExecute(std::istream &is, std::ostream &os, const ConsoleStyling &styling, std::function<void(Args...)> f, const Args &... args);
+
+    /// adds the built-in commands to the command table
+    void bindBasicCommands();
+
+    /// the built in "set" command.  A named type lets batch execution tell it from a user command bound to "set"
+    struct SetCommand
+    {
+        QuakeStyleConsole *console;
+
+        void operator()(std::istream &is, std::ostream &os) const { console->commandSet(is, os); }
+    };
+
+    /// "set" values collected by executeBatch(), they point into the script being executed
+    struct DeferredAssignments
+    {
+        std::vector<std::pair<CVarHandle, std::string_view>> values;
+        std::unordered_map<std::uint32_t, std::size_t> index; ///< position of each variable in values, by handle
+    };
+
+    /// if line is a built in "set" without $ variables, records the assignment in deferred and returns true
+    bool deferAssignment(std::string_view line, std::ostream &os, const BatchOptions &options, DeferredAssignments &deferred);
+
+    /// applies and clears the deferred assignments
+    void applyAssignments(std::ostream &os, DeferredAssignments &deferred);
+
+    /// removes the next line to execute from script, skipping blank lines and comments.  Returns false if there's none left
+    static bool nextScriptLine(std::string_view &script, std::string_view &line);
+
+    /// executes a line of a batch, deferring it if it's an assignment
+    void executeScriptLine(std::string_view line, std::ostream &output, const BatchOptions &options, DeferredAssignments &deferred);
+
+    /// executes a single command line, leading whitespace already skipped.  Records it in history, echoes it, dereferences $ variables and runs the command
+    void executeLine(std::string_view line, std::ostream &os, bool recordHistory = true, bool echoLine = true);
+
+    /// returns the next whitespace delimited token of str and removes it from str.  Returns an empty view if there are no tokens left
+    static std::string_view nextToken(std::string_view &str);
+
+    /// reads one argument of a bound C++ function.  Arithmetic types are parsed with std::from_chars, everything else with operator>>
+    template <class T>
+    static void readArgument(std::istream &is, T &value);
+
+    /// helper function to return a default-constructed temp variable of a particular type.  Used in parsing arguments for C++ functions bound to the console
+    template <class T>
+    static T makeTemp();
+
+    /// for parsing arguments to C++ functions bound to the console.  variadic template that recursively parses our function arguments in order
+    template <typename FirstType, typename... Args>
+    static void populateTemps(std::istream &is, FirstType &in, Args &... Temps);
+
+    /// for parsing arguments to C++ functions bound to the console. variadic template that recursively parses our function arguments in order.  base case
+    template <typename FirstType>
+    static void populateTemps(std::istream &is, FirstType &in);
+
+    /// for parsing arguments to C++ functions bound to the console. variadic template that recursively parses our function arguments in order.  base case
+    static void populateTemps(std::istream &) {}
+
+    /// for parsing arguments to C++ functions bound to the console.  call starts populating temp variables
+    template <typename... Args>
+    static void goPopulateTemps(std::istream &is, Args &... temps);
+
+    /// for parsing arguments to C++ functions bound to the console.  Populates the temp variables using the istream, then calls the function with them
+    template <typename... Args>
+    static void populateAndExecute(std::istream &is, std::ostream &os, const ConsoleStyling &styling, std::function<void(Args...)> f,
+                                   typename std::remove_const<typename std::remove_reference<Args>::type>::type... temps);
+
+    /// problem found while expanding the $ references of a line
+    struct ExpansionError
+    {
+        std::size_t offset; ///< position of the $ in the line
+        std::string message;
+    };
+
+    typedef std::vector<ExpansionError> ExpansionErrors;
+
+    /// expands console variables whose names appear prefixed by the $ symbol, in a single pass over the line.
+    /// The result is written to out (replacing its contents), and substituted values are never expanded again.
+    /// Every variable is formatted once per call, even if the line references it repeatedly.
+    /// References that can't be expanded are copied verbatim and reported in errors.  Returns true if there were no errors
+    bool dereferenceVariables(std::string_view line, std::string &out, ExpansionErrors &errors);
+
+  public:
+    // -----------------------------------------------------------------------------
+    // EndOfLineEscapeStreamScope : by Steve132
+    // For wrapping the output of an ostream push sequence << in a begin / end tag
+    // Used for console output formatting
+    // -----------------------------------------------------------------------------
+    typedef std::pair<std::string, std::string> EndOfLineEscapeTag;
+
+    struct EndOfLineEscapeStreamScope
+    {
+      protected:
+        EndOfLineEscapeTag tag;
+        std::ostream &os;
+
+        EndOfLineEscapeStreamScope(const EndOfLineEscapeTag &ttag, std::ostream &tout) : tag(ttag),
+                                                                                         os(tout)
+        {
+            os << tag.first; //you can overload this for custom ostream types with a different color interface
+            //this might also have a stack interface for if you need multiple resets
+        }
+
+        friend EndOfLineEscapeStreamScope operator<<(std::ostream &out, const EndOfLineEscapeTag &tg);
+
+      public:
+        template <class T>
+        EndOfLineEscapeStreamScope &operator<<(T &&t)
+        {
+            os << std::forward<T>(t);
+            return *this;
+        }
+
+        EndOfLineEscapeStreamScope &operator<<(std::ostream &(&M)(std::ostream &))
+        {
+            M(os);
+            return *this;
+        }
+
+        ~EndOfLineEscapeStreamScope()
+        {
+            os << tag.second;
+        }
+    };
+};
+
+inline Virtuoso::QuakeStyleConsole::EndOfLineEscapeStreamScope operator<<(std::ostream &os, const Virtuoso::QuakeStyleConsole::EndOfLineEscapeTag &tg)
+{
+    return Virtuoso::QuakeStyleConsole::EndOfLineEscapeStreamScope(tg, os);
+}
+
+} // namespace Virtuoso
+
+#define VIRTUOSO_CONSOLE_CONCAT_IMPL(a, b) a##b
+#define VIRTUOSO_CONSOLE_CONCAT(a, b) VIRTUOSO_CONSOLE_CONCAT_IMPL(a, b)
+
+/// registers a function for QuakeStyleConsole::registerStatic().  Use at namespace scope, eg. VIRTUOSO_CONSOLE_COMMAND("quit", &quit, "exits the game")
+#define VIRTUOSO_CONSOLE_COMMAND(name, function, help)                                                        \
+    static const Virtuoso::QuakeStyleConsole::StaticCommand VIRTUOSO_CONSOLE_CONCAT(virtuosoStaticCommand, __COUNTER__)( \
+        Virtuoso::QuakeStyleConsole::staticCommand<function>(name, help))
+
+/// registers a variable with static storage duration for QuakeStyleConsole::registerStatic(), eg. VIRTUOSO_CONSOLE_CVAR("r_width", r_width, "window width")
+#define VIRTUOSO_CONSOLE_CVAR(name, variable, help)                                                        \
+    static const Virtuoso::QuakeStyleConsole::StaticCVar VIRTUOSO_CONSOLE_CONCAT(virtuosoStaticCVar, __COUNTER__)( \
+        Virtuoso::QuakeStyleConsole::staticCVar<variable>(name, help))
 
 // -----------------------------------------------------------------------------
-// QuakeStyleConsole : Method Implementations below
-// -----------------------------------------------------------------------------
+// QuakeStyleConsole : Method Implementations below
+// -----------------------------------------------------------------------------
+
+template <class T>
+inline T Virtuoso::QuakeStyleConsole::makeTemp()
+{
+    T temp{};
+    return temp;
+}
+
+template <typename... Args>
+inline void Virtuoso::QuakeStyleConsole::conditionalExecute(std::istream &is, std::ostream &os, const ConsoleStyling &styling, std::function<void(Args...)> f, const Args &... args)
+{
+    if (is.fail())
+    {
+        os << styling.error << "Syntax error in function arguments. See help <cmd>." << std::endl;
+        is.clear();
+    }
+    else
+    {
+        f(args...);
+    }
+}
+
+template <class T>
+inline void Virtuoso::QuakeStyleConsole::readArgument(std::istream &is, T &value)
+{
+    readValue(is, value);
+}
+
+template <typename FirstType>
+inline void Virtuoso::QuakeStyleConsole::populateTemps(std::istream &is, FirstType &in)
+{
+    readArgument(is, in);
+}
+
+//variadic template that recursively parses our function arguments in order
+template <typename FirstType, typename... Args>
+inline void Virtuoso::QuakeStyleConsole::populateTemps(std::istream &is, FirstType &in, Args &... Temps)
+{
+    readArgument(is, in);
+    populateTemps(is, Temps...);
+}
+
+template <typename... Args>
+inline void Virtuoso::QuakeStyleConsole::goPopulateTemps(std::istream &is, Args &... temps)
+{
+    populateTemps(is, temps...);
+}
+
+template <typename... Args>
+inline void Virtuoso::QuakeStyleConsole::populateAndExecute(std::istream &is, std::ostream &os, const ConsoleStyling &styling, std::function<void(Args...)> f,
+                                                            typename std::remove_const<typename std::remove_reference<Args>::type>::type... temps)
+{
+    goPopulateTemps<typename std::remove_const<typename std::remove_reference<Args>::type>::type...>(is, temps...);
+
+    conditionalExecute<Args...>(is, os, styling, f, temps...);
+}
+
+//function that gets bound as type void to the console with a second function object that may have multiple arguments of various types
+//this function gets called when the user enters the function name into the console.
+template <typename... Args>
+inline void Virtuoso::QuakeStyleConsole::parse(std::istream &is, std::ostream &os, const ConsoleStyling &styling, std::function<void(Args...)> f)
+{
+
+    //first we have to create a bunch of temp variables and pass them into the populateAndExecute function
+    //the temp variables are needed to store the result.  There's no guarantee in c++ for argument evaluation order, so we can't just
+    //skip the intermediate step of passing constructed temps into a second function
+    populateAndExecute<Args...>(is, os, styling, f, (makeTemp<typename std::remove_const<typename std::remove_reference<Args>::type>::type>())...);
+}
+
+inline void Virtuoso::QuakeStyleConsole::addCommand(const std::string &commandName, ConsoleFunc f)
+{
+    commandTable[commandName] = std::move(f);
+    commandIndex.insert(commandName);
+}
+
+inline void Virtuoso::QuakeStyleConsole::bindCommand(const std::string &str, void (*fptr)(void), const std::string &help)
+{
+    addCommand(str, [fptr](std::istream &, std::ostream &) { fptr(); });
+
+    if (help.length())
+        setHelpTopic(str, help);
+}
+
+template <typename... Args>
+inline void Virtuoso::QuakeStyleConsole::bindCommand(const std::string &str, void (*fptr)(Args...), const std::string &help)
+{
+    addCommand(str, StyledCommand{this, [fptr](std::istream &is, std::ostream &os, const ConsoleStyling &styling) {
+                                      parse<Args...>(is, os, styling, std::function<void(Args...)>(fptr));
+                                  }});
+
+    if (help.length())
+        setHelpTopic(str, help);
+}
+
+template <typename... Args>
+inline void Virtuoso::QuakeStyleConsole::bindCommand(const std::string &str, std::function<void(Args...)> fun, const std::string &help)
+{
+    addCommand(str, StyledCommand{this, [fun](std::istream &is, std::ostream &os, const ConsoleStyling &styling) {
+                                      parse<Args...>(is, os, styling, fun);
+                                  }});
+
+    if (help.length())
+        setHelpTopic(str, help);
+}
+
+template <typename Func>
+inline void Virtuoso::QuakeStyleConsole::bindCommand(const std::string &commandName, Func&& func, const std::string &help) {
+    auto wrappedFunc = std::function{std::forward<Func>(func)};
+    bindCommand(commandName, wrappedFunc, help);
+}
+
+inline void Virtuoso::QuakeStyleConsole::bindCommand(const std::string &str, AsyncConsoleFunc fun, const std::string &help)
+{
+    if (help.length())
+        setHelpTopic(str, help);
+
+    addCommand(str, AsyncCommand{this, str, std::move(fun)});
+}
+
+template <typename Func>
+inline void Virtuoso::QuakeStyleConsole::bindCommand(const std::string &commandName, Func &&func, ExecutionPolicy policy, const std::string &help)
+{
+    bindCommand(commandName, std::forward<Func>(func), help);
+    setExecutionPolicy(commandName, policy);
+}
+
+inline bool Virtuoso::QuakeStyleConsole::setExecutionPolicy(const std::string &commandName, ExecutionPolicy policy)
+{
+    CommandTable::iterator it = commandTable.find(commandName);
+    if (it == commandTable.end() || it->second.target<AsyncCommand>())
+    {
+        return false;
+    }
+
+    // unwrap a command that already has a worker policy
+    std::shared_ptr<const StyledConsoleFunc> f;
+    ConsoleFunc mainThread;
+    if (const WorkerCommand *worker = it->second.target<WorkerCommand>())
+    {
+        f = worker->f;
+        mainThread = worker->mainThread;
+    }
+    else
+    {
+        mainThread = std::move(it->second);
+        if (const StyledCommand *styled = mainThread.target<StyledCommand>())
+        {
+            f = std::make_shared<const StyledConsoleFunc>(styled->f);
+        }
+        else
+        {
+            f = std::make_shared<const StyledConsoleFunc>([g = mainThread](std::istream &is, std::ostream &os, const ConsoleStyling &) { g(is, os); });
+        }
+    }
+
+    if (policy == ExecutionPolicy::MainThread)
+    {
+        it->second = std::move(mainThread);
+    }
+    else
+    {
+        it->second = WorkerCommand{this, commandName, std::move(f), std::move(mainThread), policy};
+    }
+    return true;
+}
+
+template <auto F>
+inline constexpr Virtuoso::QuakeStyleConsole::CommandSpec Virtuoso::QuakeStyleConsole::staticCommand(std::string_view name, std::string_view help)
+{
+    return {name, [](std::istream &is, std::ostream &os, const ConsoleStyling &styling) { runStatic(is, os, styling, F); }, help};
+}
+
+template <auto &Var>
+inline constexpr Virtuoso::QuakeStyleConsole::CVarSpec Virtuoso::QuakeStyleConsole::staticCVar(std::string_view name, std::string_view help)
+{
+    return {name, [](CVarRegistry &cvars, std::string_view varname) { return cvars.bind(varname, Var); }, help};
+}
+
+template <class R, class... Args>
+inline void Virtuoso::QuakeStyleConsole::runStatic(std::istream &is, std::ostream &os, const ConsoleStyling &styling, R (*f)(Args...))
+{
+    if constexpr (std::is_same_v<void(Args...), void(std::istream &, std::ostream &)>)
+    {
+        f(is, os);
+    }
+    else if constexpr (sizeof...(Args) == 0)
+    {
+        f();
+    }
+    else
+    {
+        // same parsing as bindCommand(), a std::function of a function pointer doesn't allocate
+        parse<Args...>(is, os, styling, std::function<void(Args...)>(f));
+    }
+}
+
+inline Virtuoso::QuakeStyleConsole::StaticCommand::StaticCommand(const CommandSpec &spec)
+    : spec(spec), next(first)
+{
+    first = this;
+    count++;
+}
+
+inline Virtuoso::QuakeStyleConsole::StaticCVar::StaticCVar(const CVarSpec &spec)
+    : spec(spec), next(first)
+{
+    first = this;
+    count++;
+}
+
+inline void Virtuoso::QuakeStyleConsole::reserveTables(std::size_t commandCount, std::size_t cvarCount)
+{
+    commandTable.reserve(commandTable.size() + commandCount);
+    commandIndex.reserve(commandCount);
+    cvars.reserve(cvarCount);
+    cvarIndex.reserve(cvarCount);
+    helpTable.reserve(helpTable.size() + commandCount + cvarCount);
+}
+
+inline void Virtuoso::QuakeStyleConsole::addStatic(const CommandSpec &spec)
+{
+    std::string name(spec.name);
+    // a function pointer fits in std::function's small buffer
+    commandTable.insert_or_assign(name, ConsoleFunc(StyledCommand{this, spec.run}));
+    if (!spec.help.empty())
+    {
+        helpTable.insert_or_assign(name, std::string(spec.help));
+    }
+    commandIndex.insert(std::move(name));
+}
+
+inline void Virtuoso::QuakeStyleConsole::addStatic(const CVarSpec &spec)
+{
+    spec.bind(cvars, spec.name);
+    if (!spec.help.empty())
+    {
+        helpTable.insert_or_assign(std::string(spec.name), std::string(spec.help));
+    }
+    cvarIndex.insert(std::string(spec.name));
+}
+
+inline void Virtuoso::QuakeStyleConsole::registerStatic(std::span<const CommandSpec> commandSpecs, std::span<const CVarSpec> cvarSpecs)
+{
+    reserveTables(commandSpecs.size(), cvarSpecs.size());
+
+    for (const CommandSpec &spec : commandSpecs)
+    {
+        addStatic(spec);
+    }
+
+    for (const CVarSpec &spec : cvarSpecs)
+    {
+        addStatic(spec);
+    }
+}
+
+inline void Virtuoso::QuakeStyleConsole::registerStatic()
+{
+    reserveTables(StaticCommand::count, StaticCVar::count);
+
+    for (const StaticCommand *node = StaticCommand::first; node; node = node->next)
+    {
+        addStatic(node->spec);
+    }
+
+    for (const StaticCVar *node = StaticCVar::first; node; node = node->next)
+    {
+        addStatic(node->spec);
+    }
+}
+
+inline void Virtuoso::QuakeStyleConsole::bindCommand(const std::string &str, ConsoleFunc fun, const std::string &help)
+{
+    if (help.length())
+        setHelpTopic(str, help);
+
+    addCommand(str, std::move(fun));
+}
+
+inline void Virtuoso::QuakeStyleConsole::unbindCommand(const std::string &commandName) {
+    commandTable.erase(commandName);
+    commandIndex.erase(commandName);
+    helpTable.erase(commandName);
+}
+
+inline void Virtuoso::QuakeStyleConsole::unbindAll() {
+    commandTable.clear();
+    commandIndex.clear();
+    helpTable.clear();
+}
+
+inline void Virtuoso::QuakeStyleConsole::setHelpTopic(const std::string &str, const std::string &data)
+{
+    helpTable[str] = data;
+}
+
+template <class T>
+inline Virtuoso::CVarHandle Virtuoso::QuakeStyleConsole::bindCVar(const std::string &str, T &var, const std::string &help)
+{
+    const CVarHandle h = cvars.bind(str, var);
+    cvarIndex.insert(str);
+
+    if (help.length())
+        setHelpTopic(str, help);
+
+    return h;
+}
+
+template <class T>
+inline Virtuoso::CVarHandle Virtuoso::QuakeStyleConsole::createCVar(const std::string &str, const T &value, const std::string &help)
+{
+    const CVarHandle h = cvars.create(str, value);
+    cvarIndex.insert(str);
+
+    if (help.length())
+        setHelpTopic(str, help);
+
+    return h;
+}
+
+inline void Virtuoso::QuakeStyleConsole::executeUntilEOF(std::istream &f, std::ostream &output)
+{
+    const SynchronousScope scope(synchronousDepth);
+    while (!f.eof())
+    {
+        commandExecute(f, output);
+    }
+}
+
+inline void Virtuoso::QuakeStyleConsole::executeFile(const std::string &x, std::ostream &output)
+{
+    executeFile(x, output, scriptOptions);
+}
+
+inline void Virtuoso::QuakeStyleConsole::executeFile(const std::string &x, std::ostream &output, const BatchOptions &options)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    MappedFile f(x);
+
+    if (!f.is_open())
+    {
+        output << error() << "Unable to open file : " << x << std::endl;
+        return;
+    }
+
+    const std::size_t count = executeBatch(f.view(), output, options);
+
+    if (options.reportTiming)
+    {
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        output << "Executed " << count << " lines from " << x << " in " << elapsed.count() << " ms" << std::endl;
+    }
+}
+
+inline std::size_t Virtuoso::QuakeStyleConsole::executeBatch(std::string_view script, std::ostream &output, const BatchOptions &options)
+{
+    const SynchronousScope scope(synchronousDepth);
+
+    std::optional<CVarTransaction> transaction;
+    if (options.transaction)
+    {
+        transaction.emplace(cvars);
+    }
+
+    DeferredAssignments deferred;
+    std::size_t count = 0;
+    std::string_view line;
+
+    while (nextScriptLine(script, line))
+    {
+        count++;
+        executeScriptLine(line, output, options, deferred);
+    }
+
+    applyAssignments(output, deferred);
+    return count;
+}
+
+inline Virtuoso::ConsoleTask Virtuoso::QuakeStyleConsole::executeFileAsync(std::string x, std::ostream &output, BatchOptions options)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    MappedFile f(x);
+
+    if (!f.is_open())
+    {
+        output << error() << "Unable to open file : " << x << std::endl;
+        co_return;
+    }
+
+    std::optional<CVarTransaction> transaction;
+    if (options.transaction)
+    {
+        transaction.emplace(cvars);
+    }
+
+    DeferredAssignments deferred;
+    std::size_t count = 0;
+    std::string_view script = f.view();
+    std::string_view line;
+
+    while (nextScriptLine(script, line))
+    {
+        count++;
+        executeScriptLine(line, output, options, deferred);
+
+        if (ConsoleTask::sliceExpired())
+        {
+            // other commands may run before the file continues
+            applyAssignments(output, deferred);
+            co_await ConsoleTask::yield();
+        }
+    }
+
+    applyAssignments(output, deferred);
+
+    if (options.reportTiming)
+    {
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        output << "Executed " << count << " lines from " << x << " in " << elapsed.count() << " ms" << std::endl;
+    }
+}
+
+inline bool Virtuoso::QuakeStyleConsole::nextScriptLine(std::string_view &script, std::string_view &line)
+{
+    while (!script.empty())
+    {
+        const std::size_t eol = script.find('\n');
+        line = script.substr(0, eol);
+        script.remove_prefix(eol == script.npos ? script.size() : eol + 1);
+
+        // blank lines and comments are ignored
+        const std::size_t begin = line.find_first_not_of(" \t\v\f\r");
+        if (begin == line.npos || line[begin] == '#')
+        {
+            continue;
+        }
+        line.remove_prefix(begin);
+        if (line.back() == '\r')
+        {
+            line.remove_suffix(1);
+        }
+        return true;
+    }
+    return false;
+}
+
+inline void Virtuoso::QuakeStyleConsole::executeScriptLine(std::string_view line, std::ostream &output, const BatchOptions &options, DeferredAssignments &deferred)
+{
+    if (options.deferSet && deferAssignment(line, output, options, deferred))
+    {
+        return;
+    }
+
+    // any other command may read the variables, so they have to be up to date
+    applyAssignments(output, deferred);
+    executeLine(line, output, options.recordHistory, options.echo);
+}
+
+inline void Virtuoso::QuakeStyleConsole::startTask(const std::string &commandName, const AsyncConsoleFunc &f, std::istream &is, std::ostream &os)
+{
+    RunningTask t;
+    t.name = commandName;
+    t.args = std::make_unique<std::istringstream>(std::string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>()));
+    t.output = &os;
+    t.task = f(*t.args, os);
+
+    if (synchronousDepth > 0)
+    {
+        // the lines after it may depend on what it does
+        const SynchronousScope scope(synchronousDepth);
+        t.task.resume(std::chrono::steady_clock::time_point::max());
+        return;
+    }
+
+    tasks.push_back(std::move(t));
+}
+
+inline bool Virtuoso::QuakeStyleConsole::runTasks(std::chrono::microseconds budget)
+{
+    const auto deadline = std::chrono::steady_clock::now() + budget;
+
+    worker_pool.drain();
+
+    while (!tasks.empty() && !cancelRequested)
+    {
+        bool done = false;
+        {
+            const SynchronousScope scope(synchronousDepth);
+            runningTasks = true;
+            try
+            {
+                done = tasks.front().task.resume(deadline);
+            }
+            catch (...)
+            {
+                runningTasks = false;
+                tasks.pop_front();
+                throw;
+            }
+            runningTasks = false;
+        }
+
+        if (!done)
+        {
+            break;
+        }
+        tasks.pop_front();
+
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            break;
+        }
+    }
+
+    if (cancelRequested)
+    {
+        cancelTasks();
+    }
+    return taskCount() > 0;
+}
+
+inline void Virtuoso::QuakeStyleConsole::cancelTasks()
+{
+    // the running task can't be destroyed from inside itself, it stops at its next yield
+    if (runningTasks)
+    {
+        cancelRequested = true;
+        ConsoleTask::expireSlice();
+        return;
+    }
+    cancelRequested = false;
+
+    while (!tasks.empty())
+    {
+        RunningTask t = std::move(tasks.front());
+        tasks.pop_front();
+        *t.output << warning().first << t.name << " cancelled" << warning().second << std::endl;
+    }
+
+    for (const CommandWorkerPool::Job &job : worker_pool.cancelQueued())
+    {
+        *job.output << warning().first << job.name << " cancelled" << warning().second << std::endl;
+    }
+}
+
+inline void Virtuoso::QuakeStyleConsole::startWorkerCommand(const WorkerCommand &cmd, std::istream &is, std::ostream &os)
+{
+    CommandWorkerPool::Job job;
+    job.name = cmd.name;
+    job.output = &os;
+    job.serial = cmd.policy == ExecutionPolicy::Worker;
+
+    // everything the job needs is copied, the worker doesn't touch the console: bound functions parse their arguments with the copied styling
+    std::string args(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>{});
+    job.run = [f = cmd.f, name = cmd.name, args = std::move(args), styling = style]() {
+        const auto start = std::chrono::steady_clock::now();
+
+        std::string out;
+        StringAppendBuffer outBuffer(out);
+        std::ostream outStream(&outBuffer);
+
+        StringViewStreamBuffer argsBuffer;
+        argsBuffer.reset(args);
+        std::istream argsStream(&argsBuffer);
+
+        try
+        {
+            (*f)(argsStream, outStream, styling);
+        }
+        catch (const std::exception &e)
+        {
+            outStream << styling.error.first << name << " failed : " << e.what() << styling.error.second << '\n';
+        }
+        catch (...)
+        {
+            outStream << styling.error.first << name << " failed" << styling.error.second << '\n';
+        }
+
+        // the echo of the command line scrolled away meanwhile, so the output gets its own
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::string header;
+        StringAppendBuffer headerBuffer(header);
+        std::ostream headerStream(&headerBuffer);
+        headerStream << styling.echo.first << name << args << " (" << elapsed.count() << " ms)" << styling.echo.second << '\n';
+        return header + out;
+    };
+
+    worker_pool.submit(std::move(job));
+}
+
+template <class F>
+inline std::future<std::invoke_result_t<F>> Virtuoso::QuakeStyleConsole::runOnMainThread(F &&f)
+{
+    typedef std::invoke_result_t<F> Result;
+    auto call = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(f));
+    std::future<Result> result = call->get_future();
+    worker_pool.postMainThread([call]() { (*call)(); });
+    return result;
+}
+
+inline bool Virtuoso::QuakeStyleConsole::deferAssignment(std::string_view line, std::ostream &os, const BatchOptions &options, DeferredAssignments &deferred)
+{
+    std::string_view rest = line;
+    if (line.find('$') != line.npos || nextToken(rest) != "set")
+    {
+        return false;
+    }
+
+    CommandTable::const_iterator cmd = commandTable.find(std::string_view("set"));
+    if (cmd == commandTable.end() || !cmd->second.target<SetCommand>())
+    {
+        return false;
+    }
+
+    if (options.recordHistory)
+    {
+        recordHistory(line, os);
+    }
+    if (options.echo)
+    {
+        os << echo() << line << std::endl;
+    }
+
+    const std::string_view x = nextToken(rest);
+    if (x.empty())
+    {
+        os << error() << "Syntax error parsing argument" << std::endl;
+        return true;
+    }
+
+    const CVarHandle h = cvars.find(x);
+    if (!h)
+    {
+        os << error() << "Variable " << x << " unknown." << std::endl;
+        return true;
+    }
+
+    // a later assignment to the same variable replaces the pending one
+    const auto [entry, inserted] = deferred.index.emplace(h.index, deferred.values.size());
+    if (inserted)
+    {
+        deferred.values.emplace_back(h, rest);
+    }
+    else
+    {
+        deferred.values[entry->second].second = rest;
+    }
+    return true;
+}
+
+inline void Virtuoso::QuakeStyleConsole::applyAssignments(std::ostream &os, DeferredAssignments &deferred)
+{
+    if (deferred.values.empty())
+    {
+        return;
+    }
+
+    StringViewStreamBuffer valueBuffer;
+    std::istream valueStream(&valueBuffer);
+
+    for (const auto &[h, value] : deferred.values)
+    {
+        valueBuffer.reset(value);
+        valueStream.clear();
+        if (!cvars.read(h, valueStream))
+        {
+            os << error() << "Syntax error in variable parser" << std::endl;
+        }
+    }
+
+    deferred.values.clear();
+    deferred.index.clear();
+}
+
+inline void Virtuoso::QuakeStyleConsole::commandHelp(std::istream &is, std::ostream &os)
+{
+    const char *genericHelp = "Type 'help' followed by the name of a command or variable to get help on that topic if available.";
+
+    std::string x;
+
+    if (is >> x)
+    {
+        HelpTable::const_iterator it = helpTable.find(x);
+
+        if (it != helpTable.end())
+        {
+            os << (it->second) << std::endl;
+        }
+        else
+        {
+            os << error() << "No help available for topic: " << x << std::endl;
+        }
+    }
+    else
+    {
+        os << genericHelp << std::endl;
+    }
+}
+
+inline void Virtuoso::QuakeStyleConsole::listHelp(std::ostream &os) const
+{
+    os << "\nAvailable help topics:";
+
+    for (HelpTable::const_iterator it = helpTable.begin(); it != helpTable.end(); it++)
+    {
+        os << "\n"
+           << it->first;
+    }
+
+    os << std::endl;
+}
+
+inline void Virtuoso::QuakeStyleConsole::listCmd(std::ostream &os) const
+{
+    os << "\nAvailable commands:";
+
+    for (CommandTable::const_iterator it = commandTable.begin(); it != commandTable.end(); it++)
+    {
+        os << "\n"
+           << it->first;
+    }
+
+    os << std::endl;
+}
+
+inline void Virtuoso::QuakeStyleConsole::listVars(std::ostream &os) const
+{
+    os << "\nBound console variables:";
+
+    for (const std::string &name : cvarIndex)
+    {
+        os << "\n"
+           << name;
+    }
+
+    os << std::endl;
+}
+
+inline void Virtuoso::QuakeStyleConsole::commandSet(std::istream &is, std::ostream &os)
+{
+    std::string x;
+
+    if (!(is >> x))
+    {
+        os << error() << "Syntax error parsing argument" << std::endl;
+        return;
+    }
+
+    const CVarHandle h = cvars.find(x);
+
+    if (!h)
+    {
+        os << error() << "Variable " << x << " unknown." << std::endl;
+    }
+    else if (!cvars.read(h, is))
+    {
+        os << error() << "Syntax error in variable parser" << std::endl;
+    }
+}
+
+/// the function associated with built in command "echo", which prints the value of a cvar if it is bound. if not, reports an error.
+inline void Virtuoso::QuakeStyleConsole::commandEcho(std::istream &is, std::ostream &os)
+{
+    std::string x;
+
+    if (!(is >> x))
+    {
+        os << error() << "Syntax error parsing argument." << std::endl;
+        return;
+    }
+
+    const CVarHandle h = cvars.find(x);
+
+    if (h)
+    {
+        cvars.write(h, os);
+        os << std::endl;
+    }
+    else
+    {
+        os << error() << "Variable " << x << " unknown." << std::endl;
+    }
+}
+
+inline void Virtuoso::QuakeStyleConsole::commandVar(std::istream &is, std::ostream &os)
+{
+    std::string name;
+    if (!(is >> name))
+    {
+        os << error() << "Syntax error parsing argument" << std::endl;
+        return;
+    }
+
+    std::string value;
+    is >> std::ws;
+    std::getline(is, value);
+    while (!value.empty() && std::isspace(static_cast<unsigned char>(value.back())))
+    {
+        value.pop_back();
+    }
+
+    // a declared name keeps its type, handles of the game point to it
+    if (const CVarHandle h = cvars.find(name))
+    {
+        StringViewStreamBuffer valueBuffer;
+        valueBuffer.reset(value);
+        std::istream valueStream(&valueBuffer);
+        if (!cvars.read(h, valueStream))
+        {
+            os << error() << "Variable " << name << " already exists, unable to parse " << value << std::endl;
+        }
+        return;
+    }
+
+    // a number only if it's written back exactly as typed, so 01234, 1.10 or nan stay text
+    const char *end = value.data() + value.size();
+    double number = 0.0;
+    const std::from_chars_result parsed = std::from_chars(value.data(), end, number);
+    char written[64];
+    const std::to_chars_result formatted = std::to_chars(written, written + sizeof(written), number);
+    const bool exactNumber = !value.empty() && parsed.ec == std::errc() && parsed.ptr == end && std::isfinite(number) &&
+                             std::string_view(written, formatted.ptr - written) == value;
+
+    if (value == "true" || value == "false")
+    {
+        cvars.create(name, value == "true");
+    }
+    else if (exactNumber)
+    {
+        cvars.create(name, number);
+    }
+    else
+    {
+        cvars.create(name, value, true);
+    }
+    cvarIndex.insert(name);
+}
+
+inline void Virtuoso::QuakeStyleConsole::commandExecute(std::string_view str, std::ostream &output)
+{
+    const std::size_t begin = str.find_first_not_of(" \t\n\v\f\r");
+
+    // blank lines and comments are ignored
+    if (begin == str.npos || str[begin] == '#')
+    {
+        return;
+    }
+
+    str.remove_prefix(begin);
+    executeLine(str.substr(0, str.find('\n')), output);
+}
+
+///reads a string from the input stream and executes the command associated with it, if there is one.  if not, reports an error.
+inline void Virtuoso::QuakeStyleConsole::commandExecute(std::istream &is, std::ostream &os)
+{
+    char ch;
+    while (!is.eof())
+    {
+        ch = is.peek();
+
+        if (ch == std::char_traits<char>::eof())
+        {
+            is.get(ch);
+            return;
+        }
+        else if (ch == '#')
+        {
+            std::string tmp;
+            getline(is, tmp);
+            return;
+        } //if newline we will not parse anything else
+        else if (std::isspace(ch))
+        {
+            is.get(ch);
+            continue;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    std::string lineTemp;
+
+    getline(is, lineTemp); ///\todo this constrains us to a single line.  way to go later might be to require user or
+    ///generated command parser to return string that was parsed
+
+    executeLine(lineTemp, os);
+}
+
+inline std::string_view Virtuoso::QuakeStyleConsole::nextToken(std::string_view &str)
+{
+    std::size_t begin = 0;
+    while (begin < str.size() && std::isspace(static_cast<unsigned char>(str[begin])))
+    {
+        begin++;
+    }
+
+    std::size_t end = begin;
+    while (end < str.size() && !std::isspace(static_cast<unsigned char>(str[end])))
+    {
+        end++;
+    }
+
+    std::string_view token = str.substr(begin, end - begin);
+    str.remove_prefix(end);
+    return token;
+}
+
+inline void Virtuoso::QuakeStyleConsole::executeLine(std::string_view line, std::ostream &os, bool recordHistory, bool echoLine)
+{
+    if (recordHistory)
+    {
+        this->recordHistory(line, os);
+    }
+
+    if (echoLine)
+    {
+        os << echo() << line << std::endl;
+    }
+
+    StringViewStreamBuffer lineBuffer;
+    std::istream lineStream(&lineBuffer);
+
+    // the line is only copied when there are variables to substitute
+    std::string dereferenced;
+    if (line.find('$') != line.npos)
+    {
+        ExpansionErrors errors;
+        if (!dereferenceVariables(line, dereferenced, errors))
+        {
+            for (const ExpansionError &e : errors)
+            {
+                os << error() << e.message << std::endl;
+            }
+        }
+        line = dereferenced;
+    }
+
+    const std::string_view x = nextToken(line);
+
+    if (!x.empty())
+    {
+        CommandTable::const_iterator it = commandTable.find(x);
+
+        if (it == commandTable.end())
+        {
+            os << error() << "Command " << x << " unknown" << std::endl;
+        }
+        else
+        {
+            lineBuffer.reset(line);
+
+            // timed by the token: the command may rebind commands and invalidate the iterator
+            const ConsoleStats::ScopedTimer timer = stats.timeCommand(x);
+            (it->second)(lineStream, os); //execute the command
+        }
+    }
+}
+
+inline void Virtuoso::QuakeStyleConsole::bindBasicCommands()
+{
+    bindCommand("var", [this](std::istream &is, std::ostream &os) { this->commandVar(is, os); },
+                "Type var <varname> <value> to declare a dynamic variable with name <varname> and value <value>."
+                "\nVariable names are any space delimited string and variable value is set to the remainder of the line."
+                "\ntrue and false make a bool variable and numbers a double, game code reads them with cvar<T>().");
+
+    bindCommand("listCmd", [this](std::istream &, std::ostream &os) { this->listCmd(os); }, "lists the available console commands");
+
+    bindCommand("set", ConsoleFunc(SetCommand{this}), "type set <identifier> <val> to change the value of a cvar");
+
+    bindCommand("echo", [this](std::istream &is, std::ostream &os) { this->commandEcho(is, os); }, "type echo <identifier> to print the value of a cvar");
+
+    bindCommand("listVars", [this](std::istream &, std::ostream &os) { listVars(os); }, "lists the bound cvars");
+
+    bindCommand("help", [this](std::istream &is, std::ostream &os) { this->commandHelp(is, os); }, "you're a smartass");
+
+    bindCommand("listHelp", [this](std::istream &, std::ostream &os) { this->listHelp(os); }, "lists the available help topics");
+
+    bindCommand("runFile", [this](std::istream &is, std::ostream &os) {
+        std::string f;
+        is >> f;
+        return this->executeFileAsync(std::move(f), os, scriptOptions);
+    }, "runs the commands in a text file named by the argument as a batch, a time slice per frame");
+
+    bindCommand("stats", [this](std::istream &is, std::ostream &os) {
+        std::string arg;
+        is >> arg;
+        if (arg == "reset")
+        {
+            stats.reset();
+        }
+        else
+        {
+            stats.print(os);
+        }
+    }, "prints command execution times and frontend statistics.  Type stats reset to zero them");
+}
+
+inline void Virtuoso::QuakeStyleConsole::recordHistory(std::string_view line, std::ostream &os)
+{
+    history_buffer.push(line);
+    history_index.update(history_buffer);
+
+    if (history_journal.is_open() && !history_journal.append(line, history_buffer))
+    {
+        os << warning().first << "unable to write the history journal " << history_journal.path() << ", history is no longer saved" << warning().second << std::endl;
+        history_journal.close();
+    }
+}
+
+namespace Virtuoso
+{
+/// loads history saved as a journal, or as text with one line per entry
+inline void loadHistoryData(std::string_view data, HistoryBuffer &history)
+{
+    if (HistoryJournal::load(data, history))
+    {
+        return;
+    }
+
+    while (!data.empty())
+    {
+        const std::size_t end = std::min(data.find('\n'), data.size());
+        std::string_view line = data.substr(0, end);
+        data.remove_prefix(std::min(end + 1, data.size()));
+
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.remove_suffix(1);
+        }
+        if (!line.empty())
+        {
+            history.push(line);
+        }
+    }
+}
+} // namespace Virtuoso
+
+inline bool Virtuoso::QuakeStyleConsole::loadHistoryBuffer(const std::string &inFile)
+{
+    const MappedFile file(inFile);
+
+    if (file.is_open())
+    {
+        loadHistoryData(file.view(), history_buffer);
+        return true;
+    }
+
+    return false;
+}
+
+inline void Virtuoso::QuakeStyleConsole::saveHistoryBuffer(const std::string &outFile)
+{
+    if (history_journal.is_open() && history_journal.path() == outFile)
+    {
+        // every line is in the journal already
+        history_journal.sync();
+        return;
+    }
+
+    if (history_buffer.size())
+    {
+        std::ofstream hfo(outFile, std::ios::binary);
+        HistoryJournal::write(hfo, history_buffer);
+        hfo.close();
+    }
+}
+
+inline void Virtuoso::QuakeStyleConsole::loadHistoryBuffer(std::istream &inFile)
+{
+    std::string line;
+    while (std::getline(inFile, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        if (!line.empty())
+        {
+            history_buffer.push(line);
+        }
+    }
+}
+
+inline void Virtuoso::QuakeStyleConsole::saveHistoryBuffer(std::ofstream &outfile)
+{
+    for (std::size_t i = 0; i < history_buffer.size(); i++)
+    {
+        outfile << history_buffer[i] << '\n';
+    }
+    outfile.flush();
+}
+
+inline bool Virtuoso::QuakeStyleConsole::openHistoryJournal(const std::string &path, HistoryJournalOptions options)
+{
+    return history_journal.open(path, history_buffer, options);
+}
+
+inline void Virtuoso::QuakeStyleConsole::closeHistoryJournal()
+{
+    history_journal.close();
+}
+
+inline const Virtuoso::HistoryBuffer &Virtuoso::QuakeStyleConsole::historyBuffer() const
+{
+    return history_buffer;
+}
+
+inline std::size_t Virtuoso::QuakeStyleConsole::searchHistory(std::string_view query, std::uint64_t before)
+{
+    return history_index.findBefore(history_buffer, query, before);
+}
+
+inline bool Virtuoso::QuakeStyleConsole::dereferenceVariables(std::string_view line, std::string &out, ExpansionErrors &errors)
+{
+    out.clear();
+    out.reserve(line.size() + line.size() / 2);
+
+    // values are formatted straight into out; a repeated reference copies the first expansion
+    struct CachedValue
+    {
+        std::string_view name;
+        std::size_t offset;
+        std::size_t length;
+    };
+    std::vector<CachedValue> cache;
+
+    StringAppendBuffer outBuffer(out);
+    std::ostream valueStream(&outBuffer);
+
+    const std::size_t errorCount = errors.size();
+    std::size_t pos = 0;
+
+    while (pos < line.size())
+    {
+        const std::size_t dollar = line.find('$', pos);
+        out.append(line.substr(pos, dollar == line.npos ? line.npos : dollar - pos));
+        if (dollar == line.npos)
+        {
+            break;
+        }
+
+        std::size_t nameEnd = dollar + 1;
+        while (nameEnd < line.size() && !isspace(static_cast<unsigned char>(line[nameEnd])))
+        {
+            nameEnd++;
+        }
+        const std::string_view name = line.substr(dollar + 1, nameEnd - dollar - 1);
+        pos = nameEnd;
+
+        if (name.empty())
+        {
+            errors.push_back({dollar, "Expected identifier at $"});
+            out.push_back('$');
+            continue;
+        }
+
+        auto cached = std::find_if(cache.begin(), cache.end(), [name](const CachedValue &v) { return v.name == name; });
+        if (cached != cache.end())
+        {
+            // indices rather than pointers: growing out may move its data
+            const std::size_t at = out.size();
+            out.resize(at + cached->length);
+            std::copy_n(out.begin() + cached->offset, cached->length, out.begin() + at);
+            continue;
+        }
+
+        const CVarHandle h = cvars.find(name);
+        if (!h)
+        {
+            errors.push_back({dollar, "Variable " + std::string(name) + " not found"});
+            out.append(line.substr(dollar, nameEnd - dollar));
+            continue;
+        }
+
+        const std::size_t at = out.size();
+        cvars.write(h, valueStream);
+        cache.push_back({name, at, out.size() - at});
+    }
+
+    return errors.size() == errorCount;
+}
+
+inline int Virtuoso::CompletionIndex::compareNoCase(std::string_view a, std::string_view b)
+{
+    const std::size_t n = std::min(a.size(), b.size());
+    for (std::size_t i = 0; i < n; i++)
+    {
+        const int ca = std::tolower(static_cast<unsigned char>(a[i]));
+        const int cb = std::tolower(static_cast<unsigned char>(b[i]));
+        if (ca != cb)
+        {
+            return ca < cb ? -1 : 1;
+        }
+    }
+    return a.size() == b.size() ? 0 : (a.size() < b.size() ? -1 : 1);
+}
+
+inline bool Virtuoso::CompletionIndex::less(std::string_view a, std::string_view b)
+{
+    const int order = compareNoCase(a, b);
+    return order != 0 ? order < 0 : a < b;
+}
+
+inline void Virtuoso::CompletionIndex::normalize() const
+{
+    if (sortedCount == words.size())
+    {
+        return;
+    }
+
+    const auto middle = words.begin() + sortedCount;
+    std::sort(middle, words.end(), less);
+    std::inplace_merge(words.begin(), middle, words.end(), less);
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+    sortedCount = words.size();
+}
+
+inline void Virtuoso::CompletionIndex::insert(std::string word)
+{
+    words.push_back(std::move(word));
+}
+
+inline void Virtuoso::CompletionIndex::erase(std::string_view word)
+{
+    normalize();
+
+    const auto it = std::lower_bound(words.begin(), words.end(), word,
+                                     [](const std::string &a, std::string_view b) { return less(a, b); });
+    if (it != words.end() && *it == word)
+    {
+        words.erase(it);
+        sortedCount--;
+    }
+}
+
+inline void Virtuoso::CompletionIndex::assign(std::vector<std::string> newWords)
+{
+    words = std::move(newWords);
+    sortedCount = 0;
+}
+
+inline void Virtuoso::CompletionIndex::reserve(std::size_t count)
+{
+    words.reserve(words.size() + count);
+}
+
+inline void Virtuoso::CompletionIndex::clear()
+{
+    words.clear();
+    sortedCount = 0;
+}
+
+inline std::size_t Virtuoso::CompletionIndex::size() const
+{
+    normalize();
+    return words.size();
+}
+
+inline Virtuoso::CompletionIndex::const_iterator Virtuoso::CompletionIndex::begin() const
+{
+    normalize();
+    return words.cbegin();
+}
+
+inline Virtuoso::CompletionIndex::const_iterator Virtuoso::CompletionIndex::end() const
+{
+    normalize();
+    return words.cend();
+}
+
+inline std::pair<Virtuoso::CompletionIndex::const_iterator, Virtuoso::CompletionIndex::const_iterator>
+Virtuoso::CompletionIndex::findPrefix(std::string_view prefix) const
+{
+    normalize();
+
+    // the case-insensitive order is coarser than the index order, so matches form a single run
+    const_iterator first = std::lower_bound(words.cbegin(), words.cend(), prefix,
+                                            [](const std::string &a, std::string_view b) { return compareNoCase(a, b) < 0; });
+    const_iterator last = first;
+    while (last != words.cend() && last->size() >= prefix.size() &&
+           compareNoCase(std::string_view(*last).substr(0, prefix.size()), prefix) == 0)
+    {
+        last++;
+    }
+    return {first, last};
+}
+
+template <class T>
+inline void Virtuoso::readValue(std::istream &is, T &value)
+{
+    // bool and the character types keep their stream semantics (0/1 and single characters)
+    constexpr bool useFromChars = std::is_arithmetic_v<T> && !std::is_same_v<T, bool> &&
+                                  !std::is_same_v<T, char> && !std::is_same_v<T, signed char> && !std::is_same_v<T, unsigned char>;
+
+    if constexpr (useFromChars)
+    {
+        std::istream::sentry sentry(is); // skips leading whitespace, fails on eof
+        if (!sentry)
+        {
+            return;
+        }
+
+        // numbers are short, so the token is gathered on the stack instead of in a std::string
+        char token[128];
+        std::size_t length = 0;
+        std::streambuf *buf = is.rdbuf();
+        int ch = buf->sgetc();
+        while (ch != std::char_traits<char>::eof() && !std::isspace(ch))
+        {
+            if (length == sizeof(token))
+            {
+                is.setstate(std::ios_base::failbit);
+                return;
+            }
+            token[length++] = static_cast<char>(ch);
+            ch = buf->snextc();
+        }
+        if (ch == std::char_traits<char>::eof())
+        {
+            is.setstate(std::ios_base::eofbit);
+        }
+
+        // from_chars does not accept the explicit plus sign operator>> allows
+        const char *begin = token;
+        const char *end = token + length;
+        if (begin != end && *begin == '+')
+        {
+            begin++;
+        }
+
+        T parsed{};
+        const std::from_chars_result result = std::from_chars(begin, end, parsed);
+        if (result.ec != std::errc() || result.ptr != end)
+        {
+            is.setstate(std::ios_base::failbit);
+            return;
+        }
+        value = parsed;
+    }
+    else
+    {
+        is >> value;
+    }
+}
+
+inline Virtuoso::CVarHandle Virtuoso::CVarRegistry::find(std::string_view name) const
+{
+    const auto it = indices.find(name);
+    return it == indices.end() ? CVarHandle() : CVarHandle{it->second};
+}
+
+template <class T>
+inline Virtuoso::CVarHandle Virtuoso::CVarRegistry::bind(std::string_view name, T &var)
+{
+    return assign(name, &var, nullptr, false);
+}
+
+template <class T>
+inline Virtuoso::CVarHandle Virtuoso::CVarRegistry::create(std::string_view name, const T &value, bool readsLine)
+{
+    std::shared_ptr<T> owned = std::make_shared<T>(value);
+    T *data = owned.get();
+    return assign(name, data, std::move(owned), readsLine);
+}
+
+inline void Virtuoso::CVarRegistry::reserve(std::size_t count)
+{
+    slots.reserve(slots.size() + count);
+    indices.reserve(indices.size() + count);
+}
+
+template <class T>
+inline Virtuoso::CVarHandle Virtuoso::CVarRegistry::assign(std::string_view name, T *data, std::shared_ptr<void> owned, bool readsLine)
+{
+    CVarHandle h = find(name);
+    if (!h)
+    {
+        h.index = static_cast<std::uint32_t>(slots.size());
+        slots.emplace_back();
+        slots.back().name = name;
+        indices.emplace(std::string(name), h.index);
+    }
+    else if (!holds<T>(slots[h.index]))
+    {
+        // handles of the old slot may still be used with its type, never change it.  The bound variable may be gone, so
+        // nothing reaches it anymore
+        Slot &old = slots[h.index];
+        old.type = CVarType::Custom;
+        old.valueType = nullptr;
+        old.data = nullptr;
+        old.owned.reset();
+        old.listeners.clear();
+
+        h.index = static_cast<std::uint32_t>(slots.size());
+        slots.emplace_back();
+        slots.back().name = name;
+        indices.find(name)->second = h.index;
+    }
+
+    Slot &slot = slots[h.index];
+    slot.type = cvarTypeOf<T>();
+    slot.readsLine = readsLine;
+    slot.data = data;
+    slot.owned = std::move(owned);
+    slot.valueType = &typeid(T);
+    slot.read = &readSlot<T>;
+    slot.write = &writeSlot<T>;
+    return h;
+}
+
+template <class T>
+inline T &Virtuoso::CVarRegistry::get(CVarHandle h)
+{
+    return const_cast<T &>(std::as_const(*this).get<T>(h));
+}
+
+template <class T>
+inline bool Virtuoso::CVarRegistry::holds(const Slot &slot)
+{
+    if constexpr (cvarTypeOf<T>() != CVarType::Custom)
+    {
+        return slot.type == cvarTypeOf<T>();
+    }
+    else
+    {
+        return slot.type == CVarType::Custom && slot.valueType && *slot.valueType == typeid(T);
+    }
+}
+
+template <class T>
+inline const T &Virtuoso::CVarRegistry::get(CVarHandle h) const
+{
+    if (h.index >= slots.size() || !holds<T>(slots[h.index]))
+    {
+        if (h.index >= slots.size())
+        {
+            throw std::invalid_argument("invalid cvar handle");
+        }
+        const Slot &slot = slots[h.index];
+        throw std::invalid_argument("cvar " + slot.name + (slot.data ? " has a different type" : " was bound again with another type"));
+    }
+    return *static_cast<const T *>(slots[h.index].data);
+}
+
+template <class T>
+inline T *Virtuoso::CVarRegistry::tryGet(CVarHandle h)
+{
+    if (h.index >= slots.size() || !holds<T>(slots[h.index]))
+    {
+        return nullptr;
+    }
+    return static_cast<T *>(slots[h.index].data);
+}
+
+inline bool Virtuoso::CVarRegistry::read(CVarHandle h, std::istream &is)
+{
+    const Slot &slot = slots[h.index];
+    if (!slot.data || !slot.read(slot.data, is, slot.readsLine))
+    {
+        return false;
+    }
+    markChanged(h);
+    return true;
+}
+
+template <class T>
+inline void Virtuoso::CVarRegistry::set(CVarHandle h, T value)
+{
+    get<T>(h) = std::move(value);
+    markChanged(h);
+}
+
+inline void Virtuoso::CVarRegistry::markChanged(CVarHandle h)
+{
+    Slot &slot = slots[h.index];
+    slot.version++;
+    slot.dirty = true;
+
+    if (transactionDepth == 0)
+    {
+        notify(h);
+    }
+    else if (!slot.pending)
+    {
+        slot.pending = true;
+        pendingChanges.push_back(h);
+    }
+}
+
+inline void Virtuoso::CVarRegistry::notify(CVarHandle h)
+{
+    // listeners may add listeners or bind cvars, which moves the slots, so nothing is kept across the calls
+    for (std::size_t i = 0; i < slots[h.index].listeners.size(); i++)
+    {
+        const Listener listener = slots[h.index].listeners[i].second;
+        if (listener)
+        {
+            listener(h);
+        }
+    }
+}
+
+inline Virtuoso::CVarRegistry::ListenerId Virtuoso::CVarRegistry::addListener(CVarHandle h, Listener listener)
+{
+    const ListenerId id = nextListenerId++;
+    slots[h.index].listeners.emplace_back(id, std::move(listener));
+    return id;
+}
+
+inline void Virtuoso::CVarRegistry::removeListener(CVarHandle h, ListenerId id)
+{
+    auto &listeners = slots[h.index].listeners;
+    auto it = std::find_if(listeners.begin(), listeners.end(), [id](const auto &l) { return l.first == id; });
+    if (it != listeners.end())
+    {
+        // emptied rather than erased, a notification may be iterating over the listeners
+        it->second = nullptr;
+    }
+}
+
+inline void Virtuoso::CVarRegistry::beginTransaction()
+{
+    transactionDepth++;
+}
+
+inline void Virtuoso::CVarRegistry::endTransaction()
+{
+    assert(transactionDepth > 0 && "endTransaction() without beginTransaction()");
+    if (--transactionDepth != 0)
+    {
+        return;
+    }
+
+    // changes made by the listeners are notified right away, the transaction is over
+    std::vector<CVarHandle> changed;
+    changed.swap(pendingChanges);
+    for (const CVarHandle h : changed)
+    {
+        slots[h.index].pending = false;
+    }
+    for (const CVarHandle h : changed)
+    {
+        notify(h);
+    }
+}
+
+inline void Virtuoso::CVarRegistry::write(CVarHandle h, std::ostream &os) const
+{
+    const Slot &slot = slots[h.index];
+    if (slot.data)
+    {
+        slot.write(slot.data, os);
+    }
+}
+
+template <class T>
+inline bool Virtuoso::CVarRegistry::readSlot(void *data, std::istream &is, bool readsLine)
+{
+    T tmp{}; ///temp argument is a necessity; without it we risk corruption of our variable value if there is a parse error
+
+    if constexpr (std::is_same_v<T, std::string>)
+    {
+        if (readsLine)
+        {
+            is >> std::ws;
+            std::getline(is, tmp);
+            while (!tmp.empty() && std::isspace(static_cast<unsigned char>(tmp.back())))
+            {
+                tmp.pop_back();
+            }
+        }
+        else
+        {
+            is >> tmp;
+        }
+    }
+    else if constexpr (std::is_same_v<T, bool>)
+    {
+        std::string token;
+        is >> token;
+        if (token == "1" || token == "true")
+            tmp = true;
+        else if (token == "0" || token == "false")
+            tmp = false;
+        else
+            is.setstate(std::ios_base::failbit);
+    }
+    else
+    {
+        readValue(is, tmp);
+    }
+
+    if (is.fail())
+    {
+        is.clear();
+        return false;
+    }
+
+    *static_cast<T *>(data) = std::move(tmp);
+    return true;
+}
+
+template <class T>
+inline void Virtuoso::CVarRegistry::writeSlot(const void *data, std::ostream &os)
+{
+    const T &value = *static_cast<const T *>(data);
+
+    if constexpr (std::is_same_v<T, bool>)
+    {
+        // the words read accepts, so a value written out reads back and compares as typed
+        os << (value ? "true" : "false");
+    }
+    else if constexpr (std::is_same_v<T, std::string>)
+    {
+        os.write(value.data(), static_cast<std::streamsize>(value.size()));
+    }
+    else if constexpr (cvarTypeOf<T>() != CVarType::Custom)
+    {
+        char buffer[64];
+        const std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        os.write(buffer, result.ptr - buffer);
+    }
+    else
+    {
+        os << value;
+    }
+}
+
+inline void Virtuoso::ConsoleStats::Histogram::add(std::uint64_t ns)
+{
+    min = count ? std::min(min, ns) : ns;
+    max = std::max(max, ns);
+    count++;
+    total += ns;
+    buckets[std::bit_width(ns)]++;
+}
+
+inline double Virtuoso::ConsoleStats::Histogram::mean() const
+{
+    return count ? static_cast<double>(total) / static_cast<double>(count) : 0.0;
+}
+
+inline std::uint64_t Virtuoso::ConsoleStats::Histogram::percentile(double fraction) const
+{
+    const double rank = std::clamp(fraction, 0.0, 1.0) * static_cast<double>(count);
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < bucketCount; i++)
+    {
+        seen += buckets[i];
+        if (seen && static_cast<double>(seen) >= rank)
+        {
+            const std::uint64_t upper = i == 0 ? 0 : (i == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << i) - 1);
+            return std::min(upper, max);
+        }
+    }
+    return max;
+}
+
+#if VIRTUOSO_CONSOLE_STATS
+
+inline Virtuoso::ConsoleStats::ScopedTimer::ScopedTimer(Histogram &histogram)
+    : histogram(&histogram), start(std::chrono::steady_clock::now())
+{
+}
+
+inline Virtuoso::ConsoleStats::ScopedTimer::~ScopedTimer()
+{
+    if (histogram)
+    {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        histogram->add(static_cast<std::uint64_t>(elapsed.count()));
+    }
+}
+
+inline Virtuoso::ConsoleStats::ScopedTimer Virtuoso::ConsoleStats::timeCommand(std::string_view name)
+{
+    return ScopedTimer(entry(commandTimes, name));
+}
+
+inline Virtuoso::ConsoleStats::ScopedTimer Virtuoso::ConsoleStats::timeSection(std::string_view name)
+{
+    return ScopedTimer(entry(timerTimes, name));
+}
+
+inline void Virtuoso::ConsoleStats::recordCommand(std::string_view name, std::uint64_t ns)
+{
+    entry(commandTimes, name).add(ns);
+}
+
+inline void Virtuoso::ConsoleStats::recordTimer(std::string_view name, std::uint64_t ns)
+{
+    entry(timerTimes, name).add(ns);
+}
+
+inline void Virtuoso::ConsoleStats::addCounter(std::string_view name, std::uint64_t delta)
+{
+    entry(counterValues, name) += delta;
+}
+
+inline void Virtuoso::ConsoleStats::setGauge(std::string_view name, std::uint64_t value)
+{
+    entry(gaugeValues, name) = value;
+}
+
+#else
+
+inline Virtuoso::ConsoleStats::ScopedTimer::ScopedTimer(Histogram &) {}
+inline Virtuoso::ConsoleStats::ScopedTimer::~ScopedTimer() {}
+inline Virtuoso::ConsoleStats::ScopedTimer Virtuoso::ConsoleStats::timeCommand(std::string_view) { return ScopedTimer(); }
+inline Virtuoso::ConsoleStats::ScopedTimer Virtuoso::ConsoleStats::timeSection(std::string_view) { return ScopedTimer(); }
+inline void Virtuoso::ConsoleStats::recordCommand(std::string_view, std::uint64_t) {}
+inline void Virtuoso::ConsoleStats::recordTimer(std::string_view, std::uint64_t) {}
+inline void Virtuoso::ConsoleStats::addCounter(std::string_view, std::uint64_t) {}
+inline void Virtuoso::ConsoleStats::setGauge(std::string_view, std::uint64_t) {}
+
+#endif
+
+template <class Table>
+inline typename Table::mapped_type &Virtuoso::ConsoleStats::entry(Table &table, std::string_view name)
+{
+    typename Table::iterator it = table.find(name);
+    if (it == table.end())
+    {
+        it = table.emplace(std::string(name), typename Table::mapped_type{}).first;
+    }
+    return it->second;
+}
+
+inline const Virtuoso::ConsoleStats::Histogram *Virtuoso::ConsoleStats::findCommand(std::string_view name) const
+{
+    HistogramTable::const_iterator it = commandTimes.find(name);
+    return it == commandTimes.end() ? nullptr : &it->second;
+}
+
+inline const Virtuoso::ConsoleStats::Histogram *Virtuoso::ConsoleStats::findTimer(std::string_view name) const
+{
+    HistogramTable::const_iterator it = timerTimes.find(name);
+    return it == timerTimes.end() ? nullptr : &it->second;
+}
+
+inline std::uint64_t Virtuoso::ConsoleStats::counter(std::string_view name) const
+{
+    ValueTable::const_iterator it = counterValues.find(name);
+    return it == counterValues.end() ? 0 : it->second;
+}
+
+inline std::uint64_t Virtuoso::ConsoleStats::gauge(std::string_view name) const
+{
+    ValueTable::const_iterator it = gaugeValues.find(name);
+    return it == gaugeValues.end() ? 0 : it->second;
+}
+
+inline void Virtuoso::ConsoleStats::reset()
+{
+    for (auto &h : commandTimes)
+    {
+        h.second = Histogram();
+    }
+    for (auto &h : timerTimes)
+    {
+        h.second = Histogram();
+    }
+    for (auto &c : counterValues)
+    {
+        c.second = 0;
+    }
+    for (auto &g : gaugeValues)
+    {
+        g.second = 0;
+    }
+}
+
+inline void Virtuoso::ConsoleStats::printHistograms(std::ostream &os, const char *title, const HistogramTable &table)
+{
+    std::vector<const HistogramTable::value_type *> rows;
+    rows.reserve(table.size());
+    for (const auto &row : table)
+    {
+        rows.push_back(&row);
+    }
+    std::sort(rows.begin(), rows.end(), [](const auto *a, const auto *b) { return a->first < b->first; });
+
+    const auto us = [](double ns) { return ns / 1000.0; };
+    os << std::left << std::setw(24) << title << std::right << std::setw(10) << "count" << std::setw(12) << "mean us" << std::setw(12) << "p50 us"
+       << std::setw(12) << "p99 us" << std::setw(12) << "max us" << '\n';
+    for (const auto *row : rows)
+    {
+        const Histogram &h = row->second;
+        os << std::left << std::setw(24) << row->first << std::right << std::setw(10) << h.count << std::setw(12) << us(h.mean()) << std::setw(12)
+           << us(static_cast<double>(h.percentile(0.5))) << std::setw(12) << us(static_cast<double>(h.percentile(0.99))) << std::setw(12)
+           << us(static_cast<double>(h.max)) << '\n';
+    }
+}
+
+inline void Virtuoso::ConsoleStats::printValues(std::ostream &os, const char *title, const ValueTable &table)
+{
+    std::vector<const ValueTable::value_type *> rows;
+    rows.reserve(table.size());
+    for (const auto &row : table)
+    {
+        rows.push_back(&row);
+    }
+    std::sort(rows.begin(), rows.end(), [](const auto *a, const auto *b) { return a->first < b->first; });
 
-template <class T>
-inline T Virtuoso::QuakeStyleConsole::makeTemp()
+    os << std::left << std::setw(24) << title << std::right << std::setw(20) << "value" << '\n';
+    for (const auto *row : rows)
+    {
+        os << std::left << std::setw(24) << row->first << std::right << std::setw(20) << row->second << '\n';
+    }
+}
+
+inline void Virtuoso::ConsoleStats::print(std::ostream &os) const
 {
-    T temp{};
-    return temp;
+#if VIRTUOSO_CONSOLE_STATS
+    const std::ios_base::fmtflags flags = os.flags();
+    const std::streamsize precision = os.precision();
+    os << std::fixed << std::setprecision(1);
+
+    printHistograms(os, "command", commandTimes);
+    if (!timerTimes.empty())
+    {
+        printHistograms(os, "timer", timerTimes);
+    }
+    if (!counterValues.empty())
+    {
+        printValues(os, "counter", counterValues);
+    }
+    if (!gaugeValues.empty())
+    {
+        printValues(os, "gauge", gaugeValues);
+    }
+    os << std::flush;
+
+    os.flags(flags);
+    os.precision(precision);
+#else
+    os << "statistics are compiled out, see VIRTUOSO_CONSOLE_STATS" << std::endl;
+#endif
 }
 
-template <typename... Args>
-inline void Virtuoso::QuakeStyleConsole::conditionalExecute(std::istream &is, std::ostream &os, std::function<void(Args...)> f, const Args &... args)
+inline Virtuoso::MappedFile::MappedFile(const std::string &path)
 {
-    if (is.fail())
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
     {
-        os << error() << "Syntax error in function arguments. See help <cmd>." << std::endl;
-        is.clear();
+        return;
     }
-    else
+
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(file, &fileSize))
     {
-        f(args...);
+        opened = true;
+        size = static_cast<std::size_t>(fileSize.QuadPart);
+
+        if (size)
+        {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping)
+            {
+                data = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                mapped = data != nullptr;
+                CloseHandle(mapping); // the view keeps the mapping alive
+            }
+        }
+    }
+
+    CloseHandle(file);
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) == 0)
+    {
+        opened = true;
+        size = static_cast<std::size_t>(st.st_size);
+
+        if (size)
+        {
+            void *ptr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr != MAP_FAILED)
+            {
+                ::madvise(ptr, size, MADV_SEQUENTIAL);
+                data = static_cast<const char *>(ptr);
+                mapped = true;
+            }
+        }
+    }
+
+    ::close(fd);
+#endif
+
+    // files that can't be mapped (eg. pipes or special files) are read the usual way
+    if (opened && !mapped)
+    {
+        std::ifstream f(path, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        data = contents.data();
+        size = contents.size();
     }
 }
 
-template <typename FirstType>
-inline void Virtuoso::QuakeStyleConsole::populateTemps(std::istream &is, FirstType &in)
+inline Virtuoso::MappedFile::~MappedFile()
 {
-    is >> in;
+    if (mapped)
+    {
+#if defined(_WIN32)
+        UnmapViewOfFile(data);
+#else
+        ::munmap(const_cast<char *>(data), size);
+#endif
+    }
 }
 
-//variadic template that recursively parses our function arguments in order
-template <typename FirstType, typename... Args>
-inline void Virtuoso::QuakeStyleConsole::populateTemps(std::istream &is, FirstType &in, Args &... Temps)
+inline Virtuoso::HistoryBuffer::HistoryBuffer(std::size_t maxCapacity)
 {
-    is >> in;
-    populateTemps(is, Temps...);
+    resetSlots(maxCapacity);
 }
 
-template <typename... Args>
-inline void Virtuoso::QuakeStyleConsole::goPopulateTemps(std::istream &is, Args &... temps)
+inline void Virtuoso::HistoryBuffer::resetSlots(std::size_t newCapacity)
 {
-    populateTemps(is, temps...);
+    lines.assign(newCapacity, std::string());
+    positions.assign(newCapacity, 0);
+    freeSlots.resize(newCapacity);
+    for (std::size_t i = 0; i < newCapacity; ++i)
+    {
+        // taken from the back, so slot 0 goes first
+        freeSlots[i] = static_cast<std::uint32_t>(newCapacity - 1 - i);
+    }
+    slotOf.clear();
+    order.clear();
+    order.reserve(2 * newCapacity);
+    liveTree.assign(2 * newCapacity + 1, 0);
+    head = 0;
+    count = 0;
+    byteCount = 0;
 }
 
-template <typename... Args>
-inline void Virtuoso::QuakeStyleConsole::populateAndExecute(std::istream &is, std::ostream &os, std::function<void(Args...)> f,
-                                                            typename std::remove_const<typename std::remove_reference<Args>::type>::type... temps)
+inline void Virtuoso::HistoryBuffer::addLive(std::size_t pos, int delta)
 {
-    goPopulateTemps<typename std::remove_const<typename std::remove_reference<Args>::type>::type...>(is, temps...);
+    for (std::size_t i = pos + 1; i < liveTree.size(); i += i & (~i + 1))
+    {
+        liveTree[i] += delta;
+    }
+}
 
-    conditionalExecute<Args...>(is, os, f, temps...);
+inline std::size_t Virtuoso::HistoryBuffer::liveBefore(std::size_t pos) const
+{
+    std::size_t live = 0;
+    for (std::size_t i = pos; i > 0; i -= i & (~i + 1))
+    {
+        live += liveTree[i];
+    }
+    return live;
 }
 
-//function that gets bound as type void to the console with a second function object that may have multiple arguments of various types
-//this function gets called when the user enters the function name into the console.
-template <typename... Args>
-inline void Virtuoso::QuakeStyleConsole::parse(std::istream &is, std::ostream &os, std::function<void(Args...)> f)
+inline std::size_t Virtuoso::HistoryBuffer::position(std::size_t i) const
 {
+    // descends the tree to the last position with at most i live entries before it, which holds the live entry i
+    std::size_t pos = 0;
+    for (std::size_t step = std::bit_floor(liveTree.size() - 1); step > 0; step /= 2)
+    {
+        if (pos + step < liveTree.size() && liveTree[pos + step] <= i)
+        {
+            pos += step;
+            i -= liveTree[pos];
+        }
+    }
+    return pos;
+}
 
-    //first we have to create a bunch of temp variables and pass them into the populateAndExecute function
-    //the temp variables are needed to store the result.  There's no guarantee in c++ for argument evaluation order, so we can't just
-    //skip the intermediate step of passing constructed temps into a second function
-    populateAndExecute<Args...>(is, os, f, (makeTemp<typename std::remove_const<typename std::remove_reference<Args>::type>::type>())...);
+inline std::size_t Virtuoso::HistoryBuffer::find(std::uint64_t seq) const
+{
+    // sequence numbers increase along the log
+    const auto it = std::lower_bound(order.begin() + head, order.end(), seq, [](const Entry &e, std::uint64_t s) { return e.sequence < s; });
+    if (it == order.end() || it->sequence != seq || it->slot == deadSlot)
+    {
+        return npos;
+    }
+    return liveBefore(static_cast<std::size_t>(it - order.begin()));
 }
 
-inline void Virtuoso::QuakeStyleConsole::bindCommand(const std::string &str, void (*fptr)(void), const std::string &help)
+inline void Virtuoso::HistoryBuffer::append(std::uint32_t slot)
 {
-    commandTable[str] = [fptr](std::istream &, std::ostream &) { fptr(); };
+    if (order.size() + 1 == liveTree.size())
+    {
+        compact();
+    }
+    positions[slot] = static_cast<std::uint32_t>(order.size());
+    order.push_back({nextSequence++, slot});
+    addLive(order.size() - 1, 1);
+}
 
-    if (help.length())
-        setHelpTopic(str, help);
+inline void Virtuoso::HistoryBuffer::kill(std::size_t pos)
+{
+    order[pos].slot = deadSlot;
+    addLive(pos, -1);
 }
 
-template <typename... Args>
-inline void Virtuoso::QuakeStyleConsole::bindCommand(const std::string &str, void (*fptr)(Args...), const std::string &help)
+inline void Virtuoso::HistoryBuffer::compact()
 {
-    commandTable[str] =
-        [this, fptr](std::istream &is, std::ostream &os) {
-            auto fo = std::function<void(Args...)>(fptr);
-            this->parse<Args...>(is, os, fo);
-        };
+    std::size_t out = 0;
+    for (std::size_t pos = head; pos < order.size(); ++pos)
+    {
+        if (order[pos].slot != deadSlot)
+        {
+            positions[order[pos].slot] = static_cast<std::uint32_t>(out);
+            order[out++] = order[pos];
+        }
+    }
+    order.resize(out);
+    head = 0;
 
-    if (help.length())
-        setHelpTopic(str, help);
+    // every entry is live now, build the tree in place in O(N)
+    std::fill(liveTree.begin(), liveTree.end(), 0);
+    for (std::size_t i = 1; i < liveTree.size(); ++i)
+    {
+        liveTree[i] += i <= out;
+        const std::size_t parent = i + (i & (~i + 1));
+        if (parent < liveTree.size())
+        {
+            liveTree[parent] += liveTree[i];
+        }
+    }
 }
 
-template <typename... Args>
-inline void Virtuoso::QuakeStyleConsole::bindCommand(const std::string &str, std::function<void(Args...)> fun, const std::string &help)
+inline void Virtuoso::HistoryBuffer::push(std::string_view line)
 {
-    commandTable[str] =
-        [this, fun](std::istream &is, std::ostream &os) {
-            this->parse<Args...>(is, os, fun);
-        };
+    if (lines.empty())
+    {
+        return;
+    }
 
-    if (help.length())
-        setHelpTopic(str, help);
+    const auto found = slotOf.find(line);
+    if (found != slotOf.end())
+    {
+        const std::uint32_t slot = found->second;
+        kill(positions[slot]);
+        append(slot);
+        return;
+    }
+
+    if (count == lines.size())
+    {
+        popFront();
+    }
+
+    // the slot of a dropped line keeps its memory
+    const std::uint32_t slot = freeSlots.back();
+    freeSlots.pop_back();
+    lines[slot].assign(line);
+    slotOf.emplace(lines[slot], slot);
+    append(slot);
+    ++count;
+    byteCount += line.size();
 }
 
-template <typename Func>
-inline void Virtuoso::QuakeStyleConsole::bindCommand(const std::string &commandName, Func&& func, const std::string &help) {
-    auto wrappedFunc = std::function{std::forward<Func>(func)};
-    bindCommand(commandName, wrappedFunc, help);
+inline void Virtuoso::HistoryBuffer::popFront()
+{
+    while (order[head].slot == deadSlot)
+    {
+        ++head;
+    }
+
+    const std::uint32_t slot = order[head].slot;
+    kill(head++);
+    slotOf.erase(lines[slot]);
+    freeSlots.push_back(slot);
+    byteCount -= lines[slot].size();
+    --count;
 }
 
-inline void Virtuoso::QuakeStyleConsole::bindCommand(const std::string &str, ConsoleFunc fun, const std::string &help)
+inline void Virtuoso::HistoryBuffer::clear()
 {
-    if (help.length())
-        setHelpTopic(str, help);
+    resetSlots(lines.size());
+}
+
+inline void Virtuoso::HistoryBuffer::capacity(std::size_t newCapacity)
+{
+    while (count > newCapacity)
+    {
+        popFront();
+    }
+
+    // the remaining lines keep their order and sequence numbers
+    std::vector<std::string> kept;
+    std::vector<std::uint64_t> keptSequences;
+    kept.reserve(count);
+    keptSequences.reserve(count);
+    for (std::size_t pos = head; pos < order.size(); ++pos)
+    {
+        if (order[pos].slot != deadSlot)
+        {
+            kept.push_back(std::move(lines[order[pos].slot]));
+            keptSequences.push_back(order[pos].sequence);
+        }
+    }
 
-    commandTable[str] = fun;
+    resetSlots(newCapacity);
+    for (std::size_t i = 0; i < kept.size(); ++i)
+    {
+        const std::uint32_t slot = freeSlots.back();
+        freeSlots.pop_back();
+        lines[slot] = std::move(kept[i]);
+        slotOf.emplace(lines[slot], slot);
+        positions[slot] = static_cast<std::uint32_t>(order.size());
+        order.push_back({keptSequences[i], slot});
+        addLive(order.size() - 1, 1);
+        byteCount += lines[slot].size();
+    }
+    count = kept.size();
 }
 
-inline void Virtuoso::QuakeStyleConsole::unbindCommand(const std::string &commandName) {
-    commandTable.erase(commandName);
-    helpTable.erase(commandName);
+inline std::uint32_t Virtuoso::HistorySearchIndex::gram(const char *p, std::size_t n)
+{
+    // characters in the low bytes, length in the high one
+    std::uint32_t key = static_cast<std::uint32_t>(n) << 24;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        key |= static_cast<std::uint32_t>(static_cast<unsigned char>(std::tolower(static_cast<unsigned char>(p[i])))) << (8 * i);
+    }
+    return key;
 }
 
-inline void Virtuoso::QuakeStyleConsole::unbindAll() {
-    commandTable.clear();
-    helpTable.clear();
+inline bool Virtuoso::HistorySearchIndex::containsNoCase(std::string_view text, std::string_view query)
+{
+    const auto equal = [](char a, char b) { return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b)); };
+    return std::search(text.begin(), text.end(), query.begin(), query.end(), equal) != text.end();
 }
 
-inline void Virtuoso::QuakeStyleConsole::setHelpTopic(const std::string &str, const std::string &data)
+inline void Virtuoso::HistorySearchIndex::index(std::string_view line, std::uint64_t seq)
 {
-    helpTable[str] = data;
+    lineGrams.clear();
+    for (std::size_t i = 0; i < line.size(); ++i)
+    {
+        for (std::size_t n = 1; n <= 3 && i + n <= line.size(); ++n)
+        {
+            lineGrams.push_back(gram(line.data() + i, n));
+        }
+    }
+    std::sort(lineGrams.begin(), lineGrams.end());
+    lineGrams.erase(std::unique(lineGrams.begin(), lineGrams.end()), lineGrams.end());
+
+    for (const std::uint32_t g : lineGrams)
+    {
+        postings[g].push_back(seq);
+    }
+    ++indexedLines;
 }
 
-template <class T>
-inline void Virtuoso::QuakeStyleConsole::bindCVar(const std::string &str, T &var, const std::string &help)
+inline void Virtuoso::HistorySearchIndex::update(const HistoryBuffer &history)
 {
-    cvarReadFTable[str] =
-        [this, &var](std::istream &is, std::ostream &os) {
-            this->setCvar<T>(is, os, &var);
-        };
+    if (history.lastSequence() == indexedSequence)
+    {
+        return;
+    }
 
-    cvarPrintFTable[str] =
-        [this, &var](std::istream &, std::ostream &os) {
-            this->printCvar<T>(os, &var);
-        };
+    // lines that left the window are only skipped, start over once they are the majority
+    constexpr std::size_t minRebuildLines = 64;
+    if (indexedLines > 2 * std::max(history.size(), minRebuildLines))
+    {
+        clear();
+    }
 
-    if (help.length())
-        setHelpTopic(str, help);
+    // the lines not indexed yet are the newest ones
+    std::size_t i = history.size();
+    while (i > 0 && history.sequence(i - 1) > indexedSequence)
+    {
+        --i;
+    }
+    for (; i < history.size(); ++i)
+    {
+        index(history[i], history.sequence(i));
+    }
+    indexedSequence = history.lastSequence();
+}
+
+inline std::size_t Virtuoso::HistorySearchIndex::findBefore(const HistoryBuffer &history, std::string_view query, std::uint64_t before)
+{
+    update(history);
+
+    if (query.empty())
+    {
+        return HistoryBuffer::npos;
+    }
+
+    // every match is in the posting list of each n-gram of the query, walk the shortest one
+    const std::size_t n = std::min<std::size_t>(query.size(), 3);
+    const std::vector<std::uint64_t> *shortest = nullptr;
+    for (std::size_t i = 0; i + n <= query.size(); ++i)
+    {
+        const auto found = postings.find(gram(query.data() + i, n));
+        if (found == postings.end())
+        {
+            return HistoryBuffer::npos;
+        }
+        if (!shortest || found->second.size() < shortest->size())
+        {
+            shortest = &found->second;
+        }
+    }
+
+    for (auto it = std::lower_bound(shortest->begin(), shortest->end(), before); it != shortest->begin();)
+    {
+        const std::size_t i = history.find(*--it);
+        if (i != HistoryBuffer::npos && containsNoCase(history[i], query))
+        {
+            return i;
+        }
+    }
+    return HistoryBuffer::npos;
+}
+
+inline void Virtuoso::HistorySearchIndex::clear()
+{
+    postings.clear();
+    indexedSequence = 0;
+    indexedLines = 0;
+}
+
+inline Virtuoso::HistoryJournal::~HistoryJournal()
+{
+    close();
+}
+
+inline bool Virtuoso::HistoryJournal::open(const std::string &path, HistoryBuffer &history, HistoryJournalOptions journalOptions)
+{
+    close();
+    options = journalOptions;
+    filePath = path;
+    fileSize = 0;
+
+    bool rewrite = false;
+    std::size_t existingSize = 0;
+    {
+        const MappedFile existing(path);
+        if (existing.is_open() && !existing.view().empty())
+        {
+            existingSize = existing.view().size();
+            if (!load(existing.view(), history, &fileSize))
+            {
+                // text history of older versions
+                loadHistoryData(existing.view(), history);
+                rewrite = true;
+            }
+        }
+    }
+
+    if (!openFile())
+    {
+        return false;
+    }
+    fileOpen = true;
+    unsynced = false;
+    lastSync = std::chrono::steady_clock::now();
+
+    if (rewrite || fileSize == 0)
+    {
+        return compact(history);
+    }
+    if (fileSize < existingSize && !truncateFile(fileSize))
+    {
+        close();
+        return false;
+    }
+    if (options.compactionRatio && fileSize > options.compactionRatio * compactSize(history))
+    {
+        return compact(history);
+    }
+    return true;
+}
+
+inline void Virtuoso::HistoryJournal::close()
+{
+    if (!fileOpen)
+    {
+        return;
+    }
+    if (options.sync != HistorySyncPolicy::Never)
+    {
+        sync();
+    }
+    closeFile();
+    fileOpen = false;
+    fileSize = 0;
+}
+
+inline bool Virtuoso::HistoryJournal::append(std::string_view line, const HistoryBuffer &history)
+{
+    if (!fileOpen)
+    {
+        return false;
+    }
+
+    record.clear();
+    appendRecord(record, line);
+    if (!writeFile(record.data(), record.size()))
+    {
+        return false;
+    }
+    fileSize += record.size();
+    unsynced = true;
+
+    switch (options.sync)
+    {
+        case HistorySyncPolicy::Never:
+            break;
+        case HistorySyncPolicy::Always:
+            if (!sync())
+            {
+                return false;
+            }
+            break;
+        case HistorySyncPolicy::Interval:
+            if (std::chrono::steady_clock::now() - lastSync >= options.syncInterval && !sync())
+            {
+                return false;
+            }
+            break;
+    }
+
+    if (options.compactionRatio && fileSize > options.compactionRatio * compactSize(history))
+    {
+        return compact(history);
+    }
+    return true;
+}
+
+inline bool Virtuoso::HistoryJournal::sync()
+{
+    if (!fileOpen)
+    {
+        return false;
+    }
+    if (unsynced)
+    {
+        if (!syncFile())
+        {
+            return false;
+        }
+        unsynced = false;
+    }
+    lastSync = std::chrono::steady_clock::now();
+    return true;
 }
 
-template <class T>
-void Virtuoso::QuakeStyleConsole::setCvar(std::istream &is, std::ostream &os, T *var)
+inline bool Virtuoso::HistoryJournal::compact(const HistoryBuffer &history)
 {
-    T tmp; ///temp argument is a necessity; without it we risk corruption of our variable value if there is a parse error.  Should be no issue unless someone is using this to parse a ginormous structure or copy construction invokes a state change.
+    if (!fileOpen)
+    {
+        return false;
+    }
 
-    is >> tmp;
+    std::string data;
+    data.reserve(magic.size() + history.bytes() + history.size() * recordOverhead);
+    data.append(magic);
+    for (std::size_t i = 0; i < history.size(); ++i)
+    {
+        appendRecord(data, history[i]);
+    }
 
-    if (is.fail())
+    // the file is replaced under the open handle, which some platforms don't allow
+    closeFile();
+    fileOpen = false;
+    const bool replaced = replaceFile(filePath, data, options.sync != HistorySyncPolicy::Never);
+    if (!openFile())
     {
-        os << error() << "Syntax error in variable parser" << std::endl;
-        is.clear();
+        return false;
     }
-    else
+    fileOpen = true;
+    if (replaced)
     {
-        *var = tmp;
+        fileSize = data.size();
+        unsynced = false;
+        lastSync = std::chrono::steady_clock::now();
     }
+    return replaced;
 }
 
-template <class T>
-inline void Virtuoso::QuakeStyleConsole::printCvar(std::ostream &os, T *var)
+inline std::size_t Virtuoso::HistoryJournal::compactSize(const HistoryBuffer &history)
 {
-    os << *var << std::endl;
+    // small journals aren't worth rewriting
+    constexpr std::size_t minCompactSize = 4096;
+    return std::max(magic.size() + history.bytes() + history.size() * recordOverhead, minCompactSize);
 }
 
-template <class T>
-inline void Virtuoso::QuakeStyleConsole::assignDynamicVariable(std::istream &is, std::shared_ptr<T> var)
+inline bool Virtuoso::HistoryJournal::load(std::string_view data, HistoryBuffer &history, std::size_t *validSize)
 {
-    is >> (*var);
+    if (data.substr(0, magic.size()) != magic)
+    {
+        return false;
+    }
+
+    // the newest record is normally intact, otherwise find where the intact records end from the start
+    std::size_t end = data.size();
+    std::size_t pos = end;
+    std::string_view line;
+    if (end > magic.size() && !readRecordBefore(data, pos, line))
+    {
+        end = magic.size();
+        while (readRecord(data, end, line))
+        {
+        }
+    }
+    if (validSize)
+    {
+        *validSize = end;
+    }
+
+    // read backwards until the window is full, skipping older repeats of the lines already read
+    std::vector<std::string_view> lines;
+    std::unordered_set<std::string_view> seen;
+    pos = end;
+    while (lines.size() < history.capacity() && readRecordBefore(data, pos, line))
+    {
+        if (seen.insert(line).second)
+        {
+            lines.push_back(line);
+        }
+    }
+
+    for (auto it = lines.rbegin(); it != lines.rend(); ++it)
+    {
+        history.push(*it);
+    }
+    return true;
 }
 
-template <class T>
-inline void Virtuoso::QuakeStyleConsole::writeDynamicVariable(std::ostream &os, std::shared_ptr<T> var)
+inline void Virtuoso::HistoryJournal::write(std::ostream &os, const HistoryBuffer &history)
 {
-    const T &deref = *(var);
-    os << deref;
+    std::string data;
+    data.reserve(magic.size() + history.bytes() + history.size() * recordOverhead);
+    data.append(magic);
+    for (std::size_t i = 0; i < history.size(); ++i)
+    {
+        appendRecord(data, history[i]);
+    }
+    os.write(data.data(), static_cast<std::streamsize>(data.size()));
 }
 
-template <class T>
-inline void Virtuoso::QuakeStyleConsole::bindDynamicCVar(const std::string &var, const T &value, const std::string &help)
+inline std::uint32_t Virtuoso::HistoryJournal::checksum(std::string_view line)
 {
-    helpTable[var] = help;
-    bindDynamicCVar(var, value);
+    std::uint32_t hash = 2166136261u;
+    for (const char c : line)
+    {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+    }
+    return hash;
 }
 
-template <class T>
-inline void Virtuoso::QuakeStyleConsole::bindDynamicCVar(const std::string &var, const T &valueIn)
+inline std::uint32_t Virtuoso::HistoryJournal::readU32(const char *p)
 {
-    std::shared_ptr<T> ptr(new T(valueIn));
-
-    cvarReadFTable[var] =
-        [this, ptr](std::istream &is, std::ostream &) {
-            this->assignDynamicVariable<T>(is, ptr);
-        };
-
-    cvarPrintFTable[var] =
-        [this, ptr](std::istream &, std::ostream &os) {
-            this->writeDynamicVariable<T>(os, ptr);
-        };
+    const unsigned char *b = reinterpret_cast<const unsigned char *>(p);
+    return std::uint32_t(b[0]) | std::uint32_t(b[1]) << 8 | std::uint32_t(b[2]) << 16 | std::uint32_t(b[3]) << 24;
 }
 
-inline void Virtuoso::QuakeStyleConsole::executeUntilEOF(std::istream &f, std::ostream &output)
+inline void Virtuoso::HistoryJournal::writeU32(char *p, std::uint32_t value)
 {
-    while (!f.eof())
+    for (int i = 0; i < 4; ++i)
     {
-        commandExecute(f, output);
+        p[i] = static_cast<char>((value >> (8 * i)) & 0xffu);
     }
 }
 
-inline void Virtuoso::QuakeStyleConsole::executeFile(const std::string &x, std::ostream &output)
+inline void Virtuoso::HistoryJournal::appendRecord(std::string &out, std::string_view line)
 {
-    std::ifstream f(x);
+    const std::uint32_t length = static_cast<std::uint32_t>(line.size());
+    const std::size_t at = out.size();
+    out.resize(at + recordOverhead + line.size());
+
+    char *p = out.data() + at;
+    writeU32(p, length);
+    writeU32(p + 4, checksum(line));
+    std::copy(line.begin(), line.end(), p + 8);
+    writeU32(p + 8 + line.size(), length);
+}
 
-    if (!f.is_open())
+inline bool Virtuoso::HistoryJournal::readRecord(std::string_view data, std::size_t &pos, std::string_view &line)
+{
+    if (data.size() - pos < recordOverhead)
     {
-        output << error() << "Unable to open file : " << x << std::endl;
+        return false;
     }
-    else
+    const std::uint32_t length = readU32(data.data() + pos);
+    if (length > data.size() - pos - recordOverhead)
     {
-        executeUntilEOF(f, output);
+        return false;
     }
-
-    f.close();
+    line = data.substr(pos + 8, length);
+    if (readU32(data.data() + pos + 8 + length) != length || readU32(data.data() + pos + 4) != checksum(line))
+    {
+        return false;
+    }
+    pos += recordOverhead + length;
+    return true;
 }
 
-inline void Virtuoso::QuakeStyleConsole::commandHelp(std::istream &is, std::ostream &os)
+inline bool Virtuoso::HistoryJournal::readRecordBefore(std::string_view data, std::size_t &pos, std::string_view &line)
 {
-    const char *genericHelp = "Type 'help' followed by the name of a command or variable to get help on that topic if available.";
-
-    std::string x;
-
-    if (is >> x)
+    if (pos < magic.size() + recordOverhead)
     {
-        HelpTable::const_iterator it = helpTable.find(x);
-
-        if (it != helpTable.end())
-        {
-            os << (it->second) << std::endl;
-        }
-        else
-        {
-            os << error() << "No help available for topic: " << x << std::endl;
-        }
+        return false;
     }
-    else
+    const std::uint32_t length = readU32(data.data() + pos - 4);
+    if (length > pos - magic.size() - recordOverhead)
     {
-        os << genericHelp << std::endl;
+        return false;
+    }
+    const std::size_t start = pos - recordOverhead - length;
+    line = data.substr(start + 8, length);
+    if (readU32(data.data() + start) != length || readU32(data.data() + start + 4) != checksum(line))
+    {
+        return false;
     }
+    pos = start;
+    return true;
 }
 
-inline void Virtuoso::QuakeStyleConsole::listHelp(std::ostream &os) const
+#if defined(_WIN32)
+
+inline bool Virtuoso::HistoryJournal::openFile()
 {
-    os << "\nAvailable help topics:";
+    file = CreateFileA(filePath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    return file != INVALID_HANDLE_VALUE && SetFilePointerEx(file, LARGE_INTEGER{}, nullptr, FILE_END);
+}
 
-    for (HelpTable::const_iterator it = helpTable.begin(); it != helpTable.end(); it++)
+inline bool Virtuoso::HistoryJournal::writeFile(const char *data, std::size_t size)
+{
+    while (size)
     {
-        os << "\n"
-           << it->first;
+        DWORD written = 0;
+        const DWORD chunk = static_cast<DWORD>(std::min<std::size_t>(size, 1u << 30));
+        if (!WriteFile(file, data, chunk, &written, nullptr))
+        {
+            return false;
+        }
+        data += written;
+        size -= written;
     }
+    return true;
+}
 
-    os << std::endl;
+inline bool Virtuoso::HistoryJournal::syncFile()
+{
+    return FlushFileBuffers(file) != 0;
 }
 
-inline void Virtuoso::QuakeStyleConsole::listCmd(std::ostream &os) const
+inline bool Virtuoso::HistoryJournal::truncateFile(std::size_t size)
 {
-    os << "\nAvailable commands:";
+    LARGE_INTEGER offset;
+    offset.QuadPart = static_cast<LONGLONG>(size);
+    return SetFilePointerEx(file, offset, nullptr, FILE_BEGIN) && SetEndOfFile(file);
+}
 
-    for (CommandTable::const_iterator it = commandTable.begin(); it != commandTable.end(); it++)
+inline void Virtuoso::HistoryJournal::closeFile()
+{
+    if (file != INVALID_HANDLE_VALUE)
     {
-        os << "\n"
-           << it->first;
+        CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
     }
+}
 
-    os << std::endl;
+inline bool Virtuoso::HistoryJournal::replaceFile(const std::string &path, std::string_view data, bool sync)
+{
+    const std::string tmpPath = path + ".tmp";
+    const HANDLE tmp = CreateFileA(tmpPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (tmp == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    DWORD written = 0;
+    const bool ok = WriteFile(tmp, data.data(), static_cast<DWORD>(data.size()), &written, nullptr) && written == data.size() &&
+                    (!sync || FlushFileBuffers(tmp));
+    CloseHandle(tmp);
+    return ok && MoveFileExA(tmpPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
 }
 
-inline void Virtuoso::QuakeStyleConsole::listVars(std::ostream &os) const
+#else
+
+inline bool Virtuoso::HistoryJournal::openFile()
 {
-    os << "\nBound console variables:";
+    fd = ::open(filePath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    return fd >= 0;
+}
 
-    for (CVarReadTable::const_iterator it = cvarReadFTable.begin(); it != cvarReadFTable.end(); it++)
+inline bool Virtuoso::HistoryJournal::writeFile(const char *data, std::size_t size)
+{
+    while (size)
     {
-        os << "\n"
-           << it->first;
+        const ssize_t written = ::write(fd, data, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= static_cast<std::size_t>(written);
     }
+    return true;
+}
 
-    os << std::endl;
+inline bool Virtuoso::HistoryJournal::syncFile()
+{
+    return ::fsync(fd) == 0;
 }
 
-inline void Virtuoso::QuakeStyleConsole::commandSet(std::istream &is, std::ostream &os)
+inline bool Virtuoso::HistoryJournal::truncateFile(std::size_t size)
 {
-    std::string x;
+    return ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+}
 
-    if (!(is >> x))
+inline void Virtuoso::HistoryJournal::closeFile()
+{
+    if (fd >= 0)
     {
-        os << error() << "Syntax error parsing argument" << std::endl;
-        return;
+        ::close(fd);
+        fd = -1;
     }
+}
 
-    CVarReadTable::iterator it = cvarReadFTable.find(x);
-
-    if (it != cvarReadFTable.end())
+inline bool Virtuoso::HistoryJournal::replaceFile(const std::string &path, std::string_view data, bool sync)
+{
+    const std::string tmpPath = path + ".tmp";
+    const int tmp = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (tmp < 0)
     {
-        it->second(is, os);
+        return false;
     }
-    else
+    bool ok = true;
+    for (std::size_t done = 0; ok && done < data.size();)
     {
-        os << error() << "Variable " << x << " unknown." << std::endl;
+        const ssize_t written = ::write(tmp, data.data() + done, data.size() - done);
+        if (written >= 0)
+        {
+            done += static_cast<std::size_t>(written);
+        }
+        else
+        {
+            ok = errno == EINTR;
+        }
     }
+    ok = ok && (!sync || ::fsync(tmp) == 0);
+    ::close(tmp);
+    return ok && ::rename(tmpPath.c_str(), path.c_str()) == 0;
 }
 
-/// the function associated with built in command "echo", which prints the value of a cvar if it is bound. if not, reports an error.
-inline void Virtuoso::QuakeStyleConsole::commandEcho(std::istream &is, std::ostream &os)
-{
-    std::string x;
+#endif
 
-    if (!(is >> x))
+inline Virtuoso::CommandWorkerPool::~CommandWorkerPool()
+{
+    std::vector<std::function<void()>> dropped;
     {
-        os << error() << "Syntax error parsing argument." << std::endl;
-        return;
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        queued.clear();
+        // breaks the promises of runOnMainThread(), so workers waiting for them can finish
+        dropped.swap(mainThreadCalls);
     }
+    dropped.clear();
+    wakeUp.notify_all();
 
-    CVarPrintTable::iterator it = cvarPrintFTable.find(x);
-
-    if (it != cvarPrintFTable.end())
+    for (std::thread &t : workers)
     {
-        (it->second)(is, os);
-    }
-    else
-    {
-        os << error() << "Variable " << x << " unknown." << std::endl;
+        t.join();
     }
 }
 
-inline void Virtuoso::QuakeStyleConsole::commandExecute(const std::string &str, std::ostream &output)
+inline void Virtuoso::CommandWorkerPool::threads(std::size_t count)
 {
-    std::stringstream lineStream;
-    lineStream.str(str);
-    commandExecute(lineStream, output);
+    std::lock_guard<std::mutex> lock(mutex);
+    threadCount = std::max<std::size_t>(count, 1);
 }
 
-///reads a string from the input stream and executes the command associated with it, if there is one.  if not, reports an error.
-inline void Virtuoso::QuakeStyleConsole::commandExecute(std::istream &is, std::ostream &os)
+inline void Virtuoso::CommandWorkerPool::submit(Job job)
 {
-    char ch;
-    while (!is.eof())
     {
-        ch = is.peek();
-
-        if (ch == std::char_traits<char>::eof())
-        {
-            is.get(ch);
-            return;
-        }
-        else if (ch == '#')
-        {
-            std::string tmp;
-            getline(is, tmp);
-            return;
-        } //if newline we will not parse anything else
-        else if (std::isspace(ch))
-        {
-            is.get(ch);
-            continue;
-        }
-        else
+        std::lock_guard<std::mutex> lock(mutex);
+        // started lazily, consoles without worker commands don't pay for threads
+        while (workers.size() < threadCount)
         {
-            break;
+            workers.emplace_back([this]() { workerLoop(); });
         }
+        queued.push_back(std::move(job));
+        inFlight++;
     }
+    wakeUp.notify_one();
+}
 
-    std::stringstream lineStream;
+inline void Virtuoso::CommandWorkerPool::postMainThread(std::function<void()> f)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!stopping)
     {
-        std::string lineTemp;
-
-        getline(is, lineTemp);
-
-        history_buffer.push(lineTemp);
-
-        os << echo() << lineTemp << std::endl;
-
-        dereferenceVariables(is, os, lineTemp);
-
-        lineStream.str(lineTemp); ///\todo this constrains us to a single line.  way to go later might be to require user or
-        ///generated command parser to return string that was parsed
+        mainThreadCalls.push_back(std::move(f));
     }
+}
 
-    std::string x;
-
-    if (lineStream >> x)
+inline void Virtuoso::CommandWorkerPool::drain()
+{
+    std::vector<std::pair<std::ostream *, std::string>> results;
+    std::vector<std::function<void()>> calls;
     {
-        CommandTable::const_iterator it = commandTable.find(x);
-
-        if (it == commandTable.end())
-        {
-            os << error() << "Command " << x << " unknown" << std::endl;
-        }
-        else
+        std::lock_guard<std::mutex> lock(mutex);
+        if (finished.empty() && mainThreadCalls.empty())
         {
-            (it->second)(lineStream, os); //execute the command
+            return;
         }
+        results.swap(finished);
+        calls.swap(mainThreadCalls);
     }
-}
-
-inline void Virtuoso::QuakeStyleConsole::bindBasicCommands()
-{
-    std::function<void(const std::string &, const DynamicVariable &)> f1 =
-
-        std::bind(
-            static_cast<void (QuakeStyleConsole::*)(const std::string &, const DynamicVariable &)>(&QuakeStyleConsole::bindDynamicCVar<DynamicVariable>),
-            this, std::placeholders::_1, std::placeholders::_2);
-
-    bindCommand("var", f1,
-                "Type var <varname> <value> to declare a dynamic variable with name <varname> and value <value>."
-                "\nVariable names are any space delimited string and variable value is set to the remainder of the line.");
-
-    bindCommand("listCmd", [this](std::istream &, std::ostream &os) { this->listCmd(os); }, "lists the available console commands");
-
-    bindCommand("set", [this](std::istream &is, std::ostream &os) { this->commandSet(is, os); }, "type set <identifier> <val> to change the value of a cvar");
-
-    bindCommand("echo", [this](std::istream &is, std::ostream &os) { this->commandEcho(is, os); }, "type echo <identifier> to print the value of a cvar");
 
-    bindCommand("listVars", [this](std::istream &, std::ostream &os) { listVars(os); }, "lists the bound cvars");
-
-    bindCommand("help", [this](std::istream &is, std::ostream &os) { this->commandHelp(is, os); }, "you're a smartass");
+    for (std::function<void()> &call : calls)
+    {
+        call();
+    }
 
-    bindCommand("listHelp", [this](std::istream &, std::ostream &os) { this->listHelp(os); }, "lists the available help topics");
+    for (const auto &[output, text] : results)
+    {
+        output->write(text.data(), static_cast<std::streamsize>(text.size()));
+        output->flush();
+    }
 
-    bindCommand("runFile", [this](std::istream &is, std::ostream &os) {
-        std::string f;
-        is >> f;
-        this->executeFile(f, os);
-    }, "runs the commands in a text file named by the argument");
+    std::lock_guard<std::mutex> lock(mutex);
+    inFlight -= results.size();
 }
 
-inline bool Virtuoso::QuakeStyleConsole::loadHistoryBuffer(const std::string &inFile)
+inline std::vector<Virtuoso::CommandWorkerPool::Job> Virtuoso::CommandWorkerPool::cancelQueued()
 {
-    std::ifstream hfi(inFile);
-
-    if (hfi.is_open())
-    {
-        loadHistoryBuffer(hfi);
-        hfi.close();
-        return true;
-    }
-
-    return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Job> cancelled(std::make_move_iterator(queued.begin()), std::make_move_iterator(queued.end()));
+    queued.clear();
+    inFlight -= cancelled.size();
+    return cancelled;
 }
 
-inline void Virtuoso::QuakeStyleConsole::saveHistoryBuffer(const std::string &outFile)
+inline std::size_t Virtuoso::CommandWorkerPool::pending() const
 {
-    if (history_buffer.size())
-    {
-        std::ofstream hfo(outFile);
-        saveHistoryBuffer(hfo);
-        hfo.close();
-    }
+    std::lock_guard<std::mutex> lock(mutex);
+    return inFlight;
 }
 
-inline void Virtuoso::QuakeStyleConsole::loadHistoryBuffer(std::istream &inFile)
+inline void Virtuoso::CommandWorkerPool::workerLoop()
 {
-    while (!inFile.eof())
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
     {
+        // the first job that may run: a serial one waits for the serial one that's running
+        std::deque<Job>::iterator next = queued.end();
+        wakeUp.wait(lock, [this, &next]() {
+            next = std::find_if(queued.begin(), queued.end(), [this](const Job &job) { return !job.serial || !serialRunning; });
+            return stopping || next != queued.end();
+        });
+        if (stopping)
+        {
+            return;
+        }
+
+        Job job = std::move(*next);
+        queued.erase(next);
+        if (job.serial)
+        {
+            serialRunning = true;
+        }
+        lock.unlock();
 
-        std::string tmp;
-        std::getline(inFile, tmp);
+        std::string text = job.run();
 
-        if (tmp.length())
+        lock.lock();
+        finished.emplace_back(job.output, std::move(text));
+        if (job.serial)
         {
-            history_buffer.push(tmp);
+            serialRunning = false;
+            // the next serial job may be waiting for this one
+            wakeUp.notify_all();
         }
     }
 }
 
-inline void Virtuoso::QuakeStyleConsole::saveHistoryBuffer(std::ofstream &outfile)
+inline Virtuoso::ConsoleTask &Virtuoso::ConsoleTask::operator=(ConsoleTask &&other) noexcept
 {
-    for (unsigned int i = 0; i < history_buffer.size(); i++)
+    if (this != &other)
     {
-        outfile << history_buffer[i] << std::endl;
+        if (handle)
+        {
+            handle.destroy();
+        }
+        handle = std::exchange(other.handle, nullptr);
     }
+    return *this;
 }
 
-inline const std::deque<std::string> &Virtuoso::QuakeStyleConsole::historyBuffer() const
+inline Virtuoso::ConsoleTask::~ConsoleTask()
 {
-    return history_buffer;
+    if (handle)
+    {
+        handle.destroy();
+    }
 }
 
-inline void Virtuoso::QuakeStyleConsole::dereferenceVariables(std::istream &is, std::ostream &os, std::string &str)
+inline bool Virtuoso::ConsoleTask::sliceExpired()
 {
-    size_t varBase = 0;
+    return std::chrono::steady_clock::now() >= sliceDeadline;
+}
 
-    while ((varBase = str.find('$', varBase)) != str.npos)
+inline bool Virtuoso::ConsoleTask::resume(std::chrono::steady_clock::time_point deadline)
+{
+    if (!handle)
     {
-        size_t substrEnd = varBase;
-        size_t dollar = varBase;
-        varBase++;
-
-        for (; ((substrEnd < str.size()) && (!isspace(str[substrEnd]))); substrEnd++)
-            ;
+        return true;
+    }
 
-        if (substrEnd == varBase)
+    // a task may run another one to completion inside its slice, and continues with its own deadline afterwards
+    const auto outerDeadline = sliceDeadline;
+    sliceDeadline = deadline;
+    while (!handle.done())
+    {
+        handle.resume();
+        if (sliceExpired())
         {
-            os << error() << "Expected identifier at $" << std::endl;
+            break;
         }
-        else
-        {
-            std::string substr(str.substr(varBase, substrEnd - varBase));
-
-            std::stringstream sstr;
-
-            CVarPrintTable::iterator it = cvarPrintFTable.find(substr);
+    }
+    // an expired slice stays expired for the outer task
+    sliceDeadline = std::min(outerDeadline, sliceDeadline);
 
-            // check that variable exists
-            if (it != cvarPrintFTable.end())
-            {
-                it->second(is, sstr);
-                str.replace(dollar, substrEnd, sstr.str());
-            }
-            else
-            {
-                os << error() << "Variable " << substr << " not found" << std::endl;
-            }
-        }
+    if (handle.done() && handle.promise().exception)
+    {
+        std::rethrow_exception(std::exchange(handle.promise().exception, nullptr));
     }
+    return handle.done();
 }
 
 inline Virtuoso::QuakeStyleConsole::QuakeStyleConsole(size_t maxCapacity, bool enablePrebindedCommands)
@@ -978,19 +4348,6 @@ void Virtuoso::QuakeStyleConsole::bindMemberCommand(const std::string &commandNa
     }
 }
 
-/// here we just overload the iostream operators.  The only real difference is that on input a dynamic variable takes a full line from input
-inline std::ostream &operator<<(std::ostream &instream, const Virtuoso::QuakeStyleConsole::DynamicVariable &var)
-{
-    const std::string &str = var;
-    return instream << str;
-}
-
-/// dynamic variable definitions take a full line from the input stream
-inline std::istream &operator>>(std::istream &istream, Virtuoso::QuakeStyleConsole::DynamicVariable &var)
-{
-    return getline(istream, var);
-}
-
 #endif /* QuakeStyleConsole_h */
 
 /* ------------------------------------------------------------------------------
@@ -23,6 +23,8 @@ typedef Rect<float> FloatRect;
 namespace sfe
 {
 
+class FontMetricsCache;
+
 class RichText : public sf::Drawable, public sf::Transformable
 {
 public:
@@ -42,6 +44,12 @@ public:
         //////////////////////////////////////////////////////////////////////
         void setFont(const sf::Font &font);
 
+        //////////////////////////////////////////////////////////////////////
+        // Set metrics used to measure regular style texts of their font,
+        // instead of computing the bounds of every sf::Text
+        //////////////////////////////////////////////////////////////////////
+        void setFontMetrics(FontMetricsCache *metrics);
+
         //////////////////////////////////////////////////////////////////////
         // Get texts
         //////////////////////////////////////////////////////////////////////
@@ -84,6 +92,7 @@ public:
         //////////////////////////////////////////////////////////////////////
         mutable std::vector<sf::Text> m_texts; ///< List of texts
         mutable sf::FloatRect m_bounds;        ///< Local bounds
+        FontMetricsCache *m_metrics = nullptr; ///< Optional font metrics
     };
 
     //////////////////////////////////////////////////////////////////////////
@@ -113,6 +122,12 @@ public:
     //////////////////////////////////////////////////////////////////////////
     void setFont(const sf::Font &font);
 
+    //////////////////////////////////////////////////////////////////////////
+    // Set metrics used to measure texts, nullptr to use sf::Text bounds.
+    // The metrics must outlive the rich text
+    //////////////////////////////////////////////////////////////////////////
+    void setFontMetrics(FontMetricsCache *metrics);
+
     //////////////////////////////////////////////////////////////////////////
     // Clear
     //////////////////////////////////////////////////////////////////////////
@@ -174,6 +189,7 @@ private:
     mutable sf::FloatRect m_bounds;    ///< Local bounds
     sf::Color m_currentColor;          ///< Last used color
     sf::Text::Style m_currentStyle;    ///< Last style used
+    FontMetricsCache *m_metrics;       ///< Optional font metrics
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace sfe {
+
+// Double-ended queue over a single contiguous array of slots.
+// Appending and dropping the oldest element are O(1). The ring grows by
+// doubling when it runs out of slots, so a buffer with a bounded number of
+// elements stops allocating once it reaches its working size.
+//
+// Popped slots are not destroyed: `recycle_back()` hands them out again with
+// their previous content, which lets callers reuse already allocated memory
+// (e.g. string and vector capacity) instead of freeing and reallocating it.
+template <class T>
+class RingBuffer {
+ public:
+  RingBuffer() = default;
+
+  // Number of elements in the buffer.
+  inline std::size_t size() const { return count_; }
+  inline bool empty() const { return count_ == 0; }
+  // Number of slots currently allocated.
+  inline std::size_t capacity() const { return slots_.size(); }
+
+  // Element access, index 0 is the oldest element.
+  inline T& operator[](std::size_t i) { return slots_[Slot(i)]; }
+  inline const T& operator[](std::size_t i) const { return slots_[Slot(i)]; }
+
+  inline T& front() { return (*this)[0]; }
+  inline const T& front() const { return (*this)[0]; }
+  inline T& back() { return (*this)[count_ - 1]; }
+  inline const T& back() const { return (*this)[count_ - 1]; }
+
+  // Appends an element, overwriting the content of a recycled slot.
+  inline void push_back(T value) { recycle_back() = std::move(value); }
+
+  // Appends an element and returns it. The slot may hold a previously popped
+  // element, which the caller is expected to reset.
+  inline T& recycle_back();
+
+  // Drops the oldest element. Its slot is kept for reuse.
+  inline void pop_front();
+
+  // Drops all elements, keeping the slots for reuse.
+  inline void clear() {
+    head_ = 0;
+    count_ = 0;
+  }
+
+  // Makes sure at least `n` slots are allocated.
+  inline void reserve(std::size_t n);
+
+ private:
+  inline std::size_t Slot(std::size_t i) const {
+    assert(i < count_);
+    const std::size_t slot = head_ + i;
+    return slot < slots_.size() ? slot : slot - slots_.size();
+  }
+
+  // Storage for elements, used as a circular array starting at `head_`.
+  std::vector<T> slots_;
+  // Slot of the oldest element.
+  std::size_t head_ = 0;
+  // Number of live elements.
+  std::size_t count_ = 0;
+};
+
+// --------------------------------------
+// ---- RingBuffer implementation -------
+// --------------------------------------
+
+template <class T>
+inline T& RingBuffer<T>::recycle_back() {
+  if (count_ == slots_.size()) {
+    reserve(slots_.empty() ? 16 : slots_.size() * 2);
+  }
+  ++count_;
+  return back();
+}
+
+template <class T>
+inline void RingBuffer<T>::pop_front() {
+  assert(count_ > 0);
+  if (++head_ == slots_.size()) {
+    head_ = 0;
+  }
+  --count_;
+}
+
+template <class T>
+inline void RingBuffer<T>::reserve(std::size_t n) {
+  if (n <= slots_.size()) {
+    return;
+  }
+  // Unroll the ring so the oldest element goes first, then grow at the end.
+  std::vector<T> slots;
+  slots.reserve(n);
+  for (std::size_t i = 0; i < slots_.size(); ++i) {
+    const std::size_t slot = head_ + i;
+    slots.push_back(std::move(
+        slots_[slot < slots_.size() ? slot : slot - slots_.size()]));
+  }
+  slots.resize(n);
+  slots_ = std::move(slots);
+  head_ = 0;
+}
+
+}  // namespace sfe
@@ -12,9 +12,16 @@
 /// For examples, see the demos folder.
 ///
 /// Components:
-/// - ConsoleBuffer: Manages the console's text area, supports ANSI color codes.
-/// - MultiStream: A derived ostream that duplicates output across multiple
-/// streams.
+/// - ConsoleBuffer: Manages the console's text area, supports ANSI SGR formatting.
+/// - ConsoleView: Draws the visible lines of a ConsoleBuffer.
+/// - FontMetricsCache: Caches glyph widths of the console font for layout.
+/// - LineWrapCache: Wraps long output lines into rows, used by ConsoleView.
+/// - MultiStream (MultiStream.hpp): A derived ostream that duplicates output
+/// across multiple streams.
+/// - ConsoleProducerQueue: Lets worker threads post output without locking,
+/// see SFMLInGameConsole::Post and SFMLInGameConsole::Pump.
+/// - AsyncFileSink (AsyncFileSink.hpp): A stream to mirror the output to with
+/// MultiStream::AddStream, writes a log file on a background thread.
 ///
 /// License:
 /// Available under MIT or public domain license; choose whichever you prefer.
@@ -26,10 +33,16 @@
 #include <SFML/Graphics/RectangleShape.hpp>
 #include <SFML/Window/Event.hpp>
 #include <algorithm>
+#include <cstddef>
 #include <cstring>
-#include <unordered_set>
+#include <deque>
+#include <vector>
 
 #include "ConsoleBuffer.hpp"
+#include "ConsoleProducerQueue.hpp"
+#include "ConsoleView.hpp"
+#include "FontMetricsCache.hpp"
+#include "MultiStream.hpp"
 #include "QuakeStyleConsole.h"
 #include "RichText.hpp"
 
@@ -50,48 +63,6 @@ inline constexpr std::string_view TEXT_COLOR_MAGENTA = "\u001b[35m";
 inline constexpr std::string_view TEXT_COLOR_CYAN = "\u001b[36m";
 inline constexpr std::string_view TEXT_COLOR_WHITE = "\u001b[37m";
 
-// MultiStreamBuffer class: streambuffer implementation that forwards input to
-// multiple ostreams.
-class MultiStreamBuffer : public std::streambuf {
- public:
-  // Set of output streams to forward data to.
-  std::unordered_set<std::ostream*> streams;
-
-  MultiStreamBuffer() {}
-
-  // Overrides overflow to write a single character to each ostream in streams.
-  int overflow(int in) override {
-    char c = in;  ///\todo check for eof, etc?
-    for (std::ostream* str : streams) {
-      (*str) << c;
-    }
-    return 1;
-  }
-
-  // Override xsputn to write a string of characters to each ostream in streams.
-  std::streamsize xsputn(const char* s, std::streamsize n) override {
-    std::streamsize ssz = 0;
-
-    for (std::ostream* str : streams) {
-      ssz = str->rdbuf()->sputn(s, n);
-    }
-
-    return ssz;
-  }
-};
-
-// MultiStream class: ostream that duplicates output to multiple other streams.
-class MultiStream : public std::ostream {
-  // Underlying buffer for managing output duplication.
-  MultiStreamBuffer buf;
-
- public:
-  MultiStream() : std::ostream(&buf) {}
-
-  // Adds a stream to the buffer, allowing output to be mirrored to it.
-  void AddStream(std::ostream& str) { buf.streams.insert(&str); }
-};
-
 /// SFMLInGameConsole class: main class representing an in-game console widget
 /// using SFML. Extends QuakeStyleConsole and MultiStream for SFML-based
 /// rendering and stream duplication.
@@ -107,6 +78,8 @@ class SFMLInGameConsole : public Virtuoso::QuakeStyleConsole,
   SFMLInGameConsole(sf::Font font,
                     size_t command_history_size = kCommandHistoryBufferSize,
                     bool enable_prebinded_commands = false);
+  // Forwards pending output to the mirrored streams.
+  ~SFMLInGameConsole() override;
 
   // Setters for configuring console appearance and behavior.
 
@@ -122,15 +95,42 @@ class SFMLInGameConsole : public Virtuoso::QuakeStyleConsole,
   void SetTextLeftOffset(float offset_part);
   // Sets the console's height as a fraction of the render target height.
   void SetConsoleHeightPart(float height_part);
-
-  // Registers command keywords for autocomplete functionality.
+  // Limits the scrollback to the given number of lines, dropping the oldest
+  // ones. 0 means no limit.
+  void SetMaxBufferLines(size_t count);
+  // Limits the scrollback to the given size of text in bytes, dropping the
+  // oldest lines. 0 means no limit.
+  void SetMaxBufferBytes(size_t bytes);
+  // Lays text out on a grid of space sized cells, skipping per glyph widths
+  // and kerning. Meant for monospace fonts, which the default font is.
+  void SetMonospace(bool monospace);
+  // Wraps output lines longer than the console width into several rows.
+  // Enabled by default.
+  void SetLineWrap(bool wrap);
+
+  // Shows only the output lines that pass the filter, e.g. the errors, and
+  // scrolls to the newest one. Lines are found through the indices of the
+  // console buffer, so switching filters costs about the number of matches.
+  // With the prebinded commands, the `filter` command sets it too.
+  void SetOutputFilter(LineFilter filter);
+  // Shows all output lines again.
+  void ClearOutputFilter();
+  // Returns the filter of the output pane, empty if none.
+  const LineFilter& GetOutputFilter() const;
+  // Indexes the text of the output, so text filters don't scan the whole
+  // scrollback. Costs a few bytes per character of output.
+  void SetOutputTextIndex(bool enabled);
+
+  // Registers command keywords for autocomplete functionality, replacing the
+  // ones registered for the command before.
   void SetCommandKeywords(const std::string& cmd_name,
                           std::vector<std::string> keywords);
 
   // Print vector of options into console aligning them into columns.
   void PrintOptions(const std::vector<std::string>& options);
 
-  // Returns pointer to the current font.
+  // Returns pointer to the current font. Cached font metrics are dropped,
+  // since the font may be changed through the pointer.
   sf::Font* Font();
   // Clears the output pane.
   void clear();
@@ -142,9 +142,25 @@ class SFMLInGameConsole : public Virtuoso::QuakeStyleConsole,
   void HandleUIEvent(const sf::Event& e);
 
   // Renders the console to a specified SFML RenderTarget (window or other
-  // renderable).
+  // renderable). Resumes the running command tasks (see
+  // `Virtuoso::ConsoleTask`) and calls `Pump()` even if the console is hidden.
+  // Time spent is recorded in `getStats()` under the "render" and
+  // "updateDrawnText" timers.
   void Render(sf::RenderTarget* window);
 
+  // Posts text to the console from any thread without locking. The text is
+  // written to the console, and to the mirrored streams, on the next `Pump()`.
+  // Records of one thread keep their order.
+  void Post(std::string text);
+  // Returns the queue behind `Post()`, e.g. to create a `ProducerStream` for
+  // a worker thread.
+  ConsoleProducerQueue& GetProducerQueue();
+  // Writes text posted by other threads into the console and forwards output
+  // buffered by the console stream to the mirrored streams. Must be called
+  // from the thread that renders the console, `Render()` does it once per
+  // frame.
+  void Pump();
+
   // Returns current typing console line.
   const std::string& GetCurrentText() const;
 
@@ -156,32 +172,132 @@ class SFMLInGameConsole : public Virtuoso::QuakeStyleConsole,
       const sf::Event& e);          // Handles up/down history navigation.
   void TextAutocompleteCallback();  // Handles text autocomplete actions.
 
-  // Returns number of lines that are out of visible console area.
-  int GetOverflowLinesCount() const;
+  // Reverse history search, started with Ctrl+R. Typing refines the query
+  // from the current match, Ctrl+R again steps to older matches, Enter runs
+  // the match, Escape or Ctrl+G restores the input line and any other key
+  // keeps the match in the input line and is handled as usual.
+
+  // Starts the search, or steps to the next older match if searching.
+  void StartReverseSearch();
+  // Finds the newest match of the query older than the given sequence number
+  // of the history buffer.
+  void UpdateReverseSearch(std::uint64_t before);
+  // Leaves the search, keeping the match in the input line if `accept`.
+  void StopReverseSearch(bool accept);
+  // Handles an event while searching. Returns false if the event still has to
+  // be handled as usual.
+  bool HandleReverseSearchEvent(const sf::Event& e);
+
+  // Position of a row of the output pane: index of a shown line (see
+  // `GetShownLinesCount()`) and index of a row of the line.
+  struct RowPosition {
+    size_t line = 0;
+    size_t row = 0;
+
+    bool operator==(const RowPosition& other) const = default;
+  };
+
+  // Returns number of rows the output pane shows.
+  int GetVisibleRowsCount() const;
+  // Returns number of lines the output pane can show: all lines of the
+  // buffer, or the ones passing the output filter.
+  size_t GetShownLinesCount() const;
+  // Returns index in the buffer of a shown line.
+  size_t GetBufferIndex(size_t shown_line) const;
+  // Returns number of rows of a shown line.
+  size_t GetRowsCount(size_t shown_line);
+  // Brings the lines passing the output filter up to date with the buffer.
+  // Only the lines written since the last call are checked.
+  void UpdateFilteredLines();
+  // Handles the `filter` command.
+  void FilterCommand(std::istream& is, std::ostream& os);
+  // Returns the last row of the buffer.
+  RowPosition GetLastRow();
+  // Returns the bottom row of the output pane.
+  RowPosition GetScrollRow();
+  // Moves the position by `delta` rows, stopping at the first and the last
+  // row of the buffer. Returns number of rows moved. Only the lines passed
+  // are wrapped, so the cost doesn't depend on the size of the buffer.
+  std::ptrdiff_t MoveRows(RowPosition& pos, std::ptrdiff_t delta);
+  // Scrolls the output pane by `delta` rows, negative towards older output.
+  void ScrollRows(std::ptrdiff_t delta);
+  // Scrolls the output pane to the oldest output.
+  void ScrollToTop();
+  // Scrolls the output pane to the newest output, following it as it arrives.
+  void ScrollToBottom();
 
   /// Gets possible autocomplete suggestions for a word, based on commands and
   /// keywords.
   std::vector<std::string> GetCandidatesForAutocomplete(
       const std::string& cur_word, bool is_first_word) const;
 
-  // Updates text rendering for the current output.
+  // Parts of the drawn state that have to be rebuilt on the next `Render`.
+  enum DirtyFlags : unsigned {
+    kDirtyNone = 0u,
+    // Console buffer content changed.
+    kDirtyOutput = 1u << 0,
+    // Scroll offset changed.
+    kDirtyScroll = 1u << 1,
+    // Input line text or cursor position changed.
+    kDirtyInput = 1u << 2,
+    // Font scale, console size, position or colors changed.
+    kDirtyGeometry = 1u << 3,
+    kDirtyAll = kDirtyOutput | kDirtyScroll | kDirtyInput | kDirtyGeometry,
+  };
+
+  // Schedules rebuild of the given parts of the drawn state.
+  void MarkDirty(unsigned flags);
+
+  // Rebuilds the dirty parts of the drawn text. Does nothing on an idle frame.
   void UpdateDrawnText();
-
-  typedef std::unordered_map<std::string, std::vector<std::string>>
+  // Rebuilds the input line with the cursor at the current position.
+  void UpdateInputLine();
+  // Rebuilds the visible part of the output pane.
+  void UpdateOutputText();
+  // Returns height of a single text line in pixels.
+  float GetLineHeight() const;
+  // Publishes the console buffer gauges to `getStats()`.
+  void UpdateStats();
+
+  typedef std::unordered_map<std::string, Virtuoso::CompletionIndex>
       CommandKeywordsMapping;
 
-  // Map of commands and their associated keywords.
+  // Map of commands and their associated keywords, sorted for autocomplete.
   CommandKeywordsMapping cmd_keywords_;
 
   // Custom buffer for the console's output pane.
   ConsoleBuffer console_buffer_;
+  // Output posted by other threads, drained by `Pump()`.
+  ConsoleProducerQueue producer_queue_;
+  // Number of dropped posted records already reported to the user.
+  size_t reported_dropped_records_ = 0;
   // Stream for handling console output.
   std::ostream console_stream_;
 
   // Text buffer for console input.
   std::string buffer_text_;
-  // Vertical scroll offset in lines for console content.
-  int scroll_lines_offset_ = 0;
+  // Filter of the output pane.
+  LineFilter output_filter_;
+  // Ids of the buffer lines passing `output_filter_`, if it isn't empty.
+  std::deque<size_t> filtered_ids_;
+  // Id of the first line not checked against the filter yet. The last line
+  // of the buffer is checked again every time, since it may change.
+  size_t filter_next_id_ = 0;
+  // Buffer revision the filtered lines were updated at.
+  std::uint64_t filter_revision_ = 0;
+  // Scratch list of the lines matching the filter.
+  std::vector<size_t> filter_matches_;
+  // Buffer indices of the lines in the output pane.
+  std::vector<size_t> drawn_lines_;
+
+  // Bottom row of the output pane while it's scrolled back from the newest
+  // output. Kept by line id, so the shown text stays put as output arrives
+  // and old lines are dropped.
+  size_t scroll_line_id_ = 0;
+  size_t scroll_row_ = 0;
+  bool scrolled_back_ = false;
+  // Whether long output lines are wrapped.
+  bool wrap_lines_ = true;
   // Max characters for a single line of input.
   size_t max_input_line_symbols_ = 100u;
   // Left offset for console text rendering.
@@ -195,10 +311,12 @@ class SFMLInGameConsole : public Virtuoso::QuakeStyleConsole,
   sf::Color background_color_ = kDefaultBackgroundColor;
   // Font used for console text.
   sf::Font font_;
+  // Glyph widths of `font_`, shared by the output pane and the input line.
+  FontMetricsCache metrics_;
   // Rectangle shape for console background.
   sf::RectangleShape background_rect_;
-  // Rich text object for output text formatting.
-  sfe::RichText output_text_;
+  // Visible window of the output pane.
+  ConsoleView output_view_;
   // Rich text object for input line formatting.
   sfe::RichText input_line_;
 
@@ -206,10 +324,23 @@ class SFMLInGameConsole : public Virtuoso::QuakeStyleConsole,
   bool shown_ = false;
   // Current position in command history for navigation.
   int history_pos_ = -1;
+  // Whether reverse history search is active.
+  bool searching_ = false;
+  // Text searched for in history.
+  std::string search_query_;
+  // Sequence number of the matching history line, 0 if none.
+  std::uint64_t search_match_ = 0;
+  // Input line text before the search started, restored on cancel.
+  std::string search_saved_text_;
   // Cursor position in the input line.
   size_t cursor_pos_ = 0;
   // Scaling factor for console text.
   float font_scale_ = 0.6F;
+
+  // Combination of `DirtyFlags` to rebuild on the next `Render` call.
+  unsigned dirty_flags_ = kDirtyAll;
+  // Console buffer revision the output pane was last built from.
+  std::uint64_t drawn_revision_ = 0;
 };
 
 }  // namespace sfe
\ No newline at end of file
@@ -0,0 +1,158 @@
+#include "AsyncFileSink.hpp"
+
+#include <cstring>
+
+namespace sfe {
+
+AsyncFileSink::Buffer::Buffer(AsyncFileSink& sink) : sink_(sink) {
+  setp(data_, data_ + kSize);
+}
+
+int AsyncFileSink::Buffer::overflow(int c) {
+  Commit();
+  if (c != traits_type::eof()) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+std::streamsize AsyncFileSink::Buffer::xsputn(const char* s,
+                                              std::streamsize n) {
+  const auto size = static_cast<size_t>(n);
+  if (size <= static_cast<size_t>(epptr() - pptr())) {
+    std::memcpy(pptr(), s, size);
+    pbump(static_cast<int>(n));
+    return n;
+  }
+
+  Commit();
+  if (size >= kSize) {
+    // Large writes skip the put area.
+    sink_.Enqueue(s, size);
+  } else {
+    std::memcpy(pptr(), s, size);
+    pbump(static_cast<int>(n));
+  }
+  return n;
+}
+
+int AsyncFileSink::Buffer::sync() {
+  Commit();
+  return 0;
+}
+
+void AsyncFileSink::Buffer::Commit() {
+  if (pptr() != pbase()) {
+    sink_.Enqueue(pbase(), static_cast<size_t>(pptr() - pbase()));
+    setp(data_, data_ + kSize);
+  }
+}
+
+AsyncFileSink::AsyncFileSink(const std::string& path,
+                             AsyncFileSinkOptions options)
+    : std::ostream(&buf_),
+      options_(options),
+      file_(path, std::ios::binary |
+                      (options.append ? std::ios::app : std::ios::trunc)),
+      buf_(*this) {
+  writer_ = std::thread(&AsyncFileSink::WriterLoop, this);
+}
+
+AsyncFileSink::~AsyncFileSink() {
+  flush();
+  {
+    std::lock_guard lock(mutex_);
+    stop_ = true;
+  }
+  wake_writer_.notify_one();
+  writer_.join();
+}
+
+bool AsyncFileSink::IsOpen() const { return file_.is_open(); }
+
+size_t AsyncFileSink::GetDroppedBytes() const {
+  return dropped_bytes_.load(std::memory_order_relaxed);
+}
+
+void AsyncFileSink::Enqueue(const char* data, size_t size) {
+  bool wake = false;
+  {
+    std::lock_guard lock(mutex_);
+    if (options_.max_pending_size &&
+        front_.size() + size > options_.max_pending_size) {
+      dropped_bytes_.fetch_add(size, std::memory_order_relaxed);
+      return;
+    }
+    // Wake the writer only once, when the threshold is crossed.
+    wake = front_.size() < options_.flush_size;
+    front_.append(data, size);
+    wake = wake && front_.size() >= options_.flush_size;
+  }
+  if (wake) {
+    wake_writer_.notify_one();
+  }
+}
+
+void AsyncFileSink::WriterLoop() {
+  std::unique_lock lock(mutex_);
+  for (;;) {
+    wake_writer_.wait_for(lock, options_.flush_interval, [this] {
+      return stop_ || front_.size() >= options_.flush_size;
+    });
+    // The buffers keep their capacity, so swapping them doesn't allocate.
+    std::swap(front_, back_);
+    const bool stop = stop_;
+    lock.unlock();
+
+    if (!back_.empty()) {
+      WriteToFile(back_);
+      file_.flush();
+      back_.clear();
+    }
+    if (stop) {
+      return;
+    }
+    lock.lock();
+  }
+}
+
+void AsyncFileSink::WriteToFile(const std::string& text) {
+  if (!file_.is_open()) {
+    return;
+  }
+  if (!options_.strip_ansi) {
+    file_.write(text.data(), static_cast<std::streamsize>(text.size()));
+    return;
+  }
+
+  // Escape sequences may be split between two writes, so the parser state is
+  // kept between calls.
+  const char* run = text.data();
+  const char* end = text.data() + text.size();
+  for (const char* p = text.data(); p != end; ++p) {
+    switch (ansi_state_) {
+      case AnsiState::kText:
+        if (*p == '\x1b') {
+          file_.write(run, p - run);
+          ansi_state_ = AnsiState::kEscape;
+        }
+        continue;
+      case AnsiState::kEscape:
+        ansi_state_ = *p == '[' ? AnsiState::kSequence : AnsiState::kText;
+        break;
+      case AnsiState::kSequence:
+        // Parameters and intermediate bytes until the final byte.
+        if (*p >= 0x40 && *p <= 0x7e) {
+          ansi_state_ = AnsiState::kText;
+        }
+        break;
+    }
+    run = p + 1;
+  }
+  if (ansi_state_ == AnsiState::kText) {
+    file_.write(run, end - run);
+  }
+}
+
+}  // namespace sfe
@@ -0,0 +1,601 @@
+#include "ConsoleServer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace sfe {
+
+namespace {
+
+void SetError(std::string* error, std::string text) {
+  if (error) {
+    *error = std::move(text);
+  }
+}
+
+#if !defined(_WIN32)
+
+// Flag of `send()` that keeps writing to a closed connection from raising
+// SIGPIPE. Systems without it use the SO_NOSIGPIPE socket option instead.
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+// Size of a single `recv()`.
+constexpr size_t kReceiveSize = 4096;
+
+std::string ErrorText(const char* what) {
+  return std::string(what) + ": " + std::strerror(errno);
+}
+
+bool SetNonBlocking(int fd) {
+  const int flags = fcntl(fd, F_GETFL, 0);
+  return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1 &&
+         fcntl(fd, F_SETFD, FD_CLOEXEC) != -1;
+}
+
+// Sets up an accepted socket for the network thread.
+bool SetUpConnection(int fd) {
+  if (!SetNonBlocking(fd)) {
+    return false;
+  }
+  const int one = 1;
+#ifdef SO_NOSIGPIPE
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+  // Replies are small and interactive. Fails harmlessly on Unix sockets.
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return true;
+}
+
+#endif
+
+}  // namespace
+
+int ConsoleServer::ClientStream::overflow(int c) {
+  if (c != traits_type::eof() && connected) {
+    pending.push_back(traits_type::to_char_type(c));
+  }
+  return traits_type::not_eof(c);
+}
+
+std::streamsize ConsoleServer::ClientStream::xsputn(const char* s,
+                                                    std::streamsize n) {
+  if (connected) {
+    pending.append(s, static_cast<size_t>(n));
+  }
+  return n;
+}
+
+ConsoleServer::BroadcastBuffer::BroadcastBuffer(ConsoleServer& server)
+    : server_(server) {}
+
+int ConsoleServer::BroadcastBuffer::overflow(int c) {
+  if (c != traits_type::eof()) {
+    const char ch = traits_type::to_char_type(c);
+    xsputn(&ch, 1);
+  }
+  return traits_type::not_eof(c);
+}
+
+std::streamsize ConsoleServer::BroadcastBuffer::xsputn(const char* s,
+                                                       std::streamsize n) {
+  for (auto& [id, client] : server_.clients_) {
+    client.buffer->sputn(s, n);
+  }
+  return n;
+}
+
+ConsoleServer::ConsoleServer(Virtuoso::QuakeStyleConsole& console,
+                             ConsoleServerOptions options)
+    : console_(console),
+      options_(std::move(options)),
+      broadcast_buffer_(*this),
+      broadcast_stream_(&broadcast_buffer_) {}
+
+ConsoleServer::~ConsoleServer() { Close(); }
+
+bool ConsoleServer::ListenTcp(const std::string& address, std::uint16_t port,
+                              std::string* error) {
+#if defined(_WIN32)
+  SetError(error, "ConsoleServer is not supported on this platform");
+  return false;
+#else
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+    SetError(error, "invalid IPv4 address " + address);
+    return false;
+  }
+
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    SetError(error, ErrorText("socket"));
+    return false;
+  }
+  // Restarting the server doesn't wait for the old connections to time out.
+  const int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  socklen_t length = sizeof(addr);
+  if (bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0 || !SetNonBlocking(fd) ||
+      getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &length) != 0) {
+    SetError(error, ErrorText("listen"));
+    close(fd);
+    return false;
+  }
+  if (!Start(error)) {
+    close(fd);
+    return false;
+  }
+
+  tcp_port_ = ntohs(addr.sin_port);
+  {
+    std::lock_guard lock(mutex_);
+    listeners_.push_back(fd);
+  }
+  Wake();
+  return true;
+#endif
+}
+
+bool ConsoleServer::ListenUnix(const std::string& path, std::string* error) {
+#if defined(_WIN32)
+  SetError(error, "ConsoleServer is not supported on this platform");
+  return false;
+#else
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+    SetError(error, "invalid socket path " + path);
+    return false;
+  }
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+  // A socket left by a previous run, other files are kept.
+  struct stat status {};
+  if (stat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+    unlink(path.c_str());
+  }
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    SetError(error, ErrorText("socket"));
+    return false;
+  }
+  if (bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0 || !SetNonBlocking(fd)) {
+    SetError(error, ErrorText("listen"));
+    close(fd);
+    return false;
+  }
+  if (!Start(error)) {
+    close(fd);
+    unlink(path.c_str());
+    return false;
+  }
+
+  unix_path_ = path;
+  {
+    std::lock_guard lock(mutex_);
+    listeners_.push_back(fd);
+  }
+  Wake();
+  return true;
+#endif
+}
+
+std::uint16_t ConsoleServer::GetTcpPort() const { return tcp_port_; }
+
+void ConsoleServer::Close() {
+#if !defined(_WIN32)
+  if (network_.joinable()) {
+    {
+      std::lock_guard lock(mutex_);
+      stop_ = true;
+    }
+    Wake();
+    network_.join();
+  }
+  for (int& fd : wake_fds_) {
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+
+  std::lock_guard lock(mutex_);
+  for (const int fd : listeners_) {
+    close(fd);
+  }
+  listeners_.clear();
+  if (!unix_path_.empty()) {
+    unlink(unix_path_.c_str());
+    unix_path_.clear();
+  }
+  tcp_port_ = 0;
+#endif
+}
+
+std::ostream& ConsoleServer::GetBroadcastStream() { return broadcast_stream_; }
+
+size_t ConsoleServer::GetClientsCount() const {
+  std::lock_guard lock(mutex_);
+  return clients_count_;
+}
+
+/// Runs the received lines in the order they arrived and queues the output
+/// of every client as a single block.
+void ConsoleServer::Pump() {
+  {
+    std::lock_guard lock(mutex_);
+    connected_.swap(accepted_);
+    requests_.swap(inbox_);
+    closed_.swap(disconnected_);
+    ++pumps_;
+  }
+
+  for (const std::uint64_t id : accepted_) {
+    Client& client = clients_[id];
+    client.buffer = std::make_unique<ClientStream>();
+    client.stream = std::make_unique<std::ostream>(client.buffer.get());
+  }
+  for (const Request& request : requests_) {
+    const auto it = clients_.find(request.client);
+    if (it != clients_.end()) {
+      console_.commandExecute(request.line, *it->second.stream);
+    }
+  }
+  for (const std::uint64_t id : closed_) {
+    const auto it = clients_.find(id);
+    if (it != clients_.end()) {
+      it->second.buffer->connected = false;
+      it->second.buffer->pending.clear();
+      retired_clients_.push_back(std::move(it->second));
+      clients_.erase(it);
+    }
+  }
+  const bool executed = !requests_.empty();
+  accepted_.clear();
+  requests_.clear();
+  closed_.clear();
+
+  // Tasks and worker commands keep the stream they were started with.
+  if (!retired_clients_.empty() && console_.taskCount() == 0) {
+    retired_clients_.clear();
+  }
+
+  bool wake = executed;
+  {
+    std::lock_guard lock(mutex_);
+    // Also lets the network thread close the clients that are done.
+    wake = wake || closing_count_ > 0;
+    ++output_pumps_;
+    for (auto& [id, client] : clients_) {
+      std::string& pending = client.buffer->pending;
+      if (pending.empty()) {
+        continue;
+      }
+      std::string& output = outbox_[id];
+      if (output.empty()) {
+        output.swap(pending);
+      } else {
+        output += pending;
+      }
+      pending.clear();
+      wake = true;
+    }
+  }
+  if (wake) {
+    Wake();
+  }
+}
+
+bool ConsoleServer::Start(std::string* error) {
+#if defined(_WIN32)
+  SetError(error, "ConsoleServer is not supported on this platform");
+  return false;
+#else
+  if (network_.joinable()) {
+    return true;
+  }
+  if (pipe(wake_fds_) != 0) {
+    SetError(error, ErrorText("pipe"));
+    return false;
+  }
+  if (!SetNonBlocking(wake_fds_[0]) || !SetNonBlocking(wake_fds_[1])) {
+    SetError(error, ErrorText("pipe"));
+    for (int& fd : wake_fds_) {
+      close(fd);
+      fd = -1;
+    }
+    return false;
+  }
+  {
+    std::lock_guard lock(mutex_);
+    stop_ = false;
+  }
+  network_ = std::thread(&ConsoleServer::NetworkLoop, this);
+  return true;
+#endif
+}
+
+void ConsoleServer::Wake() {
+#if !defined(_WIN32)
+  if (wake_fds_[1] >= 0) {
+    // A full pipe already wakes the thread.
+    const char byte = 0;
+    [[maybe_unused]] const ssize_t written = write(wake_fds_[1], &byte, 1);
+  }
+#endif
+}
+
+void ConsoleServer::NetworkLoop() {
+#if !defined(_WIN32)
+  std::vector<pollfd> fds;
+  std::vector<int> listeners;
+
+  for (;;) {
+    std::uint64_t pumps = 0;
+    {
+      std::lock_guard lock(mutex_);
+      if (stop_) {
+        break;
+      }
+      listeners = listeners_;
+      pumps = output_pumps_;
+      // Take the output queued by `Pump()`.
+      for (Connection& connection : connections_) {
+        const auto it = outbox_.find(connection.id);
+        if (it == outbox_.end()) {
+          continue;
+        }
+        if (connection.output_sent == connection.output.size()) {
+          connection.output.clear();
+          connection.output_sent = 0;
+        }
+        connection.output += it->second;
+        outbox_.erase(it);
+      }
+    }
+
+    // Closes the connections that are stuck or done.
+    for (size_t i = connections_.size(); i-- > 0;) {
+      Connection& connection = connections_[i];
+      const size_t queued = connection.output.size() - connection.output_sent;
+      const bool done = connection.input_closed && queued == 0 &&
+                        pumps >= connection.close_after_pumps;
+      if (done || queued > options_.max_pending_output) {
+        Disconnect(connection);
+        connections_.erase(connections_.begin() + i);
+      }
+    }
+
+    fds.clear();
+    fds.push_back({wake_fds_[0], POLLIN, 0});
+    for (const int fd : listeners) {
+      fds.push_back({fd, POLLIN, 0});
+    }
+    for (const Connection& connection : connections_) {
+      short events = connection.input_closed ? 0 : POLLIN;
+      if (connection.output_sent < connection.output.size()) {
+        events |= POLLOUT;
+      }
+      fds.push_back({connection.fd, events, 0});
+    }
+
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      char bytes[64];
+      while (read(wake_fds_[0], bytes, sizeof(bytes)) > 0) {
+      }
+    }
+
+    // Connections accepted below are polled from the next iteration on.
+    const size_t polled = connections_.size();
+    const size_t first_connection = 1 + listeners.size();
+    for (size_t i = 1; i < first_connection; ++i) {
+      if (fds[i].revents & POLLIN) {
+        Accept(fds[i].fd);
+      }
+    }
+    for (size_t i = polled; i-- > 0;) {
+      Connection& connection = connections_[i];
+      const short revents = fds[first_connection + i].revents;
+      bool keep = true;
+      if (connection.input_closed) {
+        // Only reported once the client is gone for good.
+        keep = !(revents & (POLLHUP | POLLERR));
+      } else if (revents & (POLLIN | POLLHUP | POLLERR)) {
+        keep = Receive(connection);
+      }
+      if (keep && (revents & POLLOUT)) {
+        keep = Send(connection);
+      }
+      if (!keep || (revents & POLLNVAL)) {
+        Disconnect(connection);
+        connections_.erase(connections_.begin() + i);
+      }
+    }
+  }
+
+  for (Connection& connection : connections_) {
+    Disconnect(connection);
+  }
+  connections_.clear();
+#endif
+}
+
+void ConsoleServer::Accept(int listener) {
+#if !defined(_WIN32)
+  for (;;) {
+    const int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // Nothing left to accept, or an error of a single connection.
+      return;
+    }
+    if (!SetUpConnection(fd)) {
+      close(fd);
+      continue;
+    }
+
+    {
+      std::lock_guard lock(mutex_);
+      if (clients_count_ >= options_.max_clients) {
+        static constexpr std::string_view kBusy = "too many clients\n";
+        [[maybe_unused]] const ssize_t sent =
+            send(fd, kBusy.data(), kBusy.size(), kSendFlags);
+        close(fd);
+        continue;
+      }
+      ++clients_count_;
+      connected_.push_back(next_client_id_);
+    }
+
+    Connection connection;
+    connection.fd = fd;
+    connection.id = next_client_id_++;
+    connection.output = options_.greeting;
+    connections_.push_back(std::move(connection));
+  }
+#endif
+}
+
+bool ConsoleServer::Receive(Connection& connection) {
+#if defined(_WIN32)
+  return false;
+#else
+  char bytes[kReceiveSize];
+  bool open = true;
+  for (;;) {
+    const ssize_t count = recv(connection.fd, bytes, sizeof(bytes), 0);
+    if (count > 0) {
+      connection.input.append(bytes, static_cast<size_t>(count));
+      if (static_cast<size_t>(count) < sizeof(bytes)) {
+        break;
+      }
+    } else if (count == 0) {
+      open = false;
+      break;
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    } else {
+      return false;
+    }
+  }
+
+  // Hand the complete lines to `Pump()` at once.
+  std::vector<Request> lines;
+  size_t start = 0;
+  for (size_t end = connection.input.find('\n'); end != std::string::npos;
+       end = connection.input.find('\n', start)) {
+    std::string_view line(connection.input.data() + start, end - start);
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    if (line.size() > options_.max_line_size) {
+      return false;
+    }
+    lines.push_back({connection.id, std::string(line)});
+    start = end + 1;
+  }
+  connection.input.erase(0, start);
+  if (connection.input.size() > options_.max_line_size) {
+    return false;
+  }
+  if (!open && !connection.input.empty()) {
+    // The last line may end without a newline.
+    if (connection.input.back() == '\r') {
+      connection.input.pop_back();
+    }
+    lines.push_back({connection.id, std::move(connection.input)});
+    connection.input.clear();
+  }
+
+  std::lock_guard lock(mutex_);
+  inbox_.insert(inbox_.end(), std::make_move_iterator(lines.begin()),
+                std::make_move_iterator(lines.end()));
+  if (!open) {
+    // The client may still read: close once the output of its last lines,
+    // written by the next `Pump()`, is sent.
+    connection.input_closed = true;
+    connection.close_after_pumps = pumps_ + 1;
+    ++closing_count_;
+  }
+  return true;
+#endif
+}
+
+bool ConsoleServer::Send(Connection& connection) {
+#if defined(_WIN32)
+  return false;
+#else
+  while (connection.output_sent < connection.output.size()) {
+    const ssize_t count =
+        send(connection.fd, connection.output.data() + connection.output_sent,
+             connection.output.size() - connection.output_sent, kSendFlags);
+    if (count >= 0) {
+      connection.output_sent += static_cast<size_t>(count);
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    } else {
+      return false;
+    }
+  }
+  if (connection.output_sent == connection.output.size()) {
+    connection.output.clear();
+    connection.output_sent = 0;
+  } else if (connection.output_sent > connection.output.size() / 2) {
+    // Keeps the unsent tail from moving on every partial send.
+    connection.output.erase(0, connection.output_sent);
+    connection.output_sent = 0;
+  }
+  return true;
+#endif
+}
+
+void ConsoleServer::Disconnect(Connection& connection) {
+#if !defined(_WIN32)
+  close(connection.fd);
+  connection.fd = -1;
+  std::lock_guard lock(mutex_);
+  --clients_count_;
+  if (connection.input_closed) {
+    --closing_count_;
+  }
+  disconnected_.push_back(connection.id);
+  outbox_.erase(connection.id);
+#endif
+}
+
+}  // namespace sfe
@@ -0,0 +1,333 @@
+#include "ConsoleView.hpp"
+
+#include <SFML/Graphics/Font.hpp>
+#include <SFML/Graphics/Glyph.hpp>
+#include <SFML/Graphics/RenderTarget.hpp>
+#include <SFML/Graphics/Texture.hpp>
+#include <algorithm>
+#include <utility>
+
+namespace sfe {
+
+namespace {
+
+// Colors text is drawn with unless a style sets them.
+constexpr std::uint32_t kDefaultTextColor = 0xFFFFFF;
+constexpr std::uint32_t kDefaultBackgroundColor = 0x000000;
+
+// Converts a 0xRRGGBB color to an opaque SFML color.
+inline sf::Color ToColor(std::uint32_t rgb) {
+  return sf::Color(static_cast<std::uint8_t>(rgb >> 16),
+                   static_cast<std::uint8_t>(rgb >> 8),
+                   static_cast<std::uint8_t>(rgb));
+}
+
+// Appends two triangles of a solid rectangle. Like `sf::Text` underlines, it
+// samples the white pixel every font texture reserves at (1, 1).
+inline void AddRectQuad(std::vector<sf::Vertex>& vertices, float left,
+                        float top, float width, float height,
+                        const sf::Color& color) {
+  const sf::Vector2f uv(1.F, 1.F);
+  const float right = left + width;
+  const float bottom = top + height;
+  vertices.push_back({{left, top}, color, uv});
+  vertices.push_back({{right, top}, color, uv});
+  vertices.push_back({{left, bottom}, color, uv});
+  vertices.push_back({{left, bottom}, color, uv});
+  vertices.push_back({{right, top}, color, uv});
+  vertices.push_back({{right, bottom}, color, uv});
+}
+
+// Appends two triangles of a glyph quad with the top left corner at `pos`.
+// Mirrors the layout of `sf::Text`, including the padding around glyphs.
+inline void AddGlyphQuad(std::vector<sf::Vertex>& vertices, sf::Vector2f pos,
+                         const sf::Color& color, const sf::Glyph& glyph) {
+  constexpr float kPadding = 1.F;
+
+  const float left = pos.x + glyph.bounds.left - kPadding;
+  const float top = pos.y + glyph.bounds.top - kPadding;
+  const float right = pos.x + glyph.bounds.left + glyph.bounds.width + kPadding;
+  const float bottom =
+      pos.y + glyph.bounds.top + glyph.bounds.height + kPadding;
+
+  const float u1 = static_cast<float>(glyph.textureRect.left) - kPadding;
+  const float v1 = static_cast<float>(glyph.textureRect.top) - kPadding;
+  const float u2 =
+      static_cast<float>(glyph.textureRect.left + glyph.textureRect.width) +
+      kPadding;
+  const float v2 =
+      static_cast<float>(glyph.textureRect.top + glyph.textureRect.height) +
+      kPadding;
+
+  vertices.push_back({{left, top}, color, {u1, v1}});
+  vertices.push_back({{right, top}, color, {u2, v1}});
+  vertices.push_back({{left, bottom}, color, {u1, v2}});
+  vertices.push_back({{left, bottom}, color, {u1, v2}});
+  vertices.push_back({{right, top}, color, {u2, v1}});
+  vertices.push_back({{right, bottom}, color, {u2, v2}});
+}
+
+}  // namespace
+
+void ConsoleView::SetFontMetrics(FontMetricsCache& metrics) {
+  if (metrics_ != &metrics) {
+    metrics_ = &metrics;
+    wrap_.SetFontMetrics(metrics);
+    clear();
+  }
+}
+
+void ConsoleView::SetCharacterSize(unsigned int size) {
+  if (character_size_ != size) {
+    character_size_ = size;
+    wrap_.SetCharacterSize(size);
+    clear();
+  }
+}
+
+unsigned int ConsoleView::GetCharacterSize() const { return character_size_; }
+
+void ConsoleView::SetWrapWidth(float width) {
+  if (wrap_.GetWidth() != width) {
+    wrap_.SetWidth(width);
+    clear();
+  }
+}
+
+float ConsoleView::GetWrapWidth() const { return wrap_.GetWidth(); }
+
+size_t ConsoleView::GetRowsCount(const ConsoleBuffer& buffer, size_t index) {
+  return wrap_.GetRowsCount(buffer, index);
+}
+
+float ConsoleView::GetLineHeight() const {
+  return metrics_ && metrics_->GetFont()
+             ? metrics_->GetLineSpacing(character_size_)
+             : 0.F;
+}
+
+void ConsoleView::clear() {
+  lines_.clear();
+  vertices_.clear();
+}
+
+/// Moves the window to [begin, end) reusing the cached lines that stay visible.
+void ConsoleView::Update(const ConsoleBuffer& buffer, size_t begin,
+                         size_t end, size_t skip_rows, size_t max_rows) {
+  indices_.clear();
+  for (size_t i = begin; i < end; ++i) {
+    indices_.push_back(i);
+  }
+  Update(buffer, indices_, skip_rows, max_rows);
+}
+
+/// Shows the given lines, building only the ones that weren't cached.
+void ConsoleView::Update(const ConsoleBuffer& buffer,
+                         std::span<const size_t> indices, size_t skip_rows,
+                         size_t max_rows) {
+  if (!metrics_ || !metrics_->GetFont()) {
+    return;
+  }
+  if (metrics_->GetGeneration() != metrics_generation_) {
+    clear();
+    metrics_generation_ = metrics_->GetGeneration();
+  }
+
+  const size_t base_id = buffer.GetFirstLineId();
+
+  // Only the lines written since the last update may have changed.
+  if (buffer.GetRevision() != revision_) {
+    while (!lines_.empty() && lines_.back().id >= mutable_id_) {
+      lines_.pop_back();
+    }
+    revision_ = buffer.GetRevision();
+  }
+  mutable_id_ = base_id + buffer.GetLines().size() - 1;
+
+  // Both the cached and the shown lines are ordered by id, so a single pass
+  // picks the cached ones that stay visible and drops the rest.
+  std::swap(lines_, spare_lines_);
+  lines_.clear();
+  auto cached = spare_lines_.begin();
+  for (const size_t index : indices) {
+    const size_t id = base_id + index;
+    while (cached != spare_lines_.end() && cached->id < id) {
+      ++cached;
+    }
+    if (cached != spare_lines_.end() && cached->id == id) {
+      lines_.push_back(std::move(*cached++));
+    } else {
+      lines_.push_back(BuildLine(buffer, index));
+    }
+  }
+  spare_lines_.clear();
+
+  skip_rows_ = skip_rows;
+  max_rows_ = max_rows;
+  UpdateVertices();
+}
+
+/// Lays out glyphs of the line the same way `sf::Text` does, starting at the
+/// baseline of the first row. Every row starts at the left edge, one line
+/// height below the previous one. Backgrounds are drawn under the glyphs of
+/// their run, underlines and strikethroughs over them.
+ConsoleView::CachedLine ConsoleView::BuildLine(const ConsoleBuffer& buffer,
+                                               size_t index) {
+  const ConsoleBuffer::Line line = buffer.GetLine(index);
+  const LineWrapCache::Breaks& breaks = wrap_.GetBreaks(buffer, index);
+
+  CachedLine result;
+  result.id = buffer.GetFirstLineId() + index;
+  result.vertices.reserve(line.GetBytesCount() * 6);
+  result.row_vertices.reserve(breaks.size());
+
+  FontMetricsCache& metrics = *metrics_;
+  const sf::Font& font = *metrics.GetFont();
+  const float line_height = GetLineHeight();
+  sf::Vector2f pos(0.F, static_cast<float>(character_size_));
+  std::uint32_t prev_char = 0;
+  std::uint32_t offset = 0;
+  auto next_break = breaks.begin();
+
+  // Part of a sequence in one row: its first vertex and where it starts.
+  size_t run_vertex = 0;
+  float run_x = 0.F;
+  const auto finish_run = [&](const TextStyle& style, const sf::Color& color,
+                              const ResolvedColors& colors) {
+    const float width = pos.x - run_x;
+    if (width <= 0.F) {
+      return;
+    }
+    if (colors.has_background) {
+      // Appended, then moved in front of the glyphs of the run.
+      const size_t end = result.vertices.size();
+      AddRectQuad(result.vertices, run_x,
+                  pos.y - static_cast<float>(character_size_), width,
+                  line_height, ToColor(colors.background));
+      std::rotate(result.vertices.begin() + run_vertex,
+                  result.vertices.begin() + end, result.vertices.end());
+    }
+    const float thickness = font.getUnderlineThickness(character_size_);
+    if (style.Has(STYLE_UNDERLINE)) {
+      AddRectQuad(result.vertices, run_x,
+                  pos.y + font.getUnderlinePosition(character_size_) -
+                      thickness / 2.F,
+                  width, thickness, color);
+    }
+    if (style.Has(STYLE_STRIKETHROUGH)) {
+      const sf::FloatRect x_bounds =
+          metrics.GetGlyph(U'x', character_size_).bounds;
+      AddRectQuad(result.vertices, run_x,
+                  pos.y + x_bounds.top + x_bounds.height / 2.F -
+                      thickness / 2.F,
+                  width, thickness, color);
+    }
+  };
+
+  for (const auto seq : line) {
+    const ResolvedColors colors = ResolveColors(
+        seq.style, kDefaultTextColor, kDefaultBackgroundColor);
+    const sf::Color color = ToColor(colors.text);
+    const bool decorated = colors.has_background ||
+                           seq.style.Has(STYLE_UNDERLINE) ||
+                           seq.style.Has(STYLE_STRIKETHROUGH);
+    run_vertex = result.vertices.size();
+    run_x = pos.x;
+    for (const char c : seq.text) {
+      if (next_break != breaks.end() && *next_break == offset) {
+        ++next_break;
+        if (decorated) {
+          finish_run(seq.style, color, colors);
+        }
+        result.row_vertices.push_back(result.vertices.size());
+        pos = {0.F, pos.y + line_height};
+        prev_char = 0;
+        run_vertex = result.vertices.size();
+        run_x = pos.x;
+      }
+      ++offset;
+
+      // Text is decoded byte by byte, like ANSI strings passed to sf::Text.
+      const std::uint32_t cur_char = static_cast<unsigned char>(c);
+      pos.x += metrics.GetKerning(prev_char, cur_char, character_size_);
+      prev_char = cur_char;
+
+      if (cur_char != U' ' && cur_char != U'\t' && cur_char != U'\r') {
+        AddGlyphQuad(result.vertices, pos, color,
+                     metrics.GetGlyph(cur_char, character_size_));
+      }
+      pos.x += metrics.GetAdvance(cur_char, character_size_);
+    }
+    if (decorated) {
+      finish_run(seq.style, color, colors);
+    }
+  }
+  return result;
+}
+
+/// Copies the shown rows of the cached lines, moving every row to its place in
+/// the window.
+void ConsoleView::UpdateVertices() {
+  // Range of vertices of a row of a cached line.
+  const auto row_begin = [](const CachedLine& line, size_t row) -> size_t {
+    return row == 0 ? 0 : line.row_vertices[row - 1];
+  };
+  const auto row_end = [](const CachedLine& line, size_t row) -> size_t {
+    return row < line.row_vertices.size() ? line.row_vertices[row]
+                                          : line.vertices.size();
+  };
+
+  // Shown rows of every cached line: [first, last).
+  struct Rows {
+    size_t first = 0;
+    size_t last = 0;
+  };
+  std::vector<Rows> shown(lines_.size());
+  size_t rows_left = max_rows_;
+  size_t count = 0;
+  for (size_t i = 0; i < lines_.size() && rows_left; ++i) {
+    const size_t rows = lines_[i].row_vertices.size() + 1;
+    shown[i].first = i == 0 ? std::min(skip_rows_, rows) : 0;
+    shown[i].last = shown[i].first + std::min(rows - shown[i].first, rows_left);
+    rows_left -= shown[i].last - shown[i].first;
+    if (shown[i].last > shown[i].first) {
+      count += row_end(lines_[i], shown[i].last - 1) -
+               row_begin(lines_[i], shown[i].first);
+    }
+  }
+  vertices_.resize(count);
+
+  const float line_height = GetLineHeight();
+  size_t vertex = 0;
+  size_t window_row = 0;
+  for (size_t i = 0; i < lines_.size(); ++i) {
+    if (shown[i].last == shown[i].first) {
+      continue;
+    }
+    // Rows are laid out one line height apart, so a single offset moves the
+    // first shown row to its place and the rest follow.
+    const float y = line_height * (static_cast<float>(window_row) -
+                                   static_cast<float>(shown[i].first));
+    const size_t end = row_end(lines_[i], shown[i].last - 1);
+    for (size_t v = row_begin(lines_[i], shown[i].first); v < end; ++v) {
+      vertices_[vertex] = lines_[i].vertices[v];
+      vertices_[vertex].position.y += y;
+      ++vertex;
+    }
+    window_row += shown[i].last - shown[i].first;
+  }
+}
+
+void ConsoleView::draw(sf::RenderTarget& target,
+                       const sf::RenderStates& states) const {
+  if (!metrics_ || !metrics_->GetFont() || vertices_.getVertexCount() == 0) {
+    return;
+  }
+  auto cur_states = states;
+  cur_states.transform *= getTransform();
+  cur_states.texture = &metrics_->GetFont()->getTexture(character_size_);
+
+  target.draw(vertices_, cur_states);
+}
+
+}  // namespace sfe
@@ -0,0 +1,123 @@
+#include "FontMetricsCache.hpp"
+
+#include <SFML/Graphics/Font.hpp>
+#include <SFML/System/String.hpp>
+
+namespace sfe {
+
+void FontMetricsCache::SetFont(const sf::Font& font) {
+  font_ = &font;
+  clear();
+}
+
+const sf::Font* FontMetricsCache::GetFont() const { return font_; }
+
+void FontMetricsCache::SetMonospace(bool monospace) {
+  if (monospace_ != monospace) {
+    monospace_ = monospace;
+    clear();
+  }
+}
+
+bool FontMetricsCache::IsMonospace() const { return monospace_; }
+
+std::uint64_t FontMetricsCache::GetGeneration() const { return generation_; }
+
+void FontMetricsCache::clear() {
+  sizes_.clear();
+  last_size_ = 0;
+  last_metrics_ = nullptr;
+  ++generation_;
+}
+
+FontMetricsCache::SizeMetrics& FontMetricsCache::GetSizeMetrics(
+    unsigned int size) {
+  if (last_metrics_ && last_size_ == size) {
+    return *last_metrics_;
+  }
+  auto [it, inserted] = sizes_.try_emplace(size);
+  if (inserted) {
+    it->second.line_spacing = font_->getLineSpacing(size);
+    it->second.whitespace_width = font_->getGlyph(U' ', size, false).advance;
+  }
+  last_size_ = size;
+  last_metrics_ = &it->second;
+  return it->second;
+}
+
+const sf::Glyph& FontMetricsCache::GetGlyph(std::uint32_t codepoint,
+                                            unsigned int size) {
+  SizeMetrics& metrics = GetSizeMetrics(size);
+  const sf::Glyph*& glyph = codepoint < metrics.byte_glyphs.size()
+                                ? metrics.byte_glyphs[codepoint]
+                                : metrics.other_glyphs[codepoint];
+  if (!glyph) {
+    glyph = &font_->getGlyph(codepoint, size, false);
+  }
+  return *glyph;
+}
+
+float FontMetricsCache::GetAdvance(std::uint32_t codepoint,
+                                   unsigned int size) {
+  SizeMetrics& metrics = GetSizeMetrics(size);
+  switch (codepoint) {
+    case U'\t':
+      return metrics.whitespace_width * 4;
+    case U'\r':
+      return 0.F;
+    case U' ':
+      return metrics.whitespace_width;
+    default:
+      return monospace_ ? metrics.whitespace_width
+                        : GetGlyph(codepoint, size).advance;
+  }
+}
+
+float FontMetricsCache::GetKerning(std::uint32_t first, std::uint32_t second,
+                                   unsigned int size) {
+  if (monospace_ || first == 0) {
+    return 0.F;
+  }
+  return font_->getKerning(first, second, size);
+}
+
+float FontMetricsCache::GetLineSpacing(unsigned int size) {
+  return GetSizeMetrics(size).line_spacing;
+}
+
+template <class It>
+float FontMetricsCache::MeasureText(It begin, It end, unsigned int size) {
+  if (!font_) {
+    return 0.F;
+  }
+  if (monospace_) {
+    // Every character is one cell, a tab is four and `\r` none.
+    float cells = 0.F;
+    for (It it = begin; it != end; ++it) {
+      cells += *it == '\t' ? 4.F : *it == '\r' ? 0.F : 1.F;
+    }
+    return cells * GetSizeMetrics(size).whitespace_width;
+  }
+
+  float width = 0.F;
+  std::uint32_t prev = 0;
+  for (It it = begin; it != end; ++it) {
+    const std::uint32_t cur = static_cast<std::uint32_t>(*it);
+    width += GetKerning(prev, cur, size) + GetAdvance(cur, size);
+    prev = cur;
+  }
+  return width;
+}
+
+float FontMetricsCache::GetTextWidth(std::string_view text,
+                                     unsigned int size) {
+  const auto* begin = reinterpret_cast<const unsigned char*>(text.data());
+  return MeasureText(begin, begin + text.size(), size);
+}
+
+float FontMetricsCache::GetStringWidth(const sf::String& text,
+                                       unsigned int size) {
+  return MeasureText(text.begin(), text.end(), size);
+}
+
+}  // namespace sfe
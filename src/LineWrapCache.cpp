@@ -0,0 +1,120 @@
+#include "LineWrapCache.hpp"
+
+namespace sfe {
+
+void LineWrapCache::SetFontMetrics(FontMetricsCache& metrics) {
+  if (metrics_ != &metrics) {
+    metrics_ = &metrics;
+    clear();
+  }
+}
+
+void LineWrapCache::SetCharacterSize(unsigned int size) {
+  if (character_size_ != size) {
+    character_size_ = size;
+    clear();
+  }
+}
+
+void LineWrapCache::SetWidth(float width) {
+  if (width_ != width) {
+    width_ = width;
+    clear();
+  }
+}
+
+float LineWrapCache::GetWidth() const { return width_; }
+
+const LineWrapCache::Breaks& LineWrapCache::GetBreaks(
+    const ConsoleBuffer& buffer, size_t index) {
+  Sync(buffer);
+  auto [it, inserted] = lines_.try_emplace(buffer.GetFirstLineId() + index);
+  if (inserted) {
+    it->second = Wrap(buffer.GetLine(index));
+  }
+  return it->second;
+}
+
+size_t LineWrapCache::GetRowsCount(const ConsoleBuffer& buffer, size_t index) {
+  return GetBreaks(buffer, index).size() + 1;
+}
+
+size_t LineWrapCache::size() const { return lines_.size(); }
+
+void LineWrapCache::clear() {
+  lines_.clear();
+  if (metrics_) {
+    metrics_generation_ = metrics_->GetGeneration();
+  }
+}
+
+void LineWrapCache::Sync(const ConsoleBuffer& buffer) {
+  if (metrics_ && metrics_->GetGeneration() != metrics_generation_) {
+    clear();
+  }
+  if (buffer.GetRevision() == revision_) {
+    return;
+  }
+  // Only the last line grows, every other change drops the oldest lines.
+  lines_.erase(lines_.lower_bound(mutable_id_), lines_.end());
+  lines_.erase(lines_.begin(), lines_.lower_bound(buffer.GetFirstLineId()));
+  mutable_id_ = buffer.GetFirstLineId() + buffer.GetLines().size() - 1;
+  revision_ = buffer.GetRevision();
+}
+
+/// Measures the line the same way `ConsoleView` lays it out, every row
+/// starting without kerning.
+LineWrapCache::Breaks LineWrapCache::Wrap(
+    const ConsoleBuffer::Line& line) const {
+  Breaks breaks;
+  if (!metrics_ || !metrics_->GetFont() || width_ <= 0.F) {
+    return breaks;
+  }
+
+  FontMetricsCache& metrics = *metrics_;
+  float x = 0.F;
+  std::uint32_t prev_char = 0;
+  std::uint32_t offset = 0;
+  std::uint32_t row_start = 0;
+  // First character after the last space and where it starts.
+  std::uint32_t word_start = 0;
+  float word_x = 0.F;
+
+  for (const auto seq : line) {
+    for (const char c : seq.text) {
+      const std::uint32_t cur_char = static_cast<unsigned char>(c);
+      float kerning = metrics.GetKerning(prev_char, cur_char, character_size_);
+      const float advance = metrics.GetAdvance(cur_char, character_size_);
+      if (prev_char == U' ' && cur_char != U' ') {
+        word_start = offset;
+        word_x = x + kerning;
+      }
+
+      if (cur_char != U' ' && offset > row_start &&
+          x + kerning + advance > width_) {
+        if (word_start > row_start) {
+          // Move the current word to the next row.
+          breaks.push_back(word_start);
+          row_start = word_start;
+          x -= word_x;
+        }
+        if (offset > row_start && x + kerning + advance > width_) {
+          // The word alone doesn't fit, break it.
+          breaks.push_back(offset);
+          row_start = offset;
+        }
+        if (offset == row_start) {
+          x = 0.F;
+          kerning = 0.F;
+        }
+      }
+
+      x += kerning + advance;
+      prev_char = cur_char;
+      ++offset;
+    }
+  }
+  return breaks;
+}
+
+}  // namespace sfe
@@ -3,6 +3,8 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include "RichText.hpp"
 
+#include "FontMetricsCache.hpp"
+
 #include <SFML/Graphics/Font.hpp>
 #include <SFML/Graphics/Rect.hpp>
 #include <SFML/Graphics/RenderTarget.hpp>
@@ -32,6 +34,15 @@ void RichText::Line::setFont(const sf::Font &font)
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::setFontMetrics(FontMetricsCache *metrics)
+{
+    m_metrics = metrics;
+
+    updateGeometry();
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 const std::vector<sf::Text> &RichText::Line::getTexts() const
 {
@@ -91,8 +102,18 @@ void RichText::Line::updateTextAndGeometry(sf::Text &text) const
     // Set text offset
     text.setPosition({m_bounds.width, 0.f});
 
-    // Update bounds
-    int lineSpacing = text.getFont().getLineSpacing(text.getCharacterSize());
+    // Update bounds, measuring regular texts with the cached metrics: it
+    // doesn't build the text geometry and is what sf::Text advances by
+    const unsigned int size = text.getCharacterSize();
+    if (m_metrics && m_metrics->GetFont() == &text.getFont() &&
+        text.getStyle() == sf::Text::Regular) {
+        int lineSpacing = m_metrics->GetLineSpacing(size);
+        m_bounds.height = std::max(m_bounds.height, static_cast<float>(lineSpacing));
+        m_bounds.width += m_metrics->GetStringWidth(text.getString(), size);
+        return;
+    }
+
+    int lineSpacing = text.getFont().getLineSpacing(size);
     m_bounds.height = std::max(m_bounds.height, static_cast<float>(lineSpacing));
     m_bounds.width += text.getGlobalBounds().width;
 }
@@ -172,8 +193,10 @@ RichText & RichText::operator << (const sf::String &string)
     auto it = subStrings.begin();
     if (it != subStrings.end()) {
         // If there isn't any line, just create it
-        if (m_lines.empty())
+        if (m_lines.empty()) {
             m_lines.resize(1);
+            m_lines.back().setFontMetrics(m_metrics);
+        }
 
         // Remove last line's height
         Line &line = m_lines.back();
@@ -190,6 +213,7 @@ RichText & RichText::operator << (const sf::String &string)
     // Append the rest of substrings as new lines
     while (++it != subStrings.end()) {
         Line line;
+        line.setFontMetrics(m_metrics);
         line.setPosition({0.f, m_bounds.height});
         line.appendText(createText(*it));
         m_lines.push_back(std::move(line));
@@ -240,6 +264,24 @@ void RichText::setFont(const sf::Font &font)
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+void RichText::setFontMetrics(FontMetricsCache *metrics)
+{
+    // Maybe skip
+    if (m_metrics == metrics)
+        return;
+
+    // Update metrics
+    m_metrics = metrics;
+
+    // Set lines metrics
+    for (Line &line : m_lines)
+        line.setFontMetrics(metrics);
+
+    updateGeometry();
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 void RichText::clear()
 {
@@ -302,7 +344,8 @@ RichText::RichText(const sf::Font *font)
     : m_font(font),
       m_characterSize(30),
       m_currentColor(sf::Color::White),
-      m_currentStyle(sf::Text::Regular)
+      m_currentStyle(sf::Text::Regular),
+      m_metrics(nullptr)
 {
 
 }
@@ -2,6 +2,7 @@
 
 #include <SFML/Graphics/RenderTarget.hpp>
 #include <cmath>
+#include <iomanip>
 
 namespace sfe {
 
@@ -9,32 +10,6 @@ namespace {
 
 constexpr size_t kMaxOptionsInLine = 5;
 
-// Helper function to map ANSI color codes to SFML colors.
-inline sf::Color GetAnsiTextColor(AnsiColorCode code) {
-  switch (code) {
-    case ANSI_RESET:
-      return sf::Color::White;
-    case ANSI_BLACK:
-      return sf::Color::Black;
-    case ANSI_RED:
-      return sf::Color::Red;
-    case ANSI_GREEN:
-      return sf::Color::Green;
-    case ANSI_YELLOW:
-      return sf::Color::Yellow;
-    case ANSI_BLUE:
-      return sf::Color::Blue;
-    case ANSI_MAGENTA:
-      return sf::Color::Magenta;
-    case ANSI_CYAN:
-      return sf::Color::Cyan;
-    case ANSI_WHITE:
-      return sf::Color::White;
-    default:
-      return sf::Color::Black;
-  }
-}
-
 // Extracts and returns the first word from a given string.
 inline std::string GetFirstWord(const std::string& str) {
   std::istringstream istream(str);
@@ -53,17 +28,37 @@ SFMLInGameConsole::SFMLInGameConsole(sf::Font font, size_t command_history_size,
       font_(std::move(font)) {
   AddStream(console_stream_);
 
+  metrics_.SetFont(font_);
+  output_view_.SetFontMetrics(metrics_);
+  input_line_.setFontMetrics(&metrics_);
+
   // Overrides default styling for different message types.
   style = {{"\u001b[31m[error]: ", std::string(TEXT_COLOR_RESET)},
            {"\u001b[33m[warning]: ", std::string(TEXT_COLOR_RESET)},
            {"\u001b[37m> ", std::string(TEXT_COLOR_RESET)}};
+
+  if (enable_prebinded_commands) {
+    bindCommand(
+        "filter",
+        [this](std::istream& is, std::ostream& os) { FilterCommand(is, os); },
+        "filter [errors] [warnings] [echo] [plain] [text] shows only the "
+        "output lines of the categories that contain the text, filter with "
+        "no arguments shows all lines");
+    SetCommandKeywords("filter", {"errors", "warnings", "echo", "plain"});
+  }
 }
 
+SFMLInGameConsole::~SFMLInGameConsole() { flush(); }
+
 void SFMLInGameConsole::SetBackgroundColor(const sf::Color& color) {
   background_color_ = color;
+  MarkDirty(kDirtyGeometry);
 }
 
-void SFMLInGameConsole::SetFontScale(float scale) { font_scale_ = scale; }
+void SFMLInGameConsole::SetFontScale(float scale) {
+  font_scale_ = scale;
+  MarkDirty(kDirtyGeometry);
+}
 
 void SFMLInGameConsole::SetMaxInputLineSymbols(size_t count) {
   max_input_line_symbols_ = count;
@@ -71,29 +66,113 @@ void SFMLInGameConsole::SetMaxInputLineSymbols(size_t count) {
 
 void SFMLInGameConsole::SetPosition(sf::Vector2f pos) {
   position_ = pos;
+  MarkDirty(kDirtyGeometry);
 }
 
 void SFMLInGameConsole::SetTextLeftOffset(float offset_part) {
   text_left_offset_part_ = std::clamp(offset_part, 0.F, 1.F);
+  MarkDirty(kDirtyGeometry);
 }
 
 void SFMLInGameConsole::SetConsoleHeightPart(float height_part) {
   console_height_part_ = height_part;
+  MarkDirty(kDirtyGeometry);
+}
+
+void SFMLInGameConsole::SetMaxBufferLines(size_t count) {
+  console_buffer_.SetMaxLines(count);
+}
+
+void SFMLInGameConsole::SetMaxBufferBytes(size_t bytes) {
+  console_buffer_.SetMaxBytes(bytes);
+}
+
+void SFMLInGameConsole::SetMonospace(bool monospace) {
+  metrics_.SetMonospace(monospace);
+  MarkDirty(kDirtyGeometry);
+}
+
+void SFMLInGameConsole::SetLineWrap(bool wrap) {
+  wrap_lines_ = wrap;
+  MarkDirty(kDirtyGeometry);
+}
+
+void SFMLInGameConsole::SetOutputFilter(LineFilter filter) {
+  output_filter_ = std::move(filter);
+  filtered_ids_.clear();
+  filter_next_id_ = 0;
+  // Forces `UpdateFilteredLines()` to look the lines up.
+  filter_revision_ = console_buffer_.GetRevision() - 1;
+  ScrollToBottom();
+  MarkDirty(kDirtyOutput | kDirtyInput);
+}
+
+void SFMLInGameConsole::ClearOutputFilter() { SetOutputFilter({}); }
+
+const LineFilter& SFMLInGameConsole::GetOutputFilter() const {
+  return output_filter_;
+}
+
+void SFMLInGameConsole::SetOutputTextIndex(bool enabled) {
+  console_buffer_.SetTextIndex(enabled);
+}
+
+void SFMLInGameConsole::FilterCommand(std::istream& is, std::ostream&) {
+  static constexpr std::pair<std::string_view, LineCategory> kCategories[] = {
+      {"errors", LINE_ERROR},
+      {"warnings", LINE_WARNING},
+      {"echo", LINE_ECHO},
+      {"plain", LINE_PLAIN}};
+
+  // Leading category names select categories, the rest is the text.
+  LineFilter filter;
+  unsigned categories = 0;
+  std::string word;
+  while (is >> word) {
+    const auto category =
+        std::find_if(std::begin(kCategories), std::end(kCategories),
+                     [&word](const auto& c) { return c.first == word; });
+    if (category == std::end(kCategories)) {
+      break;
+    }
+    categories |= LineCategoryBit(category->second);
+    word.clear();
+  }
+  if (categories) {
+    filter.categories = categories;
+  }
+  std::string rest;
+  std::getline(is, rest);
+  filter.text = word + rest;
+  SetOutputFilter(std::move(filter));
 }
 
 void SFMLInGameConsole::SetCommandKeywords(const std::string& cmd_name,
                                            std::vector<std::string> keywords) {
-  cmd_keywords_.insert({cmd_name, std::move(keywords)});
+  cmd_keywords_[cmd_name].assign(std::move(keywords));
 }
 
 void SFMLInGameConsole::clear() {
+  // Output written before the call is cleared too.
+  flush();
   console_buffer_.clear();
-  scroll_lines_offset_ = 0;
+  ScrollToBottom();
+  MarkDirty(kDirtyOutput);
 }
 
-sf::Font* SFMLInGameConsole::Font() { return &font_; }
+sf::Font* SFMLInGameConsole::Font() {
+  metrics_.SetFont(font_);
+  MarkDirty(kDirtyGeometry);
+  return &font_;
+}
 
-void SFMLInGameConsole::show(bool v) { shown_ = v; }
+void SFMLInGameConsole::show(bool v) {
+  // Hidden console does not track changes, so rebuild everything on show.
+  if (v && !shown_) {
+    MarkDirty(kDirtyAll);
+  }
+  shown_ = v;
+}
 
 bool SFMLInGameConsole::visible() const { return shown_; }
 
@@ -101,54 +180,124 @@ const std::string& SFMLInGameConsole::GetCurrentText() const {
   return buffer_text_;
 }
 
-/// Updates the rendered text based on the console's internal state and buffer.
+void SFMLInGameConsole::MarkDirty(unsigned flags) { dirty_flags_ |= flags; }
+
+float SFMLInGameConsole::GetLineHeight() const {
+  return font_scale_ * font_.getLineSpacing(input_line_.getCharacterSize());
+}
+
+/// Rebuilds the parts of the rendered text invalidated since the last frame.
 void SFMLInGameConsole::UpdateDrawnText() {
-  // Clear and set up input line with the cursor at the appropriate position.
+  if (console_buffer_.GetRevision() != drawn_revision_) {
+    MarkDirty(kDirtyOutput);
+  }
+  if (dirty_flags_ == kDirtyNone) {
+    return;
+  }
+  const auto timer = stats.timeSection("updateDrawnText");
+
+  if (dirty_flags_ & kDirtyGeometry) {
+    background_rect_.setPosition(position_);
+    background_rect_.setFillColor(background_color_);
+  }
+  if (dirty_flags_ & (kDirtyInput | kDirtyGeometry)) {
+    UpdateInputLine();
+  }
+  if (dirty_flags_ & (kDirtyOutput | kDirtyScroll | kDirtyGeometry)) {
+    UpdateOutputText();
+  }
+
+  dirty_flags_ = kDirtyNone;
+}
+
+/// Sets up input line with the cursor at the appropriate position.
+void SFMLInGameConsole::UpdateInputLine() {
   input_line_.clear();
-  output_text_.clear();
 
   input_line_.setFont(font_);
   input_line_.setScale({font_scale_, font_scale_});
-  input_line_ << "> " << buffer_text_.substr(0, cursor_pos_) << "_"
-              << buffer_text_.substr(cursor_pos_);
+  if (searching_) {
+    const size_t match = historyBuffer().find(search_match_);
+    input_line_ << (match != Virtuoso::HistoryBuffer::npos || search_query_.empty()
+                        ? "(reverse-i-search)'"
+                        : "(failed reverse-i-search)'")
+                << search_query_ << "_': "
+                << (match != Virtuoso::HistoryBuffer::npos
+                        ? historyBuffer()[match]
+                        : std::string());
+  } else {
+    if (!output_filter_.IsEmpty()) {
+      input_line_ << "(filtered) ";
+    }
+    input_line_ << "> " << buffer_text_.substr(0, cursor_pos_) << "_"
+                << buffer_text_.substr(cursor_pos_);
+  }
 
   const float console_height = background_rect_.getSize().y;
   const float left_offset =
       background_rect_.getSize().x * text_left_offset_part_;
-  const float line_height =
-      font_scale_ * font_.getLineSpacing(input_line_.getCharacterSize());
-  const int visible_lines_count = std::floor(console_height / line_height) - 1;
 
   // Position input line at the bottom of the console.
-  input_line_.setPosition({left_offset, console_height - line_height});
-
-  // Get range of currently visible lines.
-  const int end = console_buffer_.size() - scroll_lines_offset_;
-  const int begin = std::max(end - visible_lines_count, 0);
-  const auto& lines = console_buffer_.GetLines();
-  for (int i = begin; i < end; ++i) {
-    for (const auto& seq : lines[i].sequences) {
-      if (!seq.text.empty()) {
-        output_text_ << GetAnsiTextColor(seq.color_code) << seq.text;
-      }
+  input_line_.setPosition(
+      position_ + sf::Vector2f(left_offset, console_height - GetLineHeight()));
+}
+
+/// Moves the output pane to the currently visible rows of the buffer.
+void SFMLInGameConsole::UpdateOutputText() {
+  drawn_revision_ = console_buffer_.GetRevision();
+
+  const float console_width = background_rect_.getSize().x;
+  const float left_offset = console_width * text_left_offset_part_;
+  // Rows keep the same margin on both sides.
+  output_view_.SetWrapWidth(
+      wrap_lines_ ? std::max(console_width - 2 * left_offset, 0.F) / font_scale_
+                  : 0.F);
+
+  UpdateFilteredLines();
+  const int visible_rows = GetVisibleRowsCount();
+  if (GetShownLinesCount() == 0 || visible_rows == 0) {
+    output_view_.Update(console_buffer_, 0, 0);
+  } else {
+    // Find the top row from the bottom one. Near the oldest output the pane
+    // is filled from the first row instead, which also undoes scrolling past
+    // it.
+    RowPosition bottom = GetScrollRow();
+    RowPosition top = bottom;
+    if (-MoveRows(top, 1 - visible_rows) < visible_rows - 1) {
+      bottom = top;
+      MoveRows(bottom, visible_rows - 1);
     }
-    if (i + 1 < end) {
-      output_text_ << "\n";
+    if (scrolled_back_) {
+      scrolled_back_ = !(bottom == GetLastRow());
+      scroll_line_id_ =
+          console_buffer_.GetFirstLineId() + GetBufferIndex(bottom.line);
+      scroll_row_ = bottom.row;
+    }
+    if (output_filter_.IsEmpty()) {
+      output_view_.Update(console_buffer_, top.line, bottom.line + 1, top.row,
+                          visible_rows);
+    } else {
+      drawn_lines_.clear();
+      for (size_t line = top.line; line <= bottom.line; ++line) {
+        drawn_lines_.push_back(GetBufferIndex(line));
+      }
+      output_view_.Update(console_buffer_, drawn_lines_, top.row,
+                          visible_rows);
     }
   }
-
-  output_text_.setFont(font_);
-  output_text_.setPosition({left_offset, 0.F});
-  output_text_.setScale({font_scale_, font_scale_});
-
+  output_view_.setScale({font_scale_, font_scale_});
   // Apply current console position.
-  output_text_.move(position_);
-  input_line_.move(position_);
+  output_view_.setPosition(position_ + sf::Vector2f(left_offset, 0.F));
 }
 
 // Processes user input events for interacting with the console.
 void SFMLInGameConsole::HandleUIEvent(const sf::Event& e) {
+  if (searching_ && HandleReverseSearchEvent(e)) {
+    return;
+  }
   if (e.type == sf::Event::KeyPressed) {
+    // Nearly every handled key edits the text or moves the cursor.
+    MarkDirty(kDirtyInput);
     switch (e.key.code) {
       case sf::Keyboard::Backspace:
         if (cursor_pos_ > 0) {
@@ -166,7 +315,7 @@ void SFMLInGameConsole::HandleUIEvent(const sf::Event& e) {
         buffer_text_.clear();
         history_pos_ = -1;
         cursor_pos_ = 0;
-        scroll_lines_offset_ = 0;
+        ScrollToBottom();
         return;
       case sf::Keyboard::Tab:
         TextAutocompleteCallback();
@@ -186,10 +335,10 @@ void SFMLInGameConsole::HandleUIEvent(const sf::Event& e) {
         }
         return;
       case sf::Keyboard::PageUp:
-        scroll_lines_offset_ = GetOverflowLinesCount();
+        ScrollToTop();
         return;
       case sf::Keyboard::PageDown:
-        scroll_lines_offset_ = 0;
+        ScrollToBottom();
         return;
       case sf::Keyboard::Home:
         cursor_pos_ = 0;
@@ -203,6 +352,17 @@ void SFMLInGameConsole::HandleUIEvent(const sf::Event& e) {
       case sf::Keyboard::Right:
         cursor_pos_ = std::min(cursor_pos_ + 1, buffer_text_.size());
         return;
+      case sf::Keyboard::R:
+        if (e.key.control) {
+          StartReverseSearch();
+        }
+        return;
+      case sf::Keyboard::C:
+        // Stops commands running across frames, e.g. runFile.
+        if (e.key.control && taskCount() > 0) {
+          cancelTasks();
+        }
+        return;
       default:
         return;
     }
@@ -212,45 +372,227 @@ void SFMLInGameConsole::HandleUIEvent(const sf::Event& e) {
         buffer_text_.size() < max_input_line_symbols_) {
       buffer_text_.insert(cursor_pos_, 1, static_cast<char>(e.text.unicode));
       ++cursor_pos_;
+      MarkDirty(kDirtyInput);
     }
   }
 }
 
 // Renders the console background, output text, and input line.
 void SFMLInGameConsole::Render(sf::RenderTarget* window) {
+  const auto timer = stats.timeSection("render");
+  // Output of the tasks is shown in the same frame.
+  runTasks();
+  Pump();
+
   if (!shown_) {
     return;
   }
 
-  background_rect_.setPosition(position_);
-  background_rect_.setFillColor(background_color_);
-  background_rect_.setSize(sf::Vector2f(
-      window->getSize().x, window->getSize().y * console_height_part_));
+  const sf::Vector2f size(window->getSize().x,
+                          window->getSize().y * console_height_part_);
+  if (background_rect_.getSize() != size) {
+    background_rect_.setSize(size);
+    MarkDirty(kDirtyGeometry);
+  }
 
   UpdateDrawnText();
 
   window->draw(background_rect_);
-  window->draw(output_text_);
+  window->draw(output_view_);
   window->draw(input_line_);
 }
 
-// Returns number of lines that are out of visible console area.
-int SFMLInGameConsole::GetOverflowLinesCount() const {
-  const float line_height =
-      font_scale_ * font_.getLineSpacing(input_line_.getCharacterSize());
-  const int visible_lines_count =
-      std::floor(background_rect_.getSize().y / line_height) - 1;
+void SFMLInGameConsole::Post(std::string text) {
+  producer_queue_.Post(std::move(text));
+}
+
+ConsoleProducerQueue& SFMLInGameConsole::GetProducerQueue() {
+  return producer_queue_;
+}
+
+// Moves output of other threads and output buffered by the stream into the
+// console buffer.
+void SFMLInGameConsole::Pump() {
+  producer_queue_.Drain(*this);
+
+  const size_t dropped = producer_queue_.GetDroppedCount();
+  if (dropped != reported_dropped_records_) {
+    (*this) << style.warning.first << dropped - reported_dropped_records_
+            << " posted messages dropped, producer queue is full"
+            << style.warning.second << std::endl;
+    reported_dropped_records_ = dropped;
+  }
+
+  flush();
+  UpdateStats();
+}
+
+void SFMLInGameConsole::UpdateStats() {
+#if VIRTUOSO_CONSOLE_STATS
+  stats.setGauge("buffer.lines", console_buffer_.GetLines().size());
+  stats.setGauge("buffer.bytes", console_buffer_.GetBytesCount());
+  stats.setGauge("buffer.memory", console_buffer_.GetMemoryUsage());
+  stats.setGauge("buffer.appendedLines",
+                 console_buffer_.GetAppendedLinesCount());
+  stats.setGauge("buffer.appendedBytes",
+                 console_buffer_.GetAppendedBytesCount());
+  stats.setGauge("buffer.droppedLines",
+                 console_buffer_.GetDroppedLinesCount());
+#endif
+}
+
+int SFMLInGameConsole::GetVisibleRowsCount() const {
   return std::max(
-      static_cast<int>(console_buffer_.size()) - visible_lines_count, 0);
+      static_cast<int>(std::floor(background_rect_.getSize().y /
+                                  GetLineHeight())) - 1,
+      0);
+}
+
+size_t SFMLInGameConsole::GetShownLinesCount() const {
+  return output_filter_.IsEmpty()
+             ? static_cast<size_t>(console_buffer_.size())
+             : filtered_ids_.size();
+}
+
+size_t SFMLInGameConsole::GetBufferIndex(size_t shown_line) const {
+  return output_filter_.IsEmpty()
+             ? shown_line
+             : filtered_ids_[shown_line] - console_buffer_.GetFirstLineId();
+}
+
+size_t SFMLInGameConsole::GetRowsCount(size_t shown_line) {
+  return output_view_.GetRowsCount(console_buffer_,
+                                   GetBufferIndex(shown_line));
+}
+
+void SFMLInGameConsole::UpdateFilteredLines() {
+  if (output_filter_.IsEmpty() ||
+      console_buffer_.GetRevision() == filter_revision_) {
+    return;
+  }
+  filter_revision_ = console_buffer_.GetRevision();
+
+  const size_t first_id = console_buffer_.GetFirstLineId();
+  while (!filtered_ids_.empty() && filtered_ids_.front() < first_id) {
+    filtered_ids_.pop_front();
+  }
+  // The last line checked may have changed since.
+  while (!filtered_ids_.empty() && filtered_ids_.back() >= filter_next_id_) {
+    filtered_ids_.pop_back();
+  }
+
+  filter_matches_.clear();
+  console_buffer_.FindLines(output_filter_, filter_next_id_, filter_matches_);
+  filtered_ids_.insert(filtered_ids_.end(), filter_matches_.begin(),
+                       filter_matches_.end());
+  filter_next_id_ = first_id + console_buffer_.GetLines().size() - 1;
+}
+
+SFMLInGameConsole::RowPosition SFMLInGameConsole::GetLastRow() {
+  UpdateFilteredLines();
+  if (GetShownLinesCount() == 0) {
+    return {};
+  }
+  const size_t line = GetShownLinesCount() - 1;
+  return {line, GetRowsCount(line) - 1};
+}
+
+SFMLInGameConsole::RowPosition SFMLInGameConsole::GetScrollRow() {
+  UpdateFilteredLines();
+  const size_t first_id = console_buffer_.GetFirstLineId();
+  if (!scrolled_back_) {
+    return GetLastRow();
+  }
+  if (scroll_line_id_ < first_id) {
+    // The line was dropped.
+    return {};
+  }
+  size_t line = scroll_line_id_ - first_id;
+  size_t row = scroll_row_;
+  if (!output_filter_.IsEmpty()) {
+    // The line may not pass a filter set after scrolling to it.
+    const auto it = std::lower_bound(filtered_ids_.begin(),
+                                     filtered_ids_.end(), scroll_line_id_);
+    line = static_cast<size_t>(it - filtered_ids_.begin());
+    if (it != filtered_ids_.end() && *it != scroll_line_id_) {
+      row = 0;
+    }
+  }
+  if (line >= GetShownLinesCount()) {
+    return GetLastRow();
+  }
+  // Wrapping at another width might have changed the rows of the line.
+  return {line, std::min(row, GetRowsCount(line) - 1)};
+}
+
+std::ptrdiff_t SFMLInGameConsole::MoveRows(RowPosition& pos,
+                                           std::ptrdiff_t delta) {
+  const size_t lines_count = GetShownLinesCount();
+  std::ptrdiff_t moved = 0;
+  if (lines_count == 0) {
+    return moved;
+  }
+  while (delta < moved) {
+    if (pos.row > 0) {
+      const size_t step =
+          std::min(pos.row, static_cast<size_t>(moved - delta));
+      pos.row -= step;
+      moved -= static_cast<std::ptrdiff_t>(step);
+    } else if (pos.line > 0) {
+      --pos.line;
+      pos.row = GetRowsCount(pos.line) - 1;
+      --moved;
+    } else {
+      break;
+    }
+  }
+  while (delta > moved) {
+    const size_t rows = GetRowsCount(pos.line);
+    if (pos.row + 1 < rows) {
+      const size_t step =
+          std::min(rows - 1 - pos.row, static_cast<size_t>(delta - moved));
+      pos.row += step;
+      moved += static_cast<std::ptrdiff_t>(step);
+    } else if (pos.line + 1 < lines_count) {
+      ++pos.line;
+      pos.row = 0;
+      ++moved;
+    } else {
+      break;
+    }
+  }
+  return moved;
+}
+
+void SFMLInGameConsole::ScrollRows(std::ptrdiff_t delta) {
+  RowPosition pos = GetScrollRow();
+  MoveRows(pos, delta);
+  scrolled_back_ = !(pos == GetLastRow());
+  scroll_line_id_ = console_buffer_.GetFirstLineId() +
+                    (GetShownLinesCount() ? GetBufferIndex(pos.line) : 0);
+  scroll_row_ = pos.row;
+  MarkDirty(kDirtyScroll);
+}
+
+void SFMLInGameConsole::ScrollToTop() {
+  // The pane is filled downwards from the first row when it's drawn.
+  scrolled_back_ = true;
+  scroll_line_id_ = console_buffer_.GetFirstLineId();
+  scroll_row_ = 0;
+  MarkDirty(kDirtyScroll);
+}
+
+void SFMLInGameConsole::ScrollToBottom() {
+  scrolled_back_ = false;
+  MarkDirty(kDirtyScroll);
 }
 
 // Adjusts scroll position based on key events.
 void SFMLInGameConsole::ScrollCallback(const sf::Event& e) {
-  const int overflow_lines = GetOverflowLinesCount();
   if (e.key.code == sf::Keyboard::Up) {
-    scroll_lines_offset_ = std::min(scroll_lines_offset_ + 1, overflow_lines);
+    ScrollRows(-1);
   } else if (e.key.code == sf::Keyboard::Down) {
-    scroll_lines_offset_ = std::max(scroll_lines_offset_ - 1, 0);
+    ScrollRows(1);
   }
 }
 
@@ -277,43 +619,125 @@ void SFMLInGameConsole::HistoryCallback(const sf::Event& e) {
   }
 }
 
+void SFMLInGameConsole::StartReverseSearch() {
+  MarkDirty(kDirtyInput);
+  if (searching_) {
+    if (search_match_) {
+      UpdateReverseSearch(search_match_);
+    }
+    return;
+  }
+  searching_ = true;
+  search_query_.clear();
+  search_match_ = 0;
+  search_saved_text_ = buffer_text_;
+}
+
+void SFMLInGameConsole::UpdateReverseSearch(std::uint64_t before) {
+  const size_t match = searchHistory(search_query_, before);
+  search_match_ = match != Virtuoso::HistoryBuffer::npos
+                      ? historyBuffer().sequence(match)
+                      : 0;
+}
+
+void SFMLInGameConsole::StopReverseSearch(bool accept) {
+  MarkDirty(kDirtyInput);
+  searching_ = false;
+  const size_t match = historyBuffer().find(search_match_);
+  buffer_text_ = accept && match != Virtuoso::HistoryBuffer::npos
+                     ? historyBuffer()[match]
+                     : search_saved_text_;
+  cursor_pos_ = buffer_text_.size();
+  history_pos_ = -1;
+}
+
+bool SFMLInGameConsole::HandleReverseSearchEvent(const sf::Event& e) {
+  if (e.type == sf::Event::TextEntered) {
+    // Control characters, e.g. the one of Ctrl+R, are not part of the query.
+    if (e.text.unicode > 31 && e.text.unicode < 127) {
+      search_query_.push_back(static_cast<char>(e.text.unicode));
+      // The current match is the newest one and may still match.
+      UpdateReverseSearch(search_match_ ? search_match_ + 1 : UINT64_MAX);
+      MarkDirty(kDirtyInput);
+    }
+    return true;
+  }
+  if (e.type != sf::Event::KeyPressed) {
+    return false;
+  }
+
+  switch (e.key.code) {
+    case sf::Keyboard::R:
+      if (e.key.control) {
+        StartReverseSearch();
+      }
+      return true;
+    case sf::Keyboard::Backspace:
+      if (!search_query_.empty()) {
+        search_query_.pop_back();
+        UpdateReverseSearch(UINT64_MAX);
+        MarkDirty(kDirtyInput);
+      }
+      return true;
+    case sf::Keyboard::Escape:
+      StopReverseSearch(false);
+      return true;
+    case sf::Keyboard::G:
+      if (e.key.control) {
+        StopReverseSearch(false);
+      }
+      return true;
+    case sf::Keyboard::Enter:
+    case sf::Keyboard::Tab:
+    case sf::Keyboard::Up:
+    case sf::Keyboard::Down:
+    case sf::Keyboard::Left:
+    case sf::Keyboard::Right:
+    case sf::Keyboard::Home:
+    case sf::Keyboard::End:
+    case sf::Keyboard::Delete:
+      // Editing keys act on the accepted match.
+      StopReverseSearch(true);
+      return false;
+    default:
+      // Typed characters arrive as text, modifiers and the rest are ignored.
+      return true;
+  }
+}
+
 // Retrieves autocomplete suggestions based on the current input.
 std::vector<std::string> SFMLInGameConsole::GetCandidatesForAutocomplete(
     const std::string& cur_word, bool is_first_word) const {
-  // Build a list of candidates.
+  // Build a list of candidates. The indices return them already sorted, only
+  // the case-sensitive prefix check is left to do.
   std::vector<std::string> candidates;
+  const auto collect = [&](const Virtuoso::CompletionIndex& index) {
+    const auto [first, last] = index.findPrefix(cur_word);
+    for (auto it = first; it != last; ++it) {
+      if (it->starts_with(cur_word)) {
+        candidates.emplace_back(*it);
+      }
+    }
+  };
 
   if (is_first_word) {
     // Autocomplete for command names.
-    for (auto it = getCommandTable().begin(); it != getCommandTable().end();
-         it++) {
-      if (it->first.starts_with(cur_word)) {
-        candidates.emplace_back(it->first);
-      }
-    }
+    collect(getCommandIndex());
   }
 
   if (!is_first_word) {
     // Autocomplete variables.
-    for (auto it = getCVarReadTable().begin(); it != getCVarReadTable().end();
-         it++) {
-      if (it->first.starts_with(cur_word)) {
-        candidates.emplace_back(it->first);
-      }
-    }
+    collect(getCVarIndex());
     // Autocomplete keywords for a particular command.
-    const std::string cmd_name = GetFirstWord(buffer_text_);
-    if (cmd_keywords_.contains(cmd_name)) {
-      for (auto it = cmd_keywords_.at(cmd_name).begin();
-           it != cmd_keywords_.at(cmd_name).end(); it++) {
-        if (it->starts_with(cur_word)) {
-          candidates.emplace_back(*it);
-        }
-      }
+    const auto keywords = cmd_keywords_.find(GetFirstWord(buffer_text_));
+    if (keywords != cmd_keywords_.end()) {
+      const auto middle = static_cast<std::ptrdiff_t>(candidates.size());
+      collect(keywords->second);
+      std::inplace_merge(candidates.begin(), candidates.begin() + middle,
+                         candidates.end(), Virtuoso::CompletionIndex::less);
     }
   }
 
-  std::sort(candidates.begin(), candidates.end());
   return candidates;
 }
 
@@ -328,10 +752,9 @@ void SFMLInGameConsole::PrintOptions(const std::vector<std::string>& options) {
     }
   }
   // Add 2 spaces for columns gap.
-  sf::Text one_word(font_, options[longest_word_idx] + "  ");
-  one_word.setScale({font_scale_, font_scale_});
-
-  const float col_width = one_word.getGlobalBounds().getSize().x;
+  const float col_width =
+      font_scale_ * metrics_.GetTextWidth(options[longest_word_idx] + "  ",
+                                          input_line_.getCharacterSize());
   const float console_width = background_rect_.getSize().x;
 
   const size_t cols = std::clamp<size_t>(
@@ -386,7 +809,7 @@ void SFMLInGameConsole::TextAutocompleteCallback() {
     buffer_text_.replace(word_start_pos, candidates[0].size(), candidates[0]);
     cursor_pos_ = buffer_text_.size();
   } else {
-    scroll_lines_offset_ = 0;
+    ScrollToBottom();
     // Multiple matches - partial completion.
     // So inputing "C"+Tab will complete to "CL" then display "CLEAR" and
     // "CLASSIFY" as matches.